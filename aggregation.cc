@@ -0,0 +1,200 @@
+#include "aggregation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+// The t-digest's scale function: centroids may span at most one unit of
+// k, which is steep at the tails and flat around the median.
+double k_of_q(double q, double compression) {
+    return compression / (2 * PI) * std::asin(2 * q - 1);
+}
+
+double q_of_k(double k, double compression) {
+    if (k >= compression / 4) {
+        return 1;
+    }
+    return (std::sin(k * 2 * PI / compression) + 1) / 2;
+}
+
+}  // namespace
+
+void t_digest::add(double value, double weight) {
+    buffer_.push_back({value, weight});
+    buffered_weight_ += weight;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+    if (buffer_.size() >= 5 * compression_) {
+        compress();
+    }
+}
+
+void t_digest::merge(const t_digest &other) {
+    for (const centroid &c : other.centroids_) {
+        buffer_.push_back(c);
+        buffered_weight_ += c.weight;
+    }
+    for (const centroid &c : other.buffer_) {
+        buffer_.push_back(c);
+        buffered_weight_ += c.weight;
+    }
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    compress();
+}
+
+std::vector<t_digest::centroid> t_digest::compressed() const {
+    std::vector<centroid> all = centroids_;
+    all.insert(all.end(), buffer_.begin(), buffer_.end());
+    if (all.empty()) {
+        return all;
+    }
+    std::sort(all.begin(), all.end(), [](const centroid &a, const centroid &b) { return a.mean < b.mean; });
+    const double total = total_weight_ + buffered_weight_;
+
+    std::vector<centroid> merged;
+    centroid current = all[0];
+    double weight_before = 0;
+    double limit = total * q_of_k(k_of_q(0, compression_) + 1, compression_);
+    for (size_t i = 1; i < all.size(); i++) {
+        const double proposed = current.weight + all[i].weight;
+        if (weight_before + proposed <= limit) {
+            current.mean += (all[i].mean - current.mean) * all[i].weight / proposed;
+            current.weight = proposed;
+            continue;
+        }
+        merged.push_back(current);
+        weight_before += current.weight;
+        limit = total * q_of_k(k_of_q(weight_before / total, compression_) + 1, compression_);
+        current = all[i];
+    }
+    merged.push_back(current);
+    return merged;
+}
+
+void t_digest::compress() {
+    if (buffer_.empty()) {
+        return;
+    }
+    centroids_ = compressed();
+    total_weight_ += buffered_weight_;
+    buffer_.clear();
+    buffered_weight_ = 0;
+}
+
+size_t t_digest::size() const {
+    return compressed().size();
+}
+
+double t_digest::quantile(double q) const {
+    const std::vector<centroid> centroids = buffer_.empty() ? centroids_ : compressed();
+    if (centroids.empty()) {
+        return std::nan("");
+    }
+    if (centroids.size() == 1 || q <= 0) {
+        return q <= 0 ? min_ : centroids[0].mean;
+    }
+    if (q >= 1) {
+        return max_;
+    }
+    const double target = q * count();
+    // Each centroid's weight is centred on its mean; interpolate between
+    // neighbouring means, and between the extremes and the outer centroids.
+    double weight_before = 0;
+    for (size_t i = 0; i < centroids.size(); i++) {
+        const double centre = weight_before + centroids[i].weight / 2;
+        if (target < centre) {
+            if (i == 0) {
+                return min_ + (centroids[0].mean - min_) * target / centre;
+            }
+            const double previous_centre = weight_before - centroids[i - 1].weight / 2;
+            return centroids[i - 1].mean + (centroids[i].mean - centroids[i - 1].mean) *
+                (target - previous_centre) / (centre - previous_centre);
+        }
+        weight_before += centroids[i].weight;
+    }
+    const double last_centre = count() - centroids.back().weight / 2;
+    return centroids.back().mean + (max_ - centroids.back().mean) *
+        (target - last_centre) / std::max(count() - last_centre, 1e-9);
+}
+
+aggregate_state::aggregate_state(const aggregate_spec &spec)
+: histogram(spec.histogram_bounds.empty() ? 0 : spec.histogram_bounds.size() + 1, 0),
+  digest(spec.compression) {}
+
+void aggregate_state::add(double value, const aggregate_spec &spec) {
+    count++;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    if (false == histogram.empty()) {
+        const auto bound = std::lower_bound(spec.histogram_bounds.begin(), spec.histogram_bounds.end(), value);
+        histogram[bound - spec.histogram_bounds.begin()]++;
+    }
+    if (false == spec.percentiles.empty()) {
+        digest.add(value);
+    }
+}
+
+void aggregate_state::merge(const aggregate_state &other) {
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    for (size_t i = 0; i < histogram.size() && i < other.histogram.size(); i++) {
+        histogram[i] += other.histogram[i];
+    }
+    digest.merge(other.digest);
+}
+
+void add_to_group(grouped_aggregate &aggregate, const std::string &group, double value, const aggregate_spec &spec) {
+    auto found = aggregate.find(group);
+    if (found == aggregate.end()) {
+        found = aggregate.emplace(group, aggregate_state(spec)).first;
+    }
+    found->second.add(value, spec);
+}
+
+void merge_grouped_aggregate(grouped_aggregate &into, const grouped_aggregate &other) {
+    for (auto &[group, state] : other) {
+        auto found = into.find(group);
+        if (found == into.end()) {
+            into.emplace(group, state);
+        } else {
+            found->second.merge(state);
+        }
+    }
+}
+
+std::string format_aggregate(const grouped_aggregate &aggregate, const aggregate_spec &spec) {
+    std::ostringstream out;
+    for (auto &[group, state] : aggregate) {
+        if (spec.group_by != group_by_nothing) {
+            out << group << ": ";
+        }
+        out << "count " << state.count;
+        if (spec.value != aggregate_count_only) {
+            out << ", sum " << state.sum << ", min " << state.min << ", max " << state.max;
+        }
+        int64_t cumulative = 0;
+        for (size_t i = 0; i < state.histogram.size(); i++) {
+            cumulative += state.histogram[i];
+            out << ", le ";
+            if (i < spec.histogram_bounds.size()) {
+                out << spec.histogram_bounds[i];
+            } else {
+                out << "+Inf";
+            }
+            out << " " << cumulative;
+        }
+        for (double p : spec.percentiles) {
+            out << ", p" << p * 100 << " " << state.digest.quantile(p);
+        }
+        out << std::endl;
+    }
+    return out.str();
+}
@@ -0,0 +1,106 @@
+/*
+ * Aggregates of a query's return values, computed where the values are.
+ *
+ * Instead of a string per matching span, query_aggregate() returns a count,
+ * sum, min, max, histogram and percentiles of the return node's latency (or
+ * of a numeric return value), optionally per service or per value of an
+ * attribute of the return span.  Each batch folds its matches into a
+ * partial aggregate_state as it finishes; the partial states are merged as
+ * they come out of the pipeline, so only a few numbers per group leave a
+ * batch.
+ *
+ * Percentiles come from a t-digest: a sorted list of weighted centroids,
+ * kept small by merging neighbours, more aggressively near the median than
+ * at the tails, so p99 stays accurate while the digest stays around
+ * `compression` centroids however many values went in.  Merging two digests
+ * gives what adding both sets of values to one would, up to that accuracy.
+*/
+
+#ifndef AGGREGATION_H_ // NOLINT
+#define AGGREGATION_H_
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+const double DEFAULT_DIGEST_COMPRESSION = 100;
+
+class t_digest {
+    public: // NOLINT
+        explicit t_digest(double compression = DEFAULT_DIGEST_COMPRESSION) : compression_(compression) {}
+
+        void add(double value, double weight = 1);
+        void merge(const t_digest &other);
+        // The value below which a fraction q of the values fall; NaN if there are none.
+        double quantile(double q) const;
+        double count() const { return total_weight_ + buffered_weight_; }
+        // Centroids once compressed, for checking its size.
+        size_t size() const;
+
+    private: // NOLINT
+        struct centroid {
+            double mean;
+            double weight;
+        };
+        // Folds the buffer into the centroids.
+        void compress();
+        std::vector<centroid> compressed() const;
+
+        double compression_;
+        std::vector<centroid> centroids_;   // sorted by mean
+        double total_weight_ = 0;
+        std::vector<centroid> buffer_;      // added since the last compress()
+        double buffered_weight_ = 0;
+        double min_ = std::numeric_limits<double>::infinity();
+        double max_ = -std::numeric_limits<double>::infinity();
+};
+
+enum aggregate_group_by {
+    group_by_nothing,
+    group_by_service,      // the return node's service
+    group_by_attribute,    // an attribute of the return span; spans without it are grouped under ""
+};
+
+enum aggregated_value {
+    aggregate_count_only,     // just count the matches; no span is read unless grouping by attribute
+    aggregate_latency,        // the return span's latency in nanoseconds
+    aggregate_return_value,   // the query's return value, which must then be an int or double
+};
+
+struct aggregate_spec {
+    aggregated_value value = aggregate_latency;
+    // Cumulative histogram upper bounds; none for no histogram.
+    std::vector<double> histogram_bounds;
+    // e.g. {0.5, 0.99}
+    std::vector<double> percentiles;
+    aggregate_group_by group_by = group_by_nothing;
+    std::string group_by_attribute;
+    double compression = DEFAULT_DIGEST_COMPRESSION;
+};
+
+// A partial aggregate: what one batch, or several merged, contributed.
+struct aggregate_state {
+    int64_t count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    std::vector<int64_t> histogram;   // per bound, then above the last; not cumulative
+    t_digest digest;
+
+    explicit aggregate_state(const aggregate_spec &spec);
+    void add(double value, const aggregate_spec &spec);
+    void merge(const aggregate_state &other);
+};
+
+// Group (empty without group by) to its aggregate.
+typedef std::map<std::string, aggregate_state> grouped_aggregate;
+
+void add_to_group(grouped_aggregate &aggregate, const std::string &group, double value, const aggregate_spec &spec);
+void merge_grouped_aggregate(grouped_aggregate &into, const grouped_aggregate &other);
+
+// A line per group: its count, sum, min, max, histogram and percentiles.
+std::string format_aggregate(const grouped_aggregate &aggregate, const aggregate_spec &spec);
+
+#endif  // AGGREGATION_H_ // NOLINT
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "aggregation.h"
+
+namespace {
+
+// The exact quantile of sorted values, as the digest estimates it.
+double exact_quantile(const std::vector<double> &sorted, double q) {
+  return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+}
+
+}  // namespace
+
+TEST(TDigest, EstimatesQuantilesWithFewCentroids) {
+  std::mt19937 random(7);
+  std::lognormal_distribution<double> latency(15, 1);
+  t_digest digest;
+  std::vector<double> values;
+  for (int i = 0; i < 100000; i++) {
+    values.push_back(latency(random));
+    digest.add(values.back());
+  }
+  std::sort(values.begin(), values.end());
+
+  EXPECT_EQ(digest.count(), 100000);
+  EXPECT_LE(digest.size(), 2 * DEFAULT_DIGEST_COMPRESSION);
+  EXPECT_EQ(digest.quantile(0), values.front());
+  EXPECT_EQ(digest.quantile(1), values.back());
+  for (double q : {0.5, 0.9, 0.99, 0.999}) {
+    // in rank, which is what the digest bounds
+    const double estimate = digest.quantile(q);
+    const double rank = std::lower_bound(values.begin(), values.end(), estimate) - values.begin();
+    EXPECT_NEAR(rank / values.size(), q, q < 0.99 ? 0.01 : 0.002) << "q " << q;
+  }
+  EXPECT_TRUE(std::isnan(t_digest().quantile(0.5)));
+}
+
+TEST(TDigest, MergedDigestsAgreeWithOneOverEverything) {
+  std::mt19937 random(11);
+  std::exponential_distribution<double> latency(1e-6);
+  t_digest all;
+  std::vector<t_digest> parts(8);
+  std::vector<double> values;
+  for (int i = 0; i < 40000; i++) {
+    values.push_back(latency(random));
+    all.add(values.back());
+    parts[i % parts.size()].add(values.back());
+  }
+  std::sort(values.begin(), values.end());
+  t_digest merged;
+  for (const t_digest &part : parts) {
+    merged.merge(part);
+  }
+
+  EXPECT_EQ(merged.count(), all.count());
+  for (double q : {0.5, 0.99}) {
+    const double spread = exact_quantile(values, q + 0.005) - exact_quantile(values, q - 0.005);
+    EXPECT_NEAR(merged.quantile(q), all.quantile(q), spread) << "q " << q;
+    EXPECT_NEAR(merged.quantile(q), exact_quantile(values, q), spread) << "q " << q;
+  }
+}
+
+TEST(AggregateState, MergesGroupsAndHistograms) {
+  aggregate_spec spec;
+  spec.histogram_bounds = {10, 100};
+  spec.percentiles = {0.5};
+  spec.group_by = group_by_service;
+
+  grouped_aggregate first;
+  add_to_group(first, "cart", 5, spec);
+  add_to_group(first, "cart", 50, spec);
+  add_to_group(first, "frontend", 500, spec);
+  grouped_aggregate second;
+  add_to_group(second, "cart", 100, spec);
+  add_to_group(second, "payment", 7, spec);
+  merge_grouped_aggregate(first, second);
+
+  ASSERT_EQ(first.size(), 3);
+  const aggregate_state &cart = first.at("cart");
+  EXPECT_EQ(cart.count, 3);
+  EXPECT_EQ(cart.sum, 155);
+  EXPECT_EQ(cart.min, 5);
+  EXPECT_EQ(cart.max, 100);
+  // up to and including each bound, then above the last
+  EXPECT_EQ(cart.histogram, std::vector<int64_t>({1, 2, 0}));
+  EXPECT_EQ(cart.digest.count(), 3);
+  EXPECT_EQ(first.at("frontend").histogram, std::vector<int64_t>({0, 0, 1}));
+  EXPECT_EQ(format_aggregate(first, spec).substr(0, 57),
+            "cart: count 3, sum 155, min 5, max 100, le 10 1, le 100 3");
+}
@@ -0,0 +1,47 @@
+#include "async_io.h"
+
+#include "common.h"
+
+completion_group::completion_group()
+: all_done_future_(all_done_.get_future()) {}
+
+void completion_group::add() {
+    outstanding_++;
+}
+
+void completion_group::done() {
+    if (--outstanding_ == 0) {
+        all_done_.set_value();
+    }
+}
+
+void completion_group::fail(std::exception_ptr error) {
+    std::lock_guard<std::mutex> guard(error_mutex_);
+    if (error_ == nullptr) {
+        error_ = error;
+    }
+}
+
+void completion_group::wait() {
+    done();
+    executor::get().wait(all_done_future_);
+    if (error_ != nullptr) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void async_read(completion_group &group, storage_backend* client,
+    const std::string &bucket, const std::string &object,
+    std::function<void(StatusOr<std::shared_ptr<const stored_object>>)> then) {
+    async_then(group, [client, bucket, object]() {
+        return read_stored_object(bucket, object, client);
+    }, std::move(then));
+}
+
+void async_read_range(completion_group &group, storage_backend* client,
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end,
+    std::function<void(StatusOr<std::string>)> then) {
+    async_then(group, [client, bucket, object, begin, end]() {
+        return read_object_range(bucket, object, begin, end, client);
+    }, std::move(then));
+}
@@ -0,0 +1,97 @@
+/*
+ * Asynchronous reads with continuations, on top of the executor.
+ *
+ * A caller that wants many objects used to start a task per object and
+ * block in it until the read came back, so every outstanding read held a
+ * thread.  Here the read runs on the executor's I/O pool and hands its
+ * result to a continuation on the CPU pool; nothing waits on an individual
+ * read.  Continuations may start further reads, which is how a traversal
+ * whose next reads depend on the last ones (the bloom tree, a fallback from
+ * span columns to span data) keeps going without a thread per level.
+ *
+ * The operations started for one piece of work belong to a
+ * completion_group, and the caller waits once, on the group:
+ *
+ *     completion_group group;
+ *     for (auto &name : names) {
+ *         async_read(group, client, bucket, name, [&](auto contents) { ... });
+ *     }
+ *     group.wait();
+ *
+ * Continuations run concurrently with each other, so whatever they share
+ * needs a lock or a slot of its own.
+*/
+
+#ifndef ASYNC_IO_H_ // NOLINT
+#define ASYNC_IO_H_
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "executor.h"
+#include "storage.h"
+
+class completion_group {
+    public: // NOLINT
+        completion_group();
+        completion_group(const completion_group&) = delete;
+        completion_group& operator=(const completion_group&) = delete;
+
+        // Once per operation, before it starts.
+        void add();
+        // Once per operation, after its continuation has run.
+        void done();
+        // An operation threw; wait() rethrows the first such exception.
+        void fail(std::exception_ptr error);
+        // Until every operation added, including ones added by continuations
+        // meanwhile, is done.  Runs executor work while waiting.  Call once.
+        void wait();
+
+    private: // NOLINT
+        // The waiter holds one count until wait(), so the group can't drain
+        // while operations are still being added.
+        std::atomic<int64_t> outstanding_{1};
+        std::promise<void> all_done_;
+        std::future<void> all_done_future_;
+        std::mutex error_mutex_;
+        std::exception_ptr error_;
+};
+
+// Runs read() on the I/O pool, then then(result) on the CPU pool.
+template <typename Read, typename Then>
+void async_then(completion_group &group, Read read, Then then) {
+    group.add();
+    executor::get().submit(io_pool, [&group, read = std::move(read), then = std::move(then)]() mutable {
+        try {
+            auto result = read();
+            executor::get().submit(cpu_pool, [&group, result = std::move(result), then = std::move(then)]() mutable {
+                try {
+                    then(std::move(result));
+                } catch (...) {
+                    group.fail(std::current_exception());
+                }
+                group.done();
+            });
+        } catch (...) {
+            group.fail(std::current_exception());
+            group.done();
+        }
+    });
+}
+
+// Through the object caches, like read_stored_object().
+void async_read(completion_group &group, storage_backend* client,
+    const std::string &bucket, const std::string &object,
+    std::function<void(StatusOr<std::shared_ptr<const stored_object>>)> then);
+// Bytes [begin, end), like read_object_range().
+void async_read_range(completion_group &group, storage_backend* client,
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end,
+    std::function<void(StatusOr<std::string>)> then);
+
+#endif  // ASYNC_IO_H_ // NOLINT
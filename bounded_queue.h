@@ -0,0 +1,67 @@
+/*
+ * A blocking queue with a fixed capacity, for handing work between the
+ * stages of a pipeline.  A full queue blocks its producers, which is what
+ * keeps a fast stage from running ahead of a slow one and piling up batches
+ * in memory.
+ *
+ * close() ends the stream in both directions: consumers drain what is left
+ * and then see std::nullopt, and producers' pushes fail, so a stage whose
+ * consumer has gone away can stop early.
+*/
+
+#ifndef BOUNDED_QUEUE_H_ // NOLINT
+#define BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+template <typename T>
+class bounded_queue {
+    public: // NOLINT
+        explicit bounded_queue(size_t capacity) : capacity_(capacity) {}
+
+        // Blocks while the queue is full.  False, dropping item, once it is closed.
+        bool push(T item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+            if (closed_) {
+                return false;
+            }
+            items_.push_back(std::move(item));
+            not_empty_.notify_one();
+            return true;
+        }
+
+        // Blocks while the queue is empty; std::nullopt once it is closed and drained.
+        std::optional<T> pop() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this]() { return closed_ || false == items_.empty(); });
+            if (items_.empty()) {
+                return std::nullopt;
+            }
+            T item = std::move(items_.front());
+            items_.pop_front();
+            not_full_.notify_one();
+            return item;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> guard(mutex_);
+            closed_ = true;
+            not_full_.notify_all();
+            not_empty_.notify_all();
+        }
+
+    private: // NOLINT
+        const size_t capacity_;
+        std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+        std::deque<T> items_;
+        bool closed_ = false;
+};
+
+#endif  // BOUNDED_QUEUE_H_ // NOLINT
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "metrics.h"
 
 std::vector<std::string> split_by_string(const std::string& str, const char* ch) {
     std::vector<std::string> tokens;
@@ -16,9 +17,8 @@ std::vector<std::string> split_by_string(const std::string& str, const char* ch)
     return tokens;
 }
 
-std::map<std::string, std::pair<int, int>> get_timestamp_map_for_trace_ids(
-    const std::string &spans_data, const std::vector<std::string> &trace_ids) {
-    std::map<std::string, std::pair<int, int>> response;
+std::unordered_map<trace_id_t, std::pair<int, int>> get_timestamp_map_for_trace_ids(const std::string &spans_data) {
+    std::unordered_map<trace_id_t, std::pair<int, int>> response;
 
     ot::TracesData trace_data;
     bool ret = trace_data.ParseFromString(spans_data);
@@ -29,7 +29,7 @@ std::map<std::string, std::pair<int, int>> get_timestamp_map_for_trace_ids(
 
     for (int i=0; i < trace_data.resource_spans(0).scope_spans(0).spans_size(); i++) {
         const ot::Span* sp = &trace_data.resource_spans(0).scope_spans(0).spans(i);
-        std::string trace_id = hex_str(sp->trace_id(), sp->trace_id().length());
+        trace_id_t trace_id = trace_id_t::from_bytes(sp->trace_id());
 
         // getting timestamps and converting from nanosecond precision to seconds precision
         try {
@@ -70,30 +70,193 @@ bool is_same_hex_str(const std::string &data, const std::string &compare) {
 
 
 
-ot::TracesData read_object_and_parse_traces_data(
-    const std::string &bucket, const std::string& object_name, gcs::Client* client
+namespace {
+
+// Span objects live as folders of a single bucket; see SERVICES_BUCKET_PREFIX.
+void resolve_object_location(std::string &bucket, std::string &object) {
+    if (true == is_spans_bucket(bucket)) {
+        object = bucket + "/"+ object;
+        bucket = SERVICES_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX);
+    }
+}
+
+}  // namespace
+
+std::shared_ptr<const span_batch> read_object_and_parse_traces_data(
+    const std::string &bucket, const std::string& object_name, storage_backend* client
 ) {
-    auto data_ = read_object(bucket, object_name, client);
-    if (!data_.ok()) {
-    std::cout << "data is not okay because " << data_.status().message() << std::endl;
-	std::cout << "bucket: " << bucket << " object name: " << object_name << std::endl;
-	exit(1);
+    std::string resolved_bucket = bucket;
+    std::string resolved_object = object_name;
+    resolve_object_location(resolved_bucket, resolved_object);
+    const std::string key = object_cache_key(resolved_bucket, resolved_object);
+
+    auto cached = traces_data_cache().get(key);
+    if (cached.has_value()) {
+        if (false == cache_revalidation_enabled() ||
+            is_current_generation(resolved_bucket, resolved_object, cached->generation, client)) {
+            profile_cache_hit();
+            return cached->value;
+        }
+        traces_data_cache().invalidate(key);
     }
-    auto data = data_.value();
+
+    return traces_data_parses_in_flight().run(key, [&]() -> std::shared_ptr<const span_batch> {
+        // straight from the backend: only the parsed batch is cached, so the
+        // cache's byte budget doesn't count the object twice
+        auto data_ = client->read(resolved_bucket, resolved_object);
+        if (!data_.ok()) {
+            std::cout << "data is not okay because " << data_.status().message() << std::endl;
+            std::cout << "bucket: " << bucket << " object name: " << object_name << std::endl;
+            exit(1);
+        }
+        auto data = data_.value();
+
+        static histogram &parse_seconds = metrics().get_histogram(
+            "quest_traces_data_parse_seconds", "Time to parse a span object into TracesData.");
+        auto trace_data = std::make_unique<ot::TracesData>();
+        // parse straight out of the backend's buffer, which is a mapping for local storage
+        bool parsed;
+        {
+            histogram_timer timer(parse_seconds);
+            parsed = data->size() == 0 || trace_data->ParseFromArray(data->data(), data->size());
+        }
+        if (false == parsed) {
+            std::cerr << "Error in read_object_and_parse_traces_data:ParseFromString" << std::endl;
+            std::cerr << "while reading object " << object_name << std::endl;
+            exit(1);
+        }
+
+        std::shared_ptr<const stored_object> sidecar;
+        if (span_id_index_sidecars_enabled()) {
+            auto sidecar_or_status = client->read(
+                SPAN_ID_INDEX_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX), resolved_object);
+            if (sidecar_or_status.ok()) {
+                sidecar = sidecar_or_status.value();
+            }
+        }
+        auto batch = std::make_shared<const span_batch>(std::move(trace_data), data->generation(), sidecar);
+
+        traces_data_cache().put(key, batch, batch->space_used(), data->generation());
+        return batch;
+    });
+}
+
+namespace {
+
+Status read_span_object(const std::string &bucket, const std::string &object,
+                        ot::TracesData &trace_data, int64_t &generation, storage_backend* client) {
+    auto data = client->read(bucket, object);
+    if (!data.ok()) {
+        return data.status();
+    }
+    if (data.value()->size() > 0 && !trace_data.ParseFromArray(data.value()->data(), data.value()->size())) {
+        return Status(google::cloud::StatusCode::kDataLoss, "could not parse " + object);
+    }
+    generation = data.value()->generation();
+    return Status();
+}
+
+Status write_sidecar(const std::string &bucket, const std::string &object,
+                     const std::string &contents, storage_backend* client) {
+    Status created = client->create_bucket(bucket);
+    if (!created.ok() && created.code() != google::cloud::StatusCode::kAborted) {
+        return created;
+    }
+    return client->write(bucket, object, contents);
+}
+
+}  // namespace
+
+Status write_span_id_index(const std::string &bucket, const std::string &object_name, storage_backend* client) {
+    std::string resolved_bucket = bucket;
+    std::string resolved_object = object_name;
+    resolve_object_location(resolved_bucket, resolved_object);
+
+    ot::TracesData trace_data;
+    int64_t generation;
+    Status status = read_span_object(resolved_bucket, resolved_object, trace_data, generation, client);
+    if (!status.ok()) {
+        return status;
+    }
+    return write_sidecar(SPAN_ID_INDEX_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX), resolved_object,
+        serialize_span_id_index(trace_data, generation), client);
+}
+
+Status write_span_columns(const std::string &bucket, const std::string &object_name, storage_backend* client) {
+    std::string resolved_bucket = bucket;
+    std::string resolved_object = object_name;
+    resolve_object_location(resolved_bucket, resolved_object);
 
     ot::TracesData trace_data;
-    if (data == "") {
-        return trace_data;
+    int64_t generation;
+    Status status = read_span_object(resolved_bucket, resolved_object, trace_data, generation, client);
+    if (!status.ok()) {
+        return status;
     }
+    return write_sidecar(SPAN_COLUMNS_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX), resolved_object,
+        serialize_span_columns(trace_data, generation), client);
+}
 
-    bool ret = trace_data.ParseFromString(data);
-    if (!ret) {
-        std::cerr << "Error in read_object_and_parse_traces_data:ParseFromString" << std::endl;
-        std::cerr << "while reading object " << object_name << std::endl;
-        exit(1);
+Status write_span_latency_summary(
+    const std::string &bucket, const std::string &object_name, storage_backend* client) {
+    std::string resolved_bucket = bucket;
+    std::string resolved_object = object_name;
+    resolve_object_location(resolved_bucket, resolved_object);
+
+    ot::TracesData trace_data;
+    int64_t generation;
+    Status status = read_span_object(resolved_bucket, resolved_object, trace_data, generation, client);
+    if (!status.ok()) {
+        return status;
+    }
+    return write_sidecar(SPAN_LATENCY_SUMMARY_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX), resolved_object,
+        serialize_span_latency_summary(trace_data, generation), client);
+}
+
+StatusOr<std::shared_ptr<const span_columns>> read_span_columns(
+    const std::string &bucket, const std::string &object_name, storage_backend* client) {
+    std::string resolved_bucket = bucket;
+    std::string resolved_object = object_name;
+    resolve_object_location(resolved_bucket, resolved_object);
+
+    auto contents = read_stored_object(
+        SPAN_COLUMNS_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX), resolved_object, client);
+    if (!contents.ok()) {
+        return contents.status();
+    }
+    auto columns = span_columns::parse(*contents.value());
+    if (!columns.ok()) {
+        return columns.status();
+    }
+    // span objects aren't rewritten once uploaded, so only check when asked to
+    if (cache_revalidation_enabled() &&
+        false == is_current_generation(resolved_bucket, resolved_object, columns.value()->generation(), client)) {
+        return Status(google::cloud::StatusCode::kFailedPrecondition, "stale span columns for " + resolved_object);
     }
+    return columns;
+}
+
+StatusOr<span_latency_summary> read_span_latency_summary(
+    const std::string &bucket, const std::string &object_name, storage_backend* client) {
+    std::string resolved_bucket = bucket;
+    std::string resolved_object = object_name;
+    resolve_object_location(resolved_bucket, resolved_object);
 
-    return trace_data;
+    auto contents = read_stored_object(
+        SPAN_LATENCY_SUMMARY_BUCKET_PREFIX + std::string(BUCKETS_SUFFIX), resolved_object, client);
+    if (!contents.ok()) {
+        return contents.status();
+    }
+    auto summary = parse_span_latency_summary(*contents.value());
+    if (!summary.ok()) {
+        return summary.status();
+    }
+    if (cache_revalidation_enabled() &&
+        false == is_current_generation(resolved_bucket, resolved_object, summary->generation, client)) {
+        return Status(google::cloud::StatusCode::kFailedPrecondition,
+            "stale span latency summary for " + resolved_object);
+    }
+    return summary;
 }
 
 bool is_spans_bucket(std::string bucket) {
@@ -112,18 +275,47 @@ bool is_spans_bucket(std::string bucket) {
     return true;
 }
 
-StatusOr<std::string> read_object(std::string bucket, std::string object, gcs::Client* client) {
-    if (true == is_spans_bucket(bucket)) {
-        object = bucket + "/"+ object;
-        bucket = "microservices" + std::string(BUCKETS_SUFFIX);
-    }
-    auto reader = client->ReadObject(bucket, object);
-    if (!reader) {
-        return reader.status();
+StatusOr<std::shared_ptr<const stored_object>> read_stored_object(
+    std::string bucket, std::string object, storage_backend* client) {
+    resolve_object_location(bucket, object);
+    const std::string key = object_cache_key(bucket, object);
+
+    auto cached = object_cache().get(key);
+    if (cached.has_value()) {
+        if (false == cache_revalidation_enabled() ||
+            is_current_generation(bucket, object, cached->generation, client)) {
+            profile_cache_hit();
+            return cached->value;
+        }
+        object_cache().invalidate(key);
     }
 
-    std::string object_content{std::istreambuf_iterator<char>{reader}, {}};
-    return object_content;
+    return object_reads_in_flight().run(key, [&]() -> StatusOr<std::shared_ptr<const stored_object>> {
+        auto fetched = client->read(bucket, object);
+        if (!fetched.ok()) {
+            return fetched.status();
+        }
+        object_cache().put(key, fetched.value(), fetched.value()->size(), fetched.value()->generation());
+        return fetched;
+    });
+}
+
+StatusOr<std::string> read_object_range(
+    std::string bucket, std::string object, int64_t begin, int64_t end, storage_backend* client) {
+    resolve_object_location(bucket, object);
+    const std::string key = object_cache_key(bucket, object) +
+        "@" + std::to_string(begin) + "-" + std::to_string(end);
+    return range_reads_in_flight().run(key, [&]() {
+        return client->read_range(bucket, object, begin, end);
+    });
+}
+
+StatusOr<std::string> read_object(std::string bucket, std::string object, storage_backend* client) {
+    auto object_content = read_stored_object(bucket, object, client);
+    if (!object_content.ok()) {
+        return object_content.status();
+    }
+    return object_content.value()->str();
 }
 
 bool object_could_have_out_of_bound_traces(std::pair<int, int> batch_time, int start_time, int end_time) {
@@ -209,7 +401,7 @@ std::vector<std::string> filter_trace_ids_based_on_query_timestamp(
     const std::string &object_content,
     const int start_time,
     const int end_time,
-    gcs::Client* client) {
+    storage_backend* client) {
     std::vector<std::string> response;
 
     std::map<std::string, std::string> trace_id_to_root_service_map = get_trace_id_to_root_service_map(object_content);
@@ -218,13 +410,17 @@ std::vector<std::string> filter_trace_ids_based_on_query_timestamp(
 
     std::string buckets_suffix(BUCKETS_SUFFIX);
     for (auto const& elem : root_service_to_trace_ids_map) {
-        std::map<std::string, std::pair<int, int>> trace_id_to_timestamp_map =
+        std::unordered_map<trace_id_t, std::pair<int, int>> trace_id_to_timestamp_map =
             get_timestamp_map_for_trace_ids(
-                read_object(elem.first + buckets_suffix, batch_name, client).value(),
-                trace_ids);
+                read_object(elem.first + buckets_suffix, batch_name, client).value());
 
         for (auto const& trace_id : elem.second) {
-            std::pair<int, int> trace_timestamp = trace_id_to_timestamp_map[trace_id];
+            // the bloom filters are built over the hex form, so this stays in hex
+            trace_id_t parsed_trace_id;
+            if (false == trace_id_t::from_hex(trace_id, parsed_trace_id)) {
+                continue;
+            }
+            std::pair<int, int> trace_timestamp = trace_id_to_timestamp_map[parsed_trace_id];
             if (is_object_within_timespan(trace_timestamp, start_time, end_time)) {
                 response.push_back(trace_id);
             }
@@ -314,21 +510,14 @@ bool has_prefix(std::string fullString, std::string starting) {
     return false;
 }
 
-std::vector<std::string> get_spans_buckets_names(gcs::Client* client) {
+std::vector<std::string> get_spans_buckets_names(storage_backend* client) {
     std::vector<std::string> response;
-    for (auto&& prefix : client->ListObjectsAndPrefixes(
-        std::string(SERVICES_BUCKET_PREFIX)+std::string(BUCKETS_SUFFIX), gcs::Delimiter("/"))) {
-        if (!prefix) {
-            std::cerr << "Error in getting prefixes" << std::endl;
-            return response;
-        }
-
-        auto result = *std::move(prefix);
-        if (false == absl::holds_alternative<std::string>(result)) {
-            std::cerr << "Error in moving prefix in get_spans_buckets_names" << std::endl;
-            return response;
-        }
-        std::string res = absl::get<std::string>(result);
+    auto prefixes = client->list_prefixes(std::string(SERVICES_BUCKET_PREFIX)+std::string(BUCKETS_SUFFIX), "/");
+    if (!prefixes.ok()) {
+        std::cerr << "Error in getting prefixes" << std::endl;
+        return response;
+    }
+    for (std::string res : prefixes.value()) {
         replace_all(res, "/", "");
         response.push_back(res);
         std::cout << "pushign back " << res << std::endl;
@@ -336,6 +525,24 @@ std::vector<std::string> get_spans_buckets_names(gcs::Client* client) {
     return response;
 }
 
+void prefetch_batches(const std::vector<std::string> &batch_names, const std::set<std::string> &services,
+    storage_backend* client) {
+    if (false == client->accepts_prefetch()) {
+        return;
+    }
+
+    std::string trace_struct_bucket = std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+    for (auto &batch_name : batch_names) {
+        client->prefetch(trace_struct_bucket, batch_name);
+        for (auto &service_name : services) {
+            std::string bucket = service_name + BUCKETS_SUFFIX;
+            std::string object = batch_name;
+            resolve_object_location(bucket, object);
+            client->prefetch(bucket, object);
+        }
+    }
+}
+
 // https://stackoverflow.com/questions/14539867/how-to-display-a-progress-indicator-in-pure-c-c-cout-printf
 void print_progress(float progress, std::string label, bool verbose) {
     if (!verbose) {
@@ -402,16 +609,17 @@ std::vector<std::string> generate_prefixes(time_t earliest, time_t latest) {
     return to_return;
 }
 
-std::vector<std::string> get_list_result(gcs::Client* client, std::string prefix, time_t earliest, time_t latest) {
+std::vector<std::string> get_list_result(storage_backend* client, std::string prefix, time_t earliest, time_t latest) {
     std::vector<std::string> to_return;
     std::string trace_struct_bucket(TRACE_STRUCT_BUCKET_PREFIX);
     std::string suffix(BUCKETS_SUFFIX);
-    for (auto&& object_metadata : client->ListObjects(trace_struct_bucket+suffix, gcs::Prefix(prefix))) {
-        if (!object_metadata) {
-            throw std::runtime_error(object_metadata.status().message());
-        }
+    auto objects = client->list_objects(trace_struct_bucket+suffix, prefix);
+    if (!objects.ok()) {
+        throw std::runtime_error(objects.status().message());
+    }
+    for (auto& object_metadata : objects.value()) {
         // before we push back, should make sure that it's actually between the bounds
-        std::string name = object_metadata->name();
+        std::string name = object_metadata.name;
         std::vector<std::string> times = split_by_string(name, hyphen);
         // we care about three of these:
         // if we are neatly between earliest and latest, or if we overlap on one side
@@ -428,7 +636,7 @@ std::vector<std::string> get_list_result(gcs::Client* client, std::string prefix
     return to_return;
 }
 
-std::vector<std::string> get_batches_between_timestamps(gcs::Client* client, time_t earliest, time_t latest) {
+std::vector<std::string> get_batches_between_timestamps(storage_backend* client, time_t earliest, time_t latest) {
     std::vector<std::string> prefixes = generate_prefixes(earliest, latest);
     std::vector<std::future<std::vector<std::string>>> object_names;
     for (uint64_t i = 0; i < prefixes.size(); i++) {
@@ -436,13 +644,13 @@ std::vector<std::string> get_batches_between_timestamps(gcs::Client* client, tim
             for (int k=0; k < 10; k++) {
                 std::string new_prefix = std::to_string(j) + std::to_string(k) + "-" + prefixes[i];
                 object_names.push_back(
-                    std::async(std::launch::async, get_list_result, client, new_prefix, earliest, latest));
+                    executor::get().submit(io_pool, get_list_result, client, new_prefix, earliest, latest));
             }
         }
     }
     std::vector<std::string> to_return;
     for (uint64_t m=0; m < object_names.size(); m++) {
-        auto names = object_names[m].get();
+        auto names = executor::get().wait(object_names[m]);
         for (uint64_t n=0; n < names.size(); n++) {
             // check that these are actually within range
             std::vector<std::string> timestamps = split_by_string(names[n], hyphen);
@@ -486,7 +694,7 @@ void merge_objname_to_trace_ids(objname_to_matching_trace_ids &original,
                                 objname_to_matching_trace_ids &to_empty) {
     for (auto && map : to_empty) {
         std::string batch_name = map.first;
-        std::vector<std::string> trace_ids = map.second;
+        std::vector<trace_id_t> trace_ids = map.second;
         if (original.find(batch_name) == original.end()) {
             original[batch_name] = trace_ids;
         } else {
@@ -496,7 +704,7 @@ void merge_objname_to_trace_ids(objname_to_matching_trace_ids &original,
     }
 }
 
-time_t get_lowest_time_val(gcs::Client* client) {
+time_t get_lowest_time_val(storage_backend* client) {
     std::string trace_struct_bucket(TRACE_STRUCT_BUCKET_PREFIX);
     std::string suffix(BUCKETS_SUFFIX);
     std::string bucket_name = trace_struct_bucket+suffix;
@@ -506,19 +714,17 @@ time_t get_lowest_time_val(gcs::Client* client) {
     for (int i=0; i < 10; i++) {
         for (int j=0; j < 10; j++) {
             std::string prefix = std::to_string(i) + std::to_string(j);
-            for (auto&& object_metadata :
-                client->ListObjects(bucket_name, gcs::Prefix(prefix))) {
-                if (!object_metadata) {
-                    throw std::runtime_error(object_metadata.status().message());
-                }
-                std::string object_name = object_metadata->name();
-                auto split = split_by_string(object_name, hyphen);
+            // we only want to read the first value, not all of them
+            auto objects = client->list_objects(bucket_name, prefix, 1);
+            if (!objects.ok()) {
+                throw std::runtime_error(objects.status().message());
+            }
+            for (auto& object_metadata : objects.value()) {
+                auto split = split_by_string(object_metadata.name, hyphen);
                 time_t low = time_t_from_string(split[1]);
                 if (low < lowest_val) {
                     lowest_val = low;
                 }
-                // we break because we don't want to read all values, just first one
-                break;
             }
         }
     }
@@ -7,6 +7,7 @@
 #define COMMON_H_
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <future>
@@ -14,7 +15,12 @@
 #include <unordered_map>
 #include <utility>
 
-#include "BS_thread_pool.hpp"
+#include "executor.h"
+#include "storage.h"
+#include "object_cache.h"
+#include "structural_object.h"
+#include "span_columns.h"
+#include "trace_id.h"
 #include "absl/status/statusor.h"
 #include "google/cloud/storage/client.h"
 #include "opentelemetry/proto/trace/v1/trace.pb.h"
@@ -27,6 +33,9 @@
 
 const char BUCKET_TYPE_LABEL_KEY[] = "bucket_type";
 const char BUCKET_TYPE_LABEL_VALUE_FOR_SPAN_BUCKETS[] = "microservice";
+// Index statistics, kept up to date by the bloom index builder for the query planner.
+const char BATCHES_INDEXED_LABEL_KEY[] = "batches_indexed";
+const char DISTINCT_VALUES_LABEL_KEY[] = "distinct_values";
 const char PROJECT_ID[] = "dynamic-tracing";
 const char BUCKETS_LOCATION[] = "us-central1";
 
@@ -37,6 +46,10 @@ const char TRACE_HASHES_BUCKET_PREFIX[] = "tracehashes";
 
 // regarding the hack of changing buckets to folders
 const char SERVICES_BUCKET_PREFIX[] = "microservices";
+// Sidecars of span objects (see span_batch.h and span_columns.h), named after the span object.
+const char SPAN_ID_INDEX_BUCKET_PREFIX[] = "index-span-ids";
+const char SPAN_COLUMNS_BUCKET_PREFIX[] = "index-span-columns";
+const char SPAN_LATENCY_SUMMARY_BUCKET_PREFIX[] = "index-span-latency";
 const int TRACE_ID_LENGTH = 32;
 const int SPAN_ID_LENGTH = 16;
 const int element_count = 10000;
@@ -51,7 +64,7 @@ namespace ot = opentelemetry::proto::trace::v1;
 using ::google::cloud::StatusOr;
 using ::google::cloud::Status;
 
-typedef std::unordered_map<std::string, std::vector<std::string>> objname_to_matching_trace_ids;
+typedef std::unordered_map<std::string, std::vector<trace_id_t>> objname_to_matching_trace_ids;
 
 enum index_type {
     bloom,
@@ -76,8 +89,8 @@ bool has_prefix(std::string fullString, std::string starting);
 
 /// *********** string processing according to system conventions **********
 bool is_spans_bucket(std::string bucket);
-std::map<std::string, std::pair<int, int>> get_timestamp_map_for_trace_ids(
-    const std::string &spans_data, const std::vector<std::string> &trace_ids);
+// Trace ID to the start and end, in seconds, of its first span in the object.
+std::unordered_map<trace_id_t, std::pair<int, int>> get_timestamp_map_for_trace_ids(const std::string &spans_data);
 bool object_could_have_out_of_bound_traces(std::pair<int, int> batch_time, int start_time, int end_time);
 bool is_object_within_timespan(std::pair<int, int> batch_time, int start_time, int end_time);
 std::string extract_batch_name(const std::string &object_name);
@@ -87,13 +100,30 @@ std::map<std::string, std::vector<std::string>> get_root_service_to_trace_ids_ma
     const std::map<std::string, std::string> &trace_id_to_root_service_map);
 std::string extract_any_trace(std::vector<std::string>& trace_ids, std::string& object_content);
 std::string extract_trace_from_traces_object(const std::string &trace_id, std::string& object_content);
-std::vector<std::string> get_batches_between_timestamps(gcs::Client* client, time_t earliest, time_t latest);
-time_t get_lowest_time_val(gcs::Client* client);
+std::vector<std::string> get_batches_between_timestamps(storage_backend* client, time_t earliest, time_t latest);
+time_t get_lowest_time_val(storage_backend* client);
 
 /// **************** GCS processing ********************************
-opentelemetry::proto::trace::v1::TracesData read_object_and_parse_traces_data(
-    const std::string &bucket, const std::string &object_name, gcs::Client* client);
-StatusOr<std::string> read_object(std::string bucket, std::string object, gcs::Client* client);
+// Both go through the caches and in-flight tables in object_cache.h.
+std::shared_ptr<const span_batch> read_object_and_parse_traces_data(
+    const std::string &bucket, const std::string &object_name, storage_backend* client);
+// Builds and stores the sidecars for one span object.
+Status write_span_id_index(const std::string &bucket, const std::string &object_name, storage_backend* client);
+Status write_span_columns(const std::string &bucket, const std::string &object_name, storage_backend* client);
+Status write_span_latency_summary(
+    const std::string &bucket, const std::string &object_name, storage_backend* client);
+// Fails if the object has no columns sidecar, or, with revalidation on, if they are out of date.
+StatusOr<std::shared_ptr<const span_columns>> read_span_columns(
+    const std::string &bucket, const std::string &object_name, storage_backend* client);
+// Likewise for the latency summary.
+StatusOr<span_latency_summary> read_span_latency_summary(
+    const std::string &bucket, const std::string &object_name, storage_backend* client);
+StatusOr<std::string> read_object(std::string bucket, std::string object, storage_backend* client);
+StatusOr<std::shared_ptr<const stored_object>> read_stored_object(
+    std::string bucket, std::string object, storage_backend* client);
+// Bytes [begin, end) of an object; concurrent reads of the same range share one request.
+StatusOr<std::string> read_object_range(
+    std::string bucket, std::string object, int64_t begin, int64_t end, storage_backend* client);
 
 std::vector<std::string> filter_trace_ids_based_on_query_timestamp(
     const std::vector<std::string> &trace_ids,
@@ -101,9 +131,14 @@ std::vector<std::string> filter_trace_ids_based_on_query_timestamp(
     const std::string &object_content,
     int start_time,
     int end_time,
-    gcs::Client* client);
-
-std::vector<std::string> get_spans_buckets_names(gcs::Client* client);
+    storage_backend* client);
+
+std::vector<std::string> get_spans_buckets_names(storage_backend* client);
+// Asks the backend to warm its local tier with the structural objects of
+// these batches and their span objects of the given services, which should
+// be the ones the query's structures map onto (see mapped_services()).
+void prefetch_batches(const std::vector<std::string> &batch_names, const std::set<std::string> &services,
+    storage_backend* client);
 
 /// **************** Other ********************************
 void merge_objname_to_trace_ids(objname_to_matching_trace_ids &original,
@@ -0,0 +1,54 @@
+/*
+ * Rewrites the structural objects in the dyntraces bucket into the binary
+ * format described in structural_object.h.  Objects that are already binary,
+ * or that can't be converted exactly, are left as they are.
+ *
+ * usage: convert_structural_objects [batch name prefix]
+*/
+
+#include <iostream>
+#include <string>
+
+#include "common.h"
+
+int main(int argc, char* argv[]) {
+    std::string prefix = argc > 1 ? argv[1] : "";
+    auto client = make_storage_backend();
+    const std::string bucket = std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+
+    auto objects = client->list_objects(bucket, prefix);
+    if (!objects.ok()) {
+        std::cerr << "could not list " << bucket << ": " << objects.status().message() << std::endl;
+        return 1;
+    }
+
+    int converted = 0, skipped = 0, failed = 0;
+    for (auto &object : objects.value()) {
+        auto contents = client->read(bucket, object.name);
+        if (!contents.ok()) {
+            std::cerr << object.name << ": " << contents.status().message() << std::endl;
+            failed++;
+            continue;
+        }
+        if (is_binary_structural_object(contents.value()->view())) {
+            skipped++;
+            continue;
+        }
+        auto binary = convert_structural_object_to_binary(contents.value()->view());
+        if (!binary.ok()) {
+            std::cerr << object.name << ": " << binary.status().message() << std::endl;
+            skipped++;
+            continue;
+        }
+        Status status = client->write(bucket, object.name, binary.value());
+        if (!status.ok()) {
+            std::cerr << object.name << ": " << status.message() << std::endl;
+            failed++;
+            continue;
+        }
+        std::cout << object.name << ": " << contents.value()->size() << " -> " << binary->size() << " bytes" << std::endl;
+        converted++;
+    }
+    std::cout << "converted " << converted << ", skipped " << skipped << ", failed " << failed << std::endl;
+    return failed > 0 ? 1 : 0;
+}
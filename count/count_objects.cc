@@ -3,33 +3,33 @@
 #include <vector>
 #include "common.h"
 
-int64_t count_objects_size(std::string bucket_name, gcs::Client* client) {
+int64_t count_objects_size(std::string bucket_name, storage_backend* client) {
     int64_t count = 0;
-    for (auto& object_metadata : client ->ListObjects(bucket_name)) {
-        if (!object_metadata) {
-            std::cerr << "Error in getting object" << std::endl;
-            exit(1);
-        }
-        count += object_metadata->size();
+    auto objects = client->list_objects(bucket_name);
+    if (!objects) {
+        std::cerr << "Error in getting object" << std::endl;
+        exit(1);
+    }
+    for (auto& object_metadata : objects.value()) {
+        count += object_metadata.size;
     }
     return count;
 }
 
-int64_t count_objects_in_bucket(std::string bucket_name, gcs::Client* client) {
+int64_t count_objects_in_bucket(std::string bucket_name, storage_backend* client) {
     int64_t count = 0;
-    for (auto& object_metadata : client ->ListObjects(bucket_name)) {
-        if (!object_metadata) {
-            std::cerr << "Error in getting object" << std::endl;
-            exit(1);
-        }
-
-        count++;
+    auto objects = client->list_objects(bucket_name);
+    if (!objects) {
+        std::cerr << "Error in getting object" << std::endl;
+        exit(1);
     }
 
+    count += objects->size();
+
     return count;
 }
 
-int64_t count_objects(gcs::Client* client, bool size) {
+int64_t count_objects(storage_backend* client, bool size) {
     std::vector<std::string> bucket_prefixes = {
         "frontend", "adservice", "cartservice", "checkoutservice", "currencyservice",
         "emailservice", "paymentservice", "productcatalogservice", "recommendationservice",
@@ -44,14 +44,14 @@ int64_t count_objects(gcs::Client* client, bool size) {
     for (auto ele : bucket_prefixes) {
         auto bucket_name = ele + BUCKETS_SUFFIX;
         if (size) {
-            response_futures.push_back(std::async(std::launch::async, count_objects_size, bucket_name, client));
+            response_futures.push_back(executor::get().submit(io_pool, count_objects_size, bucket_name, client));
         } else {
-            response_futures.push_back(std::async(std::launch::async, count_objects_in_bucket, bucket_name, client));
+            response_futures.push_back(executor::get().submit(io_pool, count_objects_in_bucket, bucket_name, client));
         }
     }
 
     for (int64_t i = 0; i < response_futures.size(); i++) {
-        auto res = response_futures[i].get();
+        auto res = executor::get().wait(response_futures[i]);
         count += res;
     }
 
@@ -7,8 +7,8 @@
 #include "opentelemetry/proto/trace/v1/trace.pb.h"
 #include "common.h"
 
-int64_t count_objects_size(std::string bucket_name, gcs::Client* client);
-int64_t count_objects_in_bucket(std::string bucket_name, gcs::Client* client);
-int64_t count_objects(gcs::Client* client, bool size);
+int64_t count_objects_size(std::string bucket_name, storage_backend* client);
+int64_t count_objects_in_bucket(std::string bucket_name, storage_backend* client);
+int64_t count_objects(storage_backend* client, bool size);
 
 #endif  // COUNT_COUNT_OBJECTS_H_
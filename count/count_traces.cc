@@ -10,14 +10,14 @@ struct Counts {
     std::unordered_set<std::string> spans;
 };
 
-Counts get_counts_for_object(std::string object, gcs::Client* client) {
+Counts get_counts_for_object(std::string object, storage_backend* client) {
     Counts to_return;
-    auto reader = client->ReadObject(
-        std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX), object);
-    if (!reader) {
-        std::cerr << "Error getting object " << reader.status().code() << std::endl;
+    auto contents = read_structural_object_text(object, client);
+    if (!contents) {
+        std::cerr << "Error getting object " << contents.status().code() << std::endl;
+        return to_return;
     }
-    std::string object_content{std::istreambuf_iterator<char>{reader}, {}};
+    std::string object_content = contents.value();
     for (std::string& line : split_by_string(object_content, newline)) {
         if (line.compare("") == 0) {
             continue;
@@ -31,25 +31,26 @@ Counts get_counts_for_object(std::string object, gcs::Client* client) {
     return to_return;
 }
 
-void count_spans_and_traces(gcs::Client* client) {
+void count_spans_and_traces(storage_backend* client) {
     std::unordered_set<std::string> traces;
     std::unordered_set<std::string> spans;
     std::vector<std::future<Counts>> counts_futures;
     std::string trace_struct_bucket = std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
-    for (auto& object_metadata : client ->ListObjects(trace_struct_bucket)) {
-        if (!object_metadata) {
-            std::cerr << "Error in getting object" << std::endl;
-            exit(1);
-        }
-        counts_futures.push_back(std::async(
-            std::launch::async, get_counts_for_object, object_metadata->name(), client));
+    auto objects = client->list_objects(trace_struct_bucket);
+    if (!objects) {
+        std::cerr << "Error in getting object" << std::endl;
+        exit(1);
+    }
+    for (auto& object_metadata : objects.value()) {
+        counts_futures.push_back(executor::get().submit(
+            io_pool, get_counts_for_object, object_metadata.name, client));
     }
     Counts summation;
     for (int i=0; i < counts_futures.size(); i++) {
         if (i%20 == 0) {
             std::cout << "i " << i << std::endl;
         }
-        Counts new_count = counts_futures[i].get();
+        Counts new_count = executor::get().wait(counts_futures[i]);
         for (auto &trace : new_count.traces) {
             summation.traces.insert(trace);
         }
@@ -7,6 +7,6 @@
 #include "opentelemetry/proto/trace/v1/trace.pb.h"
 #include "common.h"
 
-void count_spans_and_traces(gcs::Client* client);
+void count_spans_and_traces(storage_backend* client);
 
 #endif  // COUNT_COUNT_TRACES_H_
@@ -2,10 +2,10 @@
 #include "count_objects.h"
 
 int main(int argc, char* argv[]) {
-    auto client = gcs::Client();
-    count_spans_and_traces(&client);
-    const int64_t res = count_objects(&client, true);
+    auto client = make_storage_backend();
+    count_spans_and_traces(client.get());
+    const int64_t res = count_objects(client.get(), true);
     std::cout << "Total data size " << res << std::endl;
-    const int64_t res2 = count_objects(&client, false);
+    const int64_t res2 = count_objects(client.get(), false);
     std::cout << "Total objects " << res2 << std::endl;
 }
@@ -0,0 +1,297 @@
+#include "disk_cache.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string cache_key(const std::string &bucket, const std::string &object) {
+    return bucket + "/" + object;
+}
+
+// Hits never reach the remote backend, which is the one metered, so they
+// are counted here, with the misses that do.
+counter& disk_cache_hits() {
+    static counter* hits = &metrics().get_counter("quest_disk_cache_hits_total", "Disk cache lookups that hit.");
+    return *hits;
+}
+
+counter& disk_cache_misses() {
+    static counter* misses = &metrics().get_counter(
+        "quest_disk_cache_misses_total", "Disk cache lookups that missed.");
+    return *misses;
+}
+
+}  // namespace
+
+disk_cache_backend::disk_cache_backend(
+    std::unique_ptr<storage_backend> remote, std::string root, uint64_t capacity_bytes, size_t max_prefetches)
+: remote_(std::move(remote)), root_(std::move(root)), capacity_(capacity_bytes), max_prefetches_(max_prefetches),
+  prefetch_pool_(DISK_CACHE_PREFETCH_THREADS) {
+    load_index();
+}
+
+std::string disk_cache_backend::file_path(
+    const std::string &bucket, const std::string &object, int64_t generation) const {
+    return root_ + "/" + bucket + "/" + object + "#" + std::to_string(generation);
+}
+
+void disk_cache_backend::load_index() {
+    std::error_code ec;
+    fs::create_directories(root_, ec);
+
+    struct found_file {
+        cached_file file;
+        int64_t mtime;
+    };
+    std::vector<found_file> found;
+    for (auto it = fs::recursive_directory_iterator(root_, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        // leftovers from an interrupted write_local_file()
+        if (it->path().filename().string()[0] == '.') {
+            fs::remove(it->path(), ec);
+            continue;
+        }
+
+        std::string name = it->path().lexically_relative(root_).generic_string();
+        std::size_t slash = name.find('/');
+        std::size_t hash = name.rfind('#');
+        if (slash == std::string::npos || hash == std::string::npos || hash < slash) {
+            continue;
+        }
+        struct stat st;
+        if (::stat(it->path().c_str(), &st) != 0) {
+            continue;
+        }
+        found.push_back(found_file {
+            .file = cached_file {
+                .bucket = name.substr(0, slash),
+                .object = name.substr(slash + 1, hash - slash - 1),
+                .generation = std::strtoll(name.c_str() + hash + 1, nullptr, 10),
+                .size = static_cast<uint64_t>(st.st_size),
+            },
+            .mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+        });
+    }
+
+    // oldest first, so that the most recently used file ends up at the front
+    std::sort(found.begin(), found.end(),
+        [](const found_file &a, const found_file &b) { return a.mtime < b.mtime; });
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &f : found) {
+        const std::string key = cache_key(f.file.bucket, f.file.object);
+        // two generations of the same object: keep the newer one
+        remove_locked(key, true);
+        lru_.push_front(f.file);
+        index_[key] = lru_.begin();
+        stats_.bytes += f.file.size;
+    }
+    evict_locked();
+}
+
+bool disk_cache_backend::lookup(const std::string &key, cached_file &found) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        stats_.misses++;
+        disk_cache_misses().add();
+        return false;
+    }
+    stats_.hits++;
+    disk_cache_hits().add();
+    lru_.splice(lru_.begin(), lru_, it->second);
+    found = *it->second;
+    return true;
+}
+
+void disk_cache_backend::store(const std::string &bucket, const std::string &object, const stored_object &contents) {
+    if (contents.size() > capacity_) {
+        return;
+    }
+    const std::string path = file_path(bucket, object, contents.generation());
+    if (!write_local_file(path, contents.view()).ok()) {
+        return;  // the cache is best effort; the caller already has the object
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string key = cache_key(bucket, object);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        // a concurrent reader may have stored the same generation at the same path
+        remove_locked(key, it->second->generation != contents.generation());
+    }
+    lru_.push_front(cached_file {
+        .bucket = bucket,
+        .object = object,
+        .generation = contents.generation(),
+        .size = contents.size(),
+    });
+    index_[key] = lru_.begin();
+    stats_.bytes += contents.size();
+    evict_locked();
+}
+
+void disk_cache_backend::drop(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.find(key) != index_.end()) {
+        remove_locked(key, true);
+        stats_.invalidations++;
+    }
+}
+
+void disk_cache_backend::remove_locked(const std::string &key, bool unlink_file) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return;
+    }
+    if (unlink_file) {
+        // readers that already mapped the file keep their mapping
+        unlink(file_path(it->second->bucket, it->second->object, it->second->generation).c_str());
+    }
+    stats_.bytes -= it->second->size;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+void disk_cache_backend::evict_locked() {
+    while (stats_.bytes > capacity_ && !lru_.empty()) {
+        remove_locked(cache_key(lru_.back().bucket, lru_.back().object), true);
+        stats_.evictions++;
+    }
+}
+
+StatusOr<std::shared_ptr<const stored_object>> disk_cache_backend::read(
+    const std::string &bucket, const std::string &object) {
+    const std::string key = cache_key(bucket, object);
+    std::shared_future<void> prefetched;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto pending = prefetching_.find(key);
+        if (pending != prefetching_.end()) {
+            prefetched = pending->second;
+        }
+    }
+    if (prefetched.valid()) {
+        prefetched.wait();
+    }
+
+    cached_file cached;
+    if (lookup(key, cached)) {
+        bool current = true;
+        if (cache_revalidation_enabled()) {
+            auto info = remote_->stat(bucket, object);
+            current = info.ok() && info->generation == cached.generation;
+        }
+        if (current) {
+            std::string path = file_path(bucket, object, cached.generation);
+            auto mapped = map_local_file(path, cached.generation);
+            if (mapped.ok()) {
+                utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+                return mapped;
+            }
+        }
+        drop(key);
+    }
+
+    auto fetched = remote_->read(bucket, object);
+    if (!fetched.ok()) {
+        return fetched.status();
+    }
+    store(bucket, object, *fetched.value());
+    return fetched;
+}
+
+StatusOr<std::string> disk_cache_backend::read_range(
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end) {
+    cached_file cached;
+    if (lookup(cache_key(bucket, object), cached) && !cache_revalidation_enabled()) {
+        auto contents = read_local_file_range(file_path(bucket, object, cached.generation), begin, end);
+        if (contents.ok()) {
+            return contents;
+        }
+    }
+    return remote_->read_range(bucket, object, begin, end);
+}
+
+void disk_cache_backend::prefetch(const std::string &bucket, const std::string &object) {
+    const std::string key = cache_key(bucket, object);
+    auto done = std::make_shared<std::promise<void>>();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index_.find(key) != index_.end() || prefetching_.find(key) != prefetching_.end() ||
+            prefetching_.size() >= max_prefetches_) {
+            return;
+        }
+        prefetching_.emplace(key, done->get_future().share());
+    }
+    prefetch_pool_.push_task([this, bucket, object, key, done]() {
+        auto fetched = remote_->read(bucket, object);
+        if (fetched.ok()) {
+            store(bucket, object, *fetched.value());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            prefetching_.erase(key);
+        }
+        done->set_value();
+    });
+}
+
+void disk_cache_backend::wait_for_prefetches() {
+    prefetch_pool_.wait_for_tasks();
+}
+
+cache_stats disk_cache_backend::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_stats ret = stats_;
+    ret.entries = index_.size();
+    ret.budget = capacity_;
+    return ret;
+}
+
+StatusOr<object_info> disk_cache_backend::stat(const std::string &bucket, const std::string &object) {
+    return remote_->stat(bucket, object);
+}
+
+StatusOr<std::vector<object_info>> disk_cache_backend::list_objects(
+    const std::string &bucket, const std::string &prefix, int64_t max_results) {
+    return remote_->list_objects(bucket, prefix, max_results);
+}
+
+StatusOr<std::vector<std::string>> disk_cache_backend::list_prefixes(
+    const std::string &bucket, const std::string &delimiter) {
+    return remote_->list_prefixes(bucket, delimiter);
+}
+
+Status disk_cache_backend::write(const std::string &bucket, const std::string &object, const std::string &contents) {
+    Status status = remote_->write(bucket, object, contents);
+    drop(cache_key(bucket, object));
+    return status;
+}
+
+StatusOr<std::map<std::string, std::string>> disk_cache_backend::get_bucket_labels(const std::string &bucket) {
+    return remote_->get_bucket_labels(bucket);
+}
+
+Status disk_cache_backend::set_bucket_label(
+    const std::string &bucket, const std::string &key, const std::string &value) {
+    return remote_->set_bucket_label(bucket, key, value);
+}
+
+Status disk_cache_backend::create_bucket(const std::string &bucket) {
+    return remote_->create_bucket(bucket);
+}
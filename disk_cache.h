@@ -0,0 +1,101 @@
+/*
+ * A persistent cache tier on local disk, in front of a remote storage backend.
+ *
+ * Batches in dyntraces, tracehashes and the per-service span folders are not
+ * rewritten once they are uploaded, so a long-running query host can keep a
+ * large working set on local SSD and only go to GCS for what it hasn't seen.
+ * Objects are stored as "<root>/<bucket>/<object>#<generation>", which lets
+ * the index be rebuilt by walking the directory after a restart.  Eviction is
+ * least recently used, by bytes; file mtimes carry recency across restarts.
+ *
+ * This sits below the in-memory caches in object_cache.h: those hold parsed
+ * and raw objects for the current process, this holds files across processes.
+*/
+
+#ifndef DISK_CACHE_H_ // NOLINT
+#define DISK_CACHE_H_
+
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "BS_thread_pool.hpp"
+#include "storage.h"
+#include "object_cache.h"
+
+const char DISK_CACHE_DIR_ENV[] = "QUEST_DISK_CACHE_DIR";
+const char DISK_CACHE_BYTES_ENV[] = "QUEST_DISK_CACHE_BYTES";
+const uint64_t DEFAULT_DISK_CACHE_BYTES = 100ull << 30;
+const int DISK_CACHE_PREFETCH_THREADS = 16;
+// Prefetches queued or running at once; more are dropped rather than queued
+// behind them, since they are only hints.
+const size_t DEFAULT_DISK_CACHE_MAX_PREFETCHES = 256;
+
+class disk_cache_backend : public storage_backend {
+    public: // NOLINT
+        disk_cache_backend(std::unique_ptr<storage_backend> remote, std::string root, uint64_t capacity_bytes,
+                           size_t max_prefetches = DEFAULT_DISK_CACHE_MAX_PREFETCHES);
+
+        // Waits for a prefetch of the object that is under way rather than
+        // fetching it a second time.
+        StatusOr<std::shared_ptr<const stored_object>> read(
+            const std::string &bucket, const std::string &object) override;
+        StatusOr<std::string> read_range(
+            const std::string &bucket, const std::string &object, int64_t begin, int64_t end) override;
+        StatusOr<object_info> stat(const std::string &bucket, const std::string &object) override;
+        StatusOr<std::vector<object_info>> list_objects(
+            const std::string &bucket, const std::string &prefix, int64_t max_results) override;
+        StatusOr<std::vector<std::string>> list_prefixes(
+            const std::string &bucket, const std::string &delimiter) override;
+        // Writes go to the remote backend and drop the local copy.
+        Status write(const std::string &bucket, const std::string &object, const std::string &contents) override;
+        StatusOr<std::map<std::string, std::string>> get_bucket_labels(const std::string &bucket) override;
+        Status set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) override;
+        Status create_bucket(const std::string &bucket) override;
+
+        // Fetches the object into the cache in the background, unless it is
+        // already cached or being fetched, or max_prefetches are pending.
+        void prefetch(const std::string &bucket, const std::string &object) override;
+        bool accepts_prefetch() const override { return true; }
+        // Blocks until all prefetches issued so far have finished.
+        void wait_for_prefetches();
+
+        cache_stats get_stats();
+
+    private: // NOLINT
+        struct cached_file {
+            std::string bucket;
+            std::string object;
+            int64_t generation;
+            uint64_t size;
+        };
+
+        std::string file_path(const std::string &bucket, const std::string &object, int64_t generation) const;
+        // Returns the cached file and marks it most recently used.
+        bool lookup(const std::string &key, cached_file &found);
+        void store(const std::string &bucket, const std::string &object, const stored_object &contents);
+        void drop(const std::string &key);
+        void remove_locked(const std::string &key, bool unlink_file);
+        void evict_locked();
+        void load_index();
+
+        std::unique_ptr<storage_backend> remote_;
+        std::string root_;
+
+        std::mutex mutex_;
+        uint64_t capacity_;
+        std::list<cached_file> lru_;
+        std::unordered_map<std::string, std::list<cached_file>::iterator> index_;
+        size_t max_prefetches_;
+        // Pending prefetches, done once the object is stored (or failed to be).
+        std::unordered_map<std::string, std::shared_future<void>> prefetching_;
+        cache_stats stats_;
+
+        // Declared last so that it is destroyed, and its tasks finished, first.
+        BS::thread_pool prefetch_pool_;
+};
+
+#endif  // DISK_CACHE_H_ // NOLINT
@@ -0,0 +1,141 @@
+#include "executor.h"
+#include "metrics.h"
+
+#include <cstdlib>
+
+namespace {
+
+// The pool and deque the current thread works from, if it is a worker.
+thread_local task_pool* current_pool = nullptr;
+thread_local int current_index = -1;
+
+int threads_from_env(const char* name, int fallback) {
+    const char* value = std::getenv(name);
+    if (value != nullptr && std::atoi(value) > 0) {
+        return std::atoi(value);
+    }
+    return fallback;
+}
+
+}  // namespace
+
+task_pool::task_pool(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        queues_.push_back(std::make_unique<worker_queue>());
+    }
+    for (int i = 0; i < num_threads; i++) {
+        threads_.emplace_back(&task_pool::worker_loop, this, i);
+    }
+}
+
+task_pool::~task_pool() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+void task_pool::push(std::function<void()> task) {
+    size_t index = current_pool == this
+        ? current_index
+        : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    {
+        std::lock_guard<std::mutex> guard(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(sleep_mutex_);
+        pending_++;
+    }
+    wake_.notify_one();
+}
+
+bool task_pool::pop(int own_index, std::function<void()> &task) {
+    if (own_index >= 0) {
+        std::lock_guard<std::mutex> guard(queues_[own_index]->mutex);
+        if (false == queues_[own_index]->tasks.empty()) {
+            task = std::move(queues_[own_index]->tasks.back());
+            queues_[own_index]->tasks.pop_back();
+            pending_--;
+            return true;
+        }
+    }
+    const size_t start = own_index >= 0 ? own_index + 1 : next_queue_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < queues_.size(); i++) {
+        worker_queue &victim = *queues_[(start + i) % queues_.size()];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (false == victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pending_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool task_pool::try_run_one() {
+    if (pending_.load() <= 0) {
+        return false;
+    }
+    std::function<void()> task;
+    if (false == pop(current_pool == this ? current_index : -1, task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void task_pool::worker_loop(int index) {
+    current_pool = this;
+    current_index = index;
+    std::function<void()> task;
+    while (true) {
+        if (pop(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this]() { return stopping_ || pending_.load() > 0; });
+        if (stopping_ && pending_.load() <= 0) {
+            return;
+        }
+    }
+}
+
+executor& executor::get() {
+    static executor* instance = new executor(
+        threads_from_env(IO_THREADS_ENV, DEFAULT_IO_THREADS),
+        threads_from_env(CPU_THREADS_ENV, std::thread::hardware_concurrency()));
+    static std::once_flag collected;
+    std::call_once(collected, []() {
+        metrics().add_collector([](const metrics_registry::gauge_writer &write) {
+            for (pool_kind kind : {io_pool, cpu_pool}) {
+                const metric_labels labels = {{"pool", kind == io_pool ? "io" : "cpu"}};
+                write("quest_executor_queued_tasks", "Tasks waiting for an executor thread.",
+                    labels, instance->pool(kind).queued());
+                write("quest_executor_threads", "Executor threads.", labels, instance->pool(kind).num_threads());
+            }
+        });
+    });
+    return *instance;
+}
+
+executor::executor(int io_threads, int cpu_threads)
+: io_(io_threads), cpu_(cpu_threads) {}
+
+bool executor::help() {
+    // the caller's own pool first, so a worker keeps to its kind of work
+    if (current_pool == &cpu_) {
+        return cpu_.try_run_one() || io_.try_run_one();
+    }
+    return io_.try_run_one() || cpu_.try_run_one();
+}
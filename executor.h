@@ -0,0 +1,139 @@
+/*
+ * One process-wide executor for everything a query fans out.
+ *
+ * Queries used to build a BS::thread_pool per call and per batch, and to
+ * std::async a fresh OS thread for every object they read, so a long time
+ * range would start tens of thousands of threads.  Instead there are two
+ * long-lived pools: an I/O pool, large because its tasks mostly block on
+ * storage, and a CPU pool sized to the machine.  Their sizes are the global
+ * concurrency limits and can be set with QUEST_IO_THREADS and
+ * QUEST_CPU_THREADS.
+ *
+ * Each worker has its own deque.  Tasks submitted from a worker go on its
+ * deque and are run newest first; idle workers steal the oldest task of
+ * another.  Tasks submitted from outside the pool are dealt round-robin.
+ *
+ * Tasks here wait on tasks they submitted, so with a bounded pool a plain
+ * future.get() could leave every worker waiting on work none of them is
+ * free to run.  Use executor::wait(), which runs queued tasks until the
+ * future it is waiting on is ready.
+*/
+
+#ifndef EXECUTOR_H_ // NOLINT
+#define EXECUTOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "query_profile.h"
+
+const char IO_THREADS_ENV[] = "QUEST_IO_THREADS";
+const char CPU_THREADS_ENV[] = "QUEST_CPU_THREADS";
+const int DEFAULT_IO_THREADS = 256;
+
+enum pool_kind {
+    io_pool,
+    cpu_pool,
+};
+
+class task_pool {
+    public: // NOLINT
+        explicit task_pool(int num_threads);
+        ~task_pool();
+
+        void push(std::function<void()> task);
+        // Runs one queued task on the calling thread; false if there were none.
+        bool try_run_one();
+        int num_threads() const { return queues_.size(); }
+        // Tasks pushed and not yet started.
+        int64_t queued() const { return pending_.load(std::memory_order_relaxed); }
+
+    private: // NOLINT
+        struct worker_queue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        // Own deque from the back, then the others' from the front.
+        bool pop(int own_index, std::function<void()> &task);
+        void worker_loop(int index);
+
+        std::vector<std::unique_ptr<worker_queue>> queues_;
+        std::vector<std::thread> threads_;
+        std::atomic<uint64_t> next_queue_{0};
+        std::atomic<int64_t> pending_{0};
+        std::mutex sleep_mutex_;
+        std::condition_variable wake_;
+        bool stopping_ = false;
+};
+
+class executor {
+    public: // NOLINT
+        // Created on first use and never destroyed, so tasks still running
+        // at exit don't race static destructors.
+        static executor& get();
+
+        executor(int io_threads, int cpu_threads);
+
+        // Like std::async: f and args are copied, and f is called with the
+        // copies (use std::ref to pass a reference).  The task is profiled
+        // as part of whatever the submitting thread was profiling.
+        template <typename F, typename... Args>
+        auto submit(pool_kind kind, F &&f, Args&&... args)
+        -> std::future<std::invoke_result_t<std::decay_t<F>&, std::decay_t<Args>&...>> {
+            using result_type = std::invoke_result_t<std::decay_t<F>&, std::decay_t<Args>&...>;
+            auto task = std::make_shared<std::packaged_task<result_type()>>(
+                [f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...),
+                 context = current_profile_context()]() mutable {
+                    profile_scope scope(context);
+                    return std::apply(f, args);
+                });
+            std::future<result_type> result = task->get_future();
+            pool(kind).push([task]() { (*task)(); });
+            return result;
+        }
+
+        template <typename T>
+        T wait(std::future<T> &result) {
+            while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                if (false == help()) {
+                    result.wait_for(std::chrono::milliseconds(1));
+                }
+            }
+            return result.get();
+        }
+
+        // Waits for the ones not yet waited on; call before returning early
+        // while tasks still hold references to the caller's locals.
+        template <typename T>
+        void wait_all(std::vector<std::future<T>> &results) {
+            for (auto &result : results) {
+                if (result.valid()) {
+                    wait(result);
+                }
+            }
+        }
+
+        task_pool& pool(pool_kind kind) { return kind == io_pool ? io_ : cpu_; }
+
+    private: // NOLINT
+        // Runs one queued task from either pool.
+        bool help();
+
+        task_pool io_;
+        task_pool cpu_;
+};
+
+#endif  // EXECUTOR_H_ // NOLINT
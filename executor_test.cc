@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "async_io.h"
+#include "executor.h"
+
+namespace {
+
+int fan_out(executor &exec, int depth) {
+  if (depth == 0) {
+    return 1;
+  }
+  std::vector<std::future<int>> children;
+  for (int i = 0; i < 4; i++) {
+    children.push_back(exec.submit(io_pool, fan_out, std::ref(exec), depth - 1));
+  }
+  int total = 0;
+  for (auto &child : children) {
+    total += exec.wait(child);
+  }
+  return total;
+}
+
+}  // namespace
+
+TEST(Executor, ReturnsResultsAndPassesReferences) {
+  executor exec(2, 2);
+  std::string name = "batch";
+  auto length = exec.submit(cpu_pool, [](const std::string &s) { return s.size(); }, std::cref(name));
+  EXPECT_EQ(exec.wait(length), 5);
+
+  std::atomic<int> ran{0};
+  std::vector<std::future<void>> done;
+  for (int i = 0; i < 100; i++) {
+    done.push_back(exec.submit(io_pool, [&ran]() { ran++; }));
+  }
+  exec.wait_all(done);
+  EXPECT_EQ(ran.load(), 100);
+}
+
+TEST(Executor, NestedWaitsDoNotDeadlockASmallPool) {
+  // 4^4 leaves through tasks that each wait on their children, on two workers
+  executor exec(2, 1);
+  EXPECT_EQ(fan_out(exec, 4), 256);
+}
+
+TEST(CompletionGroup, WaitsForOperationsStartedByContinuations) {
+  std::atomic<int> leaves{0};
+  completion_group group;
+  std::function<void(int)> expand = [&](int depth) {
+    async_then(group, [depth]() { return depth; }, [&](int d) {
+      if (d == 0) {
+        leaves++;
+        return;
+      }
+      for (int i = 0; i < 3; i++) {
+        expand(d - 1);
+      }
+    });
+  };
+  expand(4);
+  group.wait();
+  EXPECT_EQ(leaves.load(), 81);
+}
+
+TEST(CompletionGroup, RethrowsFromWait) {
+  completion_group group;
+  async_then(group, []() { return 1; }, [](int) { throw std::runtime_error("bad object"); });
+  EXPECT_THROW(group.wait(), std::runtime_error);
+}
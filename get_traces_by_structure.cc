@@ -1,140 +1,108 @@
 #include "get_traces_by_structure.h"
+#include "metrics.h"
+#include "structure_catalog.h"
+#include "structure_manifest.h"
+#include "tree_matcher.h"
+
+const std::string& traces_by_structure::service_name(int iso_map_index, int node_index) const {
+    static const std::string none;
+    const std::unordered_map<int, int> &iso_map = shapes->iso_maps[iso_map_index];
+    auto trace_node = iso_map.find(node_index);
+    if (trace_node == iso_map.end()) {
+        return none;
+    }
+    const auto &names = shapes->trace_node_names[shapes->iso_map_to_trace_node_names[iso_map_index]];
+    auto name = names.find(trace_node->second);
+    return name == names.end() ? none : name->second;
+}
 
-StatusOr<traces_by_structure> get_traces_by_structure(
-    trace_structure query_trace, int start_time, int end_time, bool verbose, gcs::Client* client) {
-    boost::posix_time::ptime start, stop, start_retrieve_prefixes, start_get_batches;
-    start = boost::posix_time::microsec_clock::local_time();
-    BS::thread_pool pool(500);
-    stop = boost::posix_time::microsec_clock::local_time();
-    boost::posix_time::time_duration dur = stop - start;
-    print_update("Time to initialize thread pool: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
-
-    std::string prefix_to_search = std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
-
-    start_retrieve_prefixes = boost::posix_time::microsec_clock::local_time();
-
-    std::vector<std::future<StatusOr<potential_prefix_struct>>> future_potential_prefixes;
-    for (auto&& prefix : client->ListObjectsAndPrefixes(prefix_to_search, gcs::Delimiter("/"))) {
-        if (!prefix) {
-            std::cerr << "Error in getting prefixes" << std::endl;
-            return prefix.status();
-        }
-
-        auto result = *std::move(prefix);
-        if (false == absl::holds_alternative<std::string>(result)) {
-            std::cerr << "Error in getting prefixes" << std::endl;
-            return Status(
-                google::cloud::StatusCode::kUnavailable, "error while moving prefix in get_traces_by_structure");
+void append_traces_of_structure(const traces_by_structure &traces, int iso_map_offset, traces_by_structure* to) {
+    const int trace_id_offset = to->trace_ids.size();
+
+    // first the data itself; batches both have are kept once
+    to->trace_ids.insert(to->trace_ids.end(), traces.trace_ids.begin(), traces.trace_ids.end());
+    std::vector<int> object_name_indices;
+    for (const std::string &object_name : traces.object_names) {
+        auto found = std::find(to->object_names.begin(), to->object_names.end(), object_name);
+        object_name_indices.push_back(found - to->object_names.begin());
+        if (found == to->object_names.end()) {
+            to->object_names.push_back(object_name);
         }
-
-        // Get mapping from batch name to prefix and trace ID.
-        future_potential_prefixes.push_back(pool.submit(
-            get_potential_prefixes, absl::get<std::string>(result), client));
     }
-
-    // Now map from batch name to prefix and trace ID, so you can check
-    // exemplar validity using the same data.
-    std::unordered_map<std::string, std::vector<std::pair<std::string, std::string>>> batch_name_map;
-    for (int64_t i=0; i < future_potential_prefixes.size(); i++) {
-        StatusOr<potential_prefix_struct> p = future_potential_prefixes[i].get();
-        if (!p.ok()) { std::cerr << "can't get prefixes" << std::endl; return p.status(); }
-        batch_name_map[p->batch_name].push_back(std::make_pair(p->prefix, p->trace_id));
+    for (const iso_map_range &range : traces.iso_map_ranges) {
+        to->iso_map_ranges.push_back(iso_map_range{range.begin + iso_map_offset, range.end + iso_map_offset});
     }
-    stop = boost::posix_time::microsec_clock::local_time();
-    dur = stop - start_retrieve_prefixes;
-    print_update("Time to retrieve prefixes: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
-
-    start_get_batches = boost::posix_time::microsec_clock::local_time();
-    std::vector<std::string> all_object_names = get_batches_between_timestamps(client, start_time, end_time);
-    stop = boost::posix_time::microsec_clock::local_time();
-    dur = stop - start_get_batches;
-    print_update("Time to get batches between timestamps: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
-    std::vector<std::future<StatusOr<std::vector<traces_by_structure>>>> response_futures;
 
-    for (auto& [batch_name, prefix_and_trace_id] : batch_name_map) {
-        response_futures.push_back(pool.submit(
-            filter_by_query, batch_name, std::ref(prefix_and_trace_id),
-            query_trace, start_time, end_time, all_object_names, false, client));
+    // then the indices into it, by adding the offsets to everything
+    for (const auto &pair : traces.object_name_to_trace_ids_of_interest) {
+        std::vector<int> &trace_indices = to->object_name_to_trace_ids_of_interest[object_name_indices[pair.first]];
+        for (int trace_index : pair.second) {
+            trace_indices.push_back(trace_index + trace_id_offset);
+        }
     }
+    for (const auto &pair : traces.trace_id_to_index) {
+        to->trace_id_to_index[pair.first] = pair.second + trace_id_offset;
+    }
+}
 
-    traces_by_structure to_return;
-
-    for (int64_t i=0; i < response_futures.size(); i++) {
-        StatusOr<std::vector<traces_by_structure>> values_to_return = response_futures[i].get();
-        if (!values_to_return.ok()) {
-            std::cerr << "so sad for you, response futures are bad" << std::endl;
-            return values_to_return.status();
+merged_shapes merge_structure_shapes(const std::vector<matched_structure> &structures) {
+    auto shapes = std::make_shared<structure_shapes>();
+    merged_shapes to_return;
+    for (const matched_structure &structure : structures) {
+        to_return.iso_map_offsets.push_back(shapes->iso_maps.size());
+        if (structure.shape.shapes == nullptr) {
+            continue;
         }
-        for (auto ele : values_to_return.value()) {
-            merge_traces_by_struct(ele, &to_return);
+        const structure_shapes &added = *structure.shape.shapes;
+        const int trace_node_names_offset = shapes->trace_node_names.size();
+        shapes->iso_maps.insert(shapes->iso_maps.end(), added.iso_maps.begin(), added.iso_maps.end());
+        shapes->trace_node_names.insert(shapes->trace_node_names.end(),
+            added.trace_node_names.begin(), added.trace_node_names.end());
+        for (int names : added.iso_map_to_trace_node_names) {
+            shapes->iso_map_to_trace_node_names.push_back(names + trace_node_names_offset);
         }
     }
-    stop = boost::posix_time::microsec_clock::local_time();
-    dur = stop - start;
-    print_update("Time to go through structural filter: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
-
+    to_return.shapes = std::move(shapes);
     return to_return;
 }
 
-void merge_traces_by_struct(const traces_by_structure &new_trace_by_struct, traces_by_structure* old ) {
-    int trace_id_offset = old->trace_ids.size();
-    int iso_map_offset = old->iso_maps.size();
-
-    // first merge the vectors of the data itself
-    old->trace_ids.insert(old->trace_ids.end(),
-                                new_trace_by_struct.trace_ids.begin(),
-                                new_trace_by_struct.trace_ids.end());
-    old->object_names.insert(old->object_names.end(),
-                                    new_trace_by_struct.object_names.begin(),
-                                    new_trace_by_struct.object_names.end());
-    old->iso_maps.insert(old->iso_maps.end(),
-                                new_trace_by_struct.iso_maps.begin(),
-                                new_trace_by_struct.iso_maps.end());
-    old->trace_node_names.insert(old->trace_node_names.end(),
-                                        new_trace_by_struct.trace_node_names.begin(),
-                                        new_trace_by_struct.trace_node_names.end());
-
-    // now merge the pointers by adding the offsets to everything
-    for (const auto &pair : new_trace_by_struct.object_name_to_trace_ids_of_interest) {
-        auto object_name = pair.first;
-        for (uint64_t i=0; i < pair.second.size(); i++) {
-            old->object_name_to_trace_ids_of_interest[object_name].push_back(
-                pair.second[i] + trace_id_offset);
+std::set<std::string> mapped_services(const structure_shapes &shapes) {
+    std::set<std::string> services;
+    for (size_t i = 0; i < shapes.iso_maps.size(); i++) {
+        const auto &names = shapes.trace_node_names[shapes.iso_map_to_trace_node_names[i]];
+        for (auto &[query_node, trace_node] : shapes.iso_maps[i]) {
+            auto name = names.find(trace_node);
+            if (name != names.end()) {
+                services.insert(name->second);
+            }
         }
     }
+    return services;
+}
 
-    for (const auto &pair : new_trace_by_struct.trace_id_to_isomap_indices) {
-        std::vector<int> isomap_indices;
-        for (uint64_t i=0; i < pair.second.size(); i++) {
-            isomap_indices.push_back(pair.second[i] + iso_map_offset);
-        }
-        old->trace_id_to_isomap_indices[pair.first] = isomap_indices;
-    }
-
-    // then finally deal with trace node name stuff
-    if (new_trace_by_struct.trace_node_names.size() > 0) {
-        old->trace_node_names.push_back(new_trace_by_struct.trace_node_names[0]);
-        int tnn_index = old->trace_node_names.size()-1;
-        for (uint64_t i=iso_map_offset; i < old->iso_maps.size(); i++) {
-            old->iso_map_to_trace_node_names[i] = tnn_index;
+std::set<std::string> mapped_services(const std::vector<matched_structure> &structures) {
+    std::set<std::string> services;
+    for (const matched_structure &structure : structures) {
+        if (structure.shape.shapes != nullptr) {
+            std::set<std::string> mapped = mapped_services(*structure.shape.shapes);
+            services.insert(mapped.begin(), mapped.end());
         }
     }
+    return services;
 }
 
-StatusOr<std::string> get_examplar_from_prefix(std::string prefix, gcs::Client* client) {
+StatusOr<std::string> get_examplar_from_prefix(std::string prefix, storage_backend* client) {
     std::string prefix_to_search = std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
     std::string object_name = "";
 
-    for (auto&& object_metadata : client->ListObjects(prefix_to_search, gcs::Prefix(prefix), gcs::MaxResults(1))) {
-        if (!object_metadata) {
-            std::cerr << object_metadata.status().message() << std::endl;
-            return object_metadata.status();
-        }
-        object_name =  object_metadata->name();
-
-        // MaxResults param just limits the size of the page, we do not need
-        // to iterate over more data, so break...
-        break;
+    // we only need one object under the prefix
+    auto objects = client->list_objects(prefix_to_search, prefix, 1);
+    if (!objects.ok()) {
+        std::cerr << objects.status().message() << std::endl;
+        return objects.status();
+    }
+    for (auto& object_metadata : objects.value()) {
+        object_name = object_metadata.name;
     }
 
     auto response_trace_ids_or_status = get_trace_ids_from_trace_hashes_object(object_name, client);
@@ -145,15 +113,18 @@ StatusOr<std::string> get_examplar_from_prefix(std::string prefix, gcs::Client*
     auto response_trace_ids = response_trace_ids_or_status.value();
 
     std::string batch_name = extract_batch_name(object_name);
-    auto object_content_or_status = read_object(TRACE_STRUCT_BUCKET_PREFIX+std::string(BUCKETS_SUFFIX),
-        batch_name, client);
-    if (!object_content_or_status.ok()) {
+    auto structural_object_or_status = read_structural_object(batch_name, client);
+    if (!structural_object_or_status.ok()) {
         return Status(google::cloud::StatusCode::kUnavailable, "could not get examplar");
     }
 
-    auto object_content = object_content_or_status.value();
-    std::string trace = extract_any_trace(response_trace_ids, object_content);
-    return trace;
+    for (auto &trace_id : response_trace_ids) {
+        std::string trace = structural_object_or_status.value()->trace(trace_id);
+        if (trace != "") {
+            return trace;
+        }
+    }
+    return std::string("");
 }
 
 /**
@@ -162,92 +133,55 @@ StatusOr<std::string> get_examplar_from_prefix(std::string prefix, gcs::Client*
 StatusOr<bool> check_examplar_validity(
     std::string examplar, trace_structure query_trace, traces_by_structure& to_return) {
     trace_structure candidate_trace = morph_trace_object_to_trace_structure(examplar);
+    return check_shape_validity(candidate_trace, query_trace, to_return);
+}
 
+bool check_shape_validity(
+    trace_structure candidate_trace, trace_structure query_trace, traces_by_structure& to_return) {
     auto iso_mappings = get_isomorphism_mappings(candidate_trace, query_trace);
     if (iso_mappings.size() < 1) {
         return false;
     }
 
-    // Store Isomaps
-    to_return.iso_maps = iso_mappings;
-
-    // Store Node Names
-    std::vector<std::unordered_map<int, std::string>> nn;
-    nn.push_back(candidate_trace.node_names);
-    to_return.trace_node_names = nn;
-
+    auto shapes = std::make_shared<structure_shapes>();
+    shapes->iso_map_to_trace_node_names.assign(iso_mappings.size(), 0);
+    shapes->iso_maps = std::move(iso_mappings);
+    shapes->trace_node_names.push_back(candidate_trace.node_names);
+    to_return.shapes = std::move(shapes);
     return true;
 }
 
-Status get_traces_by_structure_data(
-    gcs::Client* client,
-    std::string prefix,
-    std::string batch_name,
-    std::string root_service_name,
-    time_t start_time, time_t end_time,
-    traces_by_structure& to_return
-) {
-    auto hashes_bucket_object_name = prefix + batch_name;
-
-    if (false == is_object_within_timespan(extract_batch_timestamps(batch_name), start_time, end_time)) {
-        return Status();
+void append_traces_by_structure_data(
+    const std::string &batch_name, const std::vector<trace_id_t> &trace_ids, traces_by_structure& to_return) {
+    if (trace_ids.empty()) {
+        return;
     }
-
-    auto response_trace_ids_or_status = get_trace_ids_from_trace_hashes_object(hashes_bucket_object_name, client);
-
-    if (!response_trace_ids_or_status.ok()) {
-        return Status(
-            google::cloud::StatusCode::kUnavailable,
-            "error in get_traces_by_structure_data: get_trace_ids_from_trace_hashes_object");
-    }
-
-    auto response_trace_ids = response_trace_ids_or_status.value();
-    if (response_trace_ids.size() < 1) {
-        return Status();
-    }
-
-    auto trace_ids_to_append = response_trace_ids;
-
-    if (object_could_have_out_of_bound_traces(extract_batch_timestamps(batch_name), start_time, end_time)) {
-        auto trace_ids_to_append_or_status = filter_trace_ids_based_on_query_timestamp_for_given_root_service(
-            response_trace_ids, batch_name, start_time, end_time, root_service_name, client);
-        if (!trace_ids_to_append_or_status.ok()) {
-            return trace_ids_to_append_or_status.status();
-        }
-        trace_ids_to_append = trace_ids_to_append_or_status.value();
-    }
-
     int trace_id_offset = to_return.trace_ids.size();
-    to_return.trace_ids.insert(to_return.trace_ids.end(),
-        trace_ids_to_append.begin(), trace_ids_to_append.end());
+    to_return.trace_ids.insert(to_return.trace_ids.end(), trace_ids.begin(), trace_ids.end());
 
     to_return.object_names.push_back(batch_name);
     int batch_name_index = to_return.object_names.size()-1;
+    std::vector<int> &trace_indices = to_return.object_name_to_trace_ids_of_interest[batch_name_index];
     for (uint64_t i=trace_id_offset; i < to_return.trace_ids.size(); i++) {
-        for (uint64_t j=0; j < to_return.iso_maps.size(); j++) {
-            to_return.trace_id_to_isomap_indices[to_return.trace_ids[i]].push_back(j);
-        }
-        to_return.object_name_to_trace_ids_of_interest[batch_name_index].push_back(i);
+        to_return.iso_map_ranges.push_back(iso_map_range{0, to_return.num_iso_maps()});
+        to_return.trace_id_to_index[to_return.trace_ids[i]] = i;
+        trace_indices.push_back(i);
     }
-
-    return Status();
 }
 
 StatusOr<potential_prefix_struct> get_potential_prefixes(
-    std::string prefix, gcs::Client* client) {
+    std::string prefix, storage_backend* client) {
     std::string prefix_to_search = std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
     std::string object_name = "";
 
-    for (auto&& object_metadata : client->ListObjects(prefix_to_search, gcs::Prefix(prefix), gcs::MaxResults(1))) {
-        if (!object_metadata) {
-            std::cerr << object_metadata.status().message() << std::endl;
-            return object_metadata.status();
-        }
-        object_name =  object_metadata->name();
-
-        // MaxResults param just limits the size of the page, we do not need
-        // to iterate over more data, so break...
-        break;
+    // we only need one object under the prefix
+    auto objects = client->list_objects(prefix_to_search, prefix, 1);
+    if (!objects.ok()) {
+        std::cerr << objects.status().message() << std::endl;
+        return objects.status();
+    }
+    for (auto& object_metadata : objects.value()) {
+        object_name = object_metadata.name;
     }
 
     StatusOr<std::string> trace_id = get_single_trace_id_from_trace_hashes_object(object_name, client);
@@ -255,92 +189,193 @@ StatusOr<potential_prefix_struct> get_potential_prefixes(
         std::cerr << "could not get single race ID from hashes object" << std::endl;
         return trace_id.status();
     }
+    // an empty or malformed object leaves this zero, which no structural object has
+    trace_id_t parsed_trace_id;
+    trace_id_t::from_hex(trace_id.value(), parsed_trace_id);
 
     return potential_prefix_struct {
         .prefix = prefix,
         .batch_name = extract_batch_name(object_name),
-        .trace_id = trace_id.value(),
+        .trace_id = parsed_trace_id,
     };
 }
 
-StatusOr<traces_by_structure> filter_prefix_by_query(std::string &batch_name, std::string &prefix,
-    std::string &trace_id,
-    std::string &object_content, trace_structure &query_trace, int start_time, int end_time,
-    const std::vector<std::string> &all_object_names, bool verbose, gcs::Client* client) {
-    traces_by_structure cur_traces_by_structure;
-    std::string trace = extract_trace_from_traces_object(trace_id, object_content);
-    if (trace == "") {
-        std::cerr << "problematic" << std::endl;
-        return Status();  // TODO(jessberg): what is error code
-    }
-    auto valid = check_examplar_validity(trace, query_trace, cur_traces_by_structure);
-    if (!valid.ok()) {
-        return valid.status();
+StatusOr<std::vector<matched_structure>> match_structures_in_batch(const std::string &batch_name,
+    const std::vector<std::pair<std::string, trace_id_t>> &prefix_to_trace_ids,
+    trace_structure &query_trace, storage_backend* client) {
+    StatusOr<std::shared_ptr<const structural_object>> traces_object;
+    {
+        profile_scope fetching(exemplar_fetch);
+        traces_object = read_structural_object(batch_name, client);
+        if (!traces_object.ok()) {
+            return Status(google::cloud::StatusCode::kUnavailable, "could not get examplar");
+        }
     }
 
-    if (!valid.value()) {
-        traces_by_structure empty;
-        return empty;
+    profile_scope matching(structural_matching);
+    std::vector<matched_structure> matched;
+    for (auto &[prefix, trace_id] : prefix_to_trace_ids) {
+        std::string trace = traces_object.value()->trace(trace_id);
+        if (trace == "") {
+            std::cerr << "problematic" << std::endl;
+            continue;
+        }
+        matched_structure structure;
+        auto valid = check_examplar_validity(trace, query_trace, structure.shape);
+        if (!valid.ok()) {
+            return valid.status();
+        }
+        if (false == valid.value()) {
+            continue;
+        }
+        structure.prefix = prefix;
+        structure.root_service_name = get_root_service_name(trace);
+        matched.push_back(std::move(structure));
     }
+    profile_items(prefix_to_trace_ids.size(), matched.size());
+    return matched;
+}
 
-    auto root_service_name = get_root_service_name(trace);
-    for (auto batch_name : all_object_names) {
-        auto status = get_traces_by_structure_data(
-            client, prefix, batch_name,
-            root_service_name, start_time, end_time, cur_traces_by_structure);
+StatusOr<std::vector<traces_by_structure>> read_traces_of_structures(
+    const std::vector<matched_structure> &structures, const std::vector<std::string> &batch_names,
+    int start_time, int end_time, storage_backend* client) {
+    // Everything is read at once.  A batch that straddles the range needs a
+    // second read, of the root service's spans, to drop the traces outside it.
+    std::vector<std::vector<StatusOr<std::vector<trace_id_t>>>> found(structures.size());
+    completion_group group;
+    for (uint64_t i=0; i < structures.size(); i++) {
+        const matched_structure &structure = structures[i];
+        found[i].assign(batch_names.size(), std::vector<trace_id_t>());
+        for (uint64_t j=0; j < batch_names.size(); j++) {
+            const std::string &batch_name = batch_names[j];
+            if (false == is_object_within_timespan(extract_batch_timestamps(batch_name), start_time, end_time)) {
+                continue;
+            }
+            if (structure.batches_known && false == std::binary_search(
+                    structure.batch_names.begin(), structure.batch_names.end(), batch_name)) {
+                continue;
+            }
+            async_then(group, [prefix = structure.prefix, batch_name, client]() {
+                return get_trace_ids_of_structure_in_batch(prefix, batch_name, client);
+            }, [&, i, j, batch_name](StatusOr<std::vector<trace_id_t>> trace_ids) {
+                if (!trace_ids.ok()) {
+                    found[i][j] = Status(google::cloud::StatusCode::kUnavailable,
+                        "error in read_traces_of_structures: get_trace_ids_of_structure_in_batch");
+                    return;
+                }
+                if (trace_ids->empty() || false == object_could_have_out_of_bound_traces(
+                        extract_batch_timestamps(batch_name), start_time, end_time)) {
+                    found[i][j] = std::move(trace_ids);
+                    return;
+                }
+                async_then(group, [ids = std::move(trace_ids.value()), batch_name = batch_name,
+                    root_service_name = structures[i].root_service_name, start_time, end_time, client]() mutable {
+                    return filter_trace_ids_based_on_query_timestamp_for_given_root_service(
+                        ids, batch_name, start_time, end_time, root_service_name, client);
+                }, [&found, i, j](StatusOr<std::vector<trace_id_t>> in_range) {
+                    found[i][j] = std::move(in_range);
+                });
+            });
+        }
+    }
+    group.wait();
 
-        if (!status.ok()) {
-            return status;
+    std::vector<traces_by_structure> to_return;
+    to_return.reserve(structures.size());
+    for (uint64_t i=0; i < structures.size(); i++) {
+        traces_by_structure traces = structures[i].shape;
+        for (uint64_t j=0; j < batch_names.size(); j++) {
+            if (!found[i][j].ok()) {
+                return found[i][j].status();
+            }
+            append_traces_by_structure_data(batch_names[j], found[i][j].value(), traces);
         }
+        to_return.push_back(std::move(traces));
     }
-    return cur_traces_by_structure;
+    return to_return;
 }
 
-StatusOr<std::vector<traces_by_structure>> filter_by_query(std::string batch_name,
-    std::vector<std::pair<std::string, std::string>> &prefix_to_trace_ids,
-    trace_structure query_trace, int start_time, int end_time,
-    const std::vector<std::string>& all_object_names, bool verbose, gcs::Client* client) {
+StatusOr<std::unordered_map<std::string, std::vector<std::pair<std::string, trace_id_t>>>> get_exemplars_by_batch(
+    bool verbose, storage_backend* client) {
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+    std::string prefix_to_search = std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
 
-    boost::posix_time::ptime start, stop;
-    boost::posix_time::time_duration dur;
+    std::vector<std::future<StatusOr<potential_prefix_struct>>> future_potential_prefixes;
+    StatusOr<std::vector<std::string>> prefixes;
+    {
+        profile_scope listing(prefix_listing);
+        prefixes = client->list_prefixes(prefix_to_search, "/");
+        if (!prefixes.ok()) {
+            std::cerr << "Error in getting prefixes" << std::endl;
+            return prefixes.status();
+        }
+        profile_items(0, prefixes->size());
+    }
+    profile_scope fetching(exemplar_fetch);
+    for (auto& prefix : prefixes.value()) {
+        // Get mapping from batch name to prefix and trace ID.
+        future_potential_prefixes.push_back(executor::get().submit(
+            io_pool, get_potential_prefixes, prefix, client));
+    }
 
-    start = boost::posix_time::microsec_clock::local_time();
-    std::vector<traces_by_structure> to_return;
-    auto object_content_or_status = read_object(TRACE_STRUCT_BUCKET_PREFIX+std::string(BUCKETS_SUFFIX),
-        batch_name, client);
-    if (!object_content_or_status.ok()) {
-        return Status(google::cloud::StatusCode::kUnavailable, "could not get examplar");
+    // Now map from batch name to prefix and trace ID, so you can check
+    // exemplar validity using the same data.
+    std::unordered_map<std::string, std::vector<std::pair<std::string, trace_id_t>>> batch_name_map;
+    for (int64_t i=0; i < future_potential_prefixes.size(); i++) {
+        StatusOr<potential_prefix_struct> p = executor::get().wait(future_potential_prefixes[i]);
+        if (!p.ok()) { std::cerr << "can't get prefixes" << std::endl; return p.status(); }
+        batch_name_map[p->batch_name].push_back(std::make_pair(p->prefix, p->trace_id));
     }
-    stop = boost::posix_time::microsec_clock::local_time();
-    dur = stop - start;
-    print_update("Time to retrieve object: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
-    BS::thread_pool pool(5);  // TODO(jessberg): what is optimum val here?
-
-    auto object_content = object_content_or_status.value();
-    std::vector<std::future<StatusOr<traces_by_structure>>> future_traces_by_structure;
-    for (int64_t i=0; i < prefix_to_trace_ids.size(); i++) {
-        future_traces_by_structure.push_back(pool.submit(filter_prefix_by_query,
-            std::ref(batch_name), std::ref(std::get<0>(prefix_to_trace_ids[i])),
-            std::ref(std::get<1>(prefix_to_trace_ids[i])), std::ref(object_content),
-            std::ref(query_trace), start_time, end_time,
-            all_object_names, verbose, client));
-    }
-    StatusOr<traces_by_structure> cur_traces_by_structure;
-    for (int64_t i=0; i < future_traces_by_structure.size(); i++) {
-        auto cur_traces_by_structure = future_traces_by_structure[i].get();
-        if (!cur_traces_by_structure.ok()) {
-            std::cerr << "oh no!" << std::endl;
+    profile_items(prefixes->size(), future_potential_prefixes.size());
+    boost::posix_time::time_duration dur = boost::posix_time::microsec_clock::local_time() - start;
+    print_update("Time to retrieve prefixes: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
+    return batch_name_map;
+}
+
+StatusOr<std::vector<matched_structure>> get_structures_matching_query(
+    trace_structure query_trace, int end_time, bool verbose, storage_backend* client) {
+    if (structure_catalog_enabled()) {
+        StatusOr<std::shared_ptr<const structure_catalog>> catalog;
+        {
+            // the catalog stands in for listing tracehashes
+            profile_scope listing(prefix_listing);
+            catalog = read_structure_catalog(client);
+        }
+        if (catalog.ok() && catalog.value()->covered_until >= end_time) {
+            profile_scope matching(structural_matching);
+            auto matched = get_structures_matching_query_from_catalog(*catalog.value(), query_trace);
+            profile_items(catalog.value()->structures.size(), matched.size());
+            return matched;
         }
+        print_update("Structure catalog missing or behind the query, listing tracehashes\n", verbose);
+    }
 
-        to_return.push_back(cur_traces_by_structure.value());
+    auto batch_name_map = get_exemplars_by_batch(verbose, client);
+    if (!batch_name_map.ok()) {
+        return batch_name_map.status();
+    }
+    std::vector<std::future<StatusOr<std::vector<matched_structure>>>> per_batch;
+    for (auto& [batch_name, prefix_and_trace_id] : batch_name_map.value()) {
+        per_batch.push_back(executor::get().submit(
+            io_pool, match_structures_in_batch, batch_name, std::cref(prefix_and_trace_id),
+            std::ref(query_trace), client));
+    }
+    std::vector<matched_structure> to_return;
+    for (uint64_t i=0; i < per_batch.size(); i++) {
+        auto matched = executor::get().wait(per_batch[i]);
+        if (!matched.ok()) {
+            executor::get().wait_all(per_batch);
+            return matched.status();
+        }
+        for (auto &structure : matched.value()) {
+            to_return.push_back(std::move(structure));
+        }
     }
-    stop = boost::posix_time::microsec_clock::local_time();
-    dur = stop - start;
-    print_update("Time to filter by query: " + std::to_string(dur.total_milliseconds()) + "\n", verbose);
+    std::sort(to_return.begin(), to_return.end(),
+        [](const matched_structure &a, const matched_structure &b) { return a.prefix < b.prefix; });
     return to_return;
 }
 
-
 std::string get_root_service_name(const std::string &trace) {
     for (const std::string& line : split_by_string(trace, newline)) {
         if (line.substr(0, 1) == ":") {
@@ -350,22 +385,22 @@ std::string get_root_service_name(const std::string &trace) {
     return "";
 }
 
-StatusOr<std::vector<std::string>> filter_trace_ids_based_on_query_timestamp_for_given_root_service(
-    std::vector<std::string> &trace_ids,
+StatusOr<std::vector<trace_id_t>> filter_trace_ids_based_on_query_timestamp_for_given_root_service(
+    std::vector<trace_id_t> &trace_ids,
     std::string &batch_name,
     const int start_time,
     const int end_time,
     std::string &root_service_name,
-    gcs::Client* client) {
-    std::vector<std::string> response;
+    storage_backend* client) {
+    std::vector<trace_id_t> response;
 
     auto spans_data = read_object(root_service_name + std::string(BUCKETS_SUFFIX), batch_name, client);
     if (!spans_data.ok()) {
         return spans_data.status();
     }
 
-    std::map<std::string, std::pair<int, int>> trace_id_to_timestamp_map = get_timestamp_map_for_trace_ids(
-        spans_data.value(), trace_ids);
+    std::unordered_map<trace_id_t, std::pair<int, int>> trace_id_to_timestamp_map = get_timestamp_map_for_trace_ids(
+        spans_data.value());
 
     for (const auto& trace_id : trace_ids) {
         std::pair<int, int> trace_timestamp = trace_id_to_timestamp_map[trace_id];
@@ -388,7 +423,21 @@ StatusOr<std::vector<std::string>> filter_trace_ids_based_on_query_timestamp_for
  */
 std::vector<std::unordered_map<int, int>> get_isomorphism_mappings(
     trace_structure &candidate_trace, trace_structure &query_trace) {
+    static counter &tree_matches = metrics().get_counter(
+        "quest_structural_matches_total", "Structural matches run, by matcher.", {{"matcher", "tree"}});
+    static counter &vf2_matches = metrics().get_counter(
+        "quest_structural_matches_total", "Structural matches run, by matcher.", {{"matcher", "vf2"}});
+    std::vector<std::unordered_map<int, int>> isomorphism_maps;
+    if (tree_matcher_enabled() && get_tree_embeddings(candidate_trace, query_trace, isomorphism_maps)) {
+        tree_matches.add();
+        return isomorphism_maps;
+    }
+    vf2_matches.add();
+    return get_isomorphism_mappings_vf2(candidate_trace, query_trace);
+}
 
+std::vector<std::unordered_map<int, int>> get_isomorphism_mappings_vf2(
+    trace_structure &candidate_trace, trace_structure &query_trace) {
     graph_type candidate_graph = morph_trace_structure_to_boost_graph_type(candidate_trace);
     graph_type query_graph = morph_trace_structure_to_boost_graph_type(query_trace);
 
@@ -411,15 +460,16 @@ std::vector<std::unordered_map<int, int>> get_isomorphism_mappings(
 }
 
 StatusOr<std::string> get_single_trace_id_from_trace_hashes_object(
-    const std::string &object_name, gcs::Client* client) {
+    const std::string &object_name, storage_backend* client) {
 
-    auto reader = client->ReadObject(std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
-        object_name, gcs::ReadRange(0, TRACE_ID_LENGTH+1));
-    if (!reader) {
-        return reader.status();
+    auto object_content_or_status = read_object_range(
+        std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
+        object_name, 0, TRACE_ID_LENGTH+1, client);
+    if (!object_content_or_status.ok()) {
+        return object_content_or_status.status();
     }
 
-    std::string object_content{std::istreambuf_iterator<char>{reader}, {}};
+    std::string object_content = object_content_or_status.value();
 
     if (object_content == "") {
         return std::string("");
@@ -428,26 +478,42 @@ StatusOr<std::string> get_single_trace_id_from_trace_hashes_object(
     return object_content;
 }
 
-StatusOr<std::vector<std::string>> get_trace_ids_from_trace_hashes_object(
-    const std::string &object_name, gcs::Client* client) {
+StatusOr<std::vector<trace_id_t>> get_trace_ids_of_structure_in_batch(
+    const std::string &prefix, const std::string &batch_name, storage_backend* client) {
+    if (structure_manifests_enabled()) {
+        auto manifest = read_structure_manifest(batch_name, client);
+        if (manifest.ok()) {
+            std::vector<trace_id_t> trace_ids = manifest.value()->trace_ids(prefix);
+            // the structure's tracehashes object may have been written after the manifest
+            if (false == trace_ids.empty()) {
+                return trace_ids;
+            }
+        }
+    }
+    return get_trace_ids_from_trace_hashes_object(prefix + batch_name, client);
+}
+
+StatusOr<std::vector<trace_id_t>> get_trace_ids_from_trace_hashes_object(
+    const std::string &object_name, storage_backend* client) {
     auto object_content = read_object(
         std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
         object_name, client);
     if (!object_content.ok()) {
         if (object_content.status().code() == google::cloud::StatusCode::kNotFound) {
-            std::vector<std::string> res;
+            std::vector<trace_id_t> res;
             return res;
         }
         return object_content.status();
     }
 
     if (object_content.value() == "") {
-        return std::vector<std::string>();
+        return std::vector<trace_id_t>();
     }
-    std::vector<std::string> response;
+    std::vector<trace_id_t> response;
     for (auto curr_trace_id : split_by_string(object_content.value(), newline)) {
-        if (curr_trace_id != "") {
-            response.push_back(curr_trace_id);
+        trace_id_t parsed_trace_id;
+        if (trace_id_t::from_hex(curr_trace_id, parsed_trace_id)) {
+            response.push_back(parsed_trace_id);
         }
     }
     return response;
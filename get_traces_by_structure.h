@@ -5,8 +5,11 @@
 #include <unordered_map>
 #include <utility>
 #include <map>
+#include <set>
+#include <memory>
 #include <string>
 #include <vector>
+#include "async_io.h"
 #include "common.h"
 
 const char ASTERISK_SERVICE[] = "NONE";
@@ -14,17 +17,46 @@ const char ASTERISK_SERVICE[] = "NONE";
 using ::google::cloud::StatusOr;
 namespace bg = boost::graph;
 
+/*
+ * The structures a query matched: every way the query maps onto each of
+ * them, and their service names.  Never changed once built, so one snapshot
+ * is shared by the traces_by_structure of every batch instead of copied.
+*/
+struct structure_shapes {
+    std::vector<std::unordered_map<int, int>> iso_maps;
+    std::vector<std::unordered_map<int, std::string>> trace_node_names;
+    // per iso map, the trace_node_names of the structure it maps onto
+    std::vector<int> iso_map_to_trace_node_names;
+};
+
+// Iso map indices [begin, end).
+struct iso_map_range {
+    int begin = 0;
+    int end = 0;
+};
+
 class traces_by_structure {
     public: // NOLINT - I don't understand why lint is complaining
         // values
-        std::vector<std::string> trace_ids;
+        std::vector<trace_id_t> trace_ids;
         std::vector<std::string> object_names;
-        std::vector<std::unordered_map<int, int>> iso_maps;
-        std::vector<std::unordered_map<int, std::string>> trace_node_names;
+        std::shared_ptr<const structure_shapes> shapes;
+        // per trace ID, the iso maps it matches through; a trace matches all
+        // the iso maps of its structure, which are next to each other
+        std::vector<iso_map_range> iso_map_ranges;
         // maps
-        std::map<int, int> iso_map_to_trace_node_names;
         std::map<int, std::vector<int>> object_name_to_trace_ids_of_interest;
-        std::map<std::string, std::vector<int>> trace_id_to_isomap_indices;
+        std::unordered_map<trace_id_t, int> trace_id_to_index;
+
+        int num_iso_maps() const { return shapes == nullptr ? 0 : shapes->iso_maps.size(); }
+        // Empty for trace IDs that aren't here.
+        iso_map_range iso_maps_of(const trace_id_t &trace_id) const {
+            auto found = trace_id_to_index.find(trace_id);
+            return found == trace_id_to_index.end() ? iso_map_range() : iso_map_ranges[found->second];
+        }
+        // The service of the trace node that node_index of the query maps to,
+        // empty if the iso map doesn't have it.
+        const std::string& service_name(int iso_map_index, int node_index) const;
 };
 
 struct trace_structure {
@@ -36,12 +68,19 @@ struct trace_structure {
 struct potential_prefix_struct {
     std::string prefix;
     std::string batch_name;
-    std::string trace_id;
+    trace_id_t trace_id;
 };
 
-// This is the highest level function
-StatusOr<traces_by_structure> get_traces_by_structure(
-    trace_structure query_trace, int start_time, int end_time, bool verbose, gcs::Client* client);
+// A stored structure the query matches, before any of its traces are read.
+struct matched_structure {
+    std::string prefix;             // "<hash>/" in tracehashes
+    std::string root_service_name;
+    traces_by_structure shape;      // shapes only
+    // The batches it occurs in, sorted, when they are known (from the
+    // structure catalog); otherwise every batch is read.
+    bool batches_known = false;
+    std::vector<std::string> batch_names;
+};
 
 template < typename PropertyMapFirst, typename PropertyMapSecond >
 struct property_map_equivalent_custom {
@@ -116,30 +155,68 @@ struct vf2_callback_custom {
 };
 
 std::string get_root_service_name(const std::string &trace);
-StatusOr<std::vector<std::string>> filter_trace_ids_based_on_query_timestamp_for_given_root_service(
-    std::vector<std::string> &trace_ids,
+StatusOr<std::vector<trace_id_t>> filter_trace_ids_based_on_query_timestamp_for_given_root_service(
+    std::vector<trace_id_t> &trace_ids,
     std::string &batch_name,
     int start_time,
     int end_time,
     std::string &root_service_name,
-    gcs::Client* client);
+    storage_backend* client);
 std::vector<std::unordered_map<int, int>> get_isomorphism_mappings(
     trace_structure &candidate_trace, trace_structure &query_trace);
+// Always boost::vf2_subgraph_iso(), whatever tree_matcher_enabled() says.
+std::vector<std::unordered_map<int, int>> get_isomorphism_mappings_vf2(
+    trace_structure &candidate_trace, trace_structure &query_trace);
 StatusOr<traces_by_structure> process_trace_hashes_prefix_and_retrieve_relevant_trace_ids(
     std::string prefix, trace_structure query_trace, int start_time, int end_time,
-    const std::vector<std::string>& all_object_names, gcs::Client* client);
+    const std::vector<std::string>& all_object_names, storage_backend* client);
 trace_structure morph_trace_object_to_trace_structure(std::string &trace);
 graph_type morph_trace_structure_to_boost_graph_type(trace_structure &input_graph);
-StatusOr<std::vector<std::string>> get_trace_ids_from_trace_hashes_object(
-    const std::string &object_name, gcs::Client* client);
+StatusOr<std::vector<trace_id_t>> get_trace_ids_from_trace_hashes_object(
+    const std::string &object_name, storage_backend* client);
+// From the batch's manifest when QUEST_STRUCTURE_MANIFESTS is set and it lists the structure, else from
+// tracehashes.
+StatusOr<std::vector<trace_id_t>> get_trace_ids_of_structure_in_batch(
+    const std::string &prefix, const std::string &batch_name, storage_backend* client);
 StatusOr<std::string> get_single_trace_id_from_trace_hashes_object(
-    const std::string &object_name, gcs::Client* client);
+    const std::string &object_name, storage_backend* client);
 void print_trace_structure(trace_structure trace);
 StatusOr<potential_prefix_struct> get_potential_prefixes(
-    std::string prefix, gcs::Client* client);
-void merge_traces_by_struct(const traces_by_structure &new_trace_by_struct, traces_by_structure* old);
-StatusOr<std::vector<traces_by_structure>> filter_by_query(std::string batch_name,
-    std::vector<std::pair<std::string, std::string>> &prefix_to_trace_ids,
-    trace_structure query_trace, int start_time, int end_time,
-    const std::vector<std::string>& all_object_names, bool verbose, gcs::Client* client);
+    std::string prefix, storage_backend* client);
+// Appends the traces of traces to to, whose shapes already hold traces' iso maps
+// from iso_map_offset on; the shapes aren't copied.
+void append_traces_of_structure(const traces_by_structure &traces, int iso_map_offset, traces_by_structure* to);
+// The shapes of all the structures in one snapshot; structures[i]'s iso maps
+// start at iso_map_offsets[i].
+struct merged_shapes {
+    std::shared_ptr<const structure_shapes> shapes;
+    std::vector<int> iso_map_offsets;
+};
+merged_shapes merge_structure_shapes(const std::vector<matched_structure> &structures);
+// The services the query's nodes map onto in these shapes: the only ones
+// whose span objects a query on them reads.
+std::set<std::string> mapped_services(const structure_shapes &shapes);
+std::set<std::string> mapped_services(const std::vector<matched_structure> &structures);
+StatusOr<std::string> get_examplar_from_prefix(std::string prefix, storage_backend* client);
+// Sets the shapes of to_return if the query matches the candidate's structure.
+bool check_shape_validity(
+    trace_structure candidate_trace, trace_structure query_trace, traces_by_structure& to_return);
+// Appends trace IDs found in batch_name to to_return, as matching every one of its iso_maps.
+// Does nothing if there are none.
+void append_traces_by_structure_data(
+    const std::string &batch_name, const std::vector<trace_id_t> &trace_ids, traces_by_structure& to_return);
+// The structures the query matches, from the catalog if it is enabled and covers end_time.
+StatusOr<std::vector<matched_structure>> get_structures_matching_query(
+    trace_structure query_trace, int end_time, bool verbose, storage_backend* client);
+// Batch name to the structures ("<hash>/") whose exemplar trace is in that batch, with the exemplar's ID.
+StatusOr<std::unordered_map<std::string, std::vector<std::pair<std::string, trace_id_t>>>> get_exemplars_by_batch(
+    bool verbose, storage_backend* client);
+// Which of the structures with exemplars in batch_name the query matches.
+StatusOr<std::vector<matched_structure>> match_structures_in_batch(const std::string &batch_name,
+    const std::vector<std::pair<std::string, trace_id_t>> &prefix_to_trace_ids,
+    trace_structure &query_trace, storage_backend* client);
+// Per structure, its traces in batch_names that fall in the time range.
+StatusOr<std::vector<traces_by_structure>> read_traces_of_structures(
+    const std::vector<matched_structure> &structures, const std::vector<std::string> &batch_names,
+    int start_time, int end_time, storage_backend* client);
 #endif  // BY_STRUCT_H_ // NOLINT
@@ -1,145 +1,1153 @@
 #include "graph_query.h"
 
+#include <algorithm>
+#include <limits>
+#include <queue>
+
+
+namespace {
+
+// One batch on its way through the query pipeline.
+struct batch_in_flight {
+    std::string batch_name;
+    traces_by_structure structures;      // the batch's traces whose structure matches
+    std::vector<trace_id_t> trace_ids;   // those that also satisfy the indexed conditions
+    fetched_data fetched;
+    std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> filtered;
+};
+
+// Starts workers threads that take items from in, pass them through f and
+// push what f returns onto out; the last of them to finish closes out.  If
+// out is closed under them, or the query is cancelled, they close in, so the
+// stages before stop too.
+template <typename In, typename Out, typename F>
+void start_stage(std::vector<std::thread> &threads, int workers,
+    bounded_queue<In> &in, bounded_queue<Out> &out, const query_cancellation &cancellation,
+    query_profile* profile, profile_stage stage, F f) {
+    auto remaining = std::make_shared<std::atomic<int>>(workers);
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back([&in, &out, &cancellation, profile, stage, f, remaining]() mutable {
+            while (std::optional<In> item = in.pop()) {
+                if (cancellation.cancelled()) {
+                    in.close();
+                    break;
+                }
+                std::optional<Out> result;
+                {
+                    profile_scope scope(profile, stage);
+                    result = f(std::move(item.value()));
+                }
+                if (result.has_value() && false == out.push(std::move(result.value()))) {
+                    in.close();
+                    break;
+                }
+            }
+            if (--(*remaining) == 0) {
+                out.close();
+            }
+        });
+    }
+}
+
+// Starts looking up every index the plan consults.  conditions must outlive the lookups.
+std::vector<std::future<StatusOr<objname_to_matching_trace_ids>>> start_index_lookups(
+    const query_plan &plan, const std::vector<query_condition> &conditions, int start_time, int end_time,
+    storage_backend* client, query_profile* profile) {
+    std::vector<std::future<StatusOr<objname_to_matching_trace_ids>>> lookups;
+    for (int i : plan.indexed_conditions) {
+        lookups.push_back(executor::get().submit(io_pool,
+            [start_time, end_time, condition = &conditions[i], type = plan.statistics[i].type, client, profile]() {
+                profile_scope scope(profile, index_traversal);
+                auto found = get_traces_by_indexed_condition(start_time, end_time, condition, type, client);
+                if (found.ok()) {
+                    // sorted here, in parallel with the structural filtering, so batches intersect by merging
+                    sort_index_result(found.value());
+                    int64_t trace_ids = 0;
+                    for (auto &batch : found.value()) {
+                        trace_ids += batch.second.size();
+                    }
+                    profile_items(0, trace_ids);
+                }
+                return found;
+            }));
+    }
+    return lookups;
+}
+
+// The results of the lookups that succeeded.
+std::vector<objname_to_matching_trace_ids> wait_for_index_lookups(
+    std::vector<std::future<StatusOr<objname_to_matching_trace_ids>>> &lookups) {
+    std::vector<objname_to_matching_trace_ids> index_results;
+    for (auto &index_result : lookups) {
+        auto res = executor::get().wait(index_result);
+        if (!res.ok()) {
+            std::cerr << "yooo" << std::endl;
+            std::cerr << res.status().message() << std::endl;
+        } else {
+            index_results.push_back(res.value());
+        }
+    }
+    return index_results;
+}
+
+// The batch's traces with one of the matching structures, pointing into
+// shapes, the merged shapes of all of them; nothing if there are none.
+std::optional<traces_by_structure> match_traces_in_batch(
+    const std::string &batch_name, const std::vector<matched_structure> &matching, const merged_shapes &shapes,
+    int start_time, int end_time, storage_backend* client) {
+    auto per_structure = read_traces_of_structures(matching, {batch_name}, start_time, end_time, client);
+    if (!per_structure.ok()) {
+        std::cerr << "Error in struct_results for " << batch_name << ":" << std::endl;
+        std::cerr << per_structure.status().message() << std::endl;
+        return std::nullopt;
+    }
+    traces_by_structure structures;
+    structures.shapes = shapes.shapes;
+    for (size_t i = 0; i < per_structure->size(); i++) {
+        append_traces_of_structure(per_structure.value()[i], shapes.iso_map_offsets[i], &structures);
+    }
+    profile_items(1, structures.trace_ids.size());
+    if (structures.trace_ids.empty()) {
+        return std::nullopt;
+    }
+    return structures;
+}
+
+// Feeds the batches to batch_names in time order, prefetching a little
+// ahead the span objects of the services that services() returns.
+void start_batch_discovery(std::vector<std::thread> &threads, std::vector<std::string> &all_object_names,
+    bounded_queue<std::string> &batch_names, const query_cancellation &cancellation, bool verbose,
+    const std::function<std::set<std::string>()> &services, storage_backend* client) {
+    threads.emplace_back([&all_object_names, &batch_names, &cancellation, verbose, &services, client]() {
+        std::sort(all_object_names.begin(), all_object_names.end(),
+            [](const std::string &a, const std::string &b) {
+                return extract_batch_timestamps(a).first < extract_batch_timestamps(b).first;
+            });
+        print_update("Batches in range: " + std::to_string(all_object_names.size()) + "\n", verbose);
+        // Prefetch only as far ahead as the pipeline can hold, so a query
+        // that stops early hasn't asked for the rest of the range.  The
+        // services are worked out once, not per batch.
+        const size_t prefetch_ahead = PIPELINE_QUEUE_CAPACITY * 2;
+        const std::set<std::string> services_to_prefetch = services();
+        prefetch_batches(std::vector<std::string>(all_object_names.begin(),
+            all_object_names.begin() + std::min(prefetch_ahead, all_object_names.size())),
+            services_to_prefetch, client);
+        for (size_t i = 0; i < all_object_names.size(); i++) {
+            if (cancellation.cancelled() || false == batch_names.push(all_object_names[i])) {
+                break;
+            }
+            if (i + prefetch_ahead < all_object_names.size()) {
+                prefetch_batches({all_object_names[i + prefetch_ahead]}, services_to_prefetch, client);
+            }
+        }
+        batch_names.close();
+    });
+}
+
+Status check_query(const trace_structure &query_trace, int start_time, int end_time,
+    const std::vector<query_condition> &conditions, const condition_expression &where) {
+    if (end_time < start_time) {
+        return Status(google::cloud::StatusCode::kInvalidArgument,
+            "end time is less than start time;  aborting query");
+    }
+    if (query_trace.num_nodes != query_trace.node_names.size()) {
+        return Status(google::cloud::StatusCode::kInvalidArgument,
+            "num nodes does not match number of node names given;  aborting query");
+    }
+    if (false == is_valid_expression(where, conditions.size())) {
+        return Status(google::cloud::StatusCode::kInvalidArgument,
+            "condition expression " + expression_to_string(where) + " does not match the conditions;  aborting query");
+    }
+    return Status();
+}
+
+}  // namespace
 
 std::vector<std::string> query(
     trace_structure query_trace, int start_time, int end_time,
-    std::vector<query_condition> conditions, return_value ret, bool verbose, gcs::Client* client) {
+    std::vector<query_condition> conditions, return_value ret, bool verbose, storage_backend* client,
+    size_t limit, query_profile *profile) {
+    std::vector<std::string> to_return;
+    Status status = query_streaming(query_trace, start_time, end_time, conditions, ret, verbose, client,
+        [&to_return](const std::string &result) {
+            to_return.push_back(result);
+            return true;
+        }, limit, nullptr, profile);
+    if (!status.ok()) {
+        std::cerr << status.message() << std::endl;
+        return {};
+    }
+    return to_return;
+}
+
+Status query_streaming(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, return_value ret, bool verbose, storage_backend* client,
+    const result_callback &on_result, size_t limit, query_cancellation *cancellation, query_profile *profile) {
+    const condition_expression where = all_conditions(conditions.size());
+    return query_streaming(query_trace, start_time, end_time, conditions, where, ret, verbose, client,
+        on_result, limit, cancellation, profile);
+}
+
+namespace {
+
+// For queries that don't rule batches out before reading their spans.
+struct keep_every_batch {
+    bool operator()(const batch_in_flight & /*batch*/, storage_backend* /*client*/) const { return false; }
+};
+
+// Runs the query's pipeline, with extract turning each batch that has
+// matches into what the batch contributes (its return values, say), and
+// deliver taking those as they come, until it returns false.  Batches skip
+// returns true for are dropped before any of their spans are read.  The
+// query has been checked already.
+template <typename Out, typename Extract, typename Deliver, typename Skip = keep_every_batch>
+Status run_query_pipeline(
+    const trace_structure &query_trace, int start_time, int end_time,
+    const std::vector<query_condition> &conditions, const condition_expression &where, const return_value &ret,
+    bool verbose, storage_backend* client, query_cancellation *cancellation, query_profile *profile,
+    Extract extract, Deliver deliver, Skip skip = Skip()) {
+    // parsed once here rather than per span
+    const compiled_conditions compiled = compile_conditions(conditions, where);
+    query_cancellation own_cancellation;
+    if (cancellation == nullptr) {
+        cancellation = &own_cancellation;
+    }
+    // Everything the query reads goes through the profiled backend, which
+    // charges it to the stage that asked.
+    std::unique_ptr<profiled_backend> profiled;
+    if (profile != nullptr) {
+        profiled = std::make_unique<profiled_backend>(client);
+        client = profiled.get();
+    }
+
+    // Batches flow through the stages below one at a time, connected by
+    // bounded queues, so the first results come back while later batches are
+    // still being listed and the query holds a few batches' data at a time
+    // rather than the whole range's.  Matching the query against stored
+    // structures and the index lookups are global, and start right away.
+    std::shared_future<StatusOr<std::vector<matched_structure>>> structures = executor::get().submit(
+        io_pool, [&query_trace, end_time, verbose, client, profile]() {
+            profile_scope scope(profile, structural_matching);
+            return get_structures_matching_query(query_trace, end_time, verbose, client);
+        }).share();
+
+    std::vector<std::string> all_object_names;
+    {
+        profile_scope scope(profile, batch_listing);
+        all_object_names = get_batches_between_timestamps(client, start_time, end_time);
+        profile_items(0, all_object_names.size());
+    }
+    query_plan plan;
+    {
+        profile_scope scope(profile, query_planning);
+        plan = make_query_plan(start_time, end_time, all_object_names.size(), conditions, client, &where);
+    }
+    print_update(explain_query_plan(plan, conditions), verbose);
+
+    std::vector<std::future<StatusOr<objname_to_matching_trace_ids>>> index_results_futures =
+        start_index_lookups(plan, conditions, start_time, end_time, client, profile);
+    std::vector<objname_to_matching_trace_ids> index_results;
+    std::once_flag index_results_retrieved;
+    auto retrieve_index_results = [&]() {
+        std::call_once(index_results_retrieved, [&]() {
+            index_results = wait_for_index_lookups(index_results_futures);
+        });
+    };
+
+    bounded_queue<std::string> batch_names(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<batch_in_flight> matched(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<batch_in_flight> intersected(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<batch_in_flight> fetched(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<batch_in_flight> evaluated(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<Out> results(PIPELINE_QUEUE_CAPACITY);
+    std::vector<std::thread> threads;
+
+    // (1) batch discovery
+    const std::function<std::set<std::string>()> matched_services = [&structures]() {
+        const StatusOr<std::vector<matched_structure>> &matching = structures.get();
+        return matching.ok() ? mapped_services(matching.value()) : std::set<std::string>();
+    };
+    start_batch_discovery(threads, all_object_names, batch_names, *cancellation, verbose, matched_services, client);
+
+    // (2) structural match: the batch's traces with a structure the query matches
+    merged_shapes all_shapes;
+    std::once_flag shapes_merged;
+    start_stage(threads, PIPELINE_STAGE_THREADS, batch_names, matched, *cancellation, profile, tracehash_reads,
+        [&](std::string batch_name) -> std::optional<batch_in_flight> {
+            const StatusOr<std::vector<matched_structure>> &matching = structures.get();
+            if (!matching.ok()) {
+                return std::nullopt;
+            }
+            if (plan.start == start_with_index) {
+                retrieve_index_results();
+                if (false == may_have_indexed_traces(batch_name, index_results, plan.earliest_last_updated)) {
+                    return std::nullopt;
+                }
+            }
+            // every batch's traces point into one snapshot of the matched shapes
+            std::call_once(shapes_merged, [&]() { all_shapes = merge_structure_shapes(matching.value()); });
+            std::optional<traces_by_structure> structures_in_batch = match_traces_in_batch(
+                batch_name, matching.value(), all_shapes, start_time, end_time, client);
+            if (false == structures_in_batch.has_value()) {
+                return std::nullopt;
+            }
+            batch_in_flight batch;
+            batch.batch_name = batch_name;
+            batch.structures = std::move(structures_in_batch.value());
+            return batch;
+        });
+
+    // (3) index intersection
+    start_stage(threads, PIPELINE_STAGE_THREADS, matched, intersected, *cancellation, profile, intersection,
+        [&](batch_in_flight batch) -> std::optional<batch_in_flight> {
+            retrieve_index_results();
+            batch.trace_ids = intersect_index_results_in_batch(
+                batch.batch_name, index_results, batch.structures, plan.earliest_last_updated);
+            profile_items(batch.structures.trace_ids.size(), batch.trace_ids.size());
+            if (batch.trace_ids.empty()) {
+                return std::nullopt;
+            }
+            return batch;
+        });
+
+    // (4) span fetch
+    start_stage(threads, PIPELINE_STAGE_THREADS, intersected, fetched, *cancellation, profile, span_fetch,
+        [&](batch_in_flight batch) -> std::optional<batch_in_flight> {
+            if (skip(batch, client)) {
+                return std::nullopt;
+            }
+            batch.fetched = fetch_data_per_batch(
+                batch.structures, batch.batch_name, batch.trace_ids, compiled, client);
+            profile_items(batch.trace_ids.size(), batch.trace_ids.size());
+            return batch;
+        });
+
+    // (5) predicate evaluation
+    start_stage(threads, PIPELINE_STAGE_THREADS, fetched, evaluated, *cancellation, profile, predicate_evaluation,
+        [&](batch_in_flight batch) -> std::optional<batch_in_flight> {
+            if (conditions.size()) {
+                batch.filtered = filter_batch_data_based_on_conditions(
+                    batch.trace_ids, batch.structures, compiled, batch.fetched, ret, plan.evaluation_order);
+            } else {
+                batch.filtered = std::make_tuple(
+                    batch.trace_ids, get_iso_map_to_span_id_info(batch.structures, ret.node_index, client));
+            }
+            profile_items(batch.trace_ids.size(), std::get<0>(batch.filtered).size());
+            if (std::get<0>(batch.filtered).empty()) {
+                return std::nullopt;
+            }
+            return batch;
+        });
+
+    // (6) return extraction
+    start_stage(threads, PIPELINE_STAGE_THREADS, evaluated, results, *cancellation, profile, return_extraction,
+        [&](batch_in_flight batch) -> std::optional<Out> {
+            return extract(batch, client);
+        });
+
+    // Stopping closes every queue, so stages blocked on one wake up and, on
+    // seeing the cancellation, drop the batches still queued.  Batches a
+    // stage is already working on finish before the threads are joined.
+    auto stop = [&]() {
+        cancellation->cancel();
+        batch_names.close();
+        matched.close();
+        intersected.close();
+        fetched.close();
+        evaluated.close();
+        results.close();
+    };
+    while (std::optional<Out> batch_results = results.pop()) {
+        if (cancellation->cancelled() || false == deliver(std::move(batch_results.value()))) {
+            stop();
+            break;
+        }
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    // lookups no batch got as far as waiting for still use conditions and client
+    executor::get().wait_all(index_results_futures);
+    if (profile != nullptr) {
+        profile->wall_ns = profile->elapsed_ns();
+    }
+
+    if (!structures.get().ok()) {
+        return structures.get().status();
+    }
+    return Status();
+}
+
+}  // namespace
+
+Status query_streaming(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, const condition_expression &where, return_value ret, bool verbose,
+    storage_backend* client, const result_callback &on_result, size_t limit, query_cancellation *cancellation,
+    query_profile *profile) {
     // clean input a little bit
-    std::vector<std::string> empty;
-    if (end_time < start_time) {
-        std::cerr << "end time is less than start time;  aborting query";
-        return empty;
+    Status valid = check_query(query_trace, start_time, end_time, conditions, where);
+    if (!valid.ok()) {
+        return valid;
     }
-    if (query_trace.num_nodes != query_trace.node_names.size()) {
-        std::cerr << "num nodes does not match number of node names given;  aborting query";
-        return empty;
+    size_t delivered = 0;
+    Status status = run_query_pipeline<std::vector<std::string>>(
+        query_trace, start_time, end_time, conditions, where, ret, verbose, client, cancellation, profile,
+        [&](batch_in_flight &batch, storage_backend* client) {
+            auto values = get_return_values_for_batch(batch.batch_name, batch.filtered, batch.structures,
+                batch.fetched, ret, query_trace, client);
+            profile_items(std::get<0>(batch.filtered).size(), values.size());
+            return values;
+        },
+        [&](std::vector<std::string> batch_results) {
+            for (auto &result : batch_results) {
+                delivered++;
+                if (false == on_result(result) || (limit != 0 && delivered >= limit)) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    if (profile != nullptr) {
+        profile->results = delivered;
     }
+    return status;
+}
 
-    // first, get all matches to indexed query conditions
-    // note that structural is always indexed
+StatusOr<grouped_aggregate> query_aggregate(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, return_value ret, const aggregate_spec &spec, bool verbose,
+    storage_backend* client, query_profile *profile, const condition_expression *where) {
+    const condition_expression all = all_conditions(conditions.size());
+    if (where == nullptr) {
+        where = &all;
+    }
+    Status valid = check_query(query_trace, start_time, end_time, conditions, *where);
+    if (!valid.ok()) {
+        return valid;
+    }
+    if (spec.value == aggregate_return_value && ret.type != int_value && ret.type != double_value) {
+        return Status(google::cloud::StatusCode::kInvalidArgument,
+            "only int and double return values can be aggregated;  aborting query");
+    }
+    // Partial aggregates are merged as batches finish, so the results
+    // themselves never leave their batch.
+    grouped_aggregate merged;
+    query_cancellation cancellation;
+    Status status = run_query_pipeline<grouped_aggregate>(
+        query_trace, start_time, end_time, conditions, *where, ret, verbose, client, &cancellation, profile,
+        [&](batch_in_flight &batch, storage_backend* client) {
+            grouped_aggregate partial = aggregate_batch(batch.batch_name, batch.filtered, batch.structures,
+                batch.fetched, ret, spec, query_trace, client);
+            profile_items(std::get<0>(batch.filtered).size(), partial.size());
+            return partial;
+        },
+        [&](grouped_aggregate partial) {
+            merge_grouped_aggregate(merged, partial);
+            return true;
+        });
+    if (!status.ok()) {
+        return status;
+    }
+    if (profile != nullptr) {
+        for (auto &group : merged) {
+            profile->results += group.second.count;
+        }
+    }
+    return merged;
+}
+
+StatusOr<std::vector<slow_trace>> query_top_k(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, return_value ret, size_t k, bool verbose,
+    storage_backend* client, query_profile *profile, const condition_expression *where,
+    bool skip_by_latency_summaries) {
+    const condition_expression all = all_conditions(conditions.size());
+    if (where == nullptr) {
+        where = &all;
+    }
+    Status valid = check_query(query_trace, start_time, end_time, conditions, *where);
+    if (!valid.ok()) {
+        return valid;
+    }
+    if (k == 0) {
+        return Status(google::cloud::StatusCode::kInvalidArgument, "k must be at least 1;  aborting query");
+    }
+    // The k slowest traces delivered so far, and their latencies; once there
+    // are k of them, the fastest one's latency is the threshold every batch
+    // has to reach to change the answer, which the workers read as it rises.
+    std::set<ranked_trace, decltype(&slower)> ranked(&slower);
+    std::map<trace_id_t, uint64_t> latency_of;
+    std::atomic<uint64_t> threshold_ns{0};
+    std::atomic<int> skipped{0};
+    query_cancellation cancellation;
+    Status status = run_query_pipeline<std::vector<ranked_trace>>(
+        query_trace, start_time, end_time, conditions, *where, ret, verbose, client, &cancellation, profile,
+        [&](batch_in_flight &batch, storage_backend* client) {
+            auto slowest = top_k_batch(batch.batch_name, batch.filtered, batch.structures, batch.fetched, ret, k,
+                threshold_ns.load(), query_trace, client);
+            profile_items(std::get<0>(batch.filtered).size(), slowest.size());
+            return slowest;
+        },
+        [&](std::vector<ranked_trace> slowest) {
+            for (ranked_trace &trace : slowest) {
+                auto known = latency_of.find(trace.trace_id);
+                if (known != latency_of.end()) {
+                    if (known->second >= trace.latency_ns) {
+                        continue;
+                    }
+                    ranked.erase(ranked_trace{trace.trace_id, known->second});
+                    known->second = trace.latency_ns;
+                } else {
+                    latency_of[trace.trace_id] = trace.latency_ns;
+                }
+                ranked.insert(trace);
+                if (ranked.size() > k) {
+                    latency_of.erase(std::prev(ranked.end())->trace_id);
+                    ranked.erase(std::prev(ranked.end()));
+                }
+            }
+            if (ranked.size() == k) {
+                threshold_ns = std::prev(ranked.end())->latency_ns;
+            }
+            return true;
+        },
+        [&](const batch_in_flight &batch, storage_backend* client) {
+            const uint64_t threshold = threshold_ns.load();
+            if (threshold == 0 || false == skip_by_latency_summaries) {
+                return false;
+            }
+            std::set<std::string> services;
+            for (const trace_id_t &trace_id : batch.trace_ids) {
+                const iso_map_range iso_maps = batch.structures.iso_maps_of(trace_id);
+                for (int iso_map_index = iso_maps.begin; iso_map_index < iso_maps.end; iso_map_index++) {
+                    services.insert(batch.structures.service_name(iso_map_index, ret.node_index));
+                }
+            }
+            if (may_have_spans_this_slow(batch.batch_name, services, threshold, client)) {
+                return false;
+            }
+            skipped++;
+            return true;
+        });
+    if (!status.ok()) {
+        return status;
+    }
+    print_update("Batches skipped by their latency summaries: " + std::to_string(skipped.load()) + "\n", verbose);
+    if (profile != nullptr) {
+        profile->results = ranked.size();
+    }
+    std::vector<slow_trace> slowest;
+    slowest.reserve(ranked.size());
+    for (const ranked_trace &trace : ranked) {
+        slowest.push_back({trace.trace_id.hex(), trace.latency_ns});
+    }
+    return slowest;
+}
 
-    std::future<StatusOr<traces_by_structure>> struct_filter_obj = std::async(std::launch::async,
-        get_traces_by_structure,
-        query_trace, start_time, end_time, verbose, client);
+namespace {
 
-    time_t earliest_last_updated = -1;
+// One of query_batch()'s queries while it runs.
+struct query_in_batch {
+    const batched_query* query = nullptr;
+    compiled_conditions compiled;
+    query_plan plan;
+    std::shared_future<StatusOr<std::vector<matched_structure>>> structures;
     std::vector<std::future<StatusOr<objname_to_matching_trace_ids>>> index_results_futures;
-    for (uint64_t i=0; i < conditions.size(); i++) {
-        auto indexed_or_status = is_indexed(&conditions[i], client);
-        if (!indexed_or_status.ok()) {
-            std::cerr << "Error in is_indexed:" << std::endl;
-            std::cerr << indexed_or_status.status().message() << std::endl;
+    std::vector<objname_to_matching_trace_ids> index_results;
+    std::once_flag index_results_retrieved;
+    merged_shapes all_shapes;
+    std::once_flag shapes_merged;
+    // Set once the query is invalid or has all the results it wants; later batches skip it.
+    std::atomic<bool> done{false};
+    batched_query_result result;
+};
+
+// A batch on its way through query_batch()'s pipeline: query index to the
+// batch as that query sees it, for the queries with traces in it.
+struct shared_batch_in_flight {
+    std::string batch_name;
+    std::map<int, batch_in_flight> per_query;
+};
+
+// Query index to results.
+typedef std::vector<std::pair<int, std::vector<std::string>>> batch_results;
+
+// Reads the span objects the queries return values from, once for all of
+// them, into each query's fetched data, so extracting return values finds
+// them there.
+void read_return_data(const std::string &batch_name, std::map<int, batch_in_flight> &per_query,
+    const std::vector<std::unique_ptr<query_in_batch>> &queries, storage_backend* client) {
+    std::map<std::string, std::set<int>> service_to_queries;
+    for (auto &[i, batch] : per_query) {
+        if (queries[i]->query->ret.type == bytes_value) {
+            continue;  // trace IDs, which get_return_values_for_batch() returns without span data
         }
-        auto indexed = indexed_or_status.value();
-        index_type i_type = std::get<0>(indexed);
-        if (i_type != none) {
-            if (earliest_last_updated == -1 || std::get<1>(indexed) < earliest_last_updated) {
-                earliest_last_updated = std::get<1>(indexed);
+        const int return_node = queries[i]->query->ret.node_index;
+        for (auto const &trace_id : std::get<0>(batch.filtered)) {
+            const iso_map_range iso_maps = batch.structures.iso_maps_of(trace_id);
+            for (int iso_map_index = iso_maps.begin; iso_map_index < iso_maps.end; iso_map_index++) {
+                const std::string &service_name = batch.structures.service_name(iso_map_index, return_node);
+                if (batch.fetched.service_name_to_span_data.count(service_name) == 0) {
+                    service_to_queries[service_name].insert(i);
+                }
             }
-            index_results_futures.push_back(std::async(std::launch::async, get_traces_by_indexed_condition,
-            start_time, end_time, &conditions[i], i_type, client));
         }
     }
-    print_progress(0, "Retrieving indices", verbose);
+    std::mutex data_mutex;
+    completion_group group;
+    for (auto &[service_name, query_indices] : service_to_queries) {
+        async_then(group, [service_name = service_name, batch_name, client]() {
+            return read_object_and_parse_traces_data(service_name+BUCKETS_SUFFIX, batch_name, client);
+        }, [&, service_name = service_name](std::shared_ptr<const span_batch> span_data) {
+            std::lock_guard<std::mutex> guard(data_mutex);
+            for (int i : service_to_queries.at(service_name)) {
+                per_query.at(i).fetched.service_name_to_span_data[service_name] = span_data;
+            }
+        });
+    }
+    group.wait();
+}
 
-    std::vector<objname_to_matching_trace_ids> index_results;
-    index_results.reserve(index_results_futures.size());
-    for (uint64_t i=0; i < index_results_futures.size(); i++) {
-        auto res = index_results_futures[i].get();
-        if (!res.ok()) {
-            std::cerr << "yooo" << std::endl;
-            std::cerr << res.status().message() << std::endl;
+}  // namespace
+
+std::vector<batched_query_result> query_batch(
+    const std::vector<batched_query> &queries, int start_time, int end_time, bool verbose,
+    storage_backend* client, query_profile *shared_profile) {
+    std::vector<std::unique_ptr<query_in_batch>> states;
+    std::vector<int> running;
+    bool profiling = shared_profile != nullptr;
+    for (size_t i = 0; i < queries.size(); i++) {
+        auto state = std::make_unique<query_in_batch>();
+        state->query = &queries[i];
+        const condition_expression where = queries[i].where.value_or(all_conditions(queries[i].conditions.size()));
+        state->result.status = check_query(queries[i].query_trace, start_time, end_time, queries[i].conditions, where);
+        if (state->result.status.ok()) {
+            state->compiled = compile_conditions(queries[i].conditions, where);
+            running.push_back(i);
         } else {
-            index_results.push_back(res.value());
+            state->done = true;
+        }
+        profiling = profiling || queries[i].profile != nullptr;
+        states.push_back(std::move(state));
+    }
+    if (running.empty()) {
+        std::vector<batched_query_result> to_return;
+        for (auto &state : states) {
+            to_return.push_back(std::move(state->result));
         }
-        print_progress((i+1.0)/(index_results_futures.size()+1.0), "Retrieving indices", verbose);
+        return to_return;
+    }
+    // one profiled backend charges every query's profile, as each thread says
+    std::unique_ptr<profiled_backend> profiled;
+    if (profiling) {
+        profiled = std::make_unique<profiled_backend>(client);
+        client = profiled.get();
     }
 
-    auto struct_results = struct_filter_obj.get();
-    if (!struct_results.ok()) {
-        std::cerr << "Error in struct_results:" << std::endl;
-        std::cerr << struct_results.status().message() << std::endl;
-        return {};
+    for (int i : running) {
+        query_in_batch* state = states[i].get();
+        state->structures = executor::get().submit(io_pool, [state, end_time, verbose, client]() {
+            profile_scope scope(state->query->profile, structural_matching);
+            return get_structures_matching_query(state->query->query_trace, end_time, verbose, client);
+        }).share();
+    }
+    std::vector<std::string> all_object_names;
+    {
+        profile_scope scope(shared_profile, batch_listing);
+        all_object_names = get_batches_between_timestamps(client, start_time, end_time);
+        profile_items(0, all_object_names.size());
+    }
+    for (int i : running) {
+        query_in_batch* state = states[i].get();
+        {
+            profile_scope scope(state->query->profile, query_planning);
+            state->plan = make_query_plan(start_time, end_time, all_object_names.size(), state->query->conditions,
+                client, &state->compiled.expression);
+        }
+        print_update(explain_query_plan(state->plan, state->query->conditions), verbose);
+        state->index_results_futures = start_index_lookups(
+            state->plan, state->query->conditions, start_time, end_time, client, state->query->profile);
+    }
+    auto retrieve_index_results = [](query_in_batch* state) {
+        std::call_once(state->index_results_retrieved, [state]() {
+            state->index_results = wait_for_index_lookups(state->index_results_futures);
+        });
+    };
+
+    query_cancellation cancellation;
+    bounded_queue<std::string> batch_names(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<shared_batch_in_flight> matched(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<shared_batch_in_flight> fetched(PIPELINE_QUEUE_CAPACITY);
+    bounded_queue<batch_results> results(PIPELINE_QUEUE_CAPACITY);
+    std::vector<std::thread> threads;
+
+    // (1) batch discovery, once for all the queries
+    const std::function<std::set<std::string>()> matched_services = [&]() {
+        std::set<std::string> services;
+        for (int i : running) {
+            const StatusOr<std::vector<matched_structure>> &matching = states[i]->structures.get();
+            if (matching.ok()) {
+                std::set<std::string> mapped = mapped_services(matching.value());
+                services.insert(mapped.begin(), mapped.end());
+            }
+        }
+        return services;
+    };
+    start_batch_discovery(threads, all_object_names, batch_names, cancellation, verbose, matched_services, client);
+
+    // (2) structural match and index intersection, per query
+    start_stage(threads, PIPELINE_STAGE_THREADS, batch_names, matched, cancellation, shared_profile, tracehash_reads,
+        [&](std::string batch_name) -> std::optional<shared_batch_in_flight> {
+            shared_batch_in_flight shared;
+            shared.batch_name = batch_name;
+            for (int i : running) {
+                query_in_batch* state = states[i].get();
+                if (state->done) {
+                    continue;
+                }
+                profile_scope scope(state->query->profile, tracehash_reads);
+                const StatusOr<std::vector<matched_structure>> &matching = state->structures.get();
+                if (!matching.ok()) {
+                    continue;
+                }
+                if (state->plan.start == start_with_index) {
+                    retrieve_index_results(state);
+                    if (false == may_have_indexed_traces(
+                        batch_name, state->index_results, state->plan.earliest_last_updated)) {
+                        continue;
+                    }
+                }
+                std::call_once(state->shapes_merged, [&]() {
+                    state->all_shapes = merge_structure_shapes(matching.value());
+                });
+                std::optional<traces_by_structure> structures_in_batch = match_traces_in_batch(
+                    batch_name, matching.value(), state->all_shapes, start_time, end_time, client);
+                if (false == structures_in_batch.has_value()) {
+                    continue;
+                }
+                batch_in_flight batch;
+                batch.batch_name = batch_name;
+                batch.structures = std::move(structures_in_batch.value());
+                {
+                    profile_scope intersecting(state->query->profile, intersection);
+                    retrieve_index_results(state);
+                    batch.trace_ids = intersect_index_results_in_batch(
+                        batch_name, state->index_results, batch.structures, state->plan.earliest_last_updated);
+                    profile_items(batch.structures.trace_ids.size(), batch.trace_ids.size());
+                }
+                if (false == batch.trace_ids.empty()) {
+                    shared.per_query.emplace(i, std::move(batch));
+                }
+            }
+            if (shared.per_query.empty()) {
+                return std::nullopt;
+            }
+            return shared;
+        });
+
+    // (3) span fetch, once for all the queries
+    start_stage(threads, PIPELINE_STAGE_THREADS, matched, fetched, cancellation, shared_profile, span_fetch,
+        [&](shared_batch_in_flight shared) -> std::optional<shared_batch_in_flight> {
+            std::vector<fetch_request> requests;
+            std::vector<int> requested;
+            for (auto &[i, batch] : shared.per_query) {
+                requests.push_back({&batch.structures, &batch.trace_ids, &states[i]->compiled});
+                requested.push_back(i);
+            }
+            std::vector<fetched_data> data = fetch_data_for_requests(shared.batch_name, requests, client);
+            for (size_t r = 0; r < requested.size(); r++) {
+                shared.per_query.at(requested[r]).fetched = std::move(data[r]);
+            }
+            return shared;
+        });
+
+    // (4) predicate evaluation per query, then return extraction
+    start_stage(threads, PIPELINE_STAGE_THREADS, fetched, results, cancellation, shared_profile, return_extraction,
+        [&](shared_batch_in_flight shared) -> std::optional<batch_results> {
+            for (auto it = shared.per_query.begin(); it != shared.per_query.end();) {
+                query_in_batch* state = states[it->first].get();
+                batch_in_flight &batch = it->second;
+                profile_scope scope(state->query->profile, predicate_evaluation);
+                if (state->compiled.conditions.size()) {
+                    batch.filtered = filter_batch_data_based_on_conditions(batch.trace_ids, batch.structures,
+                        state->compiled, batch.fetched, state->query->ret, state->plan.evaluation_order);
+                } else {
+                    batch.filtered = std::make_tuple(batch.trace_ids,
+                        get_iso_map_to_span_id_info(batch.structures, state->query->ret.node_index, client));
+                }
+                profile_items(batch.trace_ids.size(), std::get<0>(batch.filtered).size());
+                it = std::get<0>(batch.filtered).empty() ? shared.per_query.erase(it) : std::next(it);
+            }
+            if (shared.per_query.empty()) {
+                return std::nullopt;
+            }
+            read_return_data(shared.batch_name, shared.per_query, states, client);
+            batch_results values;
+            for (auto &[i, batch] : shared.per_query) {
+                query_in_batch* state = states[i].get();
+                profile_scope scope(state->query->profile, return_extraction);
+                values.emplace_back(i, get_return_values_for_batch(batch.batch_name, batch.filtered,
+                    batch.structures, batch.fetched, state->query->ret, state->query->query_trace, client));
+                profile_items(std::get<0>(batch.filtered).size(), values.back().second.size());
+            }
+            return values;
+        });
+
+    size_t finished = 0;
+    while (std::optional<batch_results> batch = results.pop()) {
+        for (auto &[i, values] : batch.value()) {
+            query_in_batch* state = states[i].get();
+            const size_t limit = state->query->limit;
+            for (auto &result : values) {
+                if (state->done) {
+                    break;
+                }
+                state->result.results.push_back(std::move(result));
+                if (limit != 0 && state->result.results.size() >= limit) {
+                    state->done = true;
+                    finished++;
+                }
+            }
+        }
+        if (finished == running.size()) {
+            cancellation.cancel();
+            batch_names.close();
+            matched.close();
+            fetched.close();
+            results.close();
+            break;
+        }
+    }
+    for (auto &thread : threads) {
+        thread.join();
     }
 
-    print_progress(1, "Retrieving indices", verbose);
-    if (verbose) {
-        std::cout << std::endl;
+    std::vector<batched_query_result> to_return;
+    for (auto &state : states) {
+        // lookups no batch got as far as waiting for still use the query's conditions and client
+        executor::get().wait_all(state->index_results_futures);
+        if (state->result.status.ok() && false == state->structures.get().ok()) {
+            state->result.status = state->structures.get().status();
+            state->result.results.clear();
+        }
+        if (state->query->profile != nullptr) {
+            state->query->profile->wall_ns = state->query->profile->elapsed_ns();
+            state->query->profile->results = state->result.results.size();
+        }
+        to_return.push_back(std::move(state->result));
+    }
+    if (shared_profile != nullptr) {
+        shared_profile->wall_ns = shared_profile->elapsed_ns();
     }
+    return to_return;
+}
 
-    objname_to_matching_trace_ids intersection = intersect_index_results(
-        index_results, struct_results.value(), earliest_last_updated, verbose);
+std::string explain_query(int start_time, int end_time, const std::vector<query_condition> &conditions,
+    storage_backend* client, const condition_expression *where) {
+    std::vector<std::string> batch_names = get_batches_between_timestamps(client, start_time, end_time);
+    return explain_query_plan(make_query_plan(start_time, end_time, batch_names.size(), conditions, client, where),
+        conditions);
+}
 
-    std::cout << "intersection size is " << intersection.size() << std::endl;
+bool may_have_indexed_traces(const std::string &batch_name,
+    const std::vector<objname_to_matching_trace_ids> &index_results, const time_t last_updated) {
+    if (extract_batch_timestamps(batch_name).first > last_updated) {
+        return true;
+    }
+    for (auto &index_result : index_results) {
+        auto found = index_result.find(batch_name);
+        if (found == index_result.end() || found->second.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    std::vector<std::future<std::vector<std::string>>> results_futures;
-    results_futures.reserve(intersection.size());
-    for (auto &map : intersection) {
-        results_futures.push_back(std::async(std::launch::async,
-                brute_force_per_batch, map.first, map.second, struct_results.value(),
-                conditions, ret, query_trace,
-                client));
+void intersect_sorted_trace_ids(std::vector<trace_id_t> &kept, const std::vector<trace_id_t> &other) {
+    // Walk the shorter list and gallop through the longer one: double the
+    // step until it passes the value, then binary search the last step.
+    // Matches come out in order and never ahead of where they were found in
+    // kept, so they are written back over kept.
+    const bool walk_kept = kept.size() <= other.size();
+    const std::vector<trace_id_t> &walked = walk_kept ? kept : other;
+    const std::vector<trace_id_t> &searched = walk_kept ? other : kept;
+    size_t written = 0;
+    size_t from = 0;
+    for (size_t i = 0; i < walked.size() && from < searched.size(); i++) {
+        const trace_id_t value = walked[i];
+        size_t step = 1;
+        size_t bound = from;
+        while (bound < searched.size() && searched[bound] < value) {
+            from = bound + 1;
+            bound += step;
+            step *= 2;
+        }
+        auto found = std::lower_bound(searched.begin() + from,
+            searched.begin() + std::min(bound + 1, searched.size()), value);
+        from = found - searched.begin();
+        if (found != searched.end() && *found == value) {
+            kept[written++] = value;
+            from++;
+        }
     }
+    kept.resize(written);
+}
 
-    std::vector<std::string> to_return;
-    for (int64_t i = 0; i < results_futures.size(); i++) {
-        std::vector<std::string> partial_result = results_futures[i].get();
-        to_return.insert(to_return.end(),
-                         partial_result.begin(),
-                         partial_result.end());
+void sort_index_result(objname_to_matching_trace_ids &index_result) {
+    for (auto &batch : index_result) {
+        std::sort(batch.second.begin(), batch.second.end());
+        batch.second.erase(std::unique(batch.second.begin(), batch.second.end()), batch.second.end());
     }
+}
+
+std::vector<trace_id_t> intersect_index_results_in_batch(
+    const std::string &batch_name, const std::vector<objname_to_matching_trace_ids> &index_results,
+    const std::vector<trace_id_t> &candidates, const time_t last_updated) {
+    std::vector<trace_id_t> to_return = candidates;
+    std::sort(to_return.begin(), to_return.end());
+    to_return.erase(std::unique(to_return.begin(), to_return.end()), to_return.end());
 
+    // include everything if the indices haven't caught up to this batch
+    if (extract_batch_timestamps(batch_name).first > last_updated) {
+        return to_return;
+    }
+    std::vector<const std::vector<trace_id_t>*> indexed;
+    for (auto &index_result : index_results) {
+        auto found = index_result.find(batch_name);
+        if (found == index_result.end()) {
+            return {};
+        }
+        indexed.push_back(&found->second);
+    }
+    // the most selective first, so the rest search a shorter list
+    std::sort(indexed.begin(), indexed.end(),
+        [](const std::vector<trace_id_t>* a, const std::vector<trace_id_t>* b) { return a->size() < b->size(); });
+    std::vector<trace_id_t> sorted;
+    for (const std::vector<trace_id_t>* trace_ids : indexed) {
+        if (to_return.empty()) {
+            break;
+        }
+        if (std::is_sorted(trace_ids->begin(), trace_ids->end())) {
+            intersect_sorted_trace_ids(to_return, *trace_ids);
+            continue;
+        }
+        sorted.assign(trace_ids->begin(), trace_ids->end());
+        std::sort(sorted.begin(), sorted.end());
+        intersect_sorted_trace_ids(to_return, sorted);
+    }
     return to_return;
 }
 
+std::vector<trace_id_t> intersect_index_results_in_batch(
+    const std::string &batch_name, const std::vector<objname_to_matching_trace_ids> &index_results,
+    const traces_by_structure &structural_results, const time_t last_updated) {
+    return intersect_index_results_in_batch(batch_name, index_results, structural_results.trace_ids, last_updated);
+}
+
+std::vector<std::string> get_return_values_for_batch(
+    const std::string &batch_name,
+    std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, const trace_structure &query_trace, storage_backend* client) {
+    // just a small hack, should check for trace id return instead
+    if (ret.type == bytes_value) {
+        std::vector<std::string> trace_ids_hex;
+        trace_ids_hex.reserve(std::get<0>(filtered).size());
+        for (const auto &trace_id : std::get<0>(filtered)) {
+            trace_ids_hex.push_back(trace_id.hex());
+        }
+        return trace_ids_hex;
+    }
+    ret_req_data ret_data = fetch_return_data(filtered, ret, fetched, query_trace, batch_name, struct_results, client);
+    return get_return_value(filtered, ret, fetched, query_trace, ret_data, struct_results, client);
+}
+
 std::vector<std::string> brute_force_per_batch(const std::string batch_name,
-                                               std::vector<std::string> trace_ids,
-                                               traces_by_structure struct_results,
+                                               std::vector<trace_id_t> trace_ids,
+                                               traces_by_structure &struct_results,
                                                std::vector<query_condition> conditions,
                                                const return_value ret,
                                                trace_structure query_trace,
-                                               gcs::Client* client
+                                               storage_backend* client
                                                ) {
+    const compiled_conditions compiled = compile_conditions(conditions, all_conditions(conditions.size()));
     fetched_data fetched = fetch_data_per_batch(
         struct_results,
         batch_name,
         trace_ids,
-        conditions,
+        compiled,
         client);
 
-    std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> filtered;
+    std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> filtered;
     if (conditions.size()) {
-        filtered = filter_batch_data_based_on_conditions(trace_ids, struct_results, conditions, fetched, ret);
+        filtered = filter_batch_data_based_on_conditions(trace_ids, struct_results, compiled, fetched, ret);
     } else {
         filtered = std::make_tuple(
             trace_ids, get_iso_map_to_span_id_info(struct_results, ret.node_index, client));
     }
 
-    // just a small hack, should check for trace id return instead
-    if (ret.type == bytes_value) {
-        return std::get<0>(filtered);
+    return get_return_values_for_batch(batch_name, filtered, struct_results, fetched, ret, query_trace, client);
+}
+
+namespace {
+
+// The value of the attribute of that name, as text; empty if the span doesn't have it.
+std::string attribute_of_span(const ot::Span* sp, const std::string &name) {
+    for (const auto &attribute : sp->attributes()) {
+        std::string value;
+        if (attribute.key() == name && attribute_value_as_string(attribute.value(), value)) {
+            return value;
+        }
     }
+    return "";
+}
+
+uint64_t latency_of_span(const ot::Span* sp) {
+    return sp->end_time_unix_nano() > sp->start_time_unix_nano() ?
+        sp->end_time_unix_nano() - sp->start_time_unix_nano() : 0;
+}
+
+// Calls f(trace ID, service name, span) with the return span of each of the
+// filtered matches, reading the span objects that fetched doesn't hold.
+template <typename F>
+void for_each_return_span(
+    const std::string &batch_name,
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, const trace_structure &query_trace, storage_backend* client, F f) {
     ret_req_data ret_data = fetch_return_data(filtered, ret, fetched, query_trace, batch_name, struct_results, client);
-    auto returned = get_return_value(filtered, ret, fetched, query_trace, ret_data, struct_results, client);
-    return returned;
+    for (const trace_id_t &trace_id : std::get<0>(filtered)) {
+        auto iso_maps = std::get<1>(filtered).find(trace_id);
+        if (iso_maps == std::get<1>(filtered).end()) {
+            continue;
+        }
+        for (auto &[iso_map_index, node_to_span_id] : iso_maps->second) {
+            auto span_id = node_to_span_id.find(ret.node_index);
+            if (span_id == node_to_span_id.end()) {
+                continue;
+            }
+            const std::string &service_name = struct_results.service_name(iso_map_index, ret.node_index);
+            auto spans = fetched.service_name_to_span_data.find(service_name);
+            const span_batch* span_data = spans != fetched.service_name_to_span_data.end() ?
+                spans->second.get() : nullptr;
+            if (span_data == nullptr && ret_data.count(service_name)) {
+                span_data = ret_data[service_name].get();
+            }
+            const ot::Span* sp = span_data != nullptr ? span_data->find_span(span_id->second) : nullptr;
+            if (sp == nullptr) {
+                std::cerr << "didn't find the span " << span_id->second << " I was looking for " << std::endl;
+                continue;
+            }
+            f(trace_id, service_name, sp);
+        }
+    }
 }
 
-std::map<std::string, iso_to_span_id> get_iso_map_to_span_id_info(
-    traces_by_structure struct_results, int return_node_index, gcs::Client* client) {
-    std::map<std::string, iso_to_span_id> res;
+}  // namespace
+
+grouped_aggregate aggregate_batch(
+    const std::string &batch_name,
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, const aggregate_spec &spec, const trace_structure &query_trace,
+    storage_backend* client) {
+    grouped_aggregate aggregate;
+    // a count, by nothing or by service, is answered from the structures alone
+    if (spec.value == aggregate_count_only && spec.group_by != group_by_attribute) {
+        for (auto &[trace_id, iso_maps] : std::get<1>(filtered)) {
+            for (auto &iso_map : iso_maps) {
+                add_to_group(aggregate, spec.group_by == group_by_service ?
+                    struct_results.service_name(iso_map.first, ret.node_index) : "", 0, spec);
+            }
+        }
+        return aggregate;
+    }
+    for_each_return_span(batch_name, filtered, struct_results, fetched, ret, query_trace, client,
+        [&](const trace_id_t & /*trace_id*/, const std::string &service_name, const ot::Span* sp) {
+            std::string group;
+            if (spec.group_by == group_by_service) {
+                group = service_name;
+            } else if (spec.group_by == group_by_attribute) {
+                group = attribute_of_span(sp, spec.group_by_attribute);
+            }
+            double value = 0;
+            if (spec.value == aggregate_latency) {
+                value = static_cast<double>(latency_of_span(sp));
+            } else if (spec.value == aggregate_return_value) {
+                // read as typed: get_value_as_string() narrows ints, and
+                // timestamps don't fit in an int
+                value = ret.type == int_value ? static_cast<double>((sp->*ret.func.int_func)()) :
+                    (sp->*ret.func.double_func)();
+            }
+            add_to_group(aggregate, group, value, spec);
+        });
+    return aggregate;
+}
 
-    for (auto [k, v] : struct_results.object_name_to_trace_ids_of_interest) {
-        auto structural_object_ = read_object(
-            std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
-            struct_results.object_names[k], client);
-        auto structural_object = structural_object_.value();
+std::vector<ranked_trace> top_k_batch(
+    const std::string &batch_name,
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, size_t k, uint64_t threshold_ns, const trace_structure &query_trace,
+    storage_backend* client) {
+    // a trace is as slow as its slowest match
+    std::map<trace_id_t, uint64_t> slowest;
+    for_each_return_span(batch_name, filtered, struct_results, fetched, ret, query_trace, client,
+        [&](const trace_id_t &trace_id, const std::string & /*service_name*/, const ot::Span* sp) {
+            const uint64_t latency = latency_of_span(sp);
+            if (latency >= threshold_ns) {
+                uint64_t &trace_latency = slowest[trace_id];
+                trace_latency = std::max(trace_latency, latency);
+            }
+        });
+    // the k slowest so far, ordered so the fastest of them is on top
+    std::priority_queue<ranked_trace, std::vector<ranked_trace>, decltype(&slower)> heap(&slower);
+    for (auto &[trace_id, latency] : slowest) {
+        heap.push({trace_id, latency});
+        if (heap.size() > k) {
+            heap.pop();
+        }
+    }
+    std::vector<ranked_trace> ranked;
+    ranked.reserve(heap.size());
+    for (; false == heap.empty(); heap.pop()) {
+        ranked.push_back(heap.top());
+    }
+    std::reverse(ranked.begin(), ranked.end());
+    return ranked;
+}
+
+bool slower(const ranked_trace &a, const ranked_trace &b) {
+    return a.latency_ns != b.latency_ns ? a.latency_ns > b.latency_ns : a.trace_id < b.trace_id;
+}
+
+bool may_have_spans_this_slow(const std::string &batch_name, const std::set<std::string> &services,
+    uint64_t threshold_ns, storage_backend* client) {
+    for (const std::string &service_name : services) {
+        auto summary = read_span_latency_summary(service_name + BUCKETS_SUFFIX, batch_name, client);
+        if (!summary.ok() || summary->max_latency >= threshold_ns) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::map<trace_id_t, iso_to_span_id> get_iso_map_to_span_id_info(
+    const traces_by_structure &struct_results, int return_node_index, storage_backend* client) {
+    std::map<trace_id_t, iso_to_span_id> res;
+
+    for (auto &[k, v] : struct_results.object_name_to_trace_ids_of_interest) {
+        auto traces_object = read_structural_object(struct_results.object_names[k], client).value();
 
         for (auto trace_id_index : v) {
             auto trace_id = struct_results.trace_ids[trace_id_index];
             iso_to_span_id res_map;
-            auto trace = extract_trace_from_traces_object(trace_id, structural_object);
+            auto trace = traces_object->trace(trace_id);
 
-            for (auto iso_map_index : struct_results.trace_id_to_isomap_indices[trace_id]) {
+            const iso_map_range iso_maps = struct_results.iso_maps_of(trace_id);
+            for (int iso_map_index = iso_maps.begin; iso_map_index < iso_maps.end; iso_map_index++) {
                 std::map<int, std::string> node_ind_to_span_id_map;
                 auto return_service = get_service_name_for_node_index(struct_results, iso_map_index, return_node_index);
 
@@ -158,10 +1166,11 @@ std::map<std::string, iso_to_span_id> get_iso_map_to_span_id_info(
     return res;
 }
 
-objname_to_matching_trace_ids morph_struct_result_to_objname_to_matching_trace_ids(traces_by_structure struct_results) {
+objname_to_matching_trace_ids morph_struct_result_to_objname_to_matching_trace_ids(
+    const traces_by_structure &struct_results) {
     objname_to_matching_trace_ids res;
-    for (auto [k, v] : struct_results.object_name_to_trace_ids_of_interest) {
-        std::vector<std::string> trace_ids;
+    for (auto &[k, v] : struct_results.object_name_to_trace_ids_of_interest) {
+        std::vector<trace_id_t> trace_ids;
         for (auto trace_id_ind : v) {
             trace_ids.push_back(struct_results.trace_ids[trace_id_ind]);
         }
@@ -171,16 +1180,16 @@ objname_to_matching_trace_ids morph_struct_result_to_objname_to_matching_trace_i
 }
 
 ret_req_data fetch_return_data(
-    const std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> &filtered,
-    const return_value &ret, fetched_data &data, trace_structure &query_trace, const std::string batch_name,
-    traces_by_structure struct_results,
-    gcs::Client* client
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const return_value &ret, fetched_data &data, const trace_structure &query_trace, const std::string batch_name,
+    const traces_by_structure &struct_results,
+    storage_backend* client
 ) {
     ret_req_data response;
 
     for (auto const &trace_id : std::get<0>(filtered)) {
-        auto relevant_iso_maps_indices = struct_results.trace_id_to_isomap_indices[trace_id];
-        for (auto iso_map_index : relevant_iso_maps_indices) {
+        const iso_map_range iso_maps = struct_results.iso_maps_of(trace_id);
+        for (int iso_map_index = iso_maps.begin; iso_map_index < iso_maps.end; iso_map_index++) {
             std::string service_name = get_service_name_for_node_index(struct_results, iso_map_index, ret.node_index);
             if (
                 (data.service_name_to_span_data.find(service_name) ==
@@ -199,56 +1208,19 @@ ret_req_data fetch_return_data(
 
 
 // Returns index type and last updated
-StatusOr<std::tuple<index_type, time_t>> is_indexed(const query_condition *condition, gcs::Client* client) {
-    std::string bucket_name = condition->property_name;
-    replace_all(bucket_name, ".", "-");
-    bucket_name = "index-" + bucket_name + BUCKETS_SUFFIX;
-    StatusOr<gcs::BucketMetadata> bucket_metadata =
-      client->GetBucketMetadata(bucket_name);
-    if (bucket_metadata.status().code() == ::google::cloud::StatusCode::kNotFound ||
-        bucket_metadata.status().code() == ::google::cloud::StatusCode::kPermissionDenied) {
-        std::tuple<index_type, time_t> res = std::make_pair(none, 0);
-        return res;
-    }
-
-    if (!bucket_metadata.ok()) {
+StatusOr<std::tuple<index_type, time_t>> is_indexed(const query_condition *condition, storage_backend* client) {
+    auto statistics = get_index_statistics(*condition, client);
+    if (!statistics.ok()) {
         std::cout << "in error within is_indexed" << std::endl << std::flush;
-        return bucket_metadata.status();
-    }
-
-    bool bloom_index = false;
-    bool folder_index = false;
-    time_t last_indexed = 0;
-    for (auto const& kv : bucket_metadata->labels()) {
-        if (kv.first == "bucket_type") {
-            if (kv.second == "bloom_index") {
-                bloom_index = true;
-            } else if (kv.first == "folder_index") {
-                folder_index = true;
-            }
-        }
-        if (kv.first == "last_indexed")  {
-            last_indexed = std::stoi(kv.second);
-        }
-        if (kv.first == "root") {
-            last_indexed = std::stoi(split_by_string(kv.second, hyphen)[0]);
-        }
-    }
-    if (bloom_index) {
-        std::tuple<index_type, time_t> res = std::make_pair(bloom, last_indexed);
-       return res;
-    }
-    if (folder_index) {
-        std::tuple<index_type, time_t> res = std::make_pair(folder, last_indexed);
-        return res;
+        return statistics.status();
     }
-    std::tuple<index_type, time_t> res = std::make_pair(not_found, 0);
+    std::tuple<index_type, time_t> res = std::make_pair(statistics->type, statistics->last_updated);
     return res;
 }
 
 StatusOr<objname_to_matching_trace_ids> get_traces_by_indexed_condition(
     const int start_time, const int end_time, const query_condition *condition, const index_type ind_type,
-    gcs::Client* client) {
+    storage_backend* client) {
     switch (ind_type) {
         case bloom: {
             assert(condition->comp == Equal_to);
@@ -272,49 +1244,34 @@ StatusOr<objname_to_matching_trace_ids> get_traces_by_indexed_condition(
 objname_to_matching_trace_ids intersect_index_results(
     std::vector<objname_to_matching_trace_ids> &index_results,
     traces_by_structure &structural_results, const time_t last_updated, const bool verbose) {
-    // Easiest solution is just keep a count
-    // Eventually we should parallelize this, but I'm not optimizing it
-    // until we measure the rest of the code
-    // Premature optimization is of the devil and all that.
     print_progress(0, "Intersecting results", verbose);
-    std::map<std::tuple<std::string, std::string>, int> count;
-
-    // (1) increment per [batch name, trace ID] for each non-structural index
-    for (uint64_t i=0; i < index_results.size(); i++) {
-        print_progress(i/index_results.size(), "Intersecting results", verbose);
-        for (auto const &obj_to_id : index_results[i]) {
-            std::string object = obj_to_id.first;
-            for (uint64_t j=0; j < obj_to_id.second.size(); j++) {
-                count[std::make_tuple(object, obj_to_id.second[j])] += 1;
-            }
-        }
+    for (auto &index_result : index_results) {
+        sort_index_result(index_result);
     }
 
-    // (2) add 1 for the structural result being correct
+    // one task per batch; batches are independent, so nothing is shared but the read-only index results
+    std::vector<std::string> batch_names;
+    std::vector<std::future<std::vector<trace_id_t>>> intersected;
     for (auto const &obj_to_id : structural_results.object_name_to_trace_ids_of_interest) {
-        std::string obj = structural_results.object_names[obj_to_id.first];
-        for (uint64_t j=0; j < obj_to_id.second.size(); j++) {
-            count[std::make_tuple(obj, structural_results.trace_ids[obj_to_id.second[j]])] += 1;
-        }
+        batch_names.push_back(structural_results.object_names[obj_to_id.first]);
+        intersected.push_back(executor::get().submit(cpu_pool,
+            [&index_results, &structural_results, &obj_to_id, last_updated, batch_name = batch_names.back()]() {
+                std::vector<trace_id_t> candidates;
+                candidates.reserve(obj_to_id.second.size());
+                for (int trace_index : obj_to_id.second) {
+                    candidates.push_back(structural_results.trace_ids[trace_index]);
+                }
+                return intersect_index_results_in_batch(batch_name, index_results, candidates, last_updated);
+            }));
     }
 
-    // (3) if we have satisfied all of the indices, include the [batch name, trace ID]
-    //     in what we return. otherwise, discard
-
-    int goal_num = index_results.size() + 1;
     objname_to_matching_trace_ids to_return;
-    for (auto const &pair : count) {
-        auto object = std::get<0>(pair.first);
-        if (pair.second == goal_num) {
-            auto trace_id = std::get<1>(pair.first);
-            to_return[object].push_back(trace_id);
-        } else {
-            // also include it if the indices haven't caught up to this timestamp
-            auto timestamps = extract_batch_timestamps(object);
-            if (std::get<0>(timestamps) > last_updated) {
-                auto trace_id = std::get<1>(pair.first);
-                to_return[object].push_back(trace_id);
-            }
+    for (size_t i = 0; i < intersected.size(); i++) {
+        print_progress(static_cast<float>(i) / intersected.size(), "Intersecting results", verbose);
+        std::vector<trace_id_t> trace_ids = executor::get().wait(intersected[i]);
+        if (false == trace_ids.empty()) {
+            std::vector<trace_id_t> &batch = to_return[batch_names[i]];
+            batch.insert(batch.end(), trace_ids.begin(), trace_ids.end());
         }
     }
     print_progress(1, "Intersecting results", verbose);
@@ -325,17 +1282,13 @@ objname_to_matching_trace_ids intersect_index_results(
 }
 
 std::string get_return_value_from_traces_data(
-    ot::TracesData *trace_data,
+    const span_batch *trace_data,
     const std::string span_to_find,
     const return_value ret
 ) {
-     int sp_size = trace_data->resource_spans(0).scope_spans(0).spans_size();
-     for (int i=0; i < sp_size; i++) {
-        const ot::Span *sp =
-            &trace_data->resource_spans(0).scope_spans(0).spans(i);
-        if (is_same_hex_str(sp->ot::Span::span_id(), span_to_find)) {
-            return get_value_as_string(sp, ret.func, ret.type);
-        }
+    const ot::Span *sp = trace_data->find_span(span_to_find);
+    if (sp != nullptr) {
+        return get_value_as_string(sp, ret.func, ret.type);
     }
     std::cerr << "didn't find the span " << span_to_find << " I was looking for " << std::endl << std::flush;
     return "";
@@ -344,24 +1297,22 @@ std::string get_return_value_from_traces_data(
 std::string retrieve_object_and_get_return_value_from_traces_data(
     const std::string bucket_name,
     const std::string object_name, const std::string span_to_find,
-    const return_value ret, gcs::Client* client
+    const return_value ret, storage_backend* client
 ) {
-    std::string contents = read_object(bucket_name, object_name, client).value();
-    ot::TracesData trace_data;
-    trace_data.ParseFromString(contents);
-    return get_return_value_from_traces_data(&trace_data, span_to_find, ret);
+    auto trace_data = read_object_and_parse_traces_data(bucket_name, object_name, client);
+    return get_return_value_from_traces_data(trace_data.get(), span_to_find, ret);
 }
 
 std::vector<std::string> get_return_value(
-    std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> &filtered,
-    const return_value &ret, fetched_data &data, trace_structure &query_trace,
-    ret_req_data &return_data, traces_by_structure &struct_results, gcs::Client* client
+    std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const return_value &ret, fetched_data &data, const trace_structure &query_trace,
+    ret_req_data &return_data, traces_by_structure &struct_results, storage_backend* client
 ) {
     std::vector<std::future<std::string>> return_values_fut;
     std::unordered_set<std::string> span_ids;
 
     for (uint64_t i=0; i < std::get<0>(filtered).size(); i++) {
-        std::string trace_id = std::get<0>(filtered)[i];
+        const trace_id_t &trace_id = std::get<0>(filtered)[i];
 
         // for each trace id, there may be multiple isomaps
         for (auto & ii_ni_sp : std::get<1>(filtered)[trace_id]) {
@@ -369,22 +1320,23 @@ std::vector<std::string> get_return_value(
             std::string service_name;
 
             // Now we have the trace and span IDs that define the answer.
-            for (std::string& line : split_by_string(data.structural_object, newline)) {
+            std::string trace = data.traces_object ? data.traces_object->trace(trace_id) : "";
+            for (std::string& line : split_by_string(trace, newline)) {
                 if (line.find(span_id_to_find) != std::string::npos) {
                     service_name = split_by_string(line, colon)[2];
                 }
             }
             if (data.service_name_to_span_data.find(service_name) !=
                 data.service_name_to_span_data.end()) {
-                ot::TracesData* trace_data =
-                    &data.service_name_to_span_data[service_name];
-                return_values_fut.push_back(std::async(std::launch::async, get_return_value_from_traces_data,
+                const span_batch* trace_data =
+                    data.service_name_to_span_data[service_name].get();
+                return_values_fut.push_back(executor::get().submit(cpu_pool, get_return_value_from_traces_data,
                     trace_data, span_id_to_find, ret));
             } else if (return_data.find(service_name) !=
                 return_data.end()) {
-                ot::TracesData* trace_data =
-                    &return_data[service_name];
-                return_values_fut.push_back(std::async(std::launch::async, get_return_value_from_traces_data,
+                const span_batch* trace_data =
+                    return_data[service_name].get();
+                return_values_fut.push_back(executor::get().submit(cpu_pool, get_return_value_from_traces_data,
                     trace_data, span_id_to_find, ret));
             } else {
                 std::cout << "wttd " << service_name << " " << std::endl;
@@ -395,27 +1347,28 @@ std::vector<std::string> get_return_value(
     std::vector<std::string> to_return;
     to_return.reserve(return_values_fut.size());
     for (uint64_t i=0; i < return_values_fut.size(); i++) {
-        to_return.push_back(return_values_fut[i].get());
+        to_return.push_back(executor::get().wait(return_values_fut[i]));
     }
 
     return to_return;
 }
 
 // Returns list of trace IDs that match conditions, and trace ID to iso to span ID mapping.
-std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> filter_batch_data_based_on_conditions(
-    const std::vector<std::string>& trace_ids,
+std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> filter_batch_data_based_on_conditions(
+    const std::vector<trace_id_t>& trace_ids,
     traces_by_structure &structural_results,
-    std::vector<query_condition> &conditions,
+    const compiled_conditions &conditions,
     struct fetched_data &fetched,
-    const return_value &ret
+    const return_value &ret,
+    const std::vector<int> &evaluation_order
 ) {
-    std::vector<std::string> to_return_traces;
-    std::map<std::string, iso_to_span_id> trace_id_to_span_id_mappings;
+    std::vector<trace_id_t> to_return_traces;
+    std::map<trace_id_t, iso_to_span_id> trace_id_to_span_id_mappings;
 
     for (uint64_t i=0; i < trace_ids.size(); i++) {
         // isomap to node to span id
         iso_to_span_id isomap_to_node_to_span_id = does_trace_satisfy_conditions(
-            trace_ids[i], conditions, fetched, structural_results, ret);
+            trace_ids[i], conditions, fetched, structural_results, ret, evaluation_order);
         if (isomap_to_node_to_span_id.size() > 0) {
             to_return_traces.push_back(trace_ids[i]);
             trace_id_to_span_id_mappings[trace_ids[i]] = isomap_to_node_to_span_id;
@@ -427,116 +1380,256 @@ std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> filt
 fetched_data fetch_data_per_batch(
     traces_by_structure& structs_result,
     std::string batch_name,
-    const std::vector<std::string> trace_ids,
-    std::vector<query_condition> &conditions,
-    gcs::Client* client
+    const std::vector<trace_id_t> trace_ids,
+    const compiled_conditions &conditions,
+    storage_backend* client
 ) {
+    return fetch_data_for_requests(batch_name, {{&structs_result, &trace_ids, &conditions}}, client)[0];
+}
+
+std::vector<fetched_data> fetch_data_for_requests(
+    const std::string &batch_name, const std::vector<fetch_request> &requests, storage_backend* client
+) {
+    std::vector<fetched_data> per_request(requests.size());
+
+    // service name to, per request, the conditions evaluated on its spans
+    std::map<std::string, std::map<int, std::set<int>>> service_conditions;
+    for (size_t r = 0; r < requests.size(); r++) {
+        const fetch_request &request = requests[r];
+        for (auto& trace_id : *request.trace_ids) {
+            const iso_map_range iso_maps = request.structures->iso_maps_of(trace_id);
+            const int num_conditions = static_cast<int>(request.conditions->conditions.size());
+            for (int curr_cond_ind = 0; curr_cond_ind < num_conditions; curr_cond_ind++) {
+                const query_condition& curr_condition = request.conditions->conditions[curr_cond_ind].condition;
+                for (int curr_iso_map_ind = iso_maps.begin; curr_iso_map_ind < iso_maps.end; curr_iso_map_ind++) {
+                    const std::string& condition_service =
+                        request.structures->service_name(curr_iso_map_ind, curr_condition.node_index);
+
+                    // TODO(jessberg): faster to just get first token?
+                    const std::string service_name_without_hash_id = split_by_string(condition_service, ":")[0];
+                    service_conditions[service_name_without_hash_id][r].insert(curr_cond_ind);
+                }
+            }
+        }
+    }
+    if (service_conditions.empty()) {
+        return per_request;
+    }
+
+    // Every object is read once, however many requests need it, and every
+    // read is started up front; each continuation stores its result (and
+    // evaluates the conditions it can on columns) as soon as it arrives.
     fetched_data data;
-    if (conditions.size() < 1 || trace_ids.size() < 1) {
-        return data;
-    }
-
-    std::string trace_structure_bucket_prefix(TRACE_STRUCT_BUCKET_PREFIX);
-    std::string buckets_suffix(BUCKETS_SUFFIX);
-
-    data.structural_object = read_object(
-                    trace_structure_bucket_prefix+buckets_suffix,
-                    batch_name,
-                    client).value();
-
-    std::unordered_map<std::string, std::future<ot::TracesData>> data_futures;
-
-    for (auto& trace_id : trace_ids) {
-        std::vector<int>& iso_map_indices = structs_result.trace_id_to_isomap_indices[trace_id];
-        for (query_condition& curr_condition : conditions) {
-            for (int curr_iso_map_ind : iso_map_indices) {
-                const int trace_node_names_ind = structs_result.iso_map_to_trace_node_names[curr_iso_map_ind];
-                const int trace_node_index = structs_result.iso_maps[curr_iso_map_ind][curr_condition.node_index];
-                const std::string& condition_service =
-                    structs_result.trace_node_names[trace_node_names_ind][trace_node_index];
-
-                // TODO(jessberg): faster to just get first token?
-                const std::string service_name_without_hash_id = split_by_string(condition_service, ":")[0];
-                if (data_futures.find(service_name_without_hash_id) ==
-                    data_futures.end()
-                ) {
-                    data_futures[service_name_without_hash_id] = std::async(
-                        std::launch::async,
-                        read_object_and_parse_traces_data,
-                        service_name_without_hash_id+BUCKETS_SUFFIX, batch_name, client);
+    std::vector<std::map<std::pair<std::string, int>, selection_bitmap>> condition_bitmaps(requests.size());
+    std::mutex data_mutex;
+    completion_group group;
+    async_then(group, [batch_name, client]() { return read_structural_object(batch_name, client); },
+        [&data, &data_mutex](StatusOr<std::shared_ptr<const structural_object>> traces_object) {
+            std::lock_guard<std::mutex> guard(data_mutex);
+            data.traces_object = traces_object.value();
+        });
+
+    auto read_span_data = [&data, &data_mutex, &group, batch_name, client](const std::string &service_name) {
+        async_then(group, [service_name, batch_name, client]() {
+            return read_object_and_parse_traces_data(service_name+BUCKETS_SUFFIX, batch_name, client);
+        }, [&data, &data_mutex, service_name](std::shared_ptr<const span_batch> span_data) {
+            std::lock_guard<std::mutex> guard(data_mutex);
+            data.service_name_to_span_data[service_name] = span_data;
+        });
+    };
+    for (auto& [service_name, request_conditions] : service_conditions) {
+        bool columnar = span_columns_enabled();
+        for (auto& [r, condition_indices] : request_conditions) {
+            for (int cond_ind : condition_indices) {
+                columnar = columnar && can_evaluate_on_columns(requests[r].conditions->conditions[cond_ind].condition);
+            }
+        }
+        if (false == columnar) {
+            read_span_data(service_name);
+            continue;
+        }
+        async_then(group, [service_name = service_name, batch_name, client]() {
+            return read_span_columns(service_name+BUCKETS_SUFFIX, batch_name, client);
+        }, [&, service_name = service_name](StatusOr<std::shared_ptr<const span_columns>> columns) {
+            if (!columns.ok()) {
+                // no columns for this batch (yet), so evaluate on the span data
+                read_span_data(service_name);
+                return;
+            }
+            std::vector<std::map<std::pair<std::string, int>, selection_bitmap>> bitmaps(requests.size());
+            for (auto& [r, condition_indices] : service_conditions.at(service_name)) {
+                for (int cond_ind : condition_indices) {
+                    bitmaps[r][std::make_pair(service_name, cond_ind)] =
+                        evaluate_condition_on_columns(*columns.value(), requests[r].conditions->conditions[cond_ind]);
                 }
             }
+            std::lock_guard<std::mutex> guard(data_mutex);
+            data.service_name_to_span_columns[service_name] = columns.value();
+            for (size_t r = 0; r < requests.size(); r++) {
+                condition_bitmaps[r].merge(bitmaps[r]);
+            }
+        });
+    }
+    group.wait();
+
+    for (size_t r = 0; r < requests.size(); r++) {
+        if (requests[r].conditions->conditions.empty() || requests[r].trace_ids->empty()) {
+            continue;
         }
+        per_request[r] = data;
+        per_request[r].condition_bitmaps = std::move(condition_bitmaps[r]);
+    }
+    return per_request;
+}
+
+namespace {
+
+// The earliest any of the expression's conditions comes in the evaluation order.
+int earliest_rank(const condition_expression &expression, const std::vector<int> &rank) {
+    if (expression.op == condition_leaf) {
+        return rank[expression.condition_index];
     }
-    for (auto& service_name_to_span_data : data_futures) {
-        data.service_name_to_span_data[service_name_to_span_data.first] = service_name_to_span_data.second.get();
+    int earliest = std::numeric_limits<int>::max();
+    for (const auto &child : expression.children) {
+        earliest = std::min(earliest, earliest_rank(child, rank));
     }
-    return data;
+    return earliest;
 }
 
-std::map<int, std::map<int, std::string>> does_trace_satisfy_conditions(
-    const std::string &trace_id,
-    std::vector<query_condition> &conditions, fetched_data& evaluation_data,
+// Every iso map of the trace, mapping only the return node.
+iso_to_span_id every_iso_map(
+    const trace_id_t &trace_id, fetched_data& evaluation_data,
     traces_by_structure &structural_results, const return_value& ret
 ) {
-    // isomap_index_to_node_index_to_span_id -> ii_to_ni_to_si
-    std::vector<std::map<int, std::map<int, std::string>>> ii_to_ni_to_si_data_for_all_conditions;
-    for (uint64_t curr_cond_ind = 0; curr_cond_ind < conditions.size(); curr_cond_ind++) {
-        ii_to_ni_to_si_data_for_all_conditions.push_back(
-            get_iso_maps_indices_for_which_trace_satifies_curr_condition(
-                trace_id, conditions, curr_cond_ind, evaluation_data, structural_results, ret));
+    iso_to_span_id response;
+    const iso_map_range iso_maps = structural_results.iso_maps_of(trace_id);
+    const std::string trace = evaluation_data.traces_object->trace(trace_id);
+    const std::vector<std::string> lines = split_by_string(trace, newline);
+    for (int curr_iso_map_ind = iso_maps.begin; curr_iso_map_ind < iso_maps.end; curr_iso_map_ind++) {
+        const std::string &return_service = structural_results.service_name(curr_iso_map_ind, ret.node_index);
+        std::map<int, std::string> &node_ind_to_span_id_map = response[curr_iso_map_ind];
+        for (const auto &line : lines) {
+            if (line.find(return_service) != std::string::npos) {
+                node_ind_to_span_id_map[ret.node_index] = split_by_string(line, colon)[1];
+            }
+        }
     }
+    return response;
+}
 
-    std::map<int, std::map<int, std::string>> aggregate_result;
-    std::map<int, uint64_t> iso_map_to_satisfied_conditions_map;
-    for (auto vec_ele : ii_to_ni_to_si_data_for_all_conditions) {
-        for (auto ele : vec_ele) {
-            auto iso_map_index = ele.first;
-            auto ni_to_si_map = ele.second;
-
-            for (auto ni_to_si_ele : ni_to_si_map) {
-                aggregate_result[iso_map_index][ni_to_si_ele.first] = ni_to_si_ele.second;
+iso_to_span_id evaluate_expression(
+    const condition_expression &expression, const trace_id_t &trace_id,
+    const compiled_conditions &conditions, fetched_data& evaluation_data,
+    traces_by_structure &structural_results, const return_value& ret, const std::vector<int> &rank
+) {
+    switch (expression.op) {
+        case condition_leaf:
+            return get_iso_maps_indices_for_which_trace_satifies_curr_condition(
+                trace_id, conditions, expression.condition_index, evaluation_data, structural_results, ret);
+        case condition_not: {
+            iso_to_span_id response = every_iso_map(trace_id, evaluation_data, structural_results, ret);
+            const iso_to_span_id satisfied = evaluate_expression(
+                expression.children[0], trace_id, conditions, evaluation_data, structural_results, ret, rank);
+            for (auto &iso_map : satisfied) {
+                response.erase(iso_map.first);
             }
-
-            if (iso_map_to_satisfied_conditions_map.find(iso_map_index) == iso_map_to_satisfied_conditions_map.end()) {
-                iso_map_to_satisfied_conditions_map[iso_map_index] = 1;
-            } else {
-                iso_map_to_satisfied_conditions_map[iso_map_index] += 1;
+            return response;
+        }
+        case condition_or: {
+            iso_to_span_id response;
+            for (const auto &child : expression.children) {
+                iso_to_span_id satisfied = evaluate_expression(
+                    child, trace_id, conditions, evaluation_data, structural_results, ret, rank);
+                for (auto &[iso_map_ind, node_ind_to_span_id] : satisfied) {
+                    response[iso_map_ind].merge(node_ind_to_span_id);
+                }
             }
+            return response;
         }
+        case condition_and:
+            break;
     }
-
-    std::map<int, std::map<int, std::string>> response;
-    for (auto ele : aggregate_result) {
-        if (iso_map_to_satisfied_conditions_map[ele.first] >= conditions.size()) {
-            response[ele.first].insert(ele.second.begin(), ele.second.end());
+    if (expression.children.empty()) {
+        return every_iso_map(trace_id, evaluation_data, structural_results, ret);
+    }
+    std::vector<const condition_expression*> children;
+    for (const auto &child : expression.children) {
+        children.push_back(&child);
+    }
+    std::stable_sort(children.begin(), children.end(),
+        [&rank](const condition_expression* a, const condition_expression* b) {
+            return earliest_rank(*a, rank) < earliest_rank(*b, rank);
+        });
+
+    // An iso map is in the response if every child holds on it, so once
+    // none is left the remaining children needn't be evaluated.
+    iso_to_span_id response;
+    bool first = true;
+    for (const condition_expression* child : children) {
+        iso_to_span_id satisfied = evaluate_expression(
+            *child, trace_id, conditions, evaluation_data, structural_results, ret, rank);
+        if (first) {
+            response = std::move(satisfied);
+            first = false;
+        } else {
+            for (auto it = response.begin(); it != response.end();) {
+                auto found = satisfied.find(it->first);
+                if (found == satisfied.end()) {
+                    it = response.erase(it);
+                    continue;
+                }
+                for (auto &ni_to_si : found->second) {
+                    it->second[ni_to_si.first] = ni_to_si.second;
+                }
+                ++it;
+            }
+        }
+        if (response.empty()) {
+            break;
         }
     }
-
     return response;
 }
 
+}  // namespace
+
+std::map<int, std::map<int, std::string>> does_trace_satisfy_conditions(
+    const trace_id_t &trace_id,
+    const compiled_conditions &conditions, fetched_data& evaluation_data,
+    traces_by_structure &structural_results, const return_value& ret,
+    const std::vector<int> &evaluation_order
+) {
+    // condition index to its position in the evaluation order
+    std::vector<int> rank(conditions.conditions.size());
+    for (size_t i = 0; i < rank.size(); i++) {
+        rank[i] = i;
+    }
+    for (size_t i = 0; i < evaluation_order.size(); i++) {
+        rank[evaluation_order[i]] = i;
+    }
+    return evaluate_expression(
+        conditions.expression, trace_id, conditions, evaluation_data, structural_results, ret, rank);
+}
+
 std::string get_service_name_for_node_index(
-    traces_by_structure& structural_results, int iso_map_index, int node_index
+    const traces_by_structure& structural_results, int iso_map_index, int node_index
 ) {
-    auto trace_node_names_ind = structural_results.iso_map_to_trace_node_names[iso_map_index];
-    auto trace_node_index = structural_results.iso_maps[iso_map_index][node_index];
-    auto service_name = structural_results.trace_node_names[trace_node_names_ind][trace_node_index];
-    return service_name;
+    return structural_results.service_name(iso_map_index, node_index);
 }
 
 std::map<int, std::map<int, std::string>> get_iso_maps_indices_for_which_trace_satifies_curr_condition(
-    const std::string &trace_id,
-    std::vector<query_condition>& conditions,
+    const trace_id_t &trace_id,
+    const compiled_conditions &conditions,
     int curr_cond_ind, fetched_data& evaluation_data,
     traces_by_structure& structural_results, const return_value& ret
 ) {
     std::map<int, std::map<int, std::string>> response;
 
-    auto curr_condition = conditions[curr_cond_ind];
-    auto relevant_iso_maps_indices = structural_results.trace_id_to_isomap_indices[trace_id];
+    const compiled_condition &compiled = conditions.conditions[curr_cond_ind];
+    const query_condition &curr_condition = compiled.condition;
+    const iso_map_range relevant_iso_maps = structural_results.iso_maps_of(trace_id);
 
-    for (auto curr_iso_map_ind : relevant_iso_maps_indices) {
+    for (int curr_iso_map_ind = relevant_iso_maps.begin; curr_iso_map_ind < relevant_iso_maps.end; curr_iso_map_ind++) {
         std::map<int, std::string> node_ind_to_span_id_map;
         bool does_trace_satisfy_condition = false;
 
@@ -546,8 +1639,7 @@ std::map<int, std::map<int, std::string>> get_iso_maps_indices_for_which_trace_s
         auto return_service = get_service_name_for_node_index(
             structural_results, curr_iso_map_ind, ret.node_index);
 
-        std::string trace = extract_trace_from_traces_object(trace_id,
-            evaluation_data.structural_object);
+        std::string trace = evaluation_data.traces_object->trace(trace_id);
 
         for (auto line : split_by_string(trace, newline)) {
             if (line.find(return_service) != std::string::npos) {
@@ -558,7 +1650,7 @@ std::map<int, std::map<int, std::string>> get_iso_maps_indices_for_which_trace_s
                 auto span_info = split_by_string(line, colon);
                 node_ind_to_span_id_map[curr_condition.node_index] = span_info[1];
                 does_trace_satisfy_condition = does_trace_satisfy_condition || does_span_satisfy_condition(
-                    span_info[1], span_info[2], curr_condition, evaluation_data);
+                    span_info[1], span_info[2], compiled, curr_cond_ind, evaluation_data);
             }
         }
 
@@ -572,19 +1664,83 @@ std::map<int, std::map<int, std::string>> get_iso_maps_indices_for_which_trace_s
 
 bool does_span_satisfy_condition(
     const std::string &span_id, const std::string &service_name,
-    const query_condition &condition, fetched_data& evaluation_data
+    const compiled_condition &condition, int condition_index, fetched_data& evaluation_data
 ) {
-    ot::TracesData* trace_data = &(evaluation_data.service_name_to_span_data[service_name]);
+    auto columns = evaluation_data.service_name_to_span_columns.find(service_name);
+    if (columns != evaluation_data.service_name_to_span_columns.end()) {
+        auto bitmap = evaluation_data.condition_bitmaps.find(std::make_pair(service_name, condition_index));
+        const int position = columns->second->find_span(span_id);
+        if (bitmap == evaluation_data.condition_bitmaps.end() || position < 0) {
+            return false;
+        }
+        return (bitmap->second[position / 64] >> (position % 64)) & 1;
+    }
+
+    const span_batch* trace_data = evaluation_data.service_name_to_span_data[service_name].get();
+
+    const ot::Span* sp = trace_data->find_span(span_id);
+    if (sp == nullptr) {
+        return false;
+    }
+    return does_condition_hold(sp, condition);
+}
+
 
-    const ot::Span* sp;
-    for (int i=0; i < trace_data->resource_spans(0).scope_spans(0).spans_size(); i++) {
-        sp = &(trace_data->resource_spans(0).scope_spans(0).spans(i));
+namespace {
 
-        if (is_same_hex_str(sp->span_id(), span_id)) {
-            auto res = does_condition_hold(sp, condition);
-            return res;
+// Packs predicate(i) for every span into 64-bit words; the inner loop has no
+// branches, so the compiler can vectorize it.
+template <typename P>
+selection_bitmap select_spans(size_t num_spans, P predicate) {
+    selection_bitmap bitmap((num_spans + 63) / 64, 0);
+    for (size_t word = 0; word < bitmap.size(); word++) {
+        const size_t begin = word * 64;
+        const size_t end = std::min(begin + 64, num_spans);
+        uint64_t bits = 0;
+        for (size_t i = begin; i < end; i++) {
+            bits |= static_cast<uint64_t>(predicate(i)) << (i - begin);
         }
+        bitmap[word] = bits;
     }
-    return false;
+    return bitmap;
 }
 
+}  // namespace
+
+bool can_evaluate_on_columns(const query_condition &condition) {
+    return condition.is_latency_condition || condition.is_attribute_condition;
+}
+
+selection_bitmap evaluate_condition_on_columns(const span_columns &columns, const compiled_condition &compiled) {
+    const size_t num_spans = columns.num_spans();
+    const query_condition &condition = compiled.condition;
+
+    if (false == compiled.valid) {
+        return selection_bitmap((num_spans + 63) / 64, 0);
+    } else if (condition.is_latency_condition) {
+        const uint64_t* start = columns.start_times().data();
+        const uint64_t* end = columns.end_times().data();
+        // unsigned, like the comparison in does_condition_hold()
+        const uint64_t threshold = compiled.unsigned_value;
+        switch (condition.comp) {
+            case Equal_to:
+                return select_spans(num_spans, [&](size_t i) { return end[i] - start[i] == threshold; });
+            case Less_than:
+                return select_spans(num_spans, [&](size_t i) { return end[i] - start[i] < threshold; });
+            case Greater_than:
+                return select_spans(num_spans, [&](size_t i) { return end[i] - start[i] > threshold; });
+        }
+    } else if (condition.is_attribute_condition) {
+        const attribute_column* column = columns.attribute(condition.property_name);
+        if (column != nullptr) {
+            // evaluate once per distinct value, then look each span's value up
+            std::vector<uint8_t> holds(column->dictionary.size() + 1, 0);
+            for (size_t i = 0; i < column->dictionary.size(); i++) {
+                holds[i + 1] = does_value_satisfy_condition(column->dictionary[i], condition);
+            }
+            const uint32_t* codes = column->codes.data();
+            return select_spans(num_spans, [&](size_t i) { return holds[codes[i]] != 0; });
+        }
+    }
+    return selection_bitmap((num_spans + 63) / 64, 0);
+}
@@ -12,11 +12,17 @@
 #include <unordered_map>
 #include <utility>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
+#include <atomic>
+#include <functional>
 #include <future>
+#include <optional>
+#include <thread>
 #include <tuple>
 #include <unordered_set>
+#include "aggregation.h"
 #include "query_conditions.h"
 #include "google/cloud/storage/client.h"
 #include "opentelemetry/proto/trace/v1/trace.pb.h"
@@ -27,96 +33,273 @@
 #include "get_traces_by_structure.h"
 #include "indices/folders_index_query.h"
 #include "indices/query_bloom_index.h"
+#include "async_io.h"
+#include "bounded_queue.h"
+#include "query_planner.h"
 #include "common.h"
 
 const int BRUTE_FORCE_BATCH_SIZE = 1000;
+// Batches waiting between two stages of query()'s pipeline, and threads per stage.
+const int PIPELINE_QUEUE_CAPACITY = 8;
+const int PIPELINE_STAGE_THREADS = 4;
 typedef std::map<int, std::map<int, std::string>> iso_to_span_id;   // iso_map_index to (node_id_index to span_id)
+
+// Lets a running query be stopped from another thread, e.g. once the client
+// that asked for it has gone away.  The stages check it between batches.
+class query_cancellation {
+    public: // NOLINT
+        void cancel() { cancelled_ = true; }
+        bool cancelled() const { return cancelled_; }
+
+    private: // NOLINT
+        std::atomic<bool> cancelled_{false};
+};
+
+// Called with each result as soon as its batch is done; returning false stops the query.
+typedef std::function<bool(const std::string &result)> result_callback;
+
+// At most limit results (0 for all of them).  Batches are processed
+// concurrently, so which results make the cut is not deterministic.
 std::vector<std::string> query(
     trace_structure query_trace, int start_time, int end_time,
-    std::vector<query_condition> conditions, return_value ret, bool verbose, gcs::Client* client);
+    std::vector<query_condition> conditions, return_value ret, bool verbose, storage_backend* client,
+    size_t limit = 0, query_profile *profile = nullptr);
+// Streams results to on_result until all of them have been delivered,
+// limit of them have, on_result returns false or cancellation is cancelled;
+// in the last three cases batches not yet started are never read.  Stopping
+// early cancels cancellation if one was given.  If profile is given, the
+// query fills it in (see query_profile.h).
+Status query_streaming(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, return_value ret, bool verbose, storage_backend* client,
+    const result_callback &on_result, size_t limit = 0, query_cancellation *cancellation = nullptr,
+    query_profile *profile = nullptr);
+// As above, for traces where the conditions combine as where says rather
+// than all having to hold, e.g. or_of({leaf_condition(0), leaf_condition(1)}).
+Status query_streaming(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, const condition_expression &where, return_value ret, bool verbose,
+    storage_backend* client, const result_callback &on_result, size_t limit = 0,
+    query_cancellation *cancellation = nullptr, query_profile *profile = nullptr);
+
+// The aggregate of the return node's latency, or of ret's value, over every
+// match, e.g. the p99 latency of one service under another.  Each batch
+// aggregates its own matches and only its partial aggregate is passed on
+// (see aggregation.h).  where is all conditions holding if not given.
+StatusOr<grouped_aggregate> query_aggregate(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, return_value ret, const aggregate_spec &spec, bool verbose,
+    storage_backend* client, query_profile *profile = nullptr, const condition_expression *where = nullptr);
+
+struct ranked_trace {
+    trace_id_t trace_id;
+    uint64_t latency_ns;    // of its slowest return span
+};
+// Slowest first, and by trace ID among equally slow ones.
+bool slower(const ranked_trace &a, const ranked_trace &b);
+
+// One of query_top_k()'s answers.
+struct slow_trace {
+    std::string trace_id;   // hex
+    uint64_t latency_ns;
+};
+
+// The k traces whose return span is slowest, slowest first; a trace
+// matching more than once counts as its slowest match.  Each batch keeps
+// only its own k slowest, and once k traces have come back, the fastest of
+// them is a threshold the batches still to come have to reach.  With
+// skip_by_latency_summaries, a batch whose latency summaries (see
+// span_columns.h) show no span of the return node's services that slow is
+// skipped before its spans are read; it defaults to whether
+// QUEST_SPAN_LATENCY_SUMMARIES is set.  where is all conditions holding if
+// not given.
+StatusOr<std::vector<slow_trace>> query_top_k(
+    trace_structure query_trace, int start_time, int end_time,
+    std::vector<query_condition> conditions, return_value ret, size_t k, bool verbose,
+    storage_backend* client, query_profile *profile = nullptr, const condition_expression *where = nullptr,
+    bool skip_by_latency_summaries = span_latency_summaries_enabled());
+
+// One of the queries query_batch() runs over a shared scan.
+struct batched_query {
+    trace_structure query_trace;
+    std::vector<query_condition> conditions;
+    // How the conditions combine; all of them must hold if not set.
+    std::optional<condition_expression> where;
+    return_value ret;
+    size_t limit = 0;   // 0 for all results
+    query_profile *profile = nullptr;
+};
+
+struct batched_query_result {
+    Status status;
+    std::vector<std::string> results;
+};
+
+// Runs queries over the same time range as one scan: the batches in the
+// range are listed once, and each structural and span object is read once
+// for all the queries that need it; every query is then matched and
+// evaluated on its own against the shared data.  Results come back per
+// query, in the order the queries were given.  Each query's profile is
+// charged with its own work; the listing and reads done for all of them are
+// charged to shared_profile, if given.
+std::vector<batched_query_result> query_batch(
+    const std::vector<batched_query> &queries, int start_time, int end_time, bool verbose,
+    storage_backend* client, query_profile *shared_profile = nullptr);
 // ****************** conditions-related ********************************
 
 // Service name to span data for return.
-typedef std::unordered_map<
-            std::string,
-            opentelemetry::proto::trace::v1::TracesData> ret_req_data;
+typedef std::unordered_map<std::string, std::shared_ptr<const span_batch>> ret_req_data;
+
+// One bit per span in a batch, set for the spans a condition holds on.
+typedef std::vector<uint64_t> selection_bitmap;
 
 struct fetched_data {
-    std::string structural_object;
-    std::unordered_map<std::string, opentelemetry::proto::trace::v1::TracesData> service_name_to_span_data;
+    std::shared_ptr<const structural_object> traces_object;
+    std::unordered_map<std::string, std::shared_ptr<const span_batch>> service_name_to_span_data;
+    // Services whose conditions are all answered from span columns instead of span data.
+    std::unordered_map<std::string, std::shared_ptr<const span_columns>> service_name_to_span_columns;
+    // (service name, condition index) to the spans of that service the condition holds on.
+    std::map<std::pair<std::string, int>, selection_bitmap> condition_bitmaps;
 };
 
+bool can_evaluate_on_columns(const query_condition &condition);
+selection_bitmap evaluate_condition_on_columns(const span_columns &columns, const compiled_condition &condition);
+
 std::string get_service_name_for_node_index(
-    traces_by_structure& structural_results, int iso_map_index, int node_index
+    const traces_by_structure& structural_results, int iso_map_index, int node_index
 );
 fetched_data fetch_data_per_batch(
     traces_by_structure& structs_result,
     std::string batch_name,
-    const std::vector<std::string> trace_ids,
-    std::vector<query_condition> &conditions,
-    gcs::Client* client
+    const std::vector<trace_id_t> trace_ids,
+    const compiled_conditions &conditions,
+    storage_backend* client
 );
 
-StatusOr<std::tuple<index_type, time_t>>  is_indexed(const query_condition *condition, gcs::Client* client);
+// What one of several queries needs read from a batch to evaluate its conditions.
+struct fetch_request {
+    const traces_by_structure* structures;
+    const std::vector<trace_id_t>* trace_ids;
+    const compiled_conditions* conditions;
+};
+// Reads the batch's structural object, and each span object (or its columns)
+// that the requests' conditions are evaluated on, once for all of them.  The
+// requests' fetched_data share those objects; each has its own bitmaps.
+std::vector<fetched_data> fetch_data_for_requests(
+    const std::string &batch_name, const std::vector<fetch_request> &requests, storage_backend* client);
+
+StatusOr<std::tuple<index_type, time_t>>  is_indexed(const query_condition *condition, storage_backend* client);
 bool does_span_satisfy_condition(
     const std::string &span_id, const std::string &service_name,
-    const query_condition &condition, fetched_data& evaluation_data
+    const compiled_condition &condition, int condition_index, fetched_data& evaluation_data
 );
 std::map<int, std::map<int, std::string>> get_iso_maps_indices_for_which_trace_satifies_curr_condition(
-    const std::string &trace_id, std::vector<query_condition>& conditions,
+    const trace_id_t &trace_id, const compiled_conditions &conditions,
     int curr_cond_ind, fetched_data& evaluation_data, traces_by_structure& structural_results, const return_value &ret
 );
 StatusOr<objname_to_matching_trace_ids> get_traces_by_indexed_condition(
-    int start_time, int end_time, const query_condition *condition, const index_type ind_type, gcs::Client* client);
-std::tuple<objname_to_matching_trace_ids, std::map<std::string, iso_to_span_id>> filter_based_on_conditions(
+    int start_time, int end_time, const query_condition *condition, const index_type ind_type, storage_backend* client);
+std::tuple<objname_to_matching_trace_ids, std::map<trace_id_t, iso_to_span_id>> filter_based_on_conditions(
     objname_to_matching_trace_ids &intersection,
     traces_by_structure &structural_results,
     std::vector<query_condition> &conditions,
     struct fetched_data &fetched,
     return_value &ret
 );
-std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> filter_batch_data_based_on_conditions(
-    const std::vector<std::string>& trace_ids,
+std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> filter_batch_data_based_on_conditions(
+    const std::vector<trace_id_t>& trace_ids,
     traces_by_structure &structural_results,
-    std::vector<query_condition> &conditions,
+    const compiled_conditions &conditions,
     struct fetched_data &fetched,
-    const return_value &ret
+    const return_value &ret,
+    const std::vector<int> &evaluation_order = {}
 );
 
+// The iso maps of the trace that satisfy conditions.expression.  Children of
+// an AND are evaluated by the earliest of their conditions in
+// evaluation_order (as written, if it's empty), stopping at the first that
+// no iso map satisfies.  An iso map satisfies a NOT if its child doesn't
+// hold on it; it then only maps the return node.
 std::map<int, std::map<int, std::string>> does_trace_satisfy_conditions(
-    const std::string& trace_id,
-    std::vector<query_condition> &conditions, fetched_data& evaluation_data,
-    traces_by_structure &structural_results, const return_value& ret
+    const trace_id_t& trace_id,
+    const compiled_conditions &conditions, fetched_data& evaluation_data,
+    traces_by_structure &structural_results, const return_value& ret,
+    const std::vector<int> &evaluation_order = {}
 );
 
 // ***************** query-related ******************************************
 
 ret_req_data fetch_return_data(
-    const std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> &filtered,
-    const return_value &ret, fetched_data &data, trace_structure &query_trace, std::string batch_name,
-    traces_by_structure struct_results,
-    gcs::Client* client
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const return_value &ret, fetched_data &data, const trace_structure &query_trace, std::string batch_name,
+    const traces_by_structure &struct_results,
+    storage_backend* client
 );
 std::vector<std::string> get_return_value(
-    std::tuple<std::vector<std::string>, std::map<std::string, iso_to_span_id>> &filtered,
-    const return_value &ret, fetched_data &data, trace_structure &query_trace,
-    ret_req_data &return_data, traces_by_structure &struct_results, gcs::Client* client
+    std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const return_value &ret, fetched_data &data, const trace_structure &query_trace,
+    ret_req_data &return_data, traces_by_structure &struct_results, storage_backend* client
 );
 objname_to_matching_trace_ids intersect_index_results(
     std::vector<objname_to_matching_trace_ids> &index_results,
     traces_by_structure &structural_results, time_t last_indexed, bool verbose);
+// The plan query() would run with, as explain_query_plan() prints it.
+std::string explain_query(int start_time, int end_time, const std::vector<query_condition> &conditions,
+    storage_backend* client, const condition_expression *where = nullptr);
+// False if the indices cover the batch and one of them has no traces in it.
+bool may_have_indexed_traces(const std::string &batch_name,
+    const std::vector<objname_to_matching_trace_ids> &index_results, time_t last_updated);
+// Keeps the trace IDs in kept that are also in other; both sorted, and kept without duplicates.
+void intersect_sorted_trace_ids(std::vector<trace_id_t> &kept, const std::vector<trace_id_t> &other);
+// Sorts and dedupes each batch's trace IDs, so intersecting them is a merge.
+void sort_index_result(objname_to_matching_trace_ids &index_result);
+// The batch's structurally matching trace IDs that every index result also has, sorted;
+// all of them if the indices were last updated before the batch.  Index results
+// sorted by sort_index_result() are merged in place; others are sorted first.
+std::vector<trace_id_t> intersect_index_results_in_batch(
+    const std::string &batch_name, const std::vector<objname_to_matching_trace_ids> &index_results,
+    const std::vector<trace_id_t> &candidates, time_t last_updated);
+std::vector<trace_id_t> intersect_index_results_in_batch(
+    const std::string &batch_name, const std::vector<objname_to_matching_trace_ids> &index_results,
+    const traces_by_structure &structural_results, time_t last_updated);
+std::vector<std::string> get_return_values_for_batch(
+    const std::string &batch_name,
+    std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, const trace_structure &query_trace, storage_backend* client);
+// The batch's partial aggregate of its filtered matches; span objects are
+// only read if the aggregate needs values or an attribute from the spans.
+grouped_aggregate aggregate_batch(
+    const std::string &batch_name,
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, const aggregate_spec &spec, const trace_structure &query_trace,
+    storage_backend* client);
+// The batch's k slowest traces among its filtered matches with a return span
+// at least threshold_ns long, slowest first.
+std::vector<ranked_trace> top_k_batch(
+    const std::string &batch_name,
+    const std::tuple<std::vector<trace_id_t>, std::map<trace_id_t, iso_to_span_id>> &filtered,
+    const traces_by_structure &struct_results, fetched_data &fetched,
+    const return_value &ret, size_t k, uint64_t threshold_ns, const trace_structure &query_trace,
+    storage_backend* client);
+// False if the batch's latency summaries show that none of the services has
+// a span at least threshold_ns long there; true if one might, or a summary
+// can't be read.
+bool may_have_spans_this_slow(const std::string &batch_name, const std::set<std::string> &services,
+    uint64_t threshold_ns, storage_backend* client);
 objname_to_matching_trace_ids morph_struct_result_to_objname_to_matching_trace_ids(
-    traces_by_structure struct_results);
-std::map<std::string, iso_to_span_id> get_iso_map_to_span_id_info(
-    traces_by_structure struct_results, int return_node_index, gcs::Client* client);
+    const traces_by_structure &struct_results);
+std::map<trace_id_t, iso_to_span_id> get_iso_map_to_span_id_info(
+    const traces_by_structure &struct_results, int return_node_index, storage_backend* client);
 
 std::vector<std::string> brute_force_per_batch(std::string batch_name,
-                                               std::vector<std::string> trace_ids,
-                                               traces_by_structure struct_results,
+                                               std::vector<trace_id_t> trace_ids,
+                                               traces_by_structure &struct_results,
                                                std::vector<query_condition> conditions,
                                                return_value ret,
                                                trace_structure query_trace,
-                                               gcs::Client* client);
+                                               storage_backend* client);
 
 int dummy_tests();
 
@@ -1,6 +1,7 @@
 #include "get_traces_by_structure.h"
 #include "graph_query.h"
 #include "indices/query_bloom_index.h"
+#include "metrics.h"
 
 struct QueryData {
     trace_structure graph;
@@ -10,7 +11,7 @@ struct QueryData {
 
 
 
-std::string fetch_obj_name_from_index(std::string trace_id, int start_time, int end_time, gcs::Client* client) {
+std::string fetch_obj_name_from_index(std::string trace_id, int start_time, int end_time, storage_backend* client) {
     StatusOr<objname_to_matching_trace_ids> res_tup = query_bloom_index_for_value(client,
         trace_id, "index-trace-id-quest-new-one-csv", start_time, end_time);
     if (!res_tup.ok()) {
@@ -211,20 +212,26 @@ QueryData canonical() {
     return query;
 }
 
-int64_t perform_query(QueryData query_data, bool verbose, time_t start_time, time_t end_time, gcs::Client* client) {
+int64_t perform_query(QueryData query_data, bool verbose, time_t start_time, time_t end_time, size_t limit,
+    bool profiled, storage_backend* client) {
     boost::posix_time::ptime start, stop;
+    query_profile profile;
 
     start = boost::posix_time::microsec_clock::local_time();
-    auto res = query(query_data.graph, start_time, end_time, query_data.conditions, query_data.ret, verbose, client);
+    auto res = query(query_data.graph, start_time, end_time, query_data.conditions, query_data.ret, verbose, client,
+        limit, profiled ? &profile : nullptr);
     stop = boost::posix_time::microsec_clock::local_time();
 
     boost::posix_time::time_duration dur = stop - start;
     int64_t milliseconds = dur.total_milliseconds();
     std::cout << "Total results: " << res.size() << std::endl;
+    if (profiled) {
+        std::cout << profile.to_json() << std::endl;
+    }
     return milliseconds;
 }
 
-int64_t perform_trace_query(std::string trace_id, time_t start_time, time_t end_time, gcs::Client* client) {
+int64_t perform_trace_query(std::string trace_id, time_t start_time, time_t end_time, storage_backend* client) {
     boost::posix_time::ptime start, stop;
     start = boost::posix_time::microsec_clock::local_time();
 
@@ -238,7 +245,8 @@ int64_t perform_trace_query(std::string trace_id, time_t start_time, time_t end_
 }
 
 int main(int argc, char* argv[]) {
-    auto client = gcs::Client();
+    start_metrics_export();
+    auto client = make_storage_backend();
 
     QueryData data = four_fan_out();
     int n = 1;
@@ -263,12 +271,27 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    size_t limit = 0;
+    if (argc > 3) {
+        limit = std::stoul(argv[3]);
+    }
+
+    const bool profiled = argc > 4 && std::string(argv[4]) == "profile";
+    if (argc > 4 && std::string(argv[4]) == "explain") {
+        std::cout << explain_query(1670796531, 1670829563, data.conditions, client.get());
+        return 0;
+    }
+
     std::vector<time_t> times(n, 0);
     for (int i = 0; i < n; i++) {
-        auto time_taken = perform_query(data, false, 1670796531, 1670829563, &client);
+        auto time_taken = perform_query(data, false, 1670796531, 1670829563, limit, profiled, client.get());
         std::cout << "Time Taken: " << time_taken << " ms\n" << std::endl;
         times[i] = time_taken;
     }
+    std::cout << format_cache_stats("Object cache", object_cache().get_stats()) << std::endl;
+    std::cout << format_cache_stats("TracesData cache", traces_data_cache().get_stats()) << std::endl;
+    std::cout << format_single_flight_stats("Object reads", object_reads_in_flight().get_stats()) << std::endl;
+    std::cout << format_single_flight_stats("TracesData parses", traces_data_parses_in_flight().get_stats()) << std::endl;
 
     // Calculate Median
     std::sort(times.begin(), times.end());
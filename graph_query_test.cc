@@ -0,0 +1,486 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "graph_query.h"
+#include "test_util.h"
+
+namespace {
+
+const char TRACE_A[] = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+const char TRACE_B[] = "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb";
+// Past 2^31, as every real nanosecond timestamp is.
+const uint64_t START_NS = 3000000000;
+
+class GraphQuery : public local_backend_test {
+ protected:
+  void SetUp() override {
+    local_backend_test::SetUp();
+    const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    const std::string structs = std::string(TRACE_STRUCT_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    ASSERT_TRUE(backend_->create_bucket(hashes).ok());
+    ASSERT_TRUE(backend_->create_bucket(structs).ok());
+    ASSERT_TRUE(backend_->create_bucket(std::string(SERVICES_BUCKET_PREFIX) + BUCKETS_SUFFIX).ok());
+
+    // frontend -> cart in the first batch, frontend on its own in both
+    ASSERT_TRUE(backend_->write(structs, "00-150-250", std::string("Trace ID: ") + TRACE_A + ":\n"
+      ":1111111111111111:frontend:1\n"
+      "1111111111111111:2222222222222222:cart:2\n"
+      "Trace ID: " + TRACE_B + ":\n"
+      ":3333333333333333:frontend:1\n").ok());
+    ASSERT_TRUE(backend_->write(structs, "01-300-400", std::string("Trace ID: ") + TRACE_B + ":\n"
+      ":3333333333333333:frontend:1\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "12/00-150-250", std::string(TRACE_A) + "\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "34/00-150-250", std::string(TRACE_B) + "\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "34/01-300-400", std::string(TRACE_B) + "\n").ok());
+
+    // frontend's spans: TRACE_A's takes 500ns, TRACE_B's 100ns in the first
+    // batch and 300ns in the second
+    write_frontend_spans("00-150-250", {{TRACE_A, "1111111111111111", START_NS, START_NS + 500},
+                                        {TRACE_B, "3333333333333333", START_NS + 2, START_NS + 102}});
+    write_frontend_spans("01-300-400", {{TRACE_B, "3333333333333333", START_NS + 4, START_NS + 304}});
+  }
+
+  // Writes frontend's span object for the batch, and its latency summary.
+  void write_frontend_spans(const std::string &batch_name,
+                            const std::vector<std::tuple<const char*, const char*, uint64_t, uint64_t>> &spans);
+};
+
+query_condition latency_condition(const std::string &value, property_comparison comp) {
+  query_condition condition = {0, int_value, nullptr, value, comp, "", true, false};
+  return condition;
+}
+
+query_condition attribute_condition(const std::string &key, const std::string &value, property_comparison comp) {
+  query_condition condition = {0, string_value, nullptr, value, comp, key, false, true};
+  return condition;
+}
+
+trace_id_t id(const char* hex) {
+  trace_id_t parsed;
+  EXPECT_TRUE(trace_id_t::from_hex(hex, parsed));
+  return parsed;
+}
+
+void GraphQuery::write_frontend_spans(
+    const std::string &batch_name,
+    const std::vector<std::tuple<const char*, const char*, uint64_t, uint64_t>> &spans) {
+  ot::TracesData data;
+  auto scope = data.add_resource_spans()->add_scope_spans();
+  for (auto &[trace_id, span_id, start, end] : spans) {
+    auto span = scope->add_spans();
+    span->set_trace_id(id(trace_id).bytes());
+    std::string span_id_bytes;
+    for (int i = 0; i < SPAN_ID_LENGTH; i += 2) {
+      span_id_bytes.push_back(static_cast<char>(std::stoi(std::string(span_id + i, 2), nullptr, 16)));
+    }
+    span->set_span_id(span_id_bytes);
+    span->set_start_time_unix_nano(start);
+    span->set_end_time_unix_nano(end);
+  }
+  const std::string bucket = std::string("frontend") + BUCKETS_SUFFIX;
+  const std::string services = std::string(SERVICES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+  ASSERT_TRUE(backend_->write(services, bucket + "/" + batch_name, data.SerializeAsString()).ok());
+  ASSERT_TRUE(write_span_latency_summary(bucket, batch_name, backend_.get()).ok());
+}
+
+}  // namespace
+
+TEST_F(GraphQuery, ReturnsTraceIdsFromEveryBatch) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 2;
+  query_trace.node_names = {{0, "frontend"}, {1, "cart"}};
+  query_trace.edges.insert(std::make_pair(0, 1));
+  return_value ret = {0, bytes_value, nullptr};
+
+  auto results = query(query_trace, 100, 450, {}, ret, false, backend_.get());
+  EXPECT_EQ(results, std::vector<std::string>({TRACE_A}));
+
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  query_trace.edges.clear();
+  results = query(query_trace, 100, 450, {}, ret, false, backend_.get());
+  std::sort(results.begin(), results.end());
+  EXPECT_EQ(results, std::vector<std::string>({TRACE_A, TRACE_B, TRACE_B}));
+}
+
+TEST_F(GraphQuery, StopsAtLimitOrWhenTheCallbackDeclines) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  return_value ret = {0, bytes_value, nullptr};
+
+  EXPECT_EQ(query(query_trace, 100, 450, {}, ret, false, backend_.get(), 2).size(), 2);
+
+  std::vector<std::string> seen;
+  query_cancellation cancellation;
+  Status status = query_streaming(query_trace, 100, 450, {}, ret, false, backend_.get(),
+      [&seen](const std::string &result) {
+        seen.push_back(result);
+        return false;
+      }, 0, &cancellation);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(seen.size(), 1);
+  EXPECT_TRUE(cancellation.cancelled());
+
+  query_cancellation cancelled;
+  cancelled.cancel();
+  seen.clear();
+  status = query_streaming(query_trace, 100, 450, {}, ret, false, backend_.get(),
+      [&seen](const std::string &result) {
+        seen.push_back(result);
+        return true;
+      }, 0, &cancelled);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(seen.empty());
+}
+
+TEST_F(GraphQuery, FillsInAProfile) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  return_value ret = {0, bytes_value, nullptr};
+
+  query_profile profile;
+  auto results = query(query_trace, 100, 450, {}, ret, false, backend_.get(), 0, &profile);
+  EXPECT_EQ(results.size(), 3);
+  EXPECT_EQ(profile.results, 3);
+  EXPECT_EQ(profile.stage(batch_listing).items_out, 2);
+  EXPECT_EQ(profile.stage(tracehash_reads).items_in, 2);
+  EXPECT_EQ(profile.stage(tracehash_reads).items_out, 3);
+  EXPECT_EQ(profile.stage(return_extraction).items_out, 3);
+  EXPECT_GT(profile.stage(structural_matching).scopes, 0);
+  // tracehashes are read by pool threads, on behalf of the stage
+  EXPECT_GT(profile.stage(tracehash_reads).object_reads + profile.stage(tracehash_reads).cache_hits, 0);
+  EXPECT_NE(profile.to_json().find("\"stage\": \"span_fetch\""), std::string::npos);
+}
+
+TEST(IntersectIndexResultsInBatch, KeepsTracesEveryIndexHas) {
+  traces_by_structure structures;
+  structures.trace_ids = {id(TRACE_B), id(TRACE_A)};
+
+  objname_to_matching_trace_ids first, second;
+  first["00-150-250"] = {id(TRACE_A), id(TRACE_B)};
+  second["00-150-250"] = {id(TRACE_B)};
+  second["01-300-400"] = {id(TRACE_A)};
+
+  EXPECT_EQ(intersect_index_results_in_batch("00-150-250", {first, second}, structures, 500),
+    std::vector<trace_id_t>({id(TRACE_B)}));
+  EXPECT_TRUE(intersect_index_results_in_batch("01-300-400", {first, second}, structures, 500).empty());
+  // the indices haven't caught up to the batch yet
+  EXPECT_EQ(intersect_index_results_in_batch("00-150-250", {first, second}, structures, 50),
+    std::vector<trace_id_t>({id(TRACE_A), id(TRACE_B)}));
+}
+
+TEST(IntersectSortedTraceIds, AgreesWithSetIntersection) {
+  // every 3rd against every 7th, walked from either side
+  std::vector<trace_id_t> threes, sevens;
+  for (uint64_t i = 0; i < 2000; i++) {
+    trace_id_t trace_id;
+    trace_id.low = i;
+    if (i % 3 == 0) threes.push_back(trace_id);
+    if (i % 7 == 0 && i < 300) sevens.push_back(trace_id);
+  }
+  std::vector<trace_id_t> expected;
+  std::set_intersection(threes.begin(), threes.end(), sevens.begin(), sevens.end(), std::back_inserter(expected));
+
+  std::vector<trace_id_t> kept = threes;
+  intersect_sorted_trace_ids(kept, sevens);
+  EXPECT_EQ(kept, expected);
+  kept = sevens;
+  intersect_sorted_trace_ids(kept, threes);
+  EXPECT_EQ(kept, expected);
+  kept = sevens;
+  intersect_sorted_trace_ids(kept, {});
+  EXPECT_TRUE(kept.empty());
+}
+
+TEST(TracesByStructure, BatchesShareOneSnapshotOfTheShapes) {
+  trace_structure query;
+  query.num_nodes = 1;
+  query.node_names[0] = "frontend";
+  std::string first_trace = std::string("Trace ID: ") + TRACE_A + ":\n:1111111111111111:frontend:1";
+  std::string second_trace = std::string("Trace ID: ") + TRACE_B + ":\n"
+    ":3333333333333333:frontend:1\n3333333333333333:4444444444444444:frontend:2";
+
+  std::vector<matched_structure> structures(2);
+  ASSERT_TRUE(check_shape_validity(morph_trace_object_to_trace_structure(first_trace), query, structures[0].shape));
+  ASSERT_TRUE(check_shape_validity(morph_trace_object_to_trace_structure(second_trace), query, structures[1].shape));
+  merged_shapes all_shapes = merge_structure_shapes(structures);
+  EXPECT_EQ(all_shapes.iso_map_offsets, std::vector<int>({0, 1}));
+
+  traces_by_structure first = structures[0].shape, second = structures[1].shape;
+  append_traces_by_structure_data("00-150-250", {id(TRACE_A)}, first);
+  append_traces_by_structure_data("00-150-250", {id(TRACE_B)}, second);
+  traces_by_structure batch;
+  batch.shapes = all_shapes.shapes;
+  append_traces_of_structure(first, all_shapes.iso_map_offsets[0], &batch);
+  append_traces_of_structure(second, all_shapes.iso_map_offsets[1], &batch);
+
+  EXPECT_EQ(batch.shapes, all_shapes.shapes);
+  EXPECT_EQ(batch.object_names, std::vector<std::string>({"00-150-250"}));
+  EXPECT_EQ(batch.object_name_to_trace_ids_of_interest.at(0), std::vector<int>({0, 1}));
+  iso_map_range a = batch.iso_maps_of(id(TRACE_A)), b = batch.iso_maps_of(id(TRACE_B));
+  EXPECT_EQ(a.end - a.begin, 1);
+  EXPECT_EQ(b.begin, 1);
+  EXPECT_EQ(b.end, 3);  // frontend matches either of the second trace's nodes
+  EXPECT_NE(batch.service_name(b.begin, 0).find("frontend"), std::string::npos);
+  EXPECT_EQ(batch.iso_maps_of(trace_id_t()).end, 0);
+}
+
+TEST_F(GraphQuery, RejectsAnExpressionOverConditionsItWasNotGiven) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  return_value ret = {0, bytes_value, nullptr};
+
+  Status status = query_streaming(query_trace, 100, 450, {}, or_of({leaf_condition(0)}), ret, false,
+      backend_.get(), [](const std::string & /*result*/) { return true; });
+  EXPECT_EQ(status.code(), google::cloud::StatusCode::kInvalidArgument);
+}
+
+TEST_F(GraphQuery, RunsQueriesOverOneSharedScan) {
+  return_value ret = {0, bytes_value, nullptr};
+  batched_query frontend_to_cart;
+  frontend_to_cart.query_trace.num_nodes = 2;
+  frontend_to_cart.query_trace.node_names = {{0, "frontend"}, {1, "cart"}};
+  frontend_to_cart.query_trace.edges.insert(std::make_pair(0, 1));
+  frontend_to_cart.ret = ret;
+  batched_query frontend;
+  frontend.query_trace.num_nodes = 1;
+  frontend.query_trace.node_names = {{0, "frontend"}};
+  frontend.ret = ret;
+  query_profile profile;
+  frontend.profile = &profile;
+  batched_query malformed = frontend;
+  malformed.query_trace.num_nodes = 3;
+  malformed.profile = nullptr;
+  batched_query limited = frontend;
+  limited.profile = nullptr;
+  limited.limit = 1;
+
+  query_profile shared_profile;
+  std::vector<batched_query_result> results = query_batch(
+      {frontend_to_cart, frontend, malformed, limited}, 100, 450, false, backend_.get(), &shared_profile);
+  ASSERT_EQ(results.size(), 4);
+  EXPECT_TRUE(results[0].status.ok());
+  EXPECT_EQ(results[0].results, std::vector<std::string>({TRACE_A}));
+  std::sort(results[1].results.begin(), results[1].results.end());
+  EXPECT_EQ(results[1].results, std::vector<std::string>({TRACE_A, TRACE_B, TRACE_B}));
+  EXPECT_EQ(results[2].status.code(), google::cloud::StatusCode::kInvalidArgument);
+  EXPECT_EQ(results[3].results.size(), 1);
+
+  EXPECT_EQ(profile.results, 3);
+  EXPECT_GT(profile.stage(structural_matching).scopes, 0);
+  EXPECT_GT(shared_profile.stage(batch_listing).scopes, 0);
+  EXPECT_EQ(profile.stage(batch_listing).scopes, 0);
+}
+
+TEST_F(GraphQuery, AggregatesEachBatchAndMergesThePartials) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 2;
+  query_trace.node_names = {{0, "frontend"}, {1, "cart"}};
+  query_trace.edges.insert(std::make_pair(0, 1));
+  return_value ret = {1, bytes_value, nullptr};
+  aggregate_spec spec;
+  spec.value = aggregate_count_only;
+  spec.group_by = group_by_service;
+
+  auto aggregate = query_aggregate(query_trace, 100, 450, {}, ret, spec, false, backend_.get());
+  ASSERT_TRUE(aggregate.ok()) << aggregate.status().message();
+  ASSERT_EQ(aggregate->size(), 1);
+  EXPECT_EQ(aggregate->at("cart").count, 1);
+
+  // frontend on its own matches in both batches
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  query_trace.edges.clear();
+  ret.node_index = 0;
+  query_profile profile;
+  aggregate = query_aggregate(query_trace, 100, 450, {}, ret, spec, false, backend_.get(), &profile);
+  ASSERT_TRUE(aggregate.ok()) << aggregate.status().message();
+  ASSERT_EQ(aggregate->size(), 1);
+  EXPECT_EQ(aggregate->at("frontend").count, 3);
+  EXPECT_EQ(profile.results, 3);
+
+  // trace IDs aren't numbers
+  spec.value = aggregate_return_value;
+  aggregate = query_aggregate(query_trace, 100, 450, {}, ret, spec, false, backend_.get());
+  EXPECT_EQ(aggregate.status().code(), google::cloud::StatusCode::kInvalidArgument);
+}
+
+TEST_F(GraphQuery, AggregatesReturnValuesTooWideForAnInt) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  return_value ret = {0, int_value, nullptr};
+  ret.func.int_func = &ot::Span::start_time_unix_nano;
+  aggregate_spec spec;
+  spec.value = aggregate_return_value;
+
+  auto aggregate = query_aggregate(query_trace, 100, 450, {}, ret, spec, false, backend_.get());
+  ASSERT_TRUE(aggregate.ok()) << aggregate.status().message();
+  ASSERT_EQ(aggregate->size(), 1);
+  const aggregate_state &state = aggregate->begin()->second;
+  EXPECT_EQ(state.count, 3);
+  EXPECT_EQ(state.min, START_NS);
+  EXPECT_EQ(state.max, START_NS + 4);
+  EXPECT_EQ(state.sum, 3 * START_NS + 6);
+}
+
+TEST_F(GraphQuery, ReturnsTheSlowestTracesAndSkipsBatchesThatCantBeatThem) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  return_value ret = {0, bytes_value, nullptr};
+
+  auto slowest = query_top_k(query_trace, 100, 450, {}, ret, 2, false, backend_.get());
+  ASSERT_TRUE(slowest.ok()) << slowest.status().message();
+  ASSERT_EQ(slowest->size(), 2);
+  EXPECT_EQ(slowest->at(0).trace_id, TRACE_A);
+  EXPECT_EQ(slowest->at(0).latency_ns, 500);
+  EXPECT_EQ(slowest->at(1).trace_id, TRACE_B);
+  EXPECT_EQ(slowest->at(1).latency_ns, 300);
+
+  slowest = query_top_k(query_trace, 100, 450, {}, ret, 1, false, backend_.get());
+  ASSERT_TRUE(slowest.ok()) << slowest.status().message();
+  ASSERT_EQ(slowest->size(), 1);
+  EXPECT_EQ(slowest->at(0).trace_id, TRACE_A);
+  EXPECT_FALSE(query_top_k(query_trace, 100, 450, {}, ret, 0, false, backend_.get()).ok());
+
+  // with TRACE_A found, the second batch has nothing as slow
+  EXPECT_FALSE(may_have_spans_this_slow("01-300-400", {"frontend"}, 500, backend_.get()));
+  EXPECT_TRUE(may_have_spans_this_slow("01-300-400", {"frontend"}, 300, backend_.get()));
+  // no summary to go by
+  EXPECT_TRUE(may_have_spans_this_slow("01-300-400", {"cart"}, 500, backend_.get()));
+}
+
+TEST_F(GraphQuery, TopKNeverReadsTheSpansOfABatchItSkips) {
+  trace_structure query_trace;
+  query_trace.num_nodes = 1;
+  query_trace.node_names = {{0, "frontend"}};
+  return_value ret = {0, bytes_value, nullptr};
+
+  counting_backend backend(root_);
+  const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+  const std::string services = std::string(SERVICES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+  const std::string first_spans = std::string("frontend") + BUCKETS_SUFFIX + "/00-150-250";
+  const std::string second_spans = std::string("frontend") + BUCKETS_SUFFIX + "/01-300-400";
+  // earlier tests leave both batches in the process's caches
+  auto forget_cached = [&]() {
+    object_cache().invalidate(object_cache_key(hashes, "34/01-300-400"));
+    traces_data_cache().invalidate(object_cache_key(services, first_spans));
+    traces_data_cache().invalidate(object_cache_key(services, second_spans));
+  };
+
+  // The second batch's trace hashes are held back until the first batch's
+  // spans have been read, so the first batch usually sets the threshold
+  // before the second's spans would be fetched.  A run where it didn't had
+  // to read them, and is tried again.
+  bool skipped = false;
+  for (int run = 0; run < 20 && false == skipped; run++) {
+    forget_cached();
+    const int first_reads = backend.reads(first_spans);
+    const int second_reads = backend.reads(second_spans);
+    backend.hold_reads("34/01-300-400");
+    std::thread releaser([&]() {
+      while (backend.reads(first_spans) == first_reads) {
+        std::this_thread::yield();
+      }
+      backend.release_reads();
+    });
+    auto slowest = query_top_k(query_trace, 100, 450, {}, ret, 1, false, &backend, nullptr, nullptr, true);
+    releaser.join();
+    ASSERT_TRUE(slowest.ok()) << slowest.status().message();
+    ASSERT_EQ(slowest->size(), 1);
+    EXPECT_EQ(slowest->at(0).trace_id, TRACE_A);
+    EXPECT_EQ(backend.reads(first_spans), first_reads + 1);
+    skipped = backend.reads(second_spans) == second_reads;
+  }
+  EXPECT_TRUE(skipped);
+
+  forget_cached();
+  const int second_reads = backend.reads(second_spans);
+  auto slowest = query_top_k(query_trace, 100, 450, {}, ret, 1, false, &backend, nullptr, nullptr, false);
+  ASSERT_TRUE(slowest.ok()) << slowest.status().message();
+  EXPECT_EQ(slowest->at(0).trace_id, TRACE_A);
+  EXPECT_EQ(backend.reads(second_spans), second_reads + 1);
+}
+
+TEST(ConditionsOnColumns, AgreeWithTheSpans) {
+  // more than one word of the bitmap, with every kind of attribute value
+  ot::TracesData data;
+  auto scope = data.add_resource_spans()->add_scope_spans();
+  for (int i = 0; i < 70; i++) {
+    auto span = scope->add_spans();
+    span->set_span_id(std::string(7, '\0') + static_cast<char>(i + 1));
+    span->set_start_time_unix_nano(START_NS + 1000 * i);
+    span->set_end_time_unix_nano(START_NS + 1000 * i + 10 * (i % 20));
+    if (i % 3 != 2) {
+      auto method = span->add_attributes();
+      method->set_key("http.method");
+      method->mutable_value()->set_string_value(i % 3 == 0 ? "GET" : "POST");
+    }
+    auto other = span->add_attributes();
+    switch (i % 4) {
+      case 0:
+        other->set_key("retries");
+        other->mutable_value()->set_int_value(i % 5);
+        break;
+      case 1:
+        other->set_key("ratio");
+        other->mutable_value()->set_double_value(i / 8.0);
+        break;
+      case 2:
+        other->set_key("cached");
+        other->mutable_value()->set_bool_value(i % 8 == 2);
+        break;
+      case 3:
+        other->set_key("payload");
+        other->mutable_value()->set_bytes_value("\x01\x02");
+        break;
+    }
+  }
+  auto columns = span_columns::parse(string_object(serialize_span_columns(data, 1)));
+  ASSERT_TRUE(columns.ok());
+
+  // how many spans the condition holds on, checking the columns' answer for
+  // each span against does_condition_hold()'s
+  auto spans_matching = [&](const query_condition &condition) {
+    const compiled_condition compiled = compile_condition(condition);
+    const selection_bitmap bitmap = evaluate_condition_on_columns(*columns.value(), compiled);
+    EXPECT_EQ(bitmap.size(), 2);
+    int matching = 0;
+    for (int i = 0; i < data.resource_spans(0).scope_spans(0).spans_size(); i++) {
+      const bool on_columns = (bitmap[i / 64] >> (i % 64)) & 1;
+      const bool on_span = does_condition_hold(&data.resource_spans(0).scope_spans(0).spans(i), compiled);
+      EXPECT_EQ(on_columns, on_span) << "span " << i;
+      matching += on_span;
+    }
+    return matching;
+  };
+
+  EXPECT_EQ(spans_matching(latency_condition("100", Equal_to)), 3);
+  EXPECT_EQ(spans_matching(latency_condition("100", Less_than)), 40);
+  EXPECT_EQ(spans_matching(latency_condition("100", Greater_than)), 27);
+  EXPECT_EQ(spans_matching(latency_condition("ten", Greater_than)), 0);
+
+  EXPECT_EQ(spans_matching(attribute_condition("http.method", "GET", Equal_to)), 24);
+  EXPECT_EQ(spans_matching(attribute_condition("http.method", "POST", Less_than)), 24);
+  EXPECT_EQ(spans_matching(attribute_condition("http.method", "GET", Greater_than)), 23);
+  EXPECT_EQ(spans_matching(attribute_condition("missing", "GET", Equal_to)), 0);
+  EXPECT_EQ(spans_matching(attribute_condition("missing", "", Greater_than)), 0);
+
+  // values that aren't strings compare as their text
+  EXPECT_GT(spans_matching(attribute_condition("retries", "2", Equal_to)), 0);
+  EXPECT_GT(spans_matching(attribute_condition("retries", "2", Greater_than)), 0);
+  EXPECT_GT(spans_matching(attribute_condition("ratio", "4.000000", Less_than)), 0);
+  EXPECT_GT(spans_matching(attribute_condition("cached", "true", Equal_to)), 0);
+  EXPECT_EQ(spans_matching(attribute_condition("payload", "", Greater_than)), 0);
+}
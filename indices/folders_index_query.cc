@@ -1,33 +1,33 @@
 #include "folders_index_query.h"
 
-StatusOr<std::unordered_map<std::string, std::vector<std::string>>> get_obj_name_to_trace_ids_map_from_folders_index(
-	std::string attr_key, std::string attr_val, int start_time, int end_time, gcs::Client* client
+StatusOr<objname_to_matching_trace_ids> get_obj_name_to_trace_ids_map_from_folders_index(
+	std::string attr_key, std::string attr_val, int start_time, int end_time, storage_backend* client
 ) {
-	std::vector<std::future<StatusOr<std::unordered_map<std::string, std::vector<std::string>>>>> response_futures;
+	std::vector<std::future<StatusOr<objname_to_matching_trace_ids>>> response_futures;
 	std::string bucket_name = get_bucket_name_for_attr(attr_key);
 	std::string folder = get_folder_name_from_attr_value(attr_val) + "/";
 
-	for (auto&& object_metadata : client->ListObjects(bucket_name, gcs::Prefix(folder))) {
-		if (!object_metadata.ok()) {
-			std::cerr << object_metadata.status().message() << std::endl;
-			return object_metadata.status();
-		}
-
+	auto objects = client->list_objects(bucket_name, folder);
+	if (!objects.ok()) {
+		std::cerr << objects.status().message() << std::endl;
+		return objects.status();
+	}
+	for (auto& object_metadata : objects.value()) {
         if (false == is_object_within_timespan(
-                extract_batch_timestamps(object_metadata->name()), start_time, end_time)) {
+                extract_batch_timestamps(object_metadata.name), start_time, end_time)) {
             continue;
         }
 
-		response_futures.push_back(std::async(
-			std::launch::async,
+		response_futures.push_back(executor::get().submit(
+			io_pool,
 			process_findex_object_and_retrieve_obj_name_to_trace_ids_map,
-			object_metadata->name(), bucket_name, start_time, end_time, client));
+			object_metadata.name, bucket_name, start_time, end_time, client));
 	}
 
-	std::unordered_map<std::string, std::vector<std::string>> response;
+	objname_to_matching_trace_ids response;
 	for (int i = 0; i < response_futures.size(); i++) {
 		auto& fut = response_futures[i];
-		auto obj_name_to_trace_ids_map = fut.get();
+		auto obj_name_to_trace_ids_map = executor::get().wait(fut);
 		if (!obj_name_to_trace_ids_map.ok()) {
 			std::cerr <<
 				"Error in get_obj_name_to_trace_ids_map_from_folders_index " <<
@@ -43,11 +43,11 @@ StatusOr<std::unordered_map<std::string, std::vector<std::string>>> get_obj_name
 	return response;
 }
 
-StatusOr<std::unordered_map<std::string, std::vector<std::string>>>
+StatusOr<objname_to_matching_trace_ids>
 process_findex_object_and_retrieve_obj_name_to_trace_ids_map(
-	std::string findex_obj_name, std::string findex_bucket_name, int start_time, int end_time, gcs::Client* client
+	std::string findex_obj_name, std::string findex_bucket_name, int start_time, int end_time, storage_backend* client
 ) {
-	std::unordered_map<std::string, std::vector<std::string>> response;
+	objname_to_matching_trace_ids response;
 
 	auto object_content = read_object(findex_bucket_name, findex_obj_name, client);
 	if (!object_content.ok()) {
@@ -67,10 +67,11 @@ process_findex_object_and_retrieve_obj_name_to_trace_ids_map(
         if (false == is_object_within_timespan(extract_batch_timestamps(obj_name), start_time, end_time)) {
             continue;
         }
-		std::vector<std::string> trace_ids;
+		std::vector<trace_id_t> trace_ids;
 		for (uint64_t i = 1; i < lines.size(); i++) {
-			if (lines[i].length() > 1) {
-				trace_ids.push_back(lines[i]);
+			trace_id_t trace_id;
+			if (trace_id_t::from_hex(lines[i], trace_id)) {
+				trace_ids.push_back(trace_id);
 			}
 		}
 		response[obj_name] = trace_ids;
@@ -78,7 +79,7 @@ process_findex_object_and_retrieve_obj_name_to_trace_ids_map(
 	return response;
 }
 
-void print_folders_index_query_res(std::unordered_map<std::string, std::vector<std::string>> res) {
+void print_folders_index_query_res(objname_to_matching_trace_ids res) {
 	for (auto obj_name_and_trace_ids : res) {
 		std::cout << obj_name_and_trace_ids.first << std::endl;
 		for (auto curr_trace_id : obj_name_and_trace_ids.second) {
@@ -11,19 +11,16 @@
 
 #include "common.h"
 #include "make_folders_index/trace_attributes.h"
-#include "google/cloud/storage/client.h"
+#include "storage.h"
 
-namespace gcs = ::google::cloud::storage;
-using ::google::cloud::StatusOr;
 
-
-StatusOr<std::unordered_map<std::string, std::vector<std::string>>> get_obj_name_to_trace_ids_map_from_folders_index(
-	std::string attr_key, std::string attr_val, int start_time, int end_time, gcs::Client* client
+StatusOr<objname_to_matching_trace_ids> get_obj_name_to_trace_ids_map_from_folders_index(
+	std::string attr_key, std::string attr_val, int start_time, int end_time, storage_backend* client
 );
-StatusOr<std::unordered_map<std::string, std::vector<std::string>>>
+StatusOr<objname_to_matching_trace_ids>
 process_findex_object_and_retrieve_obj_name_to_trace_ids_map(
-	std::string findex_obj_name, std::string findex_bucket_name, int start_time, int end_time, gcs::Client* client
+	std::string findex_obj_name, std::string findex_bucket_name, int start_time, int end_time, storage_backend* client
 );
-void print_folders_index_query_res(std::unordered_map<std::string, std::vector<std::string>> res);
+void print_folders_index_query_res(objname_to_matching_trace_ids res);
 
 #endif  // INDICES_FOLDERS_INDEX_QUERY_H_
@@ -1,8 +1,8 @@
 #include "folders_index_query.h"
 
 int main() {
-    auto client = gcs::Client();
-    auto res = get_obj_name_to_trace_ids_map_from_folders_index("span.kind", "client", 1665612696, 1665612699, &client);
+    auto client = make_storage_backend();
+    auto res = get_obj_name_to_trace_ids_map_from_folders_index("span.kind", "client", 1665612696, 1665612699, client.get());
     if (!res.ok()) {
         std::cout << res.status() << std::endl;
     } else {
@@ -3,7 +3,7 @@
 
 #include "folders_index.h"
 
-int update_index(gcs::Client* client, time_t last_updated, std::string indexed_attribute
+int update_index(storage_backend* client, time_t last_updated, std::string indexed_attribute
 ) {
 	std::vector<std::string> span_buckets_names = get_spans_buckets_names(client);
 	std::cout << "Total Buckets: " << span_buckets_names.size() << std::endl;
@@ -25,7 +25,7 @@ int update_index(gcs::Client* client, time_t last_updated, std::string indexed_a
 	return 0;
 }
 
-void update_index_batched(gcs::Client* client, time_t last_updated, std::string indexed_attribute,
+void update_index_batched(storage_backend* client, time_t last_updated, std::string indexed_attribute,
 	std::vector<std::string> span_buckets_names, std::vector<std::string>& trace_struct_object_names,
 	int batch_start_ind, int batch_size
 ) {
@@ -47,14 +47,14 @@ void update_index_batched(gcs::Client* client, time_t last_updated, std::string
 			continue;
 		}
 
-		response_futures.push_back(std::make_pair(object_name, std::async(std::launch::async,
+		response_futures.push_back(std::make_pair(object_name, executor::get().submit(io_pool,
 			get_attr_to_trace_ids_map, object_name, indexed_attribute,
 			std::ref(span_buckets_names), client)));
 	}
 	index_batch current_index_batch = index_batch();
 	for (uint64_t i = 0; i < response_futures.size(); i++) {
 		auto object_name = response_futures[i].first;
-		auto attr_to_trace_ids_map = response_futures[i].second.get();
+		auto attr_to_trace_ids_map = executor::get().wait(response_futures[i].second);
 
 		current_index_batch.trace_ids_with_timestamps.push_back(std::make_pair(object_name, attr_to_trace_ids_map));
 
@@ -92,16 +92,17 @@ std::vector<std::string> get_all_attr_values(index_batch& current_index_batch) {
 	return response;
 }
 
-std::vector<std::string> get_all_object_names(std::string bucket_name, gcs::Client* client) {
+std::vector<std::string> get_all_object_names(std::string bucket_name, storage_backend* client) {
 	std::vector<std::string> response;
 
-	for (auto&& object_metadata : client->ListObjects(bucket_name)) {
-		if (!object_metadata) {
-			std::cerr << object_metadata.status().message() << std::endl;
-			exit(1);
-		}
+	auto objects = client->list_objects(bucket_name);
+	if (!objects.ok()) {
+		std::cerr << objects.status().message() << std::endl;
+		exit(1);
+	}
 
-		response.push_back(object_metadata->name());
+	for (auto& object_metadata : objects.value()) {
+		response.push_back(object_metadata.name);
 	}
 
 	return response;
@@ -126,7 +127,7 @@ std::vector<std::string> sort_object_names_on_start_time(std::vector<std::string
 
 std::unordered_map<std::string, std::vector<std::string>> get_attr_to_trace_ids_map(
 	std::string object_name, std::string indexed_attribute,
-	std::vector<std::string>& span_buckets_names, gcs::Client* client
+	std::vector<std::string>& span_buckets_names, storage_backend* client
 ) {
 	std::unordered_map<std::string, std::vector<std::string>> attr_to_trace_ids_map;
 
@@ -167,7 +168,7 @@ void take_per_field_union(std::unordered_map<std::string, std::vector<std::strin
 }
 
 std::unordered_map<std::string, std::vector<std::string>> calculate_attr_to_trace_ids_map_for_microservice(
-	std::string span_bucket_name, std::string object_name, std::string indexed_attribute, gcs::Client* client
+	std::string span_bucket_name, std::string object_name, std::string indexed_attribute, storage_backend* client
 ) {
 	std::unordered_map<std::string, std::vector<std::string>> response;  // attr_val_to_vec_of_traceids
 	std::string raw_span_bucket_obj_content = read_object(span_bucket_name, object_name, client).value();
@@ -286,7 +287,7 @@ void print_index_batch(index_batch& current_index_batch) {
  * @param client
  */
 void export_batch_to_storage(index_batch& current_index_batch, std::string indexed_attribute,
-	std::vector<std::string> attrs_to_export, gcs::Client* client
+	std::vector<std::string> attrs_to_export, storage_backend* client
 ) {
 	for (auto attr_being_exported : attrs_to_export) {
 		batch_timestamp consiledated_timestamp = batch_timestamp();
@@ -339,7 +340,7 @@ void export_batch_to_storage(index_batch& current_index_batch, std::string index
 }
 
 void update_last_updated_label_if_needed(
-	std::string bucket_name, std::string new_last_updated, gcs::Client* client
+	std::string bucket_name, std::string new_last_updated, storage_backend* client
 ) {
 	auto prev_last_updated = get_last_updated_for_bucket(bucket_name, client);
 	time_t new_last_updated_t = (time_t) std::stol(new_last_updated, NULL, 10);
@@ -349,12 +350,11 @@ void update_last_updated_label_if_needed(
 	return;
 }
 
-void update_bucket_label(std::string bucket_name, std::string label_key, std::string label_val, gcs::Client* client) {
-	auto updated_metadata = client->PatchBucket(bucket_name, gcs::BucketMetadataPatchBuilder().SetLabel(
-		label_key, label_val));
+void update_bucket_label(std::string bucket_name, std::string label_key, std::string label_val, storage_backend* client) {
+	auto status = client->set_bucket_label(bucket_name, label_key, label_val);
 
-	if (!updated_metadata) {
-		std::cerr << "Error in update_bucket_label " << updated_metadata.status().message() << std::endl;
+	if (!status.ok()) {
+		std::cerr << "Error in update_bucket_label " << status.message() << std::endl;
 		exit(1);
 	}
 
@@ -377,15 +377,11 @@ void remove_exported_data_from_index_batch(index_batch& current_index_batch, std
 }
 
 void write_object(std::string bucket_name, std::string object_name,
-	std::string& object_to_write, gcs::Client* client
+	std::string& object_to_write, storage_backend* client
 ) {
-	gcs::ObjectWriteStream stream = client->WriteObject(bucket_name, object_name);
-	stream << object_to_write << "\n";
-    stream.Close();
-
-	StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
-	if (!metadata) {
-		std::cerr << "Error in write_object:" << object_name << " => " << metadata.status().message() << std::endl;
+	auto status = client->write(bucket_name, object_name, object_to_write + "\n");
+	if (!status.ok()) {
+		std::cerr << "Error in write_object:" << object_name << " => " << status.message() << std::endl;
 	}
 }
 
@@ -403,37 +399,36 @@ std::string serialize_trace_ids(std::vector<std::string>& trace_ids) {
 	return response;
 }
 
-void create_index_bucket_if_not_present(std::string indexed_attribute, gcs::Client* client) {
+void create_index_bucket_if_not_present(std::string indexed_attribute, storage_backend* client) {
 	auto bucket_name = get_bucket_name_for_attr(indexed_attribute);
 
-	auto bucket_metadata = client->CreateBucketForProject(bucket_name, PROJECT_ID,
-		gcs::BucketMetadata().set_location(BUCKETS_LOCATION).set_storage_class(gcs::storage_class::Regional()));
+	auto create_status = client->create_bucket(bucket_name);
 
-	if (bucket_metadata.status().code() == ::google::cloud::StatusCode::kAborted) {
+	if (create_status.code() == ::google::cloud::StatusCode::kAborted) {
 		// ignore this, means we've already created the bucket
-	} else if (!bucket_metadata) {
-		std::cerr << "Error creating bucket " << bucket_name << ", status=" << bucket_metadata.status() << "\n";
+	} else if (!create_status.ok()) {
+		std::cerr << "Error creating bucket " << bucket_name << ", status=" << create_status << "\n";
 		exit(1);
 	}
 
-	auto updated_metadata = client->PatchBucket(bucket_name,
-		gcs::BucketMetadataPatchBuilder().SetLabel("bucket_type", "folder_index"));
+	auto label_status = client->set_bucket_label(bucket_name, "bucket_type", "folder_index");
 
-    if (!updated_metadata) {
-      std::cerr << updated_metadata.status().message() << std::endl;
+    if (!label_status.ok()) {
+      std::cerr << label_status.message() << std::endl;
 	  exit(1);
     }
 
 	return;
 }
 
-std::string read_bucket_label(std::string bucket_name, std::string label_key, gcs::Client* client) {
-	auto bucket_metadata = client->GetBucketMetadata(bucket_name);
-	if (!bucket_metadata) {
-		std::cerr << "Error in read_bucket_label: " << bucket_metadata.status().message() << std::endl;
+std::string read_bucket_label(std::string bucket_name, std::string label_key, storage_backend* client) {
+	auto bucket_labels = client->get_bucket_labels(bucket_name);
+	if (!bucket_labels) {
+		std::cerr << "Error in read_bucket_label: " << bucket_labels.status().message() << std::endl;
+		return "";
 	}
 
-	for (auto const& kv : bucket_metadata->labels()) {
+	for (auto const& kv : bucket_labels.value()) {
 		if (kv.first == label_key) {
 			return kv.second;
 		}
@@ -442,7 +437,7 @@ std::string read_bucket_label(std::string bucket_name, std::string label_key, gc
 	return "";
 }
 
-time_t get_last_updated_for_bucket(std::string bucket_name, gcs::Client* client) {
+time_t get_last_updated_for_bucket(std::string bucket_name, storage_backend* client) {
 	auto last_updated = read_bucket_label(bucket_name, "last_updated", client);
 	if (last_updated == "") {
 		return 0;
@@ -3,17 +3,17 @@
 int main(int argc, char* argv[]) {
 	dummy_tests();
 
-	auto client = gcs::Client();
+	auto client = make_storage_backend();
 
 	std::string indexed_attribute = "http.status_code";
-	create_index_bucket_if_not_present(indexed_attribute, &(client));
+	create_index_bucket_if_not_present(indexed_attribute, client.get());
 	time_t last_updated = get_last_updated_for_bucket(get_bucket_name_for_attr(
-		indexed_attribute), &(client));
+		indexed_attribute), client.get());
 
 	boost::posix_time::ptime start, stop;
 	start = boost::posix_time::microsec_clock::local_time();
 
-	update_index(&(client), last_updated, indexed_attribute);
+	update_index(client.get(), last_updated, indexed_attribute);
 
 	stop = boost::posix_time::microsec_clock::local_time();
 
@@ -1,6 +1,6 @@
 #include "range_index.h"
 
 int main(int argc, char* argv[]) {
-    auto client = gcs::Client();
-    Status ret = update("latency", &client);
+    auto client = make_storage_backend();
+    Status ret = update("latency", client.get());
 }
@@ -4,53 +4,46 @@
 #include <string>
 #include <utility>
 
-StatusOr<time_t> create_index_bucket(gcs::Client* client, std::string index_bucket) {
-    google::cloud::StatusOr<gcs::BucketMetadata> bucket_metadata =
-      client->CreateBucketForProject(
-          index_bucket, PROJECT_ID,
-          gcs::BucketMetadata()
-              .set_location(BUCKETS_LOCATION)
-              .set_storage_class(gcs::storage_class::Regional()));
-
-    if (bucket_metadata.status().code() == ::google::cloud::StatusCode::kAborted) {
+StatusOr<time_t> create_index_bucket(storage_backend* client, std::string index_bucket) {
+    Status create_status = client->create_bucket(index_bucket);
+
+    if (create_status.code() == ::google::cloud::StatusCode::kAborted) {
       // means we've already created the bucket
-      for (auto const & kv : bucket_metadata->labels()) {
+      auto bucket_labels = client->get_bucket_labels(index_bucket);
+      if (!bucket_labels) {
+          return bucket_labels.status();
+      }
+      for (auto const & kv : bucket_labels.value()) {
           if (kv.first == "last_updated") {
               return time_t_from_string(kv.second);
           }
       }
-    } else if (!bucket_metadata) {
+    } else if (!create_status.ok()) {
         std::cerr << "Error creating bucket " << index_bucket
-              << ", status=" << bucket_metadata.status() << "\n";
-        return bucket_metadata.status();
+              << ", status=" << create_status << "\n";
+        return create_status;
     }
 
     // set bucket type
-    StatusOr<gcs::BucketMetadata> updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("bucket_type", "range_index"));
+    Status label_status = client->set_bucket_label(index_bucket, "bucket_type", "range_index");
 
-    if (!updated_metadata) {
+    if (!label_status.ok()) {
       std::cerr << "failed to patch metadata for bucket_type" << std::endl;
-      throw std::runtime_error(updated_metadata.status().message());
+      throw std::runtime_error(label_status.message());
     }
-    updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("time_range_per_node",
-        std::to_string(TIME_RANGE_PER_NODE)));
+    label_status = client->set_bucket_label(index_bucket, "time_range_per_node",
+        std::to_string(TIME_RANGE_PER_NODE));
 
-    if (!updated_metadata) {
+    if (!label_status.ok()) {
       std::cerr << "failed to patch metadata for time_range_per_node" << std::endl;
-      throw std::runtime_error(updated_metadata.status().message());
+      throw std::runtime_error(label_status.message());
     }
-    updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("nodes_per_summary",
-        std::to_string(NUM_NODES_PER_SUMMARY)));
+    label_status = client->set_bucket_label(index_bucket, "nodes_per_summary",
+        std::to_string(NUM_NODES_PER_SUMMARY));
 
-    if (!updated_metadata) {
+    if (!label_status.ok()) {
       std::cerr << "failed to patch metadata for nodes_per_summary" << std::endl;
-      throw std::runtime_error(updated_metadata.status().message());
+      throw std::runtime_error(label_status.message());
     }
     return 0;
 }
@@ -60,7 +53,7 @@ std::vector<RawData> retrieve_single_batch_single_bucket_data(
     const int64_t batch_index,
     const std::string bucket_name,
     const std::string attribute_to_index,
-    gcs::Client* client) {
+    storage_backend* client) {
 
     std::vector<RawData> to_return;
 
@@ -146,20 +139,20 @@ StatusOr<std::vector<RawData>> retrieve_single_batch_data(
     const std::vector<std::string> batches,
     const int64_t batch_index,
     const std::string attribute_to_index,
-    gcs::Client* client) {
+    storage_backend* client) {
     std::vector<RawData> to_return;
     std::vector<std::string> span_buckets_names = get_spans_buckets_names(client);
     std::vector<std::future<std::vector<RawData>>> raw_data_futures;
 
     for (int64_t i=0; i < span_buckets_names.size(); i++) {
-        raw_data_futures.push_back(std::async(std::launch::async,
+        raw_data_futures.push_back(executor::get().submit(io_pool,
             retrieve_single_batch_single_bucket_data,
             batches, batch_index, span_buckets_names[i],
             attribute_to_index, client));
     }
 
     for (int64_t i=0; i < raw_data_futures.size(); i++) {
-        std::vector<RawData> data = raw_data_futures[i].get();
+        std::vector<RawData> data = executor::get().wait(raw_data_futures[i]);
         to_return.insert(to_return.end(), data.begin(), data.end());
     }
 
@@ -170,12 +163,12 @@ Status organize_data_into_nodes(
     const std::vector<std::string> &batches,
     const std::string attribute_to_index,
     std::map<time_t, Node>* nodes,
-    gcs::Client* client) {
+    storage_backend* client) {
 
     std::vector<std::future<StatusOr<std::vector<RawData>>>> data_futures;
     data_futures.reserve(batches.size());
     for (int64_t i=0; i < batches.size(); i++) {
-        data_futures.push_back(std::async(std::launch::async,
+        data_futures.push_back(executor::get().submit(io_pool,
             retrieve_single_batch_data,
             batches, i, attribute_to_index, client));
     }
@@ -183,7 +176,7 @@ Status organize_data_into_nodes(
     time_t has_contents = 0;
 
     for (int64_t i=0; i < data_futures.size(); i++) {
-        StatusOr<std::vector<RawData>> partial_data = data_futures[i].get();
+        StatusOr<std::vector<RawData>> partial_data = executor::get().wait(data_futures[i]);
         if (!partial_data.ok()) {
             std::cerr << "partial data failed" << std::endl;
             return partial_data.status();
@@ -206,29 +199,29 @@ Status organize_data_into_nodes(
 
 Status write_node_to_storage(Node& node, std::string node_name,
                             std::string bucket_name,
-                            gcs::Client* client) {
-    gcs::ObjectWriteStream stream = client->WriteObject(bucket_name, node_name);
+                            storage_backend* client) {
+    std::stringstream stream;
     node.Serialize(stream);
-    stream.Close();
-    StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
-    if (!metadata) {
-        throw std::runtime_error(metadata.status().message());
+    Status write_status = client->write(bucket_name, node_name, stream.str());
+    if (!write_status.ok()) {
+        throw std::runtime_error(write_status.message());
     }
     return Status();
 }
 
 Status update_summary_object(const std::map<time_t, Node> &nodes,
                             const time_t start_time, const time_t end_time,
-                            std::string index_bucket, gcs::Client* client) {
+                            std::string index_bucket, storage_backend* client) {
     std::string summary_object_name = "summary-" +
         std::to_string(start_time) + "-" +
         std::to_string(start_time+(TIME_RANGE_PER_NODE*NUM_NODES_PER_SUMMARY));
 
     // first, read object
-    auto reader = client->ReadObject(index_bucket, summary_object_name);
-    if (!reader) {
-        return reader.status();
+    auto summary_object = client->read(index_bucket, summary_object_name);
+    if (!summary_object) {
+        return summary_object.status();
     }
+    stored_object_stream reader(summary_object.value());
     NodeSummary sum;
     Status ret = sum.Deserialize(reader);
     if (!ret.ok()) {
@@ -267,7 +260,7 @@ Status create_summary_object(const std::map<time_t, Node> &nodes,
                              const time_t start_time,
                              const time_t end_time,
                              std::string index_bucket,
-                             gcs::Client* client) {
+                             storage_backend* client) {
     Status ret;
     NodeSummary sum = {
         .start_time = start_time,
@@ -298,22 +291,20 @@ Status create_summary_object(const std::map<time_t, Node> &nodes,
     }
 
     // Now, write the summary object.
-    gcs::ObjectWriteStream stream = client->WriteObject(index_bucket,
-        "summary-"+std::to_string(sum.start_time) + "-" +
-        std::to_string(sum.end_time));
-
+    std::stringstream stream;
     sum.Serialize(stream);
-    stream.Close();
-    StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
-    if (!metadata) {
-        throw std::runtime_error(metadata.status().message());
+    Status write_status = client->write(index_bucket,
+        "summary-"+std::to_string(sum.start_time) + "-" +
+        std::to_string(sum.end_time), stream.str());
+    if (!write_status.ok()) {
+        throw std::runtime_error(write_status.message());
     }
     return Status();
 }
 
 Status send_index_to_gcs(const std::map<time_t, Node> &nodes,
     const time_t last_updated,
-    const time_t now, std::string index_bucket, gcs::Client* client) {
+    const time_t now, std::string index_bucket, storage_backend* client) {
     time_t summary_time = NUM_NODES_PER_SUMMARY * TIME_RANGE_PER_NODE;
     time_t starting_summary_obj_time = last_updated;
     Status ret;
@@ -359,7 +350,7 @@ Status send_index_to_gcs(const std::map<time_t, Node> &nodes,
     return Status();
 }
 
-Status update(std::string indexed_attribute, gcs::Client* client) {
+Status update(std::string indexed_attribute, storage_backend* client) {
     std::string index_bucket = indexed_attribute + "-range-index";
     replace_all(index_bucket, ".", "-");
 
@@ -416,11 +407,9 @@ Status update(std::string indexed_attribute, gcs::Client* client) {
     }
 
     // Now update last_updated, since we just updated the index.
-    StatusOr<gcs::BucketMetadata> updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("last_updated", std::to_string(now)));
-    if (!updated_metadata.ok()) {
-        return updated_metadata.status();
+    Status label_status = client->set_bucket_label(index_bucket, "last_updated", std::to_string(now));
+    if (!label_status.ok()) {
+        return label_status;
     }
     return Status();
 }
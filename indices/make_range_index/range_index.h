@@ -18,6 +18,6 @@ struct RawData {
     std::string data;
 };
 
-Status update(std::string indexed_attribute, gcs::Client* client);
+Status update(std::string indexed_attribute, storage_backend* client);
 
 #endif  // INDICES_MAKE_RANGE_INDEX_RANGE_INDEX_H_
@@ -73,41 +73,32 @@ struct Leaf deserialize_leaf(std::istream &is) {
   If bucket already exists, returns time last updated.
   Otherwise, returns 0.
 */
-time_t create_index_bucket(gcs::Client* client, std::string index_bucket) {
-    google::cloud::StatusOr<gcs::BucketMetadata> bucket_metadata =
-      client->CreateBucketForProject(
-          index_bucket, PROJECT_ID,
-          gcs::BucketMetadata()
-              .set_location(BUCKETS_LOCATION)
-              .set_storage_class(gcs::storage_class::Regional()));
-    if (bucket_metadata.status().code() == ::google::cloud::StatusCode::kAborted) {
+time_t create_index_bucket(storage_backend* client, std::string index_bucket) {
+    Status create_status = client->create_bucket(index_bucket);
+    if (create_status.code() == ::google::cloud::StatusCode::kAborted) {
       // means we've already created the bucket
       std::tuple<time_t, time_t> root;
       time_t granularity;
       get_root_and_granularity(client, root, granularity, index_bucket);
       return std::get<1>(root);
-    } else if (!bucket_metadata) {
+    } else if (!create_status.ok()) {
     std::cerr << "Error creating bucket " << index_bucket
-              << ", status=" << bucket_metadata.status() << "\n";
+              << ", status=" << create_status << "\n";
       return -1;
     }
     // set bucket type
-    StatusOr<gcs::BucketMetadata> updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("bucket_type", "bloom_index"));
+    Status label_status = client->set_bucket_label(index_bucket, "bucket_type", "bloom_index");
 
-    if (!updated_metadata) {
-      throw std::runtime_error(updated_metadata.status().message());
+    if (!label_status.ok()) {
+      throw std::runtime_error(label_status.message());
     }
     return 0;
 }
 
-std::vector<std::string> trace_ids_from_trace_id_object(gcs::Client* client, std::string obj_name) {
+std::vector<std::string> trace_ids_from_trace_id_object(storage_backend* client, std::string obj_name) {
     std::vector<std::string> to_return;
     auto batch_split = split_by_string(obj_name, hyphen);
-    std::string trace_struct_bucket(TRACE_STRUCT_BUCKET_PREFIX);
-    std::string suffix(BUCKETS_SUFFIX);
-    StatusOr<std::string> contents = read_object(trace_struct_bucket+suffix, obj_name, client);
+    StatusOr<std::string> contents = read_structural_object_text(obj_name, client);
     if (!contents.ok()) {
         std::cerr << "trace_ids_from_trace_id_object: error in getting contents" << std::endl;
         return to_return;
@@ -126,12 +117,10 @@ std::vector<std::string> trace_ids_from_trace_id_object(gcs::Client* client, std
     return to_return;
 }
 
-std::vector<std::string> span_ids_from_trace_id_object(gcs::Client* client, std::string obj_name) {
+std::vector<std::string> span_ids_from_trace_id_object(storage_backend* client, std::string obj_name) {
     std::vector<std::string> to_return;
     auto batch_split = split_by_string(obj_name, hyphen);
-    std::string trace_struct_bucket(TRACE_STRUCT_BUCKET_PREFIX);
-    std::string suffix(BUCKETS_SUFFIX);
-    StatusOr<std::string> contents = read_object(trace_struct_bucket+suffix, obj_name, client);
+    StatusOr<std::string> contents = read_structural_object_text(obj_name, client);
     if (!contents.ok()) {
         std::cerr << "span_ids_from_trace_id_object: error in getting contents" << std::endl;
         return to_return;
@@ -148,7 +137,7 @@ std::vector<std::string> span_ids_from_trace_id_object(gcs::Client* client, std:
     return to_return;
 }
 
-std::vector<std::string> get_values_in_span_object(gcs::Client* client, std::string bucket_name,
+std::vector<std::string> get_values_in_span_object(storage_backend* client, std::string bucket_name,
     std::string object_name, property_type prop_type, get_value_func val_func) {
     std::vector<std::string> to_return;
 
@@ -175,7 +164,7 @@ std::vector<std::string> get_values_in_span_object(gcs::Client* client, std::str
     return to_return;
 }
 
-std::vector<std::string> values_from_trace_id_object(gcs::Client* client, std::string obj_name,
+std::vector<std::string> values_from_trace_id_object(storage_backend* client, std::string obj_name,
     std::string property_name, property_type prop_type, get_value_func val_func) {
     std::vector<std::string> to_return;
     // trace ID and span ID are special cases bc you can get them with only the structural object
@@ -188,17 +177,17 @@ std::vector<std::string> values_from_trace_id_object(gcs::Client* client, std::s
     std::vector<std::string> span_buckets_names = get_spans_buckets_names(client);
     std::vector<std::future<std::vector<std::string>>> future_values;
     for (uint64_t i=0; i < span_buckets_names.size(); i++) {
-        future_values.push_back(std::async(std::launch::async, get_values_in_span_object,
+        future_values.push_back(executor::get().submit(io_pool, get_values_in_span_object,
             client, span_buckets_names[i], obj_name, prop_type, val_func));
     }
     for (uint64_t i=0; i < future_values.size(); i++) {
-        auto new_values = future_values[i].get();
+        auto new_values = executor::get().wait(future_values[i]);
         to_return.insert(to_return.end(), new_values.begin(), new_values.end());
     }
     return to_return;
 }
 
-bloom_filter create_bloom_filter_entire_batch(gcs::Client* client, std::string batch,
+bloom_filter create_bloom_filter_entire_batch(storage_backend* client, std::string batch,
     std::string property_name, property_type prop_type, get_value_func val_func) {
     std::cout << "creating entire batch " << std::endl;
     bloom_parameters parameters;
@@ -212,6 +201,9 @@ bloom_filter create_bloom_filter_entire_batch(gcs::Client* client, std::string b
     parameters.compute_optimal_parameters();
     bloom_filter filter(parameters);
     auto values = values_from_trace_id_object(client, batch, property_name, prop_type, val_func);
+    // each value once, so the filter's element count is the batch's distinct values
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
     for (uint64_t i=0; i < values.size(); i++) {
         size_t len = values[i].length();
         const char* values_c_str = values[i].c_str();
@@ -222,7 +214,7 @@ bloom_filter create_bloom_filter_entire_batch(gcs::Client* client, std::string b
 }
 
 bloom_filter create_bloom_filter_partial_batch(
-    gcs::Client* client, std::string batch, time_t earliest, time_t latest,
+    storage_backend* client, std::string batch, time_t earliest, time_t latest,
     std::string property_name, property_type prop_type, get_value_func val_func
 ) {
     std::cout << "creating bloom filter partial batch" << std::endl;
@@ -237,15 +229,15 @@ bloom_filter create_bloom_filter_partial_batch(
     parameters.compute_optimal_parameters();
     bloom_filter filter(parameters);
     auto values_unfiltered = values_from_trace_id_object(client, batch, property_name, prop_type, val_func);
-    std::string trace_struct_bucket(TRACE_STRUCT_BUCKET_PREFIX);
-    std::string suffix(BUCKETS_SUFFIX);
-    StatusOr<std::string> contents = read_object(trace_struct_bucket+suffix, batch, client);
+    StatusOr<std::string> contents = read_structural_object_text(batch, client);
     if (!contents.ok()) {
         std::cerr << "create_bloom_filter_partial_batch: Error reading object: " << contents.status() << "\n";
         throw std::runtime_error("Error reading trace object");
     }
     auto values = filter_trace_ids_based_on_query_timestamp(
         values_unfiltered, batch, contents.value(), earliest, latest, client);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
 
     for (uint64_t i=0; i < values.size(); i++) {
         filter.insert(values[i]);
@@ -254,7 +246,7 @@ bloom_filter create_bloom_filter_partial_batch(
 }
 
 
-Leaf make_leaf(gcs::Client* client, BatchObjectNames &batch,
+Leaf make_leaf(storage_backend* client, BatchObjectNames &batch,
     time_t start_time, time_t end_time, std::string index_bucket,
     std::string property_name, property_type prop_type, get_value_func val_func) {
     Leaf leaf;
@@ -266,7 +258,7 @@ Leaf make_leaf(gcs::Client* client, BatchObjectNames &batch,
     // 1. Incorporate entire batches
     for (uint64_t i=0; i < batch.inclusive.size(); i++) {
         leaf.batch_names.push_back(batch.inclusive[i]);
-        inclusive_bloom.push_back(std::async(std::launch::async,
+        inclusive_bloom.push_back(executor::get().submit(io_pool,
             create_bloom_filter_entire_batch, client, batch.inclusive[i],
             property_name, prop_type, val_func));
     }
@@ -274,7 +266,7 @@ Leaf make_leaf(gcs::Client* client, BatchObjectNames &batch,
     // 2. Incorporate batches that overlap the first part of the time range (ie go shorter than it)
     for (uint64_t j=0; j < batch.early.size(); j++) {
         leaf.batch_names.push_back(batch.early[j]);
-        early_bloom.push_back(std::async(std::launch::async,
+        early_bloom.push_back(executor::get().submit(io_pool,
             create_bloom_filter_partial_batch, client, batch.early[j], start_time, end_time,
             property_name, prop_type, val_func));
     }
@@ -282,41 +274,40 @@ Leaf make_leaf(gcs::Client* client, BatchObjectNames &batch,
     // 3. Incorporate batches that overlap the later part of the time range (ie go longer than it)
     for (uint64_t k=0; k < batch.late.size(); k++) {
         leaf.batch_names.push_back(batch.late[k]);
-        late_bloom.push_back(std::async(std::launch::async,
+        late_bloom.push_back(executor::get().submit(io_pool,
             create_bloom_filter_partial_batch, client, batch.late[k], start_time, end_time,
             property_name, prop_type, val_func));
     }
 
     // 4. Get all the futures from async calls to be actual values
     for (uint64_t i=0; i < inclusive_bloom.size(); i++) {
-        leaf.bloom_filters.push_back(inclusive_bloom[i].get());
+        leaf.bloom_filters.push_back(executor::get().wait(inclusive_bloom[i]));
     }
 
     for (uint64_t j=0; j < early_bloom.size(); j++) {
-        leaf.bloom_filters.push_back(early_bloom[j].get());
+        leaf.bloom_filters.push_back(executor::get().wait(early_bloom[j]));
     }
 
     for (uint64_t k=0; k < late_bloom.size(); k++) {
-        leaf.bloom_filters.push_back(late_bloom[k].get());
+        leaf.bloom_filters.push_back(executor::get().wait(late_bloom[k]));
     }
     // 5. Put that leaf in storage
     std::stringstream objname_stream;
     objname_stream << start_time << "-" << end_time;
-    gcs::ObjectWriteStream stream =
-            client->WriteObject(index_bucket, objname_stream.str());
-    serialize_leaf(leaf, stream);
-    stream.Close();
-    StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
-    if (!metadata) {
-        throw std::runtime_error(metadata.status().message());
+    std::stringstream leaf_stream;
+    serialize_leaf(leaf, leaf_stream);
+    Status write_status = client->write(index_bucket, objname_stream.str(), leaf_stream.str());
+    if (!write_status.ok()) {
+        throw std::runtime_error(write_status.message());
     }
 
     // gonna double check this`
-    auto reader = client->ReadObject(index_bucket, objname_stream.str());
-    if (!reader) {
-        std::cerr << "Error reading object: " << reader.status() << "\n";
+    auto leaf_object = client->read(index_bucket, objname_stream.str());
+    if (!leaf_object) {
+        std::cerr << "Error reading object: " << leaf_object.status() << "\n";
         throw std::runtime_error("Error reading trace object");
     }
+    stored_object_stream reader(leaf_object.value());
     Leaf l2 = deserialize_leaf(reader);
     assert(leaf_equals(l2, leaf));
     return leaf;
@@ -330,7 +321,7 @@ std::tuple<time_t, time_t> get_parent(time_t start_time, time_t end_time, time_t
 }
 
 
-std::tuple<time_t, time_t>  bubble_up_leaves_helper(gcs::Client* client,
+std::tuple<time_t, time_t>  bubble_up_leaves_helper(storage_backend* client,
     std::vector<std::tuple<time_t, time_t>> just_modified,
     std::vector<bloom_filter> just_modified_bfs, time_t granularity, std::string index_bucket
 ) {
@@ -352,30 +343,28 @@ std::tuple<time_t, time_t>  bubble_up_leaves_helper(gcs::Client* client,
                     std::get<1>(just_modified[children[0]]), granularity);
             std::string parent_object = std::to_string(std::get<0>(parent_bounds))
                 + "-" + std::to_string(std::get<1>(parent_bounds));
-            auto reader = client->ReadObject(index_bucket, parent_object);
-            if (reader.status().code() == ::google::cloud::StatusCode::kNotFound) {
+            auto parent_contents = client->read(index_bucket, parent_object);
+            if (parent_contents.status().code() == ::google::cloud::StatusCode::kNotFound) {
                 // parent doesn't exist;  we're done here
                 if (children.size() == 1) {
                     return just_modified[children[0]];
                 }
-            } else if (!reader) {
+            } else if (!parent_contents) {
                 std::cerr << "Error reading object " << index_bucket << "/" <<
-                    parent_object << " :" << reader.status() << "\n";
-                throw std::runtime_error(reader.status().message());
+                    parent_object << " :" << parent_contents.status() << "\n";
+                throw std::runtime_error(parent_contents.status().message());
             }
             // now we know parent exists, which means we need to keep propagating up
             bloom_filter parental_bloom_filter;
+            stored_object_stream reader(parent_contents.value());
             parental_bloom_filter.Deserialize(reader);
-            reader.Close();
             parental_bloom_filter|=just_modified_bfs[0];
             // now rewrite the parental one back out
-            gcs::ObjectWriteStream stream =
-            client->WriteObject(index_bucket, parent_object);
+            std::stringstream stream;
             parental_bloom_filter.Serialize(stream);
-            stream.Close();
-            StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
-            if (!metadata) {
-              throw std::runtime_error(metadata.status().message());
+            Status write_status = client->write(index_bucket, parent_object, stream.str());
+            if (!write_status.ok()) {
+              throw std::runtime_error(write_status.message());
             }
             std::vector<std::tuple<time_t, time_t>> new_modified;
             new_modified.push_back(parent_bounds);
@@ -402,12 +391,11 @@ std::tuple<time_t, time_t>  bubble_up_leaves_helper(gcs::Client* client,
                 std::get<1>(just_modified[children[0]]), granularity);
         std::string parent_object = std::to_string(std::get<0>(parent_bounds)) + "-"
             + std::to_string(std::get<1>(parent_bounds));
-        gcs::ObjectWriteStream stream = client->WriteObject(index_bucket, parent_object);
+        std::stringstream stream;
         unioned_filter.Serialize(stream);
-        stream.Close();
-        StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
-        if (!metadata) {
-          throw std::runtime_error(metadata.status().message());
+        Status write_status = client->write(index_bucket, parent_object, stream.str());
+        if (!write_status.ok()) {
+          throw std::runtime_error(write_status.message());
         }
         new_modified.push_back(parent_bounds);
         new_modified_bfs.push_back(unioned_filter);
@@ -415,7 +403,7 @@ std::tuple<time_t, time_t>  bubble_up_leaves_helper(gcs::Client* client,
     return bubble_up_leaves_helper(client, new_modified, new_modified_bfs, granularity, index_bucket);
 }
 
-int bubble_up_leaves(gcs::Client* client, time_t start_time, time_t end_time,
+int bubble_up_leaves(storage_backend* client, time_t start_time, time_t end_time,
     std::vector<Leaf> &leaves, time_t granularity, std::string index_bucket) {
     // we need to bubble up leaf so that means making a bloom filter that is the union of all of them
     std::vector<std::tuple<time_t, time_t>> newly_modified;
@@ -447,19 +435,15 @@ int bubble_up_leaves(gcs::Client* client, time_t start_time, time_t end_time,
     auto new_root = bubble_up_leaves_helper(client, newly_modified, newly_modified_bfs, granularity, index_bucket);
     std::string root_str = std::to_string(std::get<0>(new_root)) + "-"
             + std::to_string(std::get<1>(new_root));
-    StatusOr<gcs::BucketMetadata> updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("root", root_str));
+    Status label_status = client->set_bucket_label(index_bucket, "root", root_str);
 
-    if (!updated_metadata) {
-      throw std::runtime_error(updated_metadata.status().message());
+    if (!label_status.ok()) {
+      throw std::runtime_error(label_status.message());
     }
-    updated_metadata = client->PatchBucket(
-      index_bucket,
-      gcs::BucketMetadataPatchBuilder().SetLabel("granularity", std::to_string(granularity)));
+    label_status = client->set_bucket_label(index_bucket, "granularity", std::to_string(granularity));
 
-    if (!updated_metadata) {
-      throw std::runtime_error(updated_metadata.status().message());
+    if (!label_status.ok()) {
+      throw std::runtime_error(label_status.message());
     }
     return 0;
 }
@@ -514,16 +498,51 @@ std::vector<struct BatchObjectNames> split_batches_by_leaf(
     return to_return;
 }
 
-Status get_root_and_granularity(gcs::Client* client, std::tuple<time_t, time_t> &root,
+/*
+  Adds the leaves' batches and distinct values to the counts in the bucket's
+  labels, which the query planner estimates selectivity from.
+*/
+void update_index_statistics(storage_backend* client, std::vector<Leaf> &leaves, std::string index_bucket) {
+    int64_t batches_indexed = 0;
+    int64_t distinct_values = 0;
+    auto bucket_labels = client->get_bucket_labels(index_bucket);
+    if (!bucket_labels.ok()) {
+        throw std::runtime_error(bucket_labels.status().message());
+    }
+    for (auto const& kv : bucket_labels.value()) {
+        if (kv.first == BATCHES_INDEXED_LABEL_KEY) {
+            batches_indexed = std::stoll(kv.second);
+        }
+        if (kv.first == DISTINCT_VALUES_LABEL_KEY) {
+            distinct_values = std::stoll(kv.second);
+        }
+    }
+    for (auto &leaf : leaves) {
+        for (auto &filter : leaf.bloom_filters) {
+            batches_indexed++;
+            distinct_values += filter.element_count();
+        }
+    }
+    Status label_status = client->set_bucket_label(
+        index_bucket, BATCHES_INDEXED_LABEL_KEY, std::to_string(batches_indexed));
+    if (!label_status.ok()) {
+      throw std::runtime_error(label_status.message());
+    }
+    label_status = client->set_bucket_label(index_bucket, DISTINCT_VALUES_LABEL_KEY, std::to_string(distinct_values));
+    if (!label_status.ok()) {
+      throw std::runtime_error(label_status.message());
+    }
+}
+
+Status get_root_and_granularity(storage_backend* client, std::tuple<time_t, time_t> &root,
     time_t &granularity, std::string ib) {
     // get root and granularity from labels
-    StatusOr<gcs::BucketMetadata> bucket_metadata =
-      client->GetBucketMetadata(ib);
-    if (!bucket_metadata) {
-        throw std::runtime_error(bucket_metadata.status().message());
-        return bucket_metadata.status();
+    auto bucket_labels = client->get_bucket_labels(ib);
+    if (!bucket_labels) {
+        throw std::runtime_error(bucket_labels.status().message());
+        return bucket_labels.status();
     }
-    for (auto const& kv : bucket_metadata->labels()) {
+    for (auto const& kv : bucket_labels.value()) {
         if (kv.first == "root") {
             std::string root_name = kv.second;
             std::vector<std::string> times = split_by_string(root_name, hyphen);
@@ -538,7 +557,7 @@ Status get_root_and_granularity(gcs::Client* client, std::tuple<time_t, time_t>
     return Status();
 }
 
-int update_index(gcs::Client* client, std::string property_name, time_t granularity,
+int update_index(storage_backend* client, std::string property_name, time_t granularity,
     property_type prop_type, get_value_func val_func) {
     std::string index_bucket = property_name;
     replace_all(index_bucket, ".", "-");
@@ -561,15 +580,16 @@ int update_index(gcs::Client* client, std::string property_name, time_t granular
     std::vector<std::future<Leaf>> leaves_future;
     std::vector<Leaf> leaves;
     for (time_t i=last_updated; i < to_update; i+= granularity) {
-        leaves_future.push_back(std::async(std::launch::async, make_leaf,
+        leaves_future.push_back(executor::get().submit(io_pool, make_leaf,
             client, std::ref(batches_by_leaf[j]), i, i+granularity, index_bucket,
             property_name, prop_type, val_func));
         j++;
     }
 
     for (uint64_t i=0; i < leaves_future.size(); i++) {
-        leaves.push_back(leaves_future[i].get());
+        leaves.push_back(executor::get().wait(leaves_future[i]));
     }
     bubble_up_leaves(client, last_updated, to_update, leaves, granularity, index_bucket);
+    update_index_statistics(client, leaves, index_bucket);
     return 0;
 }
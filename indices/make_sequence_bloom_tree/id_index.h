@@ -50,21 +50,22 @@ std::vector<struct BatchObjectNames> split_batches_by_leaf(
 
 // Core code
 std::vector<std::string> generate_prefixes(time_t earliest, time_t latest);
-std::vector<std::string> get_batches_between_timestamps(gcs::Client* client, time_t earliest, time_t latest);
-bloom_filter create_bloom_filter_partial_batch(gcs::Client* client, std::string batch, time_t earliest, time_t latest,
+std::vector<std::string> get_batches_between_timestamps(storage_backend* client, time_t earliest, time_t latest);
+bloom_filter create_bloom_filter_partial_batch(storage_backend* client, std::string batch, time_t earliest, time_t latest,
     std::string property_name, property_type prop_type, get_value_func val_func);
-bloom_filter create_bloom_filter_entire_batch(gcs::Client* client, std::string batch,
+bloom_filter create_bloom_filter_entire_batch(storage_backend* client, std::string batch,
     std::string property_name, property_type prop_type, get_value_func val_func);
-Leaf make_leaf(gcs::Client* client, BatchObjectNames &batch, time_t start_time,
+Leaf make_leaf(storage_backend* client, BatchObjectNames &batch, time_t start_time,
     time_t end_time, std::string index_bucket,
     std::string property_name, property_type prop_type, get_value_func val_func);
-int bubble_up_leaf(gcs::Client* client, time_t start_time, time_t end_time, Leaf &leaf, std::string index_bucket);
+int bubble_up_leaf(storage_backend* client, time_t start_time, time_t end_time, Leaf &leaf, std::string index_bucket);
 std::tuple<time_t, time_t> get_parent(time_t start_time, time_t end_time, time_t granularity);
-time_t create_index_bucket(gcs::Client* client, std::string index_bucket);
-int bubble_up_bloom_filter(gcs::Client* client, bloom_filter bf, std::string index_bucket);
-int update_index(gcs::Client* client, std::string property_name, time_t granularity,
+time_t create_index_bucket(storage_backend* client, std::string index_bucket);
+int bubble_up_bloom_filter(storage_backend* client, bloom_filter bf, std::string index_bucket);
+int update_index(storage_backend* client, std::string property_name, time_t granularity,
     property_type prop_type, get_value_func val_func);
-Status get_root_and_granularity(gcs::Client* client, std::tuple<time_t, time_t> &root,
+Status get_root_and_granularity(storage_backend* client, std::tuple<time_t, time_t> &root,
     time_t &granularity, std::string ib);
+void update_index_statistics(storage_backend* client, std::vector<Leaf> &leaves, std::string index_bucket);
 
 #endif  // INDICES_MAKE_SEQUENCE_BLOOM_TREE_ID_INDEX_H_
@@ -1,4 +1,21 @@
 #include "query_bloom_index.h"
+#include "metrics.h"
+
+namespace {
+
+counter& bloom_probes(const char* level) {
+    return metrics().get_counter("quest_bloom_probes_total", "Bloom filter lookups, by tree level.",
+        {{"level", level}});
+}
+
+// Batches a leaf filter matched that turned out not to hold the queried ID.
+counter& bloom_false_positives() {
+    static counter &false_positives = metrics().get_counter(
+        "quest_bloom_false_positives_total", "Batches matched by a bloom filter that did not hold the ID.");
+    return false_positives;
+}
+
+}  // namespace
 
 std::vector<std::tuple<time_t, time_t>> get_children(
     const std::tuple<time_t, time_t> parent, const time_t granularity) {
@@ -11,20 +28,27 @@ std::vector<std::tuple<time_t, time_t>> get_children(
 }
 
 StatusOr<std::vector<std::string>> is_trace_id_in_leaf(
-    gcs::Client* client, const std::string traceID, const time_t start_time,
+    storage_backend* client, const std::string traceID, const time_t start_time,
     const time_t end_time, const std::string index_bucket) {
+    std::string leaf_name = std::to_string(start_time) + "-" + std::to_string(end_time);
+    return is_trace_id_in_leaf_object(client->read(index_bucket, leaf_name), traceID);
+}
+
+StatusOr<std::vector<std::string>> is_trace_id_in_leaf_object(
+    const StatusOr<std::shared_ptr<const stored_object>> &leaf_object, const std::string &traceID) {
     std::vector<std::string> to_return;
     const char* traceID_c_str = traceID.c_str();
     size_t len = traceID.length();
-    std::string leaf_name = std::to_string(start_time) + "-" + std::to_string(end_time);
-    auto reader = client->ReadObject(index_bucket, leaf_name);
-    if (reader.status().code() == ::google::cloud::StatusCode::kNotFound) {
+    if (leaf_object.status().code() == ::google::cloud::StatusCode::kNotFound) {
         return to_return;  // if it doesn't exist, then you can't get the trace there
-    } else if (!reader) {
-        std::cerr << "Error reading object: " << reader.status() << "\n";
+    } else if (!leaf_object) {
+        std::cerr << "Error reading object: " << leaf_object.status() << "\n";
         throw std::runtime_error("Error reading leaf object");
     }
+    stored_object_stream reader(leaf_object.value());
     Leaf leaf = deserialize_leaf(reader);
+    static counter &leaf_probes = bloom_probes("leaf");
+    leaf_probes.add(leaf.batch_names.size());
     for (uint64_t i=0; i < leaf.batch_names.size(); i++) {
         if (leaf.bloom_filters[i].contains(traceID_c_str, len)) {
             to_return.push_back(leaf.batch_names[i]);
@@ -34,49 +58,58 @@ StatusOr<std::vector<std::string>> is_trace_id_in_leaf(
 }
 
 StatusOr<bool> is_trace_id_in_nonterminal_node(
-    gcs::Client* client, const std::string traceID, const time_t start_time,
+    storage_backend* client, const std::string traceID, const time_t start_time,
     const time_t end_time, const std::string index_bucket
 ) {
     std::string bloom_filter_name = std::to_string(start_time) + "-" + std::to_string(end_time);
-    auto reader = client->ReadObject(index_bucket, bloom_filter_name);
-    if (reader.status().code() == ::google::cloud::StatusCode::kNotFound) {
+    return is_trace_id_in_nonterminal_node_object(client->read(index_bucket, bloom_filter_name), traceID);
+}
+
+StatusOr<bool> is_trace_id_in_nonterminal_node_object(
+    const StatusOr<std::shared_ptr<const stored_object>> &node_object, const std::string &traceID) {
+    if (node_object.status().code() == ::google::cloud::StatusCode::kNotFound) {
         return false;  // if it doesn't exist, then you can't get the trace there
     }
-    if (!reader) {
-        std::cerr << "Error reading object: " << reader.status() << bloom_filter_name << "\n";
+    if (!node_object) {
+        std::cerr << "Error reading object: " << node_object.status() << "\n";
         throw std::runtime_error("Error reading node object");
-        return reader.status();
+        return node_object.status();
     }
+    stored_object_stream reader(node_object.value());
     bloom_filter bf;
     bf.Deserialize(reader);
     const char* traceID_c_str = traceID.c_str();
     size_t len = traceID.length();
+    static counter &node_probes = bloom_probes("node");
+    node_probes.add();
     return bf.contains(traceID_c_str, len);
 }
 
-StatusOr<objname_to_matching_trace_ids> get_return_value_from_objnames(gcs::Client* client,
+StatusOr<objname_to_matching_trace_ids> get_return_value_from_objnames(storage_backend* client,
     std::vector<std::string> object_names,
     std::string index_bucket, std::string queried_value) {
 
     objname_to_matching_trace_ids to_return;
     if (index_bucket.compare(TRACE_ID_BUCKET) == 0) {
+        trace_id_t queried_trace_id;
+        if (false == trace_id_t::from_hex(queried_value, queried_trace_id)) {
+            return to_return;
+        }
         for (uint64_t i=0; i < object_names.size(); i++) {
-            StatusOr<std::string> contents = read_object(
-                std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
-                object_names[i], client);
+            StatusOr<std::string> contents = read_structural_object_text(object_names[i], client);
             if (!contents.ok()) {
                 std::cerr << "get_return_value_from_objnames: could not read object " << object_names[i] << std::endl;
                 return contents.status();
             }
             if (contents.value().find(queried_value) != std::string::npos) {
-                to_return[object_names[i]].push_back(queried_value);
+                to_return[object_names[i]].push_back(queried_trace_id);
+            } else {
+                bloom_false_positives().add();
             }
         }
     } else if (index_bucket.compare(SPAN_ID_BUCKET) == 0) {
         for (uint64_t i=0; i < object_names.size(); i++) {
-            StatusOr<std::string> contents = read_object(
-                std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
-                object_names[i], client);
+            StatusOr<std::string> contents = read_structural_object_text(object_names[i], client);
             if (!contents.ok()) {
                 std::cerr << "get_return_value_from_objnames: could not read object " << object_names[i] << std::endl;
                 return contents.status();
@@ -84,15 +117,17 @@ StatusOr<objname_to_matching_trace_ids> get_return_value_from_objnames(gcs::Clie
             std::size_t index = contents->find(queried_value);
             if (index != std::string::npos) {
                 int trace_id_index = contents->rfind("Trace ID", index);
-                std::string trace_id = contents->substr(trace_id_index + 10, TRACE_ID_LENGTH);
-                to_return[object_names[i]].push_back(trace_id);
+                trace_id_t trace_id;
+                if (trace_id_t::from_hex(contents->substr(trace_id_index + 10, TRACE_ID_LENGTH), trace_id)) {
+                    to_return[object_names[i]].push_back(trace_id);
+                }
+            } else {
+                bloom_false_positives().add();
             }
         }
     } else {
         for (uint64_t i=0; i < object_names.size(); i++) {
-            StatusOr<std::string> contents = read_object(
-                std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX),
-                object_names[i], client);
+            StatusOr<std::string> contents = read_structural_object_text(object_names[i], client);
             if (!contents.ok()) {
                 std::cerr << "get_return_value_from_objnames: could not read object " << object_names[i] << std::endl;
                 return contents.status();
@@ -100,8 +135,9 @@ StatusOr<objname_to_matching_trace_ids> get_return_value_from_objnames(gcs::Clie
             std::vector<std::string> lines = split_by_string(contents.value(), newline);
             for (uint64_t j=0; j < lines.size(); j++) {
                 std::size_t trace_id_index = lines[j].find("Trace ID");
-                if (trace_id_index != std::string::npos) {
-                    std::string trace_id = contents->substr(trace_id_index+10, TRACE_ID_LENGTH);
+                trace_id_t trace_id;
+                if (trace_id_index != std::string::npos &&
+                    trace_id_t::from_hex(contents->substr(trace_id_index+10, TRACE_ID_LENGTH), trace_id)) {
                     if (std::find(to_return[object_names[i]].begin(),
                                   to_return[object_names[i]].end(),
                                   trace_id)
@@ -141,7 +177,7 @@ std::tuple<time_t, time_t> get_nearest_node(std::tuple<time_t, time_t> root, tim
 // trace ID queries and span ID are the exception;  those may be inferred with a single GET.
 // so it's actually more efficient for the index to return what may be a superset
 StatusOr<objname_to_matching_trace_ids> query_bloom_index_for_value(
-    gcs::Client* client, std::string queried_value, std::string index_bucket, const time_t start_time,
+    storage_backend* client, std::string queried_value, std::string index_bucket, const time_t start_time,
     const time_t end_time) {
     std::tuple<time_t, time_t> root;
     time_t granularity;
@@ -150,64 +186,51 @@ StatusOr<objname_to_matching_trace_ids> query_bloom_index_for_value(
         return status;
     }
 
-    std::vector<std::tuple<time_t, time_t>> unvisited_nodes;
-    unvisited_nodes.push_back(get_nearest_node(root, granularity, start_time, end_time));
-
-    // this will contain lists of batches that have the trace ID according to their bloom filters
-    // this is a vector and not a single value because bloom filters may give false positives
-    std::vector<std::future<StatusOr<std::vector<std::string>>>> batches;
-
-    // the way to parallelize this is to do all unvisited_nodes in parallel
-    while (unvisited_nodes.size() > 0) {
-        std::vector<std::tuple<time_t, time_t>> new_unvisited;
-        std::vector<std::future<StatusOr<bool>>> got_positive;
-        std::vector<std::tuple<time_t, time_t>> got_positive_limits;
-        for (uint64_t i=0; i < unvisited_nodes.size(); i++) {
-            const std::tuple<time_t, time_t>& visit = unvisited_nodes[i];
-            // process
-            if (std::get<1>(visit)-std::get<0>(visit) == granularity) {
-                // hit a leaf
-                batches.push_back(std::async(std::launch::async, is_trace_id_in_leaf,
-                    client, queried_value, std::get<0>(visit), std::get<1>(visit), index_bucket));
-            } else {
-                // async call if it is in nonterminal node
-                got_positive_limits.push_back(visit);
-                got_positive.push_back(std::async(std::launch::async, is_trace_id_in_nonterminal_node,
-                    client, queried_value, std::get<0>(visit), std::get<1>(visit), index_bucket));
-            }
+    // Each node is read as soon as its parent's filter says the trace ID may
+    // be below it, rather than a level at a time.  This collects the batches
+    // that have the trace ID according to their bloom filters; possibly more
+    // than one, because bloom filters may give false positives.
+    std::vector<std::string> verified_batches;
+    Status error;
+    std::mutex found_mutex;
+    completion_group group;
+    std::function<void(std::tuple<time_t, time_t>)> visit = [&](std::tuple<time_t, time_t> node) {
+        const std::string node_name = std::to_string(std::get<0>(node)) + "-" + std::to_string(std::get<1>(node));
+        auto read_node = [client, index_bucket, node_name]() { return client->read(index_bucket, node_name); };
+        if (std::get<1>(node)-std::get<0>(node) == granularity) {
+            // hit a leaf
+            async_then(group, read_node, [&](StatusOr<std::shared_ptr<const stored_object>> leaf_object) {
+                auto batches = is_trace_id_in_leaf_object(leaf_object, queried_value);
+                std::lock_guard<std::mutex> guard(found_mutex);
+                if (!batches.ok()) {
+                    error = batches.status();
+                    return;
+                }
+                verified_batches.insert(verified_batches.end(), batches->begin(), batches->end());
+            });
+            return;
         }
-        // now we need to see how many of the non-terminal nodes showed up positive
-        for (int i=0; i < got_positive.size(); i++) {
-            auto tmp = got_positive[i].get();
-            if (!tmp.ok()) {
-                std::cerr << "Error in query_bloom_index_for_value " << tmp.status().message() << std::endl;
-                return tmp.status();
+        async_then(group, read_node, [&, node](StatusOr<std::shared_ptr<const stored_object>> node_object) {
+            auto contains = is_trace_id_in_nonterminal_node_object(node_object, queried_value);
+            if (!contains.ok()) {
+                std::lock_guard<std::mutex> guard(found_mutex);
+                error = contains.status();
+                return;
             }
-            if (tmp.value()) {
-                auto children = get_children(got_positive_limits[i], granularity);
-                for (int j=0; j < children.size(); j++) {
-                    new_unvisited.push_back(children[j]);
+            if (contains.value()) {
+                for (auto &child : get_children(node, granularity)) {
+                    visit(child);
                 }
             }
-        }
-        unvisited_nodes.clear();
-        for (uint64_t i=0; i < new_unvisited.size(); i++) {
-            unvisited_nodes.push_back(new_unvisited[i]);
-        }
-    }
-    // now figure out which of the batches actually have your trace ID
-    // because false positives are a thing, this could potentially be more than one batch that shows up true
-    std::vector<std::string> verified_batches;
-    for (int i=0; i < batches.size(); i++) {
-        StatusOr<std::vector<std::string>> verified = batches[i].get();
-        if (!verified.ok()) {
-            std::cerr << "Error in query_bloom_index_for_value " << verified.status().message() << std::endl;
-            return verified.status();
-        }
-        for (int j=0; j < verified.value().size(); j++) {
-            verified_batches.push_back(verified.value()[j]);
-        }
+        });
+    };
+    visit(get_nearest_node(root, granularity, start_time, end_time));
+    group.wait();
+    if (!error.ok()) {
+        std::cerr << "Error in query_bloom_index_for_value " << error.message() << std::endl;
+        return error;
     }
+    std::sort(verified_batches.begin(), verified_batches.end());
 
     auto res = get_return_value_from_objnames(client, verified_batches, index_bucket, queried_value);
     if (!res.ok()) {
@@ -10,15 +10,14 @@
 
 
 Status get_last_updated_and_time_range_per_node_and_nodes_per_summary(
-    gcs::Client* client, time_t *last_updated, time_t *time_range_per_node,
+    storage_backend* client, time_t *last_updated, time_t *time_range_per_node,
     int64_t *nodes_per_summary, std::string index_bucket) {
-    StatusOr<gcs::BucketMetadata> bucket_metadata =
-      client->GetBucketMetadata(index_bucket);
-    if (!bucket_metadata) {
-        throw std::runtime_error(bucket_metadata.status().message());
-        return bucket_metadata.status();
+    auto bucket_labels = client->get_bucket_labels(index_bucket);
+    if (!bucket_labels) {
+        throw std::runtime_error(bucket_labels.status().message());
+        return bucket_labels.status();
     }
-    for (auto const& kv : bucket_metadata->labels()) {
+    for (auto const& kv : bucket_labels.value()) {
         if (kv.first == "last_updated") {
             std::cout << "last updated kv.second is " << kv.second << std::endl;
             *last_updated = time_t_from_string(kv.second);
@@ -59,17 +58,18 @@ std::vector<std::string> calculate_summaries_to_retrieve(
 }
 
 objname_to_matching_trace_ids get_traces_matching_query_in_node(
-    gcs::Client* client, const std::string node_name,
+    storage_backend* client, const std::string node_name,
     const std::string index_bucket,
     const query_condition condition,
     const time_t start_time, const time_t end_time) {
     objname_to_matching_trace_ids to_return;
 
-    auto reader = client->ReadObject(index_bucket, node_name);
-    if (!reader) {
+    auto node_object = client->read(index_bucket, node_name);
+    if (!node_object) {
         std::cerr << "Unable to retrieve summary object called " << node_name << std::endl;
         return to_return;
     }
+    stored_object_stream reader(node_object.value());
     Node node;
     node.Deserialize(reader);
 
@@ -80,30 +80,29 @@ objname_to_matching_trace_ids get_traces_matching_query_in_node(
         if (is_object_within_timespan(batch_timestamps, start_time, end_time) &&
             does_value_satisfy_condition(node.data[i].data, condition)
         ) {
-            if (to_return.find(node.data[i].batch_name) == to_return.end()) {
-                std::vector<std::string> trace_ids;
-                trace_ids.push_back(node.data[i].trace_id);
-                to_return[node.data[i].batch_name] = trace_ids;
-            } else {
-                to_return[node.data[i].batch_name].push_back(node.data[i].trace_id);
+            trace_id_t trace_id;
+            if (false == trace_id_t::from_hex(node.data[i].trace_id, trace_id)) {
+                continue;
             }
+            to_return[node.data[i].batch_name].push_back(trace_id);
         }
     }
     return to_return;
 }
 
 objname_to_matching_trace_ids get_traces_matching_query(
-    gcs::Client* client, std::string summary_name, time_t start_time,
+    storage_backend* client, std::string summary_name, time_t start_time,
     time_t end_time, time_t last_updated, const query_condition condition,
     const std::string &index_bucket, time_t time_period_per_node) {
     objname_to_matching_trace_ids to_return;
     // First, retrieve the summary object.
-    auto reader = client->ReadObject(index_bucket, summary_name);
-    if (!reader) {
+    auto summary_object = client->read(index_bucket, summary_name);
+    if (!summary_object) {
         std::cout << "Unable to retrieve summary object: " << summary_name <<
             "in get_traces_matching_query" << std::endl;
         return to_return;
     }
+    stored_object_stream reader(summary_object.value());
     NodeSummary ns;
     ns.Deserialize(reader);
 
@@ -116,7 +115,7 @@ objname_to_matching_trace_ids get_traces_matching_query(
         time_t node_start_time = std::get<0>(ns.node_objects[i]);
         std::string data = std::get<1>(ns.node_objects[i]);
         if (does_value_satisfy_condition(data, condition)) {
-            future_traces.push_back(std::async(std::launch::async,
+            future_traces.push_back(executor::get().submit(io_pool,
                 get_traces_matching_query_in_node,
                 client,
                 std::to_string(node_start_time) + "-" +
@@ -125,14 +124,14 @@ objname_to_matching_trace_ids get_traces_matching_query(
         }
     }
     for (int64_t i=0; i < future_traces.size(); i++) {
-        objname_to_matching_trace_ids traces = future_traces[i].get();
+        objname_to_matching_trace_ids traces = executor::get().wait(future_traces[i]);
         merge_objname_to_trace_ids(to_return, traces);
     }
     return to_return;
 }
 
 StatusOr<objname_to_matching_trace_ids> query_range_index_for_value(
-    gcs::Client* client, query_condition condition, std::string index_bucket,
+    storage_backend* client, query_condition condition, std::string index_bucket,
     time_t start_time, time_t end_time) {
 
     time_t last_updated = 0, time_range_per_node = 0;
@@ -157,14 +156,14 @@ StatusOr<objname_to_matching_trace_ids> query_range_index_for_value(
     // Now retrieve and calculate which actual objects to retrieve
     std::vector<std::future<objname_to_matching_trace_ids>> traces_matching_query;
     for (int64_t i=0; i < summaries.size(); i++) {
-        traces_matching_query.push_back(std::async(std::launch::async, get_traces_matching_query,
+        traces_matching_query.push_back(executor::get().submit(io_pool, get_traces_matching_query,
             client, "summary-" + summaries[i], start_time, end_time, last_updated, condition, index_bucket,
             time_range_per_node));
     }
 
     objname_to_matching_trace_ids to_return;
     for (int64_t i=0; i < traces_matching_query.size(); i++) {
-        objname_to_matching_trace_ids small_batch = traces_matching_query[i].get();
+        objname_to_matching_trace_ids small_batch = executor::get().wait(traces_matching_query[i]);
         merge_objname_to_trace_ids(to_return, small_batch);
     }
 
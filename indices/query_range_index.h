@@ -9,7 +9,7 @@
 #include "common.h"
 
 StatusOr<objname_to_matching_trace_ids> query_range_index_for_value(
-    gcs::Client* client, query_condition condition, std::string index_bucket,
+    storage_backend* client, query_condition condition, std::string index_bucket,
     time_t start_time, time_t end_time);
 
 #endif  // INDICES_QUERY_RANGE_INDEX_H_
@@ -1,7 +1,7 @@
 #include "query_range_index.h"
 
 int main() {
-    auto client = gcs::Client();
+    auto client = make_storage_backend();
     query_condition condition;
     condition.node_index = 0;
     condition.type = int_value;
@@ -12,7 +12,7 @@ int main() {
     condition.property_name = "latency";
     condition.is_latency_condition = true;
     StatusOr<objname_to_matching_trace_ids> res = query_range_index_for_value(
-        &client, condition,
+        client.get(), condition,
         std::string("latency-range-index"), 1669921900, 1669922000);
     if (!res.ok()) {
         std::cout << res.status() << std::endl;
@@ -0,0 +1,100 @@
+/*
+ * Fixed-width little-endian integers and length-prefixed strings, for the
+ * binary objects we write ourselves (structural objects, span sidecars,
+ * the structure catalog).
+*/
+
+#ifndef LITTLE_ENDIAN_H_ // NOLINT
+#define LITTLE_ENDIAN_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+inline void put_u32(std::string &out, uint32_t val) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<char>((val >> (8 * i)) & 0xFF));
+    }
+}
+
+inline void put_u64(std::string &out, uint64_t val) {
+    for (int i = 0; i < 8; i++) {
+        out.push_back(static_cast<char>((val >> (8 * i)) & 0xFF));
+    }
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t val = 0;
+    for (int i = 3; i >= 0; i--) {
+        val = (val << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return val;
+}
+
+inline uint64_t get_u64(const char* p) {
+    uint64_t val = 0;
+    for (int i = 7; i >= 0; i--) {
+        val = (val << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return val;
+}
+
+inline void put_string(std::string &out, const std::string &s) {
+    put_u32(out, s.size());
+    out += s;
+}
+
+// Reads forward through a serialized object, failing once anything would run past the end.
+class byte_reader {
+    public: // NOLINT
+        byte_reader(const char* data, size_t size) : data_(data), size_(size) {}
+
+        bool ok() const { return ok_; }
+        size_t position() const { return pos_; }
+
+        const char* take(size_t bytes) {
+            if (!ok_ || bytes > size_ - pos_) {
+                ok_ = false;
+                return nullptr;
+            }
+            const char* p = data_ + pos_;
+            pos_ += bytes;
+            return p;
+        }
+
+        uint32_t u32() {
+            const char* p = take(4);
+            return p == nullptr ? 0 : get_u32(p);
+        }
+
+        uint64_t u64() {
+            const char* p = take(8);
+            return p == nullptr ? 0 : get_u64(p);
+        }
+
+        std::string string() {
+            uint32_t length = u32();
+            const char* p = take(length);
+            return p == nullptr ? "" : std::string(p, length);
+        }
+
+        template <typename T>
+        void column(std::vector<T> &out, size_t count) {
+            const char* p = take(count * sizeof(T));
+            if (p == nullptr) {
+                return;
+            }
+            out.resize(count);
+            for (size_t i = 0; i < count; i++) {
+                out[i] = sizeof(T) == 8 ? get_u64(p + 8 * i) : get_u32(p + 4 * i);
+            }
+        }
+
+    private: // NOLINT
+        const char* data_;
+        size_t size_;
+        size_t pos_ = 0;
+        bool ok_ = true;
+};
+
+#endif  // LITTLE_ENDIAN_H_ // NOLINT
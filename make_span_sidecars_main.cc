@@ -0,0 +1,48 @@
+/*
+ * Writes the sidecars of every span object, or of the batches under a prefix:
+ * the span ID index (span_batch.h), used when QUEST_SPAN_ID_INDEX_SIDECARS is
+ * set, the span columns (span_columns.h), used when QUEST_SPAN_COLUMNS is, and
+ * the latency summary (also span_columns.h), used when
+ * QUEST_SPAN_LATENCY_SUMMARIES is.
+ *
+ * usage: make_span_sidecars [batch name prefix]
+*/
+
+#include <iostream>
+#include <string>
+
+#include "common.h"
+
+int main(int argc, char* argv[]) {
+    std::string prefix = argc > 1 ? argv[1] : "";
+    auto client = make_storage_backend();
+    const std::string services_bucket = std::string(SERVICES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+
+    int written = 0, failed = 0;
+    for (auto &service_bucket : get_spans_buckets_names(client.get())) {
+        auto objects = client->list_objects(services_bucket, service_bucket + "/" + prefix);
+        if (!objects.ok()) {
+            std::cerr << "could not list " << service_bucket << ": " << objects.status().message() << std::endl;
+            failed++;
+            continue;
+        }
+        for (auto &object : objects.value()) {
+            std::string batch_name = object.name.substr(service_bucket.size() + 1);
+            Status status = write_span_id_index(service_bucket, batch_name, client.get());
+            if (status.ok()) {
+                status = write_span_columns(service_bucket, batch_name, client.get());
+            }
+            if (status.ok()) {
+                status = write_span_latency_summary(service_bucket, batch_name, client.get());
+            }
+            if (!status.ok()) {
+                std::cerr << object.name << ": " << status.message() << std::endl;
+                failed++;
+                continue;
+            }
+            written++;
+        }
+    }
+    std::cout << "wrote sidecars for " << written << " span objects, " << failed << " failed" << std::endl;
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Creates the structure catalog (structure_catalog.h), or brings it up to
+ * date with tracehashes, and writes the manifests (structure_manifest.h) of
+ * batches that don't have one.  Run it as batches are written; queries only
+ * use the catalog, with QUEST_STRUCTURE_CATALOG set, when it covers their
+ * range, and read manifests when QUEST_STRUCTURE_MANIFESTS is set.
+ *
+ * usage: make_structure_catalog
+*/
+
+#include <iostream>
+
+#include "structure_catalog.h"
+
+int main() {
+    auto client = make_storage_backend();
+    auto catalog = update_structure_catalog(client.get(), true);
+    std::cout << std::endl;
+    if (!catalog.ok()) {
+        std::cerr << "could not update the structure catalog: " << catalog.status().message() << std::endl;
+        return 1;
+    }
+
+    uint64_t batches = 0;
+    for (auto &structure : catalog->structures) {
+        batches += structure.batch_names.size();
+    }
+    std::cout << catalog->structures.size() << " structures in " << batches << " structure/batch pairs, up to "
+        << catalog->covered_until << std::endl;
+
+    auto manifests = write_structure_manifests(catalog.value(), client.get(), true);
+    std::cout << std::endl;
+    if (!manifests.ok()) {
+        std::cerr << "could not write structure manifests: " << manifests.status().message() << std::endl;
+        return 1;
+    }
+    std::cout << "wrote " << manifests.value() << " batch manifests" << std::endl;
+    return 0;
+}
@@ -0,0 +1,372 @@
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "common.h"
+
+namespace {
+
+std::atomic<int> next_shard{0};
+
+int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string escape_label_value(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// {a="1",b="2"}, with extra appended last; empty if there are no labels.
+std::string format_labels(const metric_labels &labels, const std::string &extra = "") {
+    std::string formatted;
+    for (auto &[name, value] : labels) {
+        formatted += (formatted.empty() ? "" : ",") + name + "=\"" + escape_label_value(value) + "\"";
+    }
+    if (false == extra.empty()) {
+        formatted += (formatted.empty() ? "" : ",") + extra;
+    }
+    return formatted.empty() ? "" : "{" + formatted + "}";
+}
+
+std::string format_bound(double bound) {
+    std::ostringstream out;
+    out << bound;
+    return out.str();
+}
+
+void write_metrics_file(const std::string &path) {
+    Status written = write_local_file(path, metrics().render_prometheus());
+    if (!written.ok()) {
+        std::cerr << "could not write metrics to " << path << ": " << written.message() << std::endl;
+    }
+}
+
+enum bucket_class {
+    dyntraces_class,
+    tracehashes_class,
+    index_class,
+    spans_class,
+    other_class,
+    NUM_BUCKET_CLASSES,
+};
+
+const char* const BUCKET_CLASS_NAMES[NUM_BUCKET_CLASSES] = {
+    "dyntraces", "tracehashes", "index", "spans", "other"};
+
+bucket_class classify_bucket(const std::string &bucket) {
+    if (has_prefix(bucket, TRACE_STRUCT_BUCKET_PREFIX)) {
+        return dyntraces_class;
+    }
+    if (has_prefix(bucket, TRACE_HASHES_BUCKET_PREFIX)) {
+        return tracehashes_class;
+    }
+    if (has_prefix(bucket, "index-") || bucket.find("-range-index") != std::string::npos) {
+        return index_class;
+    }
+    if (has_prefix(bucket, SERVICES_BUCKET_PREFIX)) {
+        return other_class;
+    }
+    return is_spans_bucket(bucket) ? spans_class : other_class;
+}
+
+enum storage_op {
+    read_op,
+    read_range_op,
+    stat_op,
+    list_op,
+    write_op,
+    labels_op,
+    NUM_STORAGE_OPS,
+};
+
+const char* const STORAGE_OP_NAMES[NUM_STORAGE_OPS] = {
+    "read", "read_range", "stat", "list", "write", "labels"};
+
+// Looked up once, so a request costs a clock read and two atomic adds.
+struct storage_metrics {
+    histogram* request_seconds[NUM_STORAGE_OPS][NUM_BUCKET_CLASSES];
+    counter* bytes_read[NUM_BUCKET_CLASSES];
+
+    storage_metrics() {
+        for (int c = 0; c < NUM_BUCKET_CLASSES; c++) {
+            for (int op = 0; op < NUM_STORAGE_OPS; op++) {
+                request_seconds[op][c] = &metrics().get_histogram(
+                    "quest_storage_request_seconds", "Storage request latency, by operation and bucket class.",
+                    {{"op", STORAGE_OP_NAMES[op]}, {"bucket_class", BUCKET_CLASS_NAMES[c]}});
+            }
+            bytes_read[c] = &metrics().get_counter(
+                "quest_storage_bytes_read_total", "Bytes returned by storage reads, by bucket class.",
+                {{"bucket_class", BUCKET_CLASS_NAMES[c]}});
+        }
+    }
+};
+
+storage_metrics& get_storage_metrics() {
+    static storage_metrics* storage = new storage_metrics();
+    return *storage;
+}
+
+histogram& request_seconds(storage_op op, const std::string &bucket) {
+    return *get_storage_metrics().request_seconds[op][classify_bucket(bucket)];
+}
+
+void count_bytes_read(const std::string &bucket, int64_t bytes) {
+    get_storage_metrics().bytes_read[classify_bucket(bucket)]->add(bytes);
+}
+
+}  // namespace
+
+const std::vector<double> &latency_buckets() {
+    static const std::vector<double> buckets = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    return buckets;
+}
+
+int metric_shard() {
+    thread_local const int shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+int64_t counter::value() const {
+    int64_t total = 0;
+    for (auto &shard : shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+histogram::histogram(std::vector<double> bounds) : bounds_(std::move(bounds)) {
+    for (auto &shard : shards_) {
+        shard.counts = std::make_unique<std::atomic<int64_t>[]>(bounds_.size() + 1);
+        for (size_t i = 0; i <= bounds_.size(); i++) {
+            shard.counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void histogram::observe(double value) {
+    cell &shard = shards_[metric_shard()];
+    size_t bucket = 0;
+    while (bucket < bounds_.size() && value > bounds_[bucket]) {
+        bucket++;
+    }
+    shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    double sum = shard.sum.load(std::memory_order_relaxed);
+    while (false == shard.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+histogram::snapshot histogram::get_snapshot() const {
+    snapshot to_return;
+    to_return.bounds = bounds_;
+    to_return.cumulative_counts.assign(bounds_.size() + 1, 0);
+    for (auto &shard : shards_) {
+        for (size_t i = 0; i <= bounds_.size(); i++) {
+            to_return.cumulative_counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+        }
+        to_return.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    for (size_t i = 1; i <= bounds_.size(); i++) {
+        to_return.cumulative_counts[i] += to_return.cumulative_counts[i - 1];
+    }
+    to_return.count = to_return.cumulative_counts.back();
+    return to_return;
+}
+
+histogram_timer::histogram_timer(histogram &observed)
+: observed_(observed), start_ns_(steady_ns()) {}
+
+histogram_timer::~histogram_timer() {
+    observed_.observe((steady_ns() - start_ns_) / 1e9);
+}
+
+counter& metrics_registry::get_counter(const std::string &name, const std::string &help,
+    const metric_labels &labels) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    family<counter> &members = counters_[name];
+    members.help = help;
+    auto &member = members.members[labels];
+    if (member == nullptr) {
+        member = std::make_unique<counter>();
+    }
+    return *member;
+}
+
+histogram& metrics_registry::get_histogram(const std::string &name, const std::string &help,
+    const metric_labels &labels, const std::vector<double> &bounds) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    family<histogram> &members = histograms_[name];
+    members.help = help;
+    auto &member = members.members[labels];
+    if (member == nullptr) {
+        member = std::make_unique<histogram>(bounds);
+    }
+    return *member;
+}
+
+void metrics_registry::add_collector(std::function<void(const gauge_writer&)> collector) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    collectors_.push_back(std::move(collector));
+}
+
+std::string metrics_registry::render_prometheus() {
+    std::ostringstream out;
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto &[name, members] : counters_) {
+        out << "# HELP " << name << " " << members.help << "\n";
+        out << "# TYPE " << name << " counter\n";
+        for (auto &[labels, member] : members.members) {
+            out << name << format_labels(labels) << " " << member->value() << "\n";
+        }
+    }
+    for (auto &[name, members] : histograms_) {
+        out << "# HELP " << name << " " << members.help << "\n";
+        out << "# TYPE " << name << " histogram\n";
+        for (auto &[labels, member] : members.members) {
+            histogram::snapshot snapshot = member->get_snapshot();
+            for (size_t i = 0; i < snapshot.bounds.size(); i++) {
+                out << name << "_bucket" << format_labels(labels, "le=\"" + format_bound(snapshot.bounds[i]) + "\"")
+                    << " " << snapshot.cumulative_counts[i] << "\n";
+            }
+            out << name << "_bucket" << format_labels(labels, "le=\"+Inf\"") << " " << snapshot.count << "\n";
+            out << name << "_sum" << format_labels(labels) << " " << snapshot.sum << "\n";
+            out << name << "_count" << format_labels(labels) << " " << snapshot.count << "\n";
+        }
+    }
+    // gauges from the collectors, grouped by name so each gets one header
+    std::map<std::string, std::pair<std::string, std::vector<std::pair<metric_labels, double>>>> gauges;
+    for (auto &collector : collectors_) {
+        collector([&gauges](const std::string &name, const std::string &help,
+            const metric_labels &labels, double value) {
+            gauges[name].first = help;
+            gauges[name].second.push_back(std::make_pair(labels, value));
+        });
+    }
+    for (auto &[name, help_and_samples] : gauges) {
+        out << "# HELP " << name << " " << help_and_samples.first << "\n";
+        out << "# TYPE " << name << " gauge\n";
+        for (auto &[labels, value] : help_and_samples.second) {
+            out << name << format_labels(labels) << " " << value << "\n";
+        }
+    }
+    return out.str();
+}
+
+metrics_registry& metrics() {
+    static metrics_registry* registry = new metrics_registry();
+    return *registry;
+}
+
+void start_metrics_export() {
+    static std::once_flag started;
+    std::call_once(started, []() {
+        const char* path = std::getenv(METRICS_FILE_ENV);
+        if (path == nullptr || path[0] == '\0') {
+            return;
+        }
+        int interval = DEFAULT_METRICS_INTERVAL_SECONDS;
+        const char* interval_value = std::getenv(METRICS_INTERVAL_ENV);
+        if (interval_value != nullptr && std::atoi(interval_value) > 0) {
+            interval = std::atoi(interval_value);
+        }
+        static const std::string final_path = path;
+        // once more on the way out, so short runs leave their totals behind
+        std::atexit([]() { write_metrics_file(final_path); });
+        std::thread([path = std::string(path), interval]() {
+            while (true) {
+                write_metrics_file(path);
+                std::this_thread::sleep_for(std::chrono::seconds(interval));
+            }
+        }).detach();
+    });
+}
+
+std::string storage_bucket_class(const std::string &bucket) {
+    return BUCKET_CLASS_NAMES[classify_bucket(bucket)];
+}
+
+StatusOr<std::shared_ptr<const stored_object>> metered_backend::read(
+    const std::string &bucket, const std::string &object) {
+    StatusOr<std::shared_ptr<const stored_object>> contents;
+    {
+        histogram_timer timer(request_seconds(read_op, bucket));
+        contents = inner_->read(bucket, object);
+    }
+    if (contents.ok()) {
+        count_bytes_read(bucket, contents.value()->size());
+    }
+    return contents;
+}
+
+StatusOr<std::string> metered_backend::read_range(
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end) {
+    StatusOr<std::string> contents;
+    {
+        histogram_timer timer(request_seconds(read_range_op, bucket));
+        contents = inner_->read_range(bucket, object, begin, end);
+    }
+    if (contents.ok()) {
+        count_bytes_read(bucket, contents.value().size());
+    }
+    return contents;
+}
+
+StatusOr<object_info> metered_backend::stat(const std::string &bucket, const std::string &object) {
+    histogram_timer timer(request_seconds(stat_op, bucket));
+    return inner_->stat(bucket, object);
+}
+
+StatusOr<std::vector<object_info>> metered_backend::list_objects(
+    const std::string &bucket, const std::string &prefix, int64_t max_results) {
+    histogram_timer timer(request_seconds(list_op, bucket));
+    return inner_->list_objects(bucket, prefix, max_results);
+}
+
+StatusOr<std::vector<std::string>> metered_backend::list_prefixes(
+    const std::string &bucket, const std::string &delimiter) {
+    histogram_timer timer(request_seconds(list_op, bucket));
+    return inner_->list_prefixes(bucket, delimiter);
+}
+
+Status metered_backend::write(const std::string &bucket, const std::string &object, const std::string &contents) {
+    histogram_timer timer(request_seconds(write_op, bucket));
+    return inner_->write(bucket, object, contents);
+}
+
+StatusOr<std::map<std::string, std::string>> metered_backend::get_bucket_labels(const std::string &bucket) {
+    histogram_timer timer(request_seconds(labels_op, bucket));
+    return inner_->get_bucket_labels(bucket);
+}
+
+Status metered_backend::set_bucket_label(
+    const std::string &bucket, const std::string &key, const std::string &value) {
+    histogram_timer timer(request_seconds(labels_op, bucket));
+    return inner_->set_bucket_label(bucket, key, value);
+}
+
+Status metered_backend::create_bucket(const std::string &bucket) {
+    return inner_->create_bucket(bucket);
+}
+
+void metered_backend::prefetch(const std::string &bucket, const std::string &object) {
+    inner_->prefetch(bucket, object);
+}
+
+bool metered_backend::accepts_prefetch() const {
+    return inner_->accepts_prefetch();
+}
@@ -0,0 +1,173 @@
+/*
+ * Process-wide counters and histograms, for a long-running Quest process.
+ *
+ * Instrumented code looks its metric up once and keeps the reference:
+ *
+ *     static counter &probes = metrics().get_counter("quest_bloom_probes_total", "Bloom filter probes.");
+ *     probes.add();
+ *
+ * Updates are relaxed atomic adds on one of METRIC_SHARDS cache-line-sized
+ * cells, picked per thread, so threads updating the same metric don't
+ * contend on a line; reading a metric sums the cells.  That keeps the cost
+ * low enough to leave on everywhere.  Values that already live somewhere
+ * else (cache statistics, executor queue depths) are read when the metrics
+ * are exported, by collectors.
+ *
+ * render_prometheus() writes everything in the Prometheus text format.  With
+ * QUEST_METRICS_FILE set, start_metrics_export() rewrites that file every
+ * QUEST_METRICS_INTERVAL_SECONDS (10 by default), for node_exporter's
+ * textfile collector or anything else that scrapes files.
+ *
+ * make_storage_backend() wraps every backend in a metered_backend, so
+ * request latencies and bytes read are always counted, by bucket class.  With
+ * a disk cache, the metered backend is the remote one behind it, and the
+ * cache's hits and misses are counted in quest_disk_cache_hits_total and
+ * quest_disk_cache_misses_total.
+*/
+
+#ifndef METRICS_H_ // NOLINT
+#define METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "storage.h"
+
+const char METRICS_FILE_ENV[] = "QUEST_METRICS_FILE";
+const char METRICS_INTERVAL_ENV[] = "QUEST_METRICS_INTERVAL_SECONDS";
+const int DEFAULT_METRICS_INTERVAL_SECONDS = 10;
+const int METRIC_SHARDS = 16;
+
+// Upper bounds for latencies in seconds, from 100us to 10s.
+const std::vector<double> &latency_buckets();
+
+// The shard the calling thread updates.
+int metric_shard();
+
+class counter {
+    public: // NOLINT
+        void add(int64_t n = 1) {
+            shards_[metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+        int64_t value() const;
+
+    private: // NOLINT
+        struct alignas(64) cell {
+            std::atomic<int64_t> value{0};
+        };
+        std::array<cell, METRIC_SHARDS> shards_;
+};
+
+class histogram {
+    public: // NOLINT
+        explicit histogram(std::vector<double> bounds);
+
+        void observe(double value);
+
+        struct snapshot {
+            std::vector<double> bounds;
+            std::vector<int64_t> cumulative_counts;  // per bound, then +Inf
+            double sum = 0;
+            int64_t count = 0;
+        };
+        snapshot get_snapshot() const;
+
+    private: // NOLINT
+        struct alignas(64) cell {
+            // one more than there are bounds, for +Inf
+            std::unique_ptr<std::atomic<int64_t>[]> counts;
+            std::atomic<double> sum{0};
+        };
+        const std::vector<double> bounds_;
+        std::array<cell, METRIC_SHARDS> shards_;
+};
+
+// Times a scope into a histogram, in seconds.
+class histogram_timer {
+    public: // NOLINT
+        explicit histogram_timer(histogram &observed);
+        ~histogram_timer();
+        histogram_timer(const histogram_timer&) = delete;
+        histogram_timer& operator=(const histogram_timer&) = delete;
+
+    private: // NOLINT
+        histogram &observed_;
+        int64_t start_ns_;
+};
+
+// Label name to value, e.g. {{"bucket_class", "spans"}}.
+typedef std::map<std::string, std::string> metric_labels;
+
+class metrics_registry {
+    public: // NOLINT
+        // The returned references stay valid for the life of the process.
+        counter& get_counter(const std::string &name, const std::string &help, const metric_labels &labels = {});
+        histogram& get_histogram(const std::string &name, const std::string &help, const metric_labels &labels = {},
+            const std::vector<double> &bounds = latency_buckets());
+
+        // Called on every export with a function that emits a gauge sample.
+        typedef std::function<void(const std::string &name, const std::string &help,
+            const metric_labels &labels, double value)> gauge_writer;
+        void add_collector(std::function<void(const gauge_writer&)> collector);
+
+        std::string render_prometheus();
+
+    private: // NOLINT
+        template <typename M>
+        struct family {
+            std::string help;
+            std::map<metric_labels, std::unique_ptr<M>> members;
+        };
+
+        std::mutex mutex_;
+        std::map<std::string, family<counter>> counters_;
+        std::map<std::string, family<histogram>> histograms_;
+        std::vector<std::function<void(const gauge_writer&)>> collectors_;
+};
+
+// Created on first use and never destroyed.
+metrics_registry& metrics();
+
+// Starts rewriting QUEST_METRICS_FILE in the background, and once more at
+// exit, if it is set.  Safe to call more than once.
+void start_metrics_export();
+
+// dyntraces, tracehashes, index, spans or other; a label small enough to
+// keep one series per class rather than per bucket.
+std::string storage_bucket_class(const std::string &bucket);
+
+// Times every request into quest_storage_request_seconds and counts the bytes
+// returned into quest_storage_bytes_read_total.
+class metered_backend : public storage_backend {
+    public: // NOLINT
+        explicit metered_backend(std::unique_ptr<storage_backend> inner) : inner_(std::move(inner)) {}
+
+        StatusOr<std::shared_ptr<const stored_object>> read(
+            const std::string &bucket, const std::string &object) override;
+        StatusOr<std::string> read_range(
+            const std::string &bucket, const std::string &object, int64_t begin, int64_t end) override;
+        StatusOr<object_info> stat(const std::string &bucket, const std::string &object) override;
+        StatusOr<std::vector<object_info>> list_objects(
+            const std::string &bucket, const std::string &prefix, int64_t max_results) override;
+        StatusOr<std::vector<std::string>> list_prefixes(
+            const std::string &bucket, const std::string &delimiter) override;
+        Status write(const std::string &bucket, const std::string &object, const std::string &contents) override;
+        StatusOr<std::map<std::string, std::string>> get_bucket_labels(const std::string &bucket) override;
+        Status set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) override;
+        Status create_bucket(const std::string &bucket) override;
+        void prefetch(const std::string &bucket, const std::string &object) override;
+        bool accepts_prefetch() const override;
+
+    private: // NOLINT
+        std::unique_ptr<storage_backend> inner_;
+};
+
+#endif  // METRICS_H_ // NOLINT
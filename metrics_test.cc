@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+TEST(Metrics, CounterSumsAddsFromEveryThread) {
+  counter added;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&added]() {
+      for (int j = 0; j < 1000; j++) {
+        added.add();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(added.value(), 8000);
+}
+
+TEST(Metrics, HistogramCountsAreCumulative) {
+  histogram observed({1, 10});
+  observed.observe(0.5);
+  observed.observe(5);
+  observed.observe(50);
+  histogram::snapshot snapshot = observed.get_snapshot();
+  EXPECT_EQ(snapshot.cumulative_counts, std::vector<int64_t>({1, 2, 3}));
+  EXPECT_EQ(snapshot.count, 3);
+  EXPECT_DOUBLE_EQ(snapshot.sum, 55.5);
+}
+
+TEST(Metrics, RendersThePrometheusTextFormat) {
+  metrics_registry registry;
+  registry.get_counter("test_reads_total", "Reads.", {{"bucket_class", "spans"}}).add(3);
+  registry.get_histogram("test_seconds", "Latency.", {}, {0.5}).observe(0.25);
+  registry.add_collector([](const metrics_registry::gauge_writer &write) {
+    write("test_queued", "Queued.", {}, 7);
+  });
+
+  const std::string text = registry.render_prometheus();
+  EXPECT_NE(text.find("# TYPE test_reads_total counter\n"), std::string::npos);
+  EXPECT_NE(text.find("test_reads_total{bucket_class=\"spans\"} 3\n"), std::string::npos);
+  EXPECT_NE(text.find("test_seconds_bucket{le=\"0.5\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("test_seconds_bucket{le=\"+Inf\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("test_seconds_count 1\n"), std::string::npos);
+  EXPECT_NE(text.find("# TYPE test_queued gauge\ntest_queued 7\n"), std::string::npos);
+}
+
+TEST(Metrics, ClassifiesBuckets) {
+  EXPECT_EQ(storage_bucket_class("dyntraces-quest-hopefully-final"), "dyntraces");
+  EXPECT_EQ(storage_bucket_class("tracehashes-quest-hopefully-final"), "tracehashes");
+  EXPECT_EQ(storage_bucket_class("index-trace-id-quest-hopefully-final"), "index");
+  EXPECT_EQ(storage_bucket_class("frontend-quest-hopefully-final"), "spans");
+}
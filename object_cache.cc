@@ -0,0 +1,108 @@
+#include "object_cache.h"
+#include "metrics.h"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+size_t budget_from_env(const char* env, size_t default_bytes) {
+    const char* val = std::getenv(env);
+    if (val == nullptr || val[0] == '\0') {
+        return default_bytes;
+    }
+    return std::strtoull(val, nullptr, 10);
+}
+
+template <typename V>
+bool add_cache_collector(const std::string &name, lru_cache<V> &cache) {
+    metrics().add_collector([name, &cache](const metrics_registry::gauge_writer &write) {
+        const cache_stats stats = cache.get_stats();
+        const metric_labels labels = {{"cache", name}};
+        const uint64_t lookups = stats.hits + stats.misses;
+        write("quest_cache_hits", "Cache lookups that hit.", labels, stats.hits);
+        write("quest_cache_misses", "Cache lookups that missed.", labels, stats.misses);
+        write("quest_cache_hit_ratio", "Hits over lookups, 0 before the first lookup.",
+            labels, lookups == 0 ? 0 : static_cast<double>(stats.hits) / lookups);
+        write("quest_cache_evictions", "Entries evicted to stay in budget.", labels, stats.evictions);
+        write("quest_cache_bytes", "Bytes held.", labels, stats.bytes);
+        write("quest_cache_budget_bytes", "Bytes the cache may hold.", labels, stats.budget);
+    });
+    return true;
+}
+
+}  // namespace
+
+// Never destroyed, so the metrics export thread can read them during exit.
+object_cache_t& object_cache() {
+    static object_cache_t* cache = new object_cache_t(
+        budget_from_env(OBJECT_CACHE_BYTES_ENV, DEFAULT_OBJECT_CACHE_BYTES));
+    static const bool collected = add_cache_collector("object", *cache);
+    (void) collected;
+    return *cache;
+}
+
+traces_data_cache_t& traces_data_cache() {
+    static traces_data_cache_t* cache = new traces_data_cache_t(
+        budget_from_env(TRACES_DATA_CACHE_BYTES_ENV, DEFAULT_TRACES_DATA_CACHE_BYTES));
+    static const bool collected = add_cache_collector("traces_data", *cache);
+    (void) collected;
+    return *cache;
+}
+
+structural_object_cache_t& structural_object_cache() {
+    static structural_object_cache_t* cache = new structural_object_cache_t(
+        budget_from_env(STRUCTURAL_OBJECT_CACHE_BYTES_ENV, DEFAULT_STRUCTURAL_OBJECT_CACHE_BYTES));
+    static const bool collected = add_cache_collector("structural_object", *cache);
+    (void) collected;
+    return *cache;
+}
+
+single_flight<StatusOr<std::shared_ptr<const stored_object>>>& object_reads_in_flight() {
+    static single_flight<StatusOr<std::shared_ptr<const stored_object>>> in_flight;
+    return in_flight;
+}
+
+single_flight<std::shared_ptr<const span_batch>>& traces_data_parses_in_flight() {
+    static single_flight<std::shared_ptr<const span_batch>> in_flight;
+    return in_flight;
+}
+
+single_flight<StatusOr<std::shared_ptr<const structural_object>>>& structural_object_parses_in_flight() {
+    static single_flight<StatusOr<std::shared_ptr<const structural_object>>> in_flight;
+    return in_flight;
+}
+
+single_flight<StatusOr<std::string>>& range_reads_in_flight() {
+    static single_flight<StatusOr<std::string>> in_flight;
+    return in_flight;
+}
+
+bool cache_revalidation_enabled() {
+    static const bool enabled = std::getenv(CACHE_REVALIDATE_ENV) != nullptr;
+    return enabled;
+}
+
+bool is_current_generation(
+    const std::string &bucket, const std::string &object, int64_t generation, storage_backend* client) {
+    auto info = client->stat(bucket, object);
+    return info.ok() && info->generation == generation;
+}
+
+std::string object_cache_key(const std::string &bucket, const std::string &object) {
+    return bucket + "/" + object;
+}
+
+std::string format_cache_stats(const std::string &name, const cache_stats &stats) {
+    std::ostringstream out;
+    out << name << ": " << stats.hits << " hits, " << stats.misses << " misses, "
+        << stats.evictions << " evictions, " << stats.invalidations << " invalidations, "
+        << stats.entries << " entries, " << stats.bytes << "/" << stats.budget << " bytes";
+    return out.str();
+}
+
+std::string format_single_flight_stats(const std::string &name, const single_flight_stats &stats) {
+    std::ostringstream out;
+    out << name << ": " << stats.fetches << " fetches, " << stats.coalesced << " coalesced";
+    return out.str();
+}
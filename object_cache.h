@@ -0,0 +1,239 @@
+/*
+ * Process-wide caches that sit under read_object() and
+ * read_object_and_parse_traces_data().
+ *
+ * A query touches the same structural object and the same span objects from
+ * several places (filtering, fetching per batch, building the return value),
+ * and back-to-back queries overlap heavily.  Both caches are LRU with a byte
+ * budget and remember the generation of the object each entry came from, so
+ * that an entry can be dropped once the object has been rewritten.
+ *
+ * Misses go through a single_flight table, so concurrent readers of the same
+ * object (e.g. brute_force_per_batch tasks and index lookups running at the
+ * same time) share one fetch and one parse instead of each issuing a GET.
+*/
+
+#ifndef OBJECT_CACHE_H_ // NOLINT
+#define OBJECT_CACHE_H_
+
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "storage.h"
+#include "span_batch.h"
+#include "structural_object.h"
+
+// Byte budgets for the caches; 0 disables a cache.
+const char OBJECT_CACHE_BYTES_ENV[] = "QUEST_OBJECT_CACHE_BYTES";
+const char TRACES_DATA_CACHE_BYTES_ENV[] = "QUEST_TRACES_DATA_CACHE_BYTES";
+const char STRUCTURAL_OBJECT_CACHE_BYTES_ENV[] = "QUEST_STRUCTURAL_OBJECT_CACHE_BYTES";
+// If set, every cache hit is checked against the object's current generation.
+const char CACHE_REVALIDATE_ENV[] = "QUEST_CACHE_REVALIDATE";
+
+const size_t DEFAULT_OBJECT_CACHE_BYTES = 512ull << 20;
+const size_t DEFAULT_TRACES_DATA_CACHE_BYTES = 1ull << 30;
+const size_t DEFAULT_STRUCTURAL_OBJECT_CACHE_BYTES = 512ull << 20;
+
+struct cache_stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+    size_t bytes = 0;
+    size_t entries = 0;
+    size_t budget = 0;
+};
+
+template <typename V>
+class lru_cache {
+    public: // NOLINT
+        struct entry {
+            V value;
+            int64_t generation;
+        };
+
+        explicit lru_cache(size_t budget_bytes) : budget_(budget_bytes) {}
+
+        // Counts a hit or a miss and, on a hit, makes the key most recently used.
+        std::optional<entry> get(const std::string &key) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(key);
+            if (it == index_.end()) {
+                stats_.misses++;
+                return std::nullopt;
+            }
+            stats_.hits++;
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->e;
+        }
+
+        // Replaces any existing entry.  Values larger than the whole budget are not kept.
+        void put(const std::string &key, V value, size_t bytes, int64_t generation) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            erase_locked(key);
+            if (bytes > budget_) {
+                return;
+            }
+            lru_.push_front(node{key, entry{std::move(value), generation}, bytes});
+            index_[key] = lru_.begin();
+            stats_.bytes += bytes;
+            while (stats_.bytes > budget_) {
+                erase_locked(lru_.back().key);
+                stats_.evictions++;
+            }
+        }
+
+        void invalidate(const std::string &key) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (erase_locked(key)) {
+                stats_.invalidations++;
+            }
+        }
+
+        // Drops the entry if it was built from a different generation of the object.
+        void invalidate_if_stale(const std::string &key, int64_t current_generation) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(key);
+            if (it != index_.end() && it->second->e.generation != current_generation) {
+                erase_locked(key);
+                stats_.invalidations++;
+            }
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            lru_.clear();
+            index_.clear();
+            stats_.bytes = 0;
+        }
+
+        void set_budget(size_t budget_bytes) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            budget_ = budget_bytes;
+            while (stats_.bytes > budget_) {
+                erase_locked(lru_.back().key);
+                stats_.evictions++;
+            }
+        }
+
+        cache_stats get_stats() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cache_stats ret = stats_;
+            ret.entries = index_.size();
+            ret.budget = budget_;
+            return ret;
+        }
+
+    private: // NOLINT
+        struct node {
+            std::string key;
+            entry e;
+            size_t bytes;
+        };
+
+        bool erase_locked(const std::string &key) {
+            auto it = index_.find(key);
+            if (it == index_.end()) {
+                return false;
+            }
+            stats_.bytes -= it->second->bytes;
+            lru_.erase(it->second);
+            index_.erase(it);
+            return true;
+        }
+
+        std::mutex mutex_;
+        size_t budget_;
+        std::list<node> lru_;
+        std::unordered_map<std::string, typename std::list<node>::iterator> index_;
+        cache_stats stats_;
+};
+
+struct single_flight_stats {
+    uint64_t fetches = 0;
+    uint64_t coalesced = 0;
+};
+
+template <typename V>
+class single_flight {
+    public: // NOLINT
+        // Calls fetch() unless a call for the same key is already running, in
+        // which case waits for that call and returns its result (or rethrows).
+        template <typename F>
+        V run(const std::string &key, F fetch) {
+            std::promise<V> promise;
+            std::shared_future<V> result;
+            bool leader = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = in_flight_.find(key);
+                if (it != in_flight_.end()) {
+                    result = it->second;
+                    stats_.coalesced++;
+                } else {
+                    result = promise.get_future().share();
+                    in_flight_[key] = result;
+                    stats_.fetches++;
+                    leader = true;
+                }
+            }
+            if (!leader) {
+                return result.get();
+            }
+
+            try {
+                promise.set_value(fetch());
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                in_flight_.erase(key);
+            }
+            return result.get();
+        }
+
+        single_flight_stats get_stats() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return stats_;
+        }
+
+    private: // NOLINT
+        std::mutex mutex_;
+        std::unordered_map<std::string, std::shared_future<V>> in_flight_;
+        single_flight_stats stats_;
+};
+
+typedef lru_cache<std::shared_ptr<const stored_object>> object_cache_t;
+typedef lru_cache<std::shared_ptr<const span_batch>> traces_data_cache_t;
+typedef lru_cache<std::shared_ptr<const structural_object>> structural_object_cache_t;
+
+// Raw object bytes, keyed by "bucket/object".
+object_cache_t& object_cache();
+// Parsed and indexed span objects, keyed the same way.
+traces_data_cache_t& traces_data_cache();
+// Parsed and indexed structural objects, so text-format ones are only scanned once.
+structural_object_cache_t& structural_object_cache();
+
+single_flight<StatusOr<std::shared_ptr<const stored_object>>>& object_reads_in_flight();
+single_flight<std::shared_ptr<const span_batch>>& traces_data_parses_in_flight();
+single_flight<StatusOr<std::shared_ptr<const structural_object>>>& structural_object_parses_in_flight();
+// Keyed by "bucket/object@begin-end".
+single_flight<StatusOr<std::string>>& range_reads_in_flight();
+bool cache_revalidation_enabled();
+// Whether a cached copy of the object, stored at this generation, is still current.
+bool is_current_generation(
+    const std::string &bucket, const std::string &object, int64_t generation, storage_backend* client);
+std::string object_cache_key(const std::string &bucket, const std::string &object);
+std::string format_cache_stats(const std::string &name, const cache_stats &stats);
+std::string format_single_flight_stats(const std::string &name, const single_flight_stats &stats);
+
+#endif  // OBJECT_CACHE_H_ // NOLINT
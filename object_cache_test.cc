@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+
+#include "object_cache.h"
+
+TEST(LruCache, HitsAndMisses) {
+  lru_cache<std::string> cache(100);
+  EXPECT_FALSE(cache.get("a").has_value());
+  cache.put("a", "contents", 10, 1);
+
+  auto hit = cache.get("a");
+  ASSERT_TRUE(hit.has_value());
+  EXPECT_EQ(hit->value, "contents");
+  EXPECT_EQ(hit->generation, 1);
+
+  cache_stats stats = cache.get_stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.entries, 1);
+  EXPECT_EQ(stats.bytes, 10);
+}
+
+TEST(LruCache, EvictsLeastRecentlyUsedOverBudget) {
+  lru_cache<int> cache(30);
+  cache.put("a", 1, 10, 0);
+  cache.put("b", 2, 10, 0);
+  cache.put("c", 3, 10, 0);
+  cache.get("a");  // b is now the least recently used
+  cache.put("d", 4, 10, 0);
+
+  EXPECT_TRUE(cache.get("a").has_value());
+  EXPECT_FALSE(cache.get("b").has_value());
+  EXPECT_TRUE(cache.get("c").has_value());
+  EXPECT_TRUE(cache.get("d").has_value());
+  EXPECT_EQ(cache.get_stats().evictions, 1);
+  EXPECT_EQ(cache.get_stats().bytes, 30);
+
+  // larger than the whole budget, so never cached
+  cache.put("e", 5, 31, 0);
+  EXPECT_FALSE(cache.get("e").has_value());
+}
+
+TEST(LruCache, InvalidatesStaleGeneration) {
+  lru_cache<int> cache(100);
+  cache.put("a", 1, 10, 7);
+  cache.invalidate_if_stale("a", 7);
+  EXPECT_TRUE(cache.get("a").has_value());
+
+  cache.invalidate_if_stale("a", 8);
+  EXPECT_FALSE(cache.get("a").has_value());
+  EXPECT_EQ(cache.get_stats().invalidations, 1);
+  EXPECT_EQ(cache.get_stats().bytes, 0);
+}
+
+TEST(SingleFlight, ConcurrentCallersShareOneFetch) {
+  single_flight<int> flight;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<int> calls{0};
+
+  auto fetch = [&]() {
+    calls++;
+    released.wait();
+    return 42;
+  };
+  auto leader = std::async(std::launch::async, [&]() { return flight.run("k", fetch); });
+  while (flight.get_stats().fetches == 0) {
+    std::this_thread::yield();
+  }
+  auto follower = std::async(std::launch::async, [&]() { return flight.run("k", fetch); });
+  while (flight.get_stats().coalesced == 0) {
+    std::this_thread::yield();
+  }
+  release.set_value();
+
+  EXPECT_EQ(leader.get(), 42);
+  EXPECT_EQ(follower.get(), 42);
+  EXPECT_EQ(calls, 1);
+
+  // once the first call finishes, the key is fetched again
+  EXPECT_EQ(flight.run("k", []() { return 7; }), 7);
+  EXPECT_EQ(flight.get_stats().fetches, 2);
+}
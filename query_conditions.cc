@@ -1,5 +1,10 @@
 #include "query_conditions.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
 std::string get_value_as_string(const ot::Span* sp,
     const get_value_func val_func, const property_type prop_type) {
     switch (prop_type) {
@@ -32,105 +37,358 @@ std::string get_value_as_string(const ot::Span* sp,
     }
 }
 
-bool does_attribute_condition_hold(const ot::Span* sp, const query_condition condition) {
-    const opentelemetry::proto::common::v1::KeyValue* attribute;
-
-    for (int64_t i=0; i < sp->attributes_size(); i++) {
-        attribute = &(sp->attributes(i));
-        const opentelemetry::proto::common::v1::AnyValue* val = &(attribute->value());
-        auto curr_attr_key = attribute->key();
-        std::string curr_attr_val = "";
-        switch (val->value_case()) {
-            case 1:
-                curr_attr_val = val->string_value();
-                break;
-            case 2:
-                curr_attr_val = val->bool_value() ? "true" : "false";
-                break;
-            case 3:
-                curr_attr_val = std::to_string(val->int_value());
-                break;
-            case 4:
-                curr_attr_val = std::to_string(val->double_value());
-                break;
-            default:
-                std::cerr << "Not supported attr type." << std::endl;
-                exit(1);
-                break;
-        }
-        if (condition.property_name == curr_attr_key) {
-            return does_value_satisfy_condition(curr_attr_val, condition);
+namespace {
+
+template <typename T>
+bool compare(const T &span_value, const T &value, const property_comparison comp) {
+    switch (comp) {
+        case Equal_to: return span_value == value;
+        case Less_than: return span_value < value;
+        case Greater_than: return span_value > value;
+    }
+    return false;
+}
+
+bool parse_int(const std::string &text, int64_t &out) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    out = std::strtoll(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+bool parse_unsigned(const std::string &text, uint64_t &out) {
+    if (text.empty() || text[0] == '-') {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    out = std::strtoull(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+bool parse_double(const std::string &text, double &out) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    out = std::strtod(text.c_str(), &end);
+    return *end == '\0';
+}
+
+bool parse_hex(const std::string &text, std::string &out) {
+    if (text.size() % 2 != 0) {
+        return false;
+    }
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    out.clear();
+    for (size_t i = 0; i < text.size(); i += 2) {
+        const int high = nibble(text[i]);
+        const int low = nibble(text[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
         }
+        out.push_back(static_cast<char>(high << 4 | low));
+    }
+    return true;
+}
+
+bool does_attribute_condition_hold(const ot::Span* sp, const compiled_condition &compiled) {
+    const query_condition &condition = compiled.condition;
+    for (const auto &attribute : sp->attributes()) {
+        if (attribute.key() != condition.property_name) {
+            continue;
+        }
+        // compared as text, like the span columns and the range index store them
+        if (attribute.value().value_case() == opentelemetry::proto::common::v1::AnyValue::kStringValue) {
+            return compare(attribute.value().string_value(), condition.node_property_value, condition.comp);
+        }
+        std::string value;
+        if (false == attribute_value_as_string(attribute.value(), value)) {
+            return false;
+        }
+        return compare(value, condition.node_property_value, condition.comp);
     }
     // couldn't find the attribute, so probably not true for this span
     return false;
 }
 
-bool does_condition_hold(const ot::Span* sp, const query_condition condition) {
+void collect_required_conditions(const condition_expression &expression, std::vector<int> &required) {
+    if (expression.op == condition_leaf) {
+        required.push_back(expression.condition_index);
+    } else if (expression.op == condition_and) {
+        for (const auto &child : expression.children) {
+            collect_required_conditions(child, required);
+        }
+    }
+}
+
+}  // namespace
+
+compiled_condition compile_condition(const query_condition &condition) {
+    compiled_condition compiled;
+    compiled.condition = condition;
     if (condition.is_latency_condition) {
-        return does_latency_condition_hold(sp, condition);
+        compiled.valid = parse_unsigned(condition.node_property_value, compiled.unsigned_value);
     } else if (condition.is_attribute_condition) {
-        return does_attribute_condition_hold(sp, condition);
+        compiled.valid = true;
+    } else if (condition.type == int_value) {
+        compiled.valid = parse_int(condition.node_property_value, compiled.int_value);
+    } else if (condition.type == double_value) {
+        compiled.valid = parse_double(condition.node_property_value, compiled.double_value);
+    } else if (condition.type == bytes_value) {
+        compiled.valid = parse_hex(condition.node_property_value, compiled.bytes_value);
     }
-    switch (condition.type) {
-        case string_value: {
-            std::cout << "In string val" << std::endl;
-            const std::string span_value = (sp->*condition.func.string_func)();
-            std::cout << "In2 string val" << std::endl;
-            switch (condition.comp) {
-                case Equal_to:
-                    return span_value.compare(condition.node_property_value) == 0;
-                default:
-                    return span_value.compare(condition.node_property_value);
+    return compiled;
+}
+
+condition_expression leaf_condition(int condition_index) {
+    condition_expression expression;
+    expression.op = condition_leaf;
+    expression.condition_index = condition_index;
+    return expression;
+}
+
+condition_expression and_of(std::vector<condition_expression> children) {
+    condition_expression expression;
+    expression.op = condition_and;
+    expression.children = std::move(children);
+    return expression;
+}
+
+condition_expression or_of(std::vector<condition_expression> children) {
+    condition_expression expression;
+    expression.op = condition_or;
+    expression.children = std::move(children);
+    return expression;
+}
+
+condition_expression not_of(condition_expression child) {
+    condition_expression expression;
+    expression.op = condition_not;
+    expression.children.push_back(std::move(child));
+    return expression;
+}
+
+condition_expression all_conditions(int num_conditions) {
+    std::vector<condition_expression> children;
+    for (int i = 0; i < num_conditions; i++) {
+        children.push_back(leaf_condition(i));
+    }
+    return and_of(std::move(children));
+}
+
+std::vector<int> required_conditions(const condition_expression &expression) {
+    std::vector<int> required;
+    collect_required_conditions(expression, required);
+    std::sort(required.begin(), required.end());
+    required.erase(std::unique(required.begin(), required.end()), required.end());
+    return required;
+}
+
+bool is_valid_expression(const condition_expression &expression, int num_conditions) {
+    switch (expression.op) {
+        case condition_leaf:
+            return expression.condition_index >= 0 && expression.condition_index < num_conditions;
+        case condition_not:
+            if (expression.children.size() != 1) {
+                return false;
             }
+            break;
+        case condition_and:
+        case condition_or:
+            break;
+    }
+    for (const auto &child : expression.children) {
+        if (false == is_valid_expression(child, num_conditions)) {
+            return false;
         }
-        case bool_value: {
-            const bool val = (sp->*condition.func.bool_func)();
-            std::string span_val;
-            if (val) {
-                span_val = "false";
-            } else {
-                span_val = "true";
+    }
+    return true;
+}
+
+std::string expression_to_string(const condition_expression &expression) {
+    switch (expression.op) {
+        case condition_leaf:
+            return std::to_string(expression.condition_index);
+        case condition_not:
+            return "NOT " + (expression.children.empty() ? std::string("()") :
+                expression_to_string(expression.children[0]));
+        case condition_and:
+        case condition_or: {
+            std::string joined;
+            for (const auto &child : expression.children) {
+                joined += (joined.empty() ? "" : (expression.op == condition_and ? " AND " : " OR ")) +
+                    expression_to_string(child);
             }
-            switch (condition.comp) {
-                case Equal_to:
-                    return span_val.compare(condition.node_property_value) == 0;
-                default:
-                    return false;  // it is undefined to be "less than" or "greater than" a bool
+            return "(" + joined + ")";
+        }
+    }
+    return "";
+}
+
+namespace {
+
+// Recursive descent over the tokens of an expression, from next on.
+class expression_parser {
+    public: // NOLINT
+        explicit expression_parser(std::vector<std::string> tokens) : tokens_(std::move(tokens)) {}
+
+        StatusOr<condition_expression> parse() {
+            StatusOr<condition_expression> expression = parse_or();
+            if (expression.ok() && next_ < tokens_.size()) {
+                return error("unexpected " + tokens_[next_]);
             }
+            return expression;
         }
-        case int_value: {
-            const int span_val = (sp->*condition.func.int_func)();
-            const int cond_val = std::stoi(condition.node_property_value);
-            switch (condition.comp) {
-                case Equal_to: return span_val == cond_val;
-                case Less_than: return span_val < cond_val;
-                case Greater_than: return span_val > cond_val;
+
+    private: // NOLINT
+        StatusOr<condition_expression> parse_or() {
+            return parse_joined("OR", &expression_parser::parse_and, or_of);
+        }
+
+        StatusOr<condition_expression> parse_and() {
+            return parse_joined("AND", &expression_parser::parse_not, and_of);
+        }
+
+        StatusOr<condition_expression> parse_joined(const std::string &joiner,
+            StatusOr<condition_expression> (expression_parser::*parse_operand)(),
+            condition_expression (*join)(std::vector<condition_expression>)) {
+            std::vector<condition_expression> operands;
+            do {
+                StatusOr<condition_expression> operand = (this->*parse_operand)();
+                if (!operand.ok()) {
+                    return operand;
+                }
+                operands.push_back(std::move(operand.value()));
+            } while (accept(joiner));
+            if (operands.size() == 1) {
+                return std::move(operands[0]);
             }
+            return join(std::move(operands));
         }
-        case double_value: {
-            const double span_val = (sp->*condition.func.double_func)();
-            const double cond_val = std::stod(condition.node_property_value);
-            switch (condition.comp) {
-                case Equal_to: return span_val == cond_val;
-                case Less_than: return span_val < cond_val;
-                case Greater_than: return span_val > cond_val;
+
+        StatusOr<condition_expression> parse_not() {
+            if (accept("NOT")) {
+                StatusOr<condition_expression> child = parse_not();
+                if (!child.ok()) {
+                    return child;
+                }
+                return not_of(std::move(child.value()));
             }
+            if (accept("(")) {
+                StatusOr<condition_expression> inner = parse_or();
+                if (inner.ok() && false == accept(")")) {
+                    return error("missing )");
+                }
+                return inner;
+            }
+            if (next_ == tokens_.size()) {
+                return error("unexpected end");
+            }
+            int64_t condition_index = 0;
+            if (false == parse_int(tokens_[next_], condition_index) || condition_index < 0) {
+                return error("expected a condition index, found " + tokens_[next_]);
+            }
+            next_++;
+            return leaf_condition(condition_index);
         }
-        case bytes_value: {
-            // for bytes, we use a string representation
-            const std::string span_value = (sp->*condition.func.bytes_func)();
-            switch (condition.comp) {
-                case Equal_to:
-                    return hex_str(span_value, span_value.size()).compare(condition.node_property_value) == 0;
-                default:
-                    return hex_str(span_value, span_value.size()).compare(condition.node_property_value);
+
+        bool accept(const std::string &token) {
+            if (next_ < tokens_.size() && tokens_[next_] == token) {
+                next_++;
+                return true;
+            }
+            return false;
+        }
+
+        Status error(const std::string &why) {
+            return Status(google::cloud::StatusCode::kInvalidArgument, "condition expression: " + why);
+        }
+
+        std::vector<std::string> tokens_;
+        size_t next_ = 0;
+};
+
+}  // namespace
+
+StatusOr<condition_expression> parse_expression(const std::string &text) {
+    std::vector<std::string> tokens;
+    std::string token;
+    for (char c : text) {
+        if (c == '(' || c == ')' || std::isspace(static_cast<unsigned char>(c))) {
+            if (false == token.empty()) {
+                tokens.push_back(token);
+                token.clear();
+            }
+            if (c == '(' || c == ')') {
+                tokens.push_back(std::string(1, c));
+            }
+        } else {
+            token.push_back(std::toupper(static_cast<unsigned char>(c)));
+        }
+    }
+    if (false == token.empty()) {
+        tokens.push_back(token);
+    }
+    return expression_parser(std::move(tokens)).parse();
+}
+
+compiled_conditions compile_conditions(
+    const std::vector<query_condition> &conditions, const condition_expression &expression) {
+    compiled_conditions compiled;
+    for (const auto &condition : conditions) {
+        compiled.conditions.push_back(compile_condition(condition));
+    }
+    compiled.expression = expression;
+    return compiled;
+}
+
+bool does_condition_hold(const ot::Span* sp, const compiled_condition &compiled) {
+    const query_condition &condition = compiled.condition;
+    if (false == compiled.valid) {
+        return false;
+    }
+    if (condition.is_latency_condition) {
+        // unsigned, as the columns evaluate it
+        const uint64_t latency = sp->end_time_unix_nano() - sp->start_time_unix_nano();
+        return compare(latency, compiled.unsigned_value, condition.comp);
+    } else if (condition.is_attribute_condition) {
+        return does_attribute_condition_hold(sp, compiled);
+    }
+    switch (condition.type) {
+        case string_value:
+            return compare((sp->*condition.func.string_func)(), condition.node_property_value, condition.comp);
+        case bool_value: {
+            if (condition.comp != Equal_to) {
+                return false;  // it is undefined to be "less than" or "greater than" a bool
             }
+            // spelled as get_value_as_string() spells it
+            const char* span_value = (sp->*condition.func.bool_func)() ? "false" : "true";
+            return condition.node_property_value == span_value;
         }
+        case int_value:
+            return compare(static_cast<int64_t>((sp->*condition.func.int_func)()), compiled.int_value, condition.comp);
+        case double_value:
+            return compare((sp->*condition.func.double_func)(), compiled.double_value, condition.comp);
+        case bytes_value:
+            // raw bytes order like their hex
+            return compare((sp->*condition.func.bytes_func)(), compiled.bytes_value, condition.comp);
     }
     return false;
 }
 
+bool does_condition_hold(const ot::Span* sp, const query_condition condition) {
+    return does_condition_hold(sp, compile_condition(condition));
+}
+
 /**
  * TODO: There got to be a concise way to do all this stuff.. directly getting function name
  * from `condition` and invoking that using `reflection` maybe???
@@ -138,54 +396,27 @@ bool does_condition_hold(const ot::Span* sp, const query_condition condition) {
  */
 
 bool does_latency_condition_hold(const ot::Span* sp, const query_condition condition) {
-    const __int64_t latency = sp->end_time_unix_nano() - sp->start_time_unix_nano();
-
-    switch (condition.comp) {
-        case Equal_to:
-            return latency == std::stoul(condition.node_property_value);
-        case Less_than:
-            return latency < std::stoul(condition.node_property_value);
-        case Greater_than:
-            return latency > std::stoul(condition.node_property_value);
-        default:
-            return false;
-    }
-
-    return false;
+    compiled_condition compiled = compile_condition(condition);
+    compiled.condition.is_latency_condition = true;
+    compiled.condition.is_attribute_condition = false;
+    compiled.valid = parse_unsigned(condition.node_property_value, compiled.unsigned_value);
+    return does_condition_hold(sp, compiled);
 }
 
 bool does_start_time_condition_hold(const ot::Span* sp, const query_condition condition) {
-    auto start_time = sp->start_time_unix_nano();
-
-    switch (condition.comp) {
-        case Equal_to:
-            return start_time == std::stoul(condition.node_property_value);
-        case Less_than:
-            return start_time < std::stoul(condition.node_property_value);
-        case Greater_than:
-            return start_time > std::stoul(condition.node_property_value);
-        default:
-            return false;
+    uint64_t value = 0;
+    if (false == parse_unsigned(condition.node_property_value, value)) {
+        return false;
     }
-
-    return false;
+    return compare(static_cast<uint64_t>(sp->start_time_unix_nano()), value, condition.comp);
 }
 
 bool does_end_time_condition_hold(const ot::Span* sp, const query_condition condition) {
-    auto end_time = sp->end_time_unix_nano();
-
-    switch (condition.comp) {
-        case Equal_to:
-            return end_time == std::stoul(condition.node_property_value);
-        case Less_than:
-            return end_time < std::stoul(condition.node_property_value);
-        case Greater_than:
-            return end_time > std::stoul(condition.node_property_value);
-        default:
-            return false;
+    uint64_t value = 0;
+    if (false == parse_unsigned(condition.node_property_value, value)) {
+        return false;
     }
-
-    return false;
+    return compare(static_cast<uint64_t>(sp->end_time_unix_nano()), value, condition.comp);
 }
 
 bool does_value_satisfy_condition(std::string value, query_condition condition) {
@@ -1,7 +1,9 @@
 #ifndef QUERY_CONDITIONS_H_  // NOLINT
 #define QUERY_CONDITIONS_H_  // NOLINT
 
+#include <cstdint>
 #include <string>
+#include <vector>
 #include "opentelemetry/proto/trace/v1/trace.pb.h"
 #include "common.h"
 
@@ -45,8 +47,69 @@ struct query_condition {
     bool is_attribute_condition;
 };
 
+/*
+ * A condition ready to be evaluated on many spans: its value is parsed once,
+ * into the type the span's field is compared as, so evaluating it neither
+ * parses the value nor formats the span's.  Attribute conditions find the
+ * attribute by key before looking at any value.
+*/
+struct compiled_condition {
+    query_condition condition;
+    // false if node_property_value isn't a valid number for a numeric
+    // field; the condition then holds on no span
+    bool valid = true;
+    int64_t int_value = 0;
+    uint64_t unsigned_value = 0;   // latencies and timestamps, in nanoseconds
+    double double_value = 0;
+    std::string bytes_value;       // decoded from hex
+};
+
+compiled_condition compile_condition(const query_condition &condition);
+
+enum condition_operator {
+    condition_leaf,
+    condition_and,
+    condition_or,
+    condition_not,
+};
+
+// A boolean combination of a query's conditions; leaves refer to them by index.
+struct condition_expression {
+    condition_operator op = condition_and;
+    int condition_index = -1;
+    std::vector<condition_expression> children;
+};
+
+condition_expression leaf_condition(int condition_index);
+condition_expression and_of(std::vector<condition_expression> children);
+condition_expression or_of(std::vector<condition_expression> children);
+condition_expression not_of(condition_expression child);
+// What a list of conditions means without an expression: all of them.
+condition_expression all_conditions(int num_conditions);
+// The conditions every match satisfies: leaves reached from the root through
+// ANDs only.  Only these can narrow a query down through their indices.
+std::vector<int> required_conditions(const condition_expression &expression);
+// False if a leaf refers to no condition or a NOT doesn't have exactly one child.
+bool is_valid_expression(const condition_expression &expression, int num_conditions);
+// E.g. "(0 AND (1 OR NOT 2))".
+std::string expression_to_string(const condition_expression &expression);
+// Reads what expression_to_string() writes; NOT binds tighter than AND,
+// and AND tighter than OR, so "0 AND 1 OR NOT 2" is "((0 AND 1) OR NOT 2)".
+StatusOr<condition_expression> parse_expression(const std::string &text);
+
+// A query's conditions compiled, with how they combine.
+struct compiled_conditions {
+    std::vector<compiled_condition> conditions;
+    condition_expression expression;
+};
+
+compiled_conditions compile_conditions(
+    const std::vector<query_condition> &conditions, const condition_expression &expression);
+
 std::string get_value_as_string(const ot::Span* sp,
     get_value_func val_func, property_type prop_type);
+bool does_condition_hold(const ot::Span* sp, const compiled_condition &condition);
+// Compiles condition first; for one-off checks.
 bool does_condition_hold(const ot::Span* sp, query_condition condition);
 
 bool does_latency_condition_hold(const ot::Span* sp, query_condition condition);
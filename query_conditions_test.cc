@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "query_conditions.h"
+
+namespace {
+
+ot::Span make_span() {
+  ot::Span span;
+  span.set_span_id(std::string("\x01\xab", 2));
+  span.set_start_time_unix_nano(1000);
+  span.set_end_time_unix_nano(1500);
+  auto attribute = span.add_attributes();
+  attribute->set_key("http.method");
+  attribute->mutable_value()->set_string_value("GET");
+  attribute = span.add_attributes();
+  attribute->set_key("retries");
+  attribute->mutable_value()->set_int_value(2);
+  return span;
+}
+
+query_condition latency_condition(const std::string &value, property_comparison comp) {
+  query_condition condition;
+  condition.node_index = 0;
+  condition.type = int_value;
+  condition.node_property_value = value;
+  condition.comp = comp;
+  condition.is_latency_condition = true;
+  condition.is_attribute_condition = false;
+  return condition;
+}
+
+query_condition attribute_condition(const std::string &key, const std::string &value, property_comparison comp) {
+  query_condition condition;
+  condition.node_index = 0;
+  condition.type = string_value;
+  condition.property_name = key;
+  condition.node_property_value = value;
+  condition.comp = comp;
+  condition.is_latency_condition = false;
+  condition.is_attribute_condition = true;
+  return condition;
+}
+
+}  // namespace
+
+TEST(CompiledCondition, ParsesTheValueOnce) {
+  const ot::Span span = make_span();
+  EXPECT_TRUE(does_condition_hold(&span, compile_condition(latency_condition("500", Equal_to))));
+  EXPECT_TRUE(does_condition_hold(&span, compile_condition(latency_condition("400", Greater_than))));
+  EXPECT_FALSE(does_condition_hold(&span, compile_condition(latency_condition("400", Less_than))));
+
+  compiled_condition invalid = compile_condition(latency_condition("fast", Less_than));
+  EXPECT_FALSE(invalid.valid);
+  EXPECT_FALSE(does_condition_hold(&span, invalid));
+
+  query_condition span_id = latency_condition("01AB", Equal_to);
+  span_id.is_latency_condition = false;
+  span_id.type = bytes_value;
+  span_id.func.bytes_func = &ot::Span::span_id;
+  EXPECT_TRUE(does_condition_hold(&span, compile_condition(span_id)));
+}
+
+TEST(CompiledCondition, ComparesAttributesAsText) {
+  const ot::Span span = make_span();
+  EXPECT_TRUE(does_condition_hold(&span, attribute_condition("http.method", "GET", Equal_to)));
+  EXPECT_TRUE(does_condition_hold(&span, attribute_condition("http.method", "POST", Less_than)));
+  EXPECT_TRUE(does_condition_hold(&span, attribute_condition("retries", "2", Equal_to)));
+  EXPECT_FALSE(does_condition_hold(&span, attribute_condition("user.id", "2", Equal_to)));
+}
+
+TEST(ConditionExpression, OnlyConditionsUnderAndAreRequired) {
+  condition_expression where = and_of({leaf_condition(0), or_of({leaf_condition(1), not_of(leaf_condition(2))})});
+  EXPECT_EQ(expression_to_string(where), "(0 AND (1 OR NOT 2))");
+  EXPECT_EQ(required_conditions(where), std::vector<int>({0}));
+  EXPECT_EQ(required_conditions(all_conditions(3)), std::vector<int>({0, 1, 2}));
+  EXPECT_TRUE(is_valid_expression(where, 3));
+  EXPECT_FALSE(is_valid_expression(where, 2));
+}
+
+TEST(ConditionExpression, ParsesWhatItPrints) {
+  condition_expression where = or_of({and_of({leaf_condition(0), leaf_condition(1)}), not_of(leaf_condition(2))});
+  auto parsed = parse_expression(expression_to_string(where));
+  ASSERT_TRUE(parsed.ok());
+  EXPECT_EQ(expression_to_string(parsed.value()), expression_to_string(where));
+
+  parsed = parse_expression("0 and 1 or not 2");
+  ASSERT_TRUE(parsed.ok());
+  EXPECT_EQ(expression_to_string(parsed.value()), "((0 AND 1) OR NOT 2)");
+
+  EXPECT_FALSE(parse_expression("(0 AND").ok());
+  EXPECT_FALSE(parse_expression("0 1").ok());
+  EXPECT_FALSE(parse_expression("duration").ok());
+}
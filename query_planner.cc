@@ -0,0 +1,245 @@
+#include "query_planner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "graph_query.h"
+
+namespace {
+
+const char* index_type_name(index_type type) {
+    switch (type) {
+        case bloom: return "bloom";
+        case folder: return "folder";
+        case none: break;
+        case not_found: break;
+    }
+    return "none";
+}
+
+const char* comparison_name(property_comparison comp) {
+    switch (comp) {
+        case Equal_to: return "==";
+        case Less_than: return "<";
+        case Greater_than: return ">";
+    }
+    return "?";
+}
+
+condition_estimate estimate_condition(const query_condition &condition, const index_statistics &statistics,
+    int start_time, int end_time, int num_batches) {
+    condition_estimate estimate;
+    if (condition.comp == Equal_to) {
+        // one value out of those a batch has, on average
+        estimate.selectivity = statistics.distinct_values > 0 && statistics.batches_indexed > 0
+            ? std::min(1.0, static_cast<double>(statistics.batches_indexed) / statistics.distinct_values)
+            : DEFAULT_EQUALITY_SELECTIVITY;
+    } else {
+        estimate.selectivity = DEFAULT_RANGE_SELECTIVITY;
+    }
+    estimate.evaluation_cost = span_columns_enabled() && can_evaluate_on_columns(condition)
+        ? COLUMNS_EVALUATION_COST : SPAN_DATA_EVALUATION_COST;
+
+    if (statistics.type != bloom && statistics.type != folder) {
+        estimate.reason = "not indexed";
+        return estimate;
+    }
+    // batches starting after last_updated aren't in the index, and pass it unfiltered
+    if (end_time > start_time) {
+        estimate.index_coverage = std::clamp(
+            static_cast<double>(statistics.last_updated - start_time) / (end_time - start_time), 0.0, 1.0);
+    } else {
+        estimate.index_coverage = statistics.last_updated >= start_time ? 1 : 0;
+    }
+
+    if (statistics.type == bloom && condition.comp != Equal_to) {
+        estimate.reason = "a bloom index only answers equality";
+    } else if (num_batches == 0) {
+        estimate.reason = "no batches in range";
+    } else if (estimate.index_coverage <= 0) {
+        estimate.reason = "index hasn't reached the time range";
+    } else if (estimate.selectivity > MAX_INDEXED_SELECTIVITY) {
+        estimate.reason = "not selective enough to be worth reading the index";
+    } else {
+        estimate.use_index = true;
+        estimate.reason = "index consulted";
+    }
+    return estimate;
+}
+
+std::atomic<int> index_statistics_ttl_seconds{0};
+
+struct cached_statistics {
+    index_statistics statistics;
+    std::chrono::steady_clock::time_point read_at;
+};
+
+// Index bucket name to the statistics last read from it.
+std::mutex statistics_cache_mutex;
+std::unordered_map<std::string, cached_statistics> statistics_cache;
+
+StatusOr<index_statistics> get_index_statistics_within_ttl(const query_condition &condition,
+    storage_backend* client) {
+    const int ttl_seconds = index_statistics_ttl_seconds;
+    if (ttl_seconds <= 0) {
+        return get_index_statistics(condition, client);
+    }
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(statistics_cache_mutex);
+        auto cached = statistics_cache.find(condition.property_name);
+        if (cached != statistics_cache.end() && now - cached->second.read_at < std::chrono::seconds(ttl_seconds)) {
+            return cached->second.statistics;
+        }
+    }
+    auto statistics = get_index_statistics(condition, client);
+    if (statistics.ok()) {
+        std::lock_guard<std::mutex> lock(statistics_cache_mutex);
+        statistics_cache[condition.property_name] = {statistics.value(), now};
+    }
+    return statistics;
+}
+
+}  // namespace
+
+void set_index_statistics_ttl(int ttl_seconds) {
+    index_statistics_ttl_seconds = ttl_seconds;
+    std::lock_guard<std::mutex> lock(statistics_cache_mutex);
+    statistics_cache.clear();
+}
+
+StatusOr<index_statistics> get_index_statistics(const query_condition &condition, storage_backend* client) {
+    std::string bucket_name = condition.property_name;
+    replace_all(bucket_name, ".", "-");
+    bucket_name = "index-" + bucket_name + BUCKETS_SUFFIX;
+    index_statistics statistics;
+    auto bucket_labels = client->get_bucket_labels(bucket_name);
+    if (bucket_labels.status().code() == ::google::cloud::StatusCode::kNotFound ||
+        bucket_labels.status().code() == ::google::cloud::StatusCode::kPermissionDenied) {
+        return statistics;
+    }
+    if (!bucket_labels.ok()) {
+        return bucket_labels.status();
+    }
+
+    statistics.type = not_found;
+    for (auto const& kv : bucket_labels.value()) {
+        if (kv.first == BUCKET_TYPE_LABEL_KEY) {
+            if (kv.second == "bloom_index") {
+                statistics.type = bloom;
+            } else if (kv.second == "folder_index") {
+                statistics.type = folder;
+            }
+        }
+        if (kv.first == "last_indexed")  {
+            statistics.last_updated = std::stoi(kv.second);
+        }
+        if (kv.first == "root") {
+            statistics.last_updated = std::stoi(split_by_string(kv.second, hyphen)[0]);
+        }
+        if (kv.first == BATCHES_INDEXED_LABEL_KEY) {
+            statistics.batches_indexed = std::stoll(kv.second);
+        }
+        if (kv.first == DISTINCT_VALUES_LABEL_KEY) {
+            statistics.distinct_values = std::stoll(kv.second);
+        }
+    }
+    if (statistics.type == not_found) {
+        statistics.last_updated = 0;
+    }
+    return statistics;
+}
+
+query_plan plan_query(int start_time, int end_time, int num_batches,
+    const std::vector<query_condition> &conditions, const std::vector<index_statistics> &statistics,
+    const condition_expression *where) {
+    query_plan plan;
+    plan.start_time = start_time;
+    plan.end_time = end_time;
+    plan.num_batches = num_batches;
+    plan.statistics = statistics;
+    plan.where = where == nullptr ? all_conditions(conditions.size()) : *where;
+    const std::vector<int> required = required_conditions(plan.where);
+
+    for (size_t i = 0; i < conditions.size(); i++) {
+        condition_estimate estimate = estimate_condition(conditions[i], statistics[i], start_time, end_time,
+            num_batches);
+        if (estimate.use_index && false == std::binary_search(required.begin(), required.end(), static_cast<int>(i))) {
+            estimate.use_index = false;
+            estimate.reason = "not required by every match (under OR or NOT)";
+        }
+        if (estimate.use_index) {
+            plan.indexed_conditions.push_back(i);
+            if (plan.earliest_last_updated == -1 || statistics[i].last_updated < plan.earliest_last_updated) {
+                plan.earliest_last_updated = statistics[i].last_updated;
+            }
+            // Waiting on the index first only pays if it can rule out whole batches.
+            if (num_batches > 1 && estimate.selectivity <= MAX_INDEX_FIRST_SELECTIVITY &&
+                estimate.index_coverage >= 0.5) {
+                plan.start = start_with_index;
+            }
+        }
+        plan.estimates.push_back(estimate);
+        plan.evaluation_order.push_back(i);
+    }
+
+    // The expected cost of evaluating a condition per trace it rules out.
+    auto rank = [&plan](int i) {
+        return plan.estimates[i].evaluation_cost / std::max(1 - plan.estimates[i].selectivity, 1e-9);
+    };
+    std::stable_sort(plan.evaluation_order.begin(), plan.evaluation_order.end(),
+        [&rank](int a, int b) { return rank(a) < rank(b); });
+    return plan;
+}
+
+query_plan make_query_plan(int start_time, int end_time, int num_batches,
+    const std::vector<query_condition> &conditions, storage_backend* client,
+    const condition_expression *where) {
+    std::vector<index_statistics> statistics;
+    for (auto &condition : conditions) {
+        auto condition_statistics = get_index_statistics_within_ttl(condition, client);
+        if (!condition_statistics.ok()) {
+            // plan as if unindexed; the query still answers it from span data
+            std::cerr << "Error reading index statistics for " << condition.property_name << ":" << std::endl;
+            std::cerr << condition_statistics.status().message() << std::endl;
+            statistics.push_back(index_statistics());
+            continue;
+        }
+        statistics.push_back(condition_statistics.value());
+    }
+    return plan_query(start_time, end_time, num_batches, conditions, statistics, where);
+}
+
+std::string explain_query_plan(const query_plan &plan, const std::vector<query_condition> &conditions) {
+    std::ostringstream out;
+    out << std::setprecision(3);
+    out << "Query plan for [" << plan.start_time << ", " << plan.end_time << "], "
+        << plan.num_batches << " batches" << std::endl;
+    out << "  start with: " << (plan.start == start_with_index ? "index" : "structure") << std::endl;
+    out << "  where: " << expression_to_string(plan.where) << std::endl;
+    for (size_t i = 0; i < conditions.size(); i++) {
+        const condition_estimate &estimate = plan.estimates[i];
+        out << "  condition " << i << " (" << conditions[i].property_name << " "
+            << comparison_name(conditions[i].comp) << " " << conditions[i].node_property_value << "):"
+            << " selectivity " << estimate.selectivity
+            << ", cost " << estimate.evaluation_cost
+            << ", index " << index_type_name(plan.statistics[i].type);
+        if (plan.statistics[i].type == bloom || plan.statistics[i].type == folder) {
+            out << " covering " << estimate.index_coverage * 100 << "% of the range";
+        }
+        out << " -- " << estimate.reason << std::endl;
+    }
+    if (false == plan.evaluation_order.empty()) {
+        out << "  evaluation order:";
+        for (int i : plan.evaluation_order) {
+            out << " " << i;
+        }
+        out << std::endl;
+    }
+    return out.str();
+}
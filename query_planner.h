@@ -0,0 +1,107 @@
+/*
+ * Chooses how query() runs, from what is known before any data is read.
+ *
+ * Left to itself, query() consults every index is_indexed() reports,
+ * filters every batch by structure before looking at the index results,
+ * and evaluates the conditions in the order they were written.  The planner
+ * estimates, for each condition, the fraction of spans it holds on
+ * (selectivity) and what evaluating it costs, using the statistics the
+ * index builders leave in the index bucket's labels, the query's time range
+ * and the number of batches in it, and decides
+ *
+ *   - which indices to consult: only ones that cover part of the range and
+ *     are selective enough that reading them beats evaluating the
+ *     condition on span data;
+ *   - whether to start with an index: when one is very selective, its
+ *     results are waited for first and batches it has no traces in are
+ *     never filtered by structure;
+ *   - the order conditions are evaluated in: cheapest and most selective
+ *     first, stopping on a trace as soon as one fails.
+ *
+ * When the conditions combine through OR or NOT, only the ones every match
+ * satisfies (required_conditions()) can have their index consulted; an
+ * index on the others would drop traces that match some other way.
+ *
+ * explain_query_plan() prints the plan and the estimates behind it.  The
+ * estimates only steer the plan; every choice returns the same results.
+*/
+
+#ifndef QUERY_PLANNER_H_ // NOLINT
+#define QUERY_PLANNER_H_
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "query_conditions.h"
+
+// Selectivities assumed when there are no statistics to go on.
+const double DEFAULT_EQUALITY_SELECTIVITY = 0.1;
+const double DEFAULT_RANGE_SELECTIVITY = 1.0 / 3;
+// Consult an index only if its condition holds on at most this fraction of spans.
+const double MAX_INDEXED_SELECTIVITY = 0.2;
+// Start with an index if its condition holds on at most this fraction of spans
+// and it covers at least half the time range.
+const double MAX_INDEX_FIRST_SELECTIVITY = 0.01;
+// Relative cost of evaluating a condition per span, on span columns and on span data.
+const double COLUMNS_EVALUATION_COST = 1;
+const double SPAN_DATA_EVALUATION_COST = 8;
+
+struct index_statistics {
+    index_type type = none;
+    time_t last_updated = 0;
+    // Summed over the batches indexed; 0 if the index predates these labels.
+    int64_t batches_indexed = 0;
+    int64_t distinct_values = 0;
+};
+
+StatusOr<index_statistics> get_index_statistics(const query_condition &condition, storage_backend* client);
+// Lets make_query_plan() reuse an index's statistics for up to ttl_seconds
+// rather than reading its bucket's labels for every query; 0, the default,
+// turns that off.  Statistics a little out of date only make the plan
+// assume an index covers less of the range than it does.
+void set_index_statistics_ttl(int ttl_seconds);
+
+enum plan_start {
+    start_with_structure,
+    start_with_index,
+};
+
+struct condition_estimate {
+    double selectivity = 1;
+    double evaluation_cost = SPAN_DATA_EVALUATION_COST;
+    // Fraction of the query's time range the condition's index covers.
+    double index_coverage = 0;
+    bool use_index = false;
+    std::string reason;
+};
+
+struct query_plan {
+    int start_time = 0;
+    int end_time = 0;
+    int num_batches = 0;
+    std::vector<index_statistics> statistics;   // per condition
+    std::vector<condition_estimate> estimates;  // per condition
+    // Conditions whose index is consulted, and the earliest their indices were last updated.
+    std::vector<int> indexed_conditions;
+    time_t earliest_last_updated = -1;
+    plan_start start = start_with_structure;
+    // Condition indices, in the order they are evaluated.
+    std::vector<int> evaluation_order;
+    // How the conditions combine.
+    condition_expression where;
+};
+
+// Only arithmetic on what it's given, so plans can be checked without storage.
+// Without where, all the conditions must hold.
+query_plan plan_query(int start_time, int end_time, int num_batches,
+    const std::vector<query_condition> &conditions, const std::vector<index_statistics> &statistics,
+    const condition_expression *where = nullptr);
+// Reads the statistics of every condition's index.
+query_plan make_query_plan(int start_time, int end_time, int num_batches,
+    const std::vector<query_condition> &conditions, storage_backend* client,
+    const condition_expression *where = nullptr);
+std::string explain_query_plan(const query_plan &plan, const std::vector<query_condition> &conditions);
+
+#endif  // QUERY_PLANNER_H_ // NOLINT
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "query_planner.h"
+
+namespace {
+
+query_condition condition(const std::string &property_name, property_comparison comp) {
+  query_condition to_return;
+  to_return.node_index = 0;
+  to_return.type = string_value;
+  to_return.property_name = property_name;
+  to_return.node_property_value = "1";
+  to_return.comp = comp;
+  to_return.is_latency_condition = false;
+  to_return.is_attribute_condition = false;
+  return to_return;
+}
+
+index_statistics bloom_index(time_t last_updated, int64_t batches_indexed, int64_t distinct_values) {
+  index_statistics statistics;
+  statistics.type = bloom;
+  statistics.last_updated = last_updated;
+  statistics.batches_indexed = batches_indexed;
+  statistics.distinct_values = distinct_values;
+  return statistics;
+}
+
+}  // namespace
+
+TEST(QueryPlanner, ConsultsOnlySelectiveIndicesThatReachTheRange) {
+  std::vector<query_condition> conditions = {
+    condition("trace.id", Equal_to),       // one value in 1000 per batch
+    condition("http.status", Equal_to),    // one value in 2 per batch
+    condition("duration", Greater_than),   // bloom can't answer ranges
+    condition("user.id", Equal_to),        // indexed only up to before the range
+    condition("region", Equal_to),         // no index
+  };
+  std::vector<index_statistics> statistics = {
+    bloom_index(1000, 10, 10000),
+    bloom_index(1000, 10, 20),
+    bloom_index(1000, 10, 10000),
+    bloom_index(50, 10, 10000),
+    index_statistics(),
+  };
+
+  query_plan plan = plan_query(100, 500, 4, conditions, statistics);
+  EXPECT_EQ(plan.indexed_conditions, std::vector<int>({0}));
+  EXPECT_EQ(plan.earliest_last_updated, 1000);
+  EXPECT_EQ(plan.start, start_with_index);
+  EXPECT_FALSE(explain_query_plan(plan, conditions).empty());
+}
+
+TEST(QueryPlanner, EvaluatesSelectiveConditionsFirst) {
+  std::vector<query_condition> conditions = {
+    condition("duration", Greater_than),
+    condition("http.status", Equal_to),
+    condition("trace.id", Equal_to),
+  };
+  std::vector<index_statistics> statistics = {
+    index_statistics(),
+    bloom_index(0, 10, 20),
+    bloom_index(0, 10, 10000),
+  };
+
+  query_plan plan = plan_query(100, 500, 4, conditions, statistics);
+  EXPECT_EQ(plan.evaluation_order, std::vector<int>({2, 0, 1}));
+  EXPECT_TRUE(plan.indexed_conditions.empty());
+  EXPECT_EQ(plan.start, start_with_structure);
+}
+
+TEST(QueryPlanner, ConsultsIndicesOnlyForConditionsEveryMatchSatisfies) {
+  std::vector<query_condition> conditions = {
+    condition("trace.id", Equal_to),
+    condition("user.id", Equal_to),
+  };
+  std::vector<index_statistics> statistics = {
+    bloom_index(1000, 10, 10000),
+    bloom_index(1000, 10, 10000),
+  };
+
+  condition_expression where = or_of({leaf_condition(0), leaf_condition(1)});
+  query_plan plan = plan_query(100, 500, 4, conditions, statistics, &where);
+  EXPECT_TRUE(plan.indexed_conditions.empty());
+
+  where = and_of({leaf_condition(0), not_of(leaf_condition(1))});
+  plan = plan_query(100, 500, 4, conditions, statistics, &where);
+  EXPECT_EQ(plan.indexed_conditions, std::vector<int>({0}));
+}
@@ -0,0 +1,232 @@
+#include "query_profile.h"
+
+#include <time.h>
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+thread_local profile_context current_context;
+// Wall and CPU time of the scopes that have finished inside the innermost
+// open scope on this thread, which it doesn't count as its own.
+thread_local int64_t nested_wall_ns = 0;
+thread_local int64_t nested_cpu_ns = 0;
+
+int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t thread_cpu_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+stage_profile* current_stage() {
+    if (current_context.profile == nullptr) {
+        return nullptr;
+    }
+    return &current_context.profile->stage(current_context.stage);
+}
+
+void store_min(std::atomic<int64_t> &target, int64_t value) {
+    int64_t seen = target.load(std::memory_order_relaxed);
+    while ((seen < 0 || value < seen) && false == target.compare_exchange_weak(seen, value)) {}
+}
+
+void store_max(std::atomic<int64_t> &target, int64_t value) {
+    int64_t seen = target.load(std::memory_order_relaxed);
+    while (value > seen && false == target.compare_exchange_weak(seen, value)) {}
+}
+
+double ms(int64_t ns) {
+    return ns / 1e6;
+}
+
+}  // namespace
+
+const char* profile_stage_name(profile_stage stage) {
+    switch (stage) {
+        case prefix_listing: return "prefix_listing";
+        case batch_listing: return "batch_listing";
+        case exemplar_fetch: return "exemplar_fetch";
+        case structural_matching: return "structural_matching";
+        case tracehash_reads: return "tracehash_reads";
+        case query_planning: return "query_planning";
+        case index_traversal: return "index_traversal";
+        case intersection: return "intersection";
+        case span_fetch: return "span_fetch";
+        case predicate_evaluation: return "predicate_evaluation";
+        case return_extraction: return "return_extraction";
+        case NUM_PROFILE_STAGES: break;
+    }
+    return "unknown";
+}
+
+query_profile::query_profile() : created_ns_(steady_ns()) {}
+
+int64_t query_profile::elapsed_ns() const {
+    return steady_ns() - created_ns_;
+}
+
+std::string query_profile::to_json() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"wall_ms\": " << ms(wall_ns) << ", \"results\": " << results << ", \"stages\": [";
+    for (int i = 0; i < NUM_PROFILE_STAGES; i++) {
+        const stage_profile &s = stages_[i];
+        out << (i > 0 ? ", " : "")
+            << "{\"stage\": \"" << profile_stage_name(static_cast<profile_stage>(i)) << "\""
+            << ", \"scopes\": " << s.scopes
+            << ", \"thread_wall_ms\": " << ms(s.thread_wall_ns)
+            << ", \"cpu_ms\": " << ms(s.cpu_ns)
+            << ", \"first_start_ms\": " << (s.first_start_ns < 0 ? 0 : ms(s.first_start_ns))
+            << ", \"last_end_ms\": " << ms(s.last_end_ns)
+            << ", \"object_reads\": " << s.object_reads
+            << ", \"lists\": " << s.lists
+            << ", \"bytes_read\": " << s.bytes_read
+            << ", \"cache_hits\": " << s.cache_hits
+            << ", \"items_in\": " << s.items_in
+            << ", \"items_out\": " << s.items_out << "}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+profile_context current_profile_context() {
+    return current_context;
+}
+
+profile_scope::profile_scope(query_profile* profile, profile_stage stage) {
+    profile_context context;
+    context.profile = profile;
+    context.stage = stage;
+    enter(context);
+    if (profile != nullptr) {
+        profile->stage(stage).scopes++;
+    }
+}
+
+profile_scope::profile_scope(profile_stage stage)
+: profile_scope(current_context.profile, stage) {}
+
+profile_scope::profile_scope(profile_context context) {
+    enter(context);
+}
+
+void profile_scope::enter(profile_context context) {
+    saved_ = current_context;
+    context_ = context;
+    current_context = context;
+    if (context_.profile == nullptr) {
+        return;
+    }
+    start_ns_ = steady_ns();
+    start_cpu_ns_ = thread_cpu_ns();
+    saved_nested_wall_ns_ = nested_wall_ns;
+    saved_nested_cpu_ns_ = nested_cpu_ns;
+    nested_wall_ns = 0;
+    nested_cpu_ns = 0;
+    store_min(context_.profile->stage(context_.stage).first_start_ns, context_.profile->elapsed_ns());
+}
+
+profile_scope::~profile_scope() {
+    current_context = saved_;
+    if (context_.profile == nullptr) {
+        return;
+    }
+    const int64_t wall = steady_ns() - start_ns_;
+    const int64_t cpu = thread_cpu_ns() - start_cpu_ns_;
+    stage_profile &stage = context_.profile->stage(context_.stage);
+    stage.thread_wall_ns += wall - nested_wall_ns;
+    stage.cpu_ns += cpu - nested_cpu_ns;
+    store_max(stage.last_end_ns, context_.profile->elapsed_ns());
+    nested_wall_ns = saved_nested_wall_ns_ + wall;
+    nested_cpu_ns = saved_nested_cpu_ns_ + cpu;
+}
+
+void profile_items(int64_t in, int64_t out) {
+    if (stage_profile* stage = current_stage()) {
+        stage->items_in += in;
+        stage->items_out += out;
+    }
+}
+
+void profile_cache_hit() {
+    if (stage_profile* stage = current_stage()) {
+        stage->cache_hits++;
+    }
+}
+
+void profile_object_read(int64_t bytes) {
+    if (stage_profile* stage = current_stage()) {
+        stage->object_reads++;
+        stage->bytes_read += bytes;
+    }
+}
+
+void profile_list() {
+    if (stage_profile* stage = current_stage()) {
+        stage->lists++;
+    }
+}
+
+StatusOr<std::shared_ptr<const stored_object>> profiled_backend::read(
+    const std::string &bucket, const std::string &object) {
+    auto contents = inner_->read(bucket, object);
+    profile_object_read(contents.ok() ? contents.value()->size() : 0);
+    return contents;
+}
+
+StatusOr<std::string> profiled_backend::read_range(
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end) {
+    auto contents = inner_->read_range(bucket, object, begin, end);
+    profile_object_read(contents.ok() ? contents.value().size() : 0);
+    return contents;
+}
+
+StatusOr<object_info> profiled_backend::stat(const std::string &bucket, const std::string &object) {
+    profile_object_read(0);
+    return inner_->stat(bucket, object);
+}
+
+StatusOr<std::vector<object_info>> profiled_backend::list_objects(
+    const std::string &bucket, const std::string &prefix, int64_t max_results) {
+    profile_list();
+    return inner_->list_objects(bucket, prefix, max_results);
+}
+
+StatusOr<std::vector<std::string>> profiled_backend::list_prefixes(
+    const std::string &bucket, const std::string &delimiter) {
+    profile_list();
+    return inner_->list_prefixes(bucket, delimiter);
+}
+
+Status profiled_backend::write(const std::string &bucket, const std::string &object, const std::string &contents) {
+    return inner_->write(bucket, object, contents);
+}
+
+StatusOr<std::map<std::string, std::string>> profiled_backend::get_bucket_labels(const std::string &bucket) {
+    profile_object_read(0);
+    return inner_->get_bucket_labels(bucket);
+}
+
+Status profiled_backend::set_bucket_label(
+    const std::string &bucket, const std::string &key, const std::string &value) {
+    return inner_->set_bucket_label(bucket, key, value);
+}
+
+Status profiled_backend::create_bucket(const std::string &bucket) {
+    return inner_->create_bucket(bucket);
+}
+
+void profiled_backend::prefetch(const std::string &bucket, const std::string &object) {
+    inner_->prefetch(bucket, object);
+}
+
+bool profiled_backend::accepts_prefetch() const {
+    return inner_->accepts_prefetch();
+}
@@ -0,0 +1,151 @@
+/*
+ * Per-query profiles: where a query spent its time and what it read.
+ *
+ * A query_profile has a row per stage of a query (listing, structural
+ * matching, index traversal, span fetch, ...).  Code does its work for a
+ * stage inside a profile_scope; the scope adds its thread's wall and CPU
+ * time to the stage, less the time of scopes nested in it on the same
+ * thread, so each row only counts its own work.  The stage a thread is
+ * working for is carried into the tasks it submits to the executor, so
+ * reads and parses done on pool threads are charged to the stage that asked
+ * for them.
+ *
+ * A query wraps its storage backend in a profiled_backend, which charges
+ * every request and the bytes it returned to the current stage.  Cache hits
+ * are charged by the caches.  Stages record how many candidates (batches,
+ * structures, traces) came in and went out with profile_items().
+ *
+ * With no profile attached to the thread, scopes and counters do nothing
+ * but look at a thread-local pointer.
+*/
+
+#ifndef QUERY_PROFILE_H_ // NOLINT
+#define QUERY_PROFILE_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "storage.h"
+
+enum profile_stage {
+    prefix_listing,
+    batch_listing,
+    exemplar_fetch,
+    structural_matching,
+    tracehash_reads,
+    query_planning,
+    index_traversal,
+    intersection,
+    span_fetch,
+    predicate_evaluation,
+    return_extraction,
+    NUM_PROFILE_STAGES,
+};
+
+const char* profile_stage_name(profile_stage stage);
+
+struct stage_profile {
+    std::atomic<int64_t> scopes{0};
+    // Summed over threads, so busy stages can exceed the query's wall time.
+    std::atomic<int64_t> thread_wall_ns{0};
+    std::atomic<int64_t> cpu_ns{0};
+    // When the stage was first entered and last left, since the query started.
+    std::atomic<int64_t> first_start_ns{-1};
+    std::atomic<int64_t> last_end_ns{0};
+    std::atomic<int64_t> object_reads{0};
+    std::atomic<int64_t> lists{0};
+    std::atomic<int64_t> bytes_read{0};
+    std::atomic<int64_t> cache_hits{0};
+    std::atomic<int64_t> items_in{0};
+    std::atomic<int64_t> items_out{0};
+};
+
+class query_profile {
+    public: // NOLINT
+        query_profile();
+        query_profile(const query_profile&) = delete;
+        query_profile& operator=(const query_profile&) = delete;
+
+        stage_profile& stage(profile_stage stage) { return stages_[stage]; }
+        const stage_profile& stage(profile_stage stage) const { return stages_[stage]; }
+        // Nanoseconds since the profile was created.
+        int64_t elapsed_ns() const;
+
+        // Set by the query as it finishes.
+        std::atomic<int64_t> wall_ns{0};
+        std::atomic<int64_t> results{0};
+
+        std::string to_json() const;
+
+    private: // NOLINT
+        const int64_t created_ns_;
+        std::array<stage_profile, NUM_PROFILE_STAGES> stages_;
+};
+
+// What the current thread is working for; captured by executor::submit().
+struct profile_context {
+    query_profile* profile = nullptr;
+    profile_stage stage = NUM_PROFILE_STAGES;
+};
+
+profile_context current_profile_context();
+
+class profile_scope {
+    public: // NOLINT
+        profile_scope(query_profile* profile, profile_stage stage);
+        // A stage of the profile the thread is already working for.
+        explicit profile_scope(profile_stage stage);
+        // Resumes a context captured on another thread.
+        explicit profile_scope(profile_context context);
+        ~profile_scope();
+        profile_scope(const profile_scope&) = delete;
+        profile_scope& operator=(const profile_scope&) = delete;
+
+    private: // NOLINT
+        void enter(profile_context context);
+
+        profile_context saved_;
+        profile_context context_;
+        int64_t start_ns_ = 0;
+        int64_t start_cpu_ns_ = 0;
+        int64_t saved_nested_wall_ns_ = 0;
+        int64_t saved_nested_cpu_ns_ = 0;
+};
+
+// Charge the current stage, if any.
+void profile_items(int64_t in, int64_t out);
+void profile_cache_hit();
+void profile_object_read(int64_t bytes);
+void profile_list();
+
+// Counts what passes through to the current stage.
+class profiled_backend : public storage_backend {
+    public: // NOLINT
+        explicit profiled_backend(storage_backend* inner) : inner_(inner) {}
+
+        StatusOr<std::shared_ptr<const stored_object>> read(
+            const std::string &bucket, const std::string &object) override;
+        StatusOr<std::string> read_range(
+            const std::string &bucket, const std::string &object, int64_t begin, int64_t end) override;
+        StatusOr<object_info> stat(const std::string &bucket, const std::string &object) override;
+        StatusOr<std::vector<object_info>> list_objects(
+            const std::string &bucket, const std::string &prefix, int64_t max_results) override;
+        StatusOr<std::vector<std::string>> list_prefixes(
+            const std::string &bucket, const std::string &delimiter) override;
+        Status write(const std::string &bucket, const std::string &object, const std::string &contents) override;
+        StatusOr<std::map<std::string, std::string>> get_bucket_labels(const std::string &bucket) override;
+        Status set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) override;
+        Status create_bucket(const std::string &bucket) override;
+        void prefetch(const std::string &bucket, const std::string &object) override;
+        bool accepts_prefetch() const override;
+
+    private: // NOLINT
+        storage_backend* inner_;
+};
+
+#endif  // QUERY_PROFILE_H_ // NOLINT
@@ -0,0 +1,438 @@
+#include "query_server.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "metrics.h"
+
+namespace {
+
+// How often a connection waiting on its query checks whether the peer has hung up.
+const int HANGUP_POLL_MILLISECONDS = 100;
+
+Status invalid_request(const std::string &why) {
+    return Status(google::cloud::StatusCode::kInvalidArgument, "query request: " + why);
+}
+
+StatusOr<property_comparison> parse_comparison(const std::string &text) {
+    if (text == "==" || text == "=") {
+        return Equal_to;
+    } else if (text == "<") {
+        return Less_than;
+    } else if (text == ">") {
+        return Greater_than;
+    }
+    return invalid_request("unknown comparison " + text);
+}
+
+query_condition make_condition(int node_index, const std::string &property, property_comparison comp,
+    const std::string &value) {
+    query_condition condition;
+    condition.node_index = node_index;
+    condition.type = string_value;
+    condition.node_property_value = value;
+    condition.comp = comp;
+    condition.property_name = property;
+    condition.is_latency_condition = false;
+    condition.is_attribute_condition = false;
+    if (property == "duration") {
+        condition.type = int_value;
+        condition.is_latency_condition = true;
+    } else if (property == "trace_id") {
+        condition.type = bytes_value;
+        condition.func.bytes_func = &ot::Span::trace_id;
+    } else if (property == "span_id") {
+        condition.type = bytes_value;
+        condition.func.bytes_func = &ot::Span::span_id;
+    } else if (property == "parent_span_id") {
+        condition.type = bytes_value;
+        condition.func.bytes_func = &ot::Span::parent_span_id;
+    } else if (property == "start_time") {
+        condition.type = int_value;
+        condition.func.int_func = &ot::Span::start_time_unix_nano;
+    } else if (property == "end_time") {
+        condition.type = int_value;
+        condition.func.int_func = &ot::Span::end_time_unix_nano;
+    } else {
+        condition.is_attribute_condition = true;
+    }
+    return condition;
+}
+
+StatusOr<return_value> make_return_value(int node_index, const std::string &property) {
+    return_value ret;
+    ret.node_index = node_index;
+    if (property == "trace_id") {
+        ret.type = bytes_value;
+        ret.func.bytes_func = &ot::Span::trace_id;
+    } else if (property == "start_time") {
+        ret.type = int_value;
+        ret.func.int_func = &ot::Span::start_time_unix_nano;
+    } else if (property == "end_time") {
+        ret.type = int_value;
+        ret.func.int_func = &ot::Span::end_time_unix_nano;
+    } else {
+        return invalid_request("can't return " + property);
+    }
+    return ret;
+}
+
+// Whole reads and writes on a connection's socket.
+class connection {
+    public: // NOLINT
+        explicit connection(int fd) : fd_(fd) {}
+
+        // The lines up to the next empty line; nothing once the peer has
+        // closed the connection without starting another request.
+        std::optional<std::string> read_request() {
+            std::string request;
+            while (true) {
+                const size_t end = buffered_.find('\n');
+                if (end == std::string::npos) {
+                    char chunk[4096];
+                    const ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+                    if (n <= 0) {
+                        if (request.empty()) {
+                            return std::nullopt;
+                        }
+                        return request + buffered_;
+                    }
+                    buffered_.append(chunk, n);
+                    continue;
+                }
+                std::string line = buffered_.substr(0, end);
+                buffered_.erase(0, end + 1);
+                if (false == line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (line.empty()) {
+                    if (request.empty()) {
+                        continue;  // blank lines between requests
+                    }
+                    return request;
+                }
+                request += line + "\n";
+            }
+        }
+
+        bool write_line(const std::string &line) {
+            const std::string data = line + "\n";
+            size_t written = 0;
+            while (written < data.size()) {
+                const ssize_t n = send(fd_, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                written += n;
+            }
+            return true;
+        }
+
+    private: // NOLINT
+        const int fd_;
+        std::string buffered_;
+};
+
+}  // namespace
+
+StatusOr<query_request> parse_query_request(const std::string &text) {
+    query_request request;
+    bool has_range = false;
+    bool has_return = false;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string keyword;
+        if (false == static_cast<bool>(fields >> keyword)) {
+            continue;
+        }
+        if (keyword == "range") {
+            if (false == static_cast<bool>(fields >> request.start_time >> request.end_time)) {
+                return invalid_request("expected range <start> <end>");
+            }
+            has_range = true;
+        } else if (keyword == "node") {
+            int node_index;
+            std::string service_name;
+            if (false == static_cast<bool>(fields >> node_index >> service_name) || node_index < 0) {
+                return invalid_request("expected node <index> <service>");
+            }
+            if (false == request.query_trace.node_names.insert(std::make_pair(node_index, service_name)).second) {
+                return invalid_request("node " + std::to_string(node_index) + " given twice");
+            }
+        } else if (keyword == "edge") {
+            int from, to;
+            if (false == static_cast<bool>(fields >> from >> to)) {
+                return invalid_request("expected edge <parent index> <child index>");
+            }
+            request.query_trace.edges.insert(std::make_pair(from, to));
+        } else if (keyword == "condition") {
+            int node_index;
+            std::string property, comparison, value;
+            if (false == static_cast<bool>(fields >> node_index >> property >> comparison)) {
+                return invalid_request("expected condition <node index> <property> <==, < or >> <value>");
+            }
+            std::getline(fields >> std::ws, value);
+            auto comp = parse_comparison(comparison);
+            if (!comp.ok()) {
+                return comp.status();
+            }
+            request.conditions.push_back(make_condition(node_index, property, comp.value(), value));
+        } else if (keyword == "where") {
+            std::string expression;
+            std::getline(fields >> std::ws, expression);
+            auto where = parse_expression(expression);
+            if (!where.ok()) {
+                return where.status();
+            }
+            request.where = where.value();
+        } else if (keyword == "return") {
+            int node_index;
+            std::string property;
+            if (false == static_cast<bool>(fields >> node_index >> property)) {
+                return invalid_request("expected return <node index> <property>");
+            }
+            auto ret = make_return_value(node_index, property);
+            if (!ret.ok()) {
+                return ret.status();
+            }
+            request.ret = ret.value();
+            has_return = true;
+        } else if (keyword == "limit") {
+            if (false == static_cast<bool>(fields >> request.limit)) {
+                return invalid_request("expected limit <number of results>");
+            }
+        } else if (keyword == "profile") {
+            request.profile = true;
+        } else if (keyword == "explain") {
+            request.explain = true;
+        } else {
+            return invalid_request("unknown keyword " + keyword);
+        }
+    }
+
+    request.query_trace.num_nodes = request.query_trace.node_names.size();
+    if (false == has_range) {
+        return invalid_request("no range");
+    }
+    if (request.query_trace.node_names.empty()) {
+        return invalid_request("no nodes");
+    }
+    if (false == has_return) {
+        return invalid_request("no return");
+    }
+    for (auto &node : request.query_trace.node_names) {
+        if (node.first >= static_cast<int>(request.query_trace.num_nodes)) {
+            return invalid_request("nodes must be numbered from 0 without gaps");
+        }
+    }
+    auto is_node = [&request](int node_index) { return request.query_trace.node_names.count(node_index) > 0; };
+    for (auto &edge : request.query_trace.edges) {
+        if (false == is_node(edge.first) || false == is_node(edge.second)) {
+            return invalid_request("edge to a node that isn't given");
+        }
+    }
+    for (auto &condition : request.conditions) {
+        if (false == is_node(condition.node_index)) {
+            return invalid_request("condition on a node that isn't given");
+        }
+    }
+    if (false == is_node(request.ret.node_index)) {
+        return invalid_request("return from a node that isn't given");
+    }
+    return request;
+}
+
+void serve_query_request(const query_request &request, storage_backend* client,
+    const std::function<bool(const std::string &line)> &write_line, query_cancellation *cancellation) {
+    static histogram &latency = metrics().get_histogram(
+        "quest_server_request_seconds", "Time to answer a query server request.");
+    static counter &succeeded = metrics().get_counter(
+        "quest_server_requests_total", "Query server requests, by outcome.", {{"outcome", "ok"}});
+    static counter &failed = metrics().get_counter(
+        "quest_server_requests_total", "Query server requests, by outcome.", {{"outcome", "error"}});
+    histogram_timer timer(latency);
+
+    const condition_expression where = request.where.value_or(all_conditions(request.conditions.size()));
+    if (request.explain) {
+        std::istringstream plan(explain_query(request.start_time, request.end_time, request.conditions, client,
+            &where));
+        std::string line;
+        bool open = true;
+        while (open && std::getline(plan, line)) {
+            open = write_line("plan " + line);
+        }
+        succeeded.add();
+        write_line("done 0");
+        return;
+    }
+
+    query_profile profile;
+    size_t delivered = 0;
+    bool open = true;
+    Status status = query_streaming(request.query_trace, request.start_time, request.end_time, request.conditions,
+        where, request.ret, false, client,
+        [&](const std::string &result) {
+            open = write_line("result " + result);
+            delivered += open;
+            return open;
+        }, request.limit, cancellation, request.profile ? &profile : nullptr);
+    if (!status.ok()) {
+        failed.add();
+        write_line("error " + status.message());
+        return;
+    }
+    if (false == open) {
+        succeeded.add();
+        return;
+    }
+    // the query cancels itself once it has enough results; otherwise it was cut short
+    if (cancellation != nullptr && cancellation->cancelled() &&
+        (request.limit == 0 || delivered < request.limit)) {
+        failed.add();
+        write_line("error query cancelled after " + std::to_string(delivered) + " results");
+        return;
+    }
+    succeeded.add();
+    if (request.profile) {
+        write_line("profile " + profile.to_json());
+    }
+    write_line("done " + std::to_string(delivered));
+}
+
+query_server::~query_server() {
+    stop();
+}
+
+Status query_server::start() {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path_.size() >= sizeof(address.sun_path)) {
+        return Status(google::cloud::StatusCode::kInvalidArgument, "socket path too long: " + socket_path_);
+    }
+    std::strncpy(address.sun_path, socket_path_.c_str(), sizeof(address.sun_path) - 1);
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        return Status(google::cloud::StatusCode::kInternal, std::string("socket: ") + std::strerror(errno));
+    }
+    unlink(socket_path_.c_str());
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd_, SOMAXCONN) != 0) {
+        const std::string why = std::strerror(errno);
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return Status(google::cloud::StatusCode::kInternal, "listening on " + socket_path_ + ": " + why);
+    }
+    accept_thread_ = std::thread([this]() { accept_connections(); });
+    return Status();
+}
+
+void query_server::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return stopping_; });
+}
+
+void query_server::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+        // wakes accept() and every recv(), which then see stopping_
+        if (listen_fd_ >= 0) {
+            shutdown(listen_fd_, SHUT_RDWR);
+        }
+        for (int fd : connections_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    changed_.notify_all();
+    if (accept_thread_.joinable()) {
+        accept_thread_.join();
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        unlink(socket_path_.c_str());
+        listen_fd_ = -1;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return connections_.empty(); });
+}
+
+void query_server::accept_connections() {
+    while (true) {
+        const int fd = accept(listen_fd_, nullptr, nullptr);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "query server: accept: " << std::strerror(errno) << std::endl;
+            }
+            continue;
+        }
+        connections_.insert(fd);
+        // detached; stop() waits for connections_ to empty instead
+        std::thread([this, fd]() { serve_connection(fd); }).detach();
+    }
+}
+
+void query_server::serve_connection(int fd) {
+    connection conn(fd);
+    auto write_line = [&conn](const std::string &line) { return conn.write_line(line); };
+    while (std::optional<std::string> text = conn.read_request()) {
+        StatusOr<query_request> request = parse_query_request(text.value());
+        if (!request.ok()) {
+            if (false == write_line("error " + request.status().message())) {
+                break;
+            }
+            continue;
+        }
+        serve_request(fd, request.value(), write_line);
+    }
+    // closed under the lock, so stop() can't shut down a socket that has reused fd
+    std::lock_guard<std::mutex> lock(mutex_);
+    close(fd);
+    connections_.erase(fd);
+    changed_.notify_all();
+}
+
+void query_server::serve_request(int fd, const query_request &request,
+                                 const std::function<bool(const std::string &line)> &write_line) {
+    query_cancellation cancellation;
+    std::atomic<bool> answered{false};
+    // Only a full close is watched for: the peer may well have sent its next
+    // request already, or shut down its side once it sent this one, and then
+    // still be waiting for the answer.  POLLHUP and POLLERR are always polled.
+    std::thread watcher([fd, &cancellation, &answered]() {
+        pollfd polled = {fd, 0, 0};
+        while (false == answered) {
+            if (poll(&polled, 1, HANGUP_POLL_MILLISECONDS) > 0 &&
+                (polled.revents & (POLLHUP | POLLERR)) != 0) {
+                cancellation.cancel();
+                return;
+            }
+        }
+    });
+    serve_query_request(request, client_, write_line, &cancellation);
+    answered = true;
+    watcher.join();
+}
@@ -0,0 +1,112 @@
+/*
+ * A long-running query server, so queries don't pay for a cold process.
+ *
+ * graph_query_main runs one query and exits, so every run starts with empty
+ * object and span caches, reads the structure catalog and every index's
+ * statistics again and starts the executor's threads.  query_server keeps
+ * one storage backend and all of that across queries, and takes queries
+ * over a Unix socket.
+ *
+ * A request is a few lines of text ending with an empty line:
+ *
+ *     range 1670796531 1670829563
+ *     node 0 frontend
+ *     node 1 cart
+ *     edge 0 1
+ *     condition 1 duration > 300000000
+ *     condition 1 http.method == GET
+ *     where 0 OR 1
+ *     return 0 trace_id
+ *     limit 100
+ *
+ * Conditions are on a node's duration, trace_id, span_id, parent_span_id,
+ * start_time or end_time, or else on the attribute of that name; they are
+ * numbered in the order they are given, for where (see parse_expression()),
+ * and without where all of them must hold.  A node's trace_id, start_time or
+ * end_time can be returned.  "profile" adds the query's profile to the
+ * response, and "explain" prints the plan instead of running the query.
+ *
+ * The response is a line per result, "result <value>", sent as soon as its
+ * batch is done, then "done <number of results>", or "error <message>".  A
+ * connection can send any number of requests one after the other; closing
+ * it stops the query it is waiting on, without waiting for its next result,
+ * but shutting down only its write side once the request is sent does not.
+*/
+
+#ifndef QUERY_SERVER_H_ // NOLINT
+#define QUERY_SERVER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "graph_query.h"
+
+const char QUERY_SOCKET_ENV[] = "QUEST_QUERY_SOCKET";
+const char DEFAULT_QUERY_SOCKET[] = "/tmp/quest-query.sock";
+// How long the server reuses index statistics, unless QUEST_INDEX_STATISTICS_TTL_SECONDS says otherwise.
+const char INDEX_STATISTICS_TTL_ENV[] = "QUEST_INDEX_STATISTICS_TTL_SECONDS";
+const int DEFAULT_SERVER_INDEX_STATISTICS_TTL_SECONDS = 60;
+
+struct query_request {
+    trace_structure query_trace;
+    std::vector<query_condition> conditions;
+    std::optional<condition_expression> where;
+    return_value ret;
+    int start_time = 0;
+    int end_time = 0;
+    size_t limit = 0;
+    bool profile = false;
+    bool explain = false;
+};
+
+StatusOr<query_request> parse_query_request(const std::string &text);
+
+// Runs the request, handing each line of the response to write_line (without
+// its newline); the query stops if write_line returns false or cancellation
+// is cancelled, in which case the response ends with an error line.
+void serve_query_request(const query_request &request, storage_backend* client,
+    const std::function<bool(const std::string &line)> &write_line, query_cancellation *cancellation = nullptr);
+
+class query_server {
+    public: // NOLINT
+        query_server(std::string socket_path, storage_backend* client)
+        : socket_path_(std::move(socket_path)), client_(client) {}
+        ~query_server();
+        query_server(const query_server&) = delete;
+        query_server& operator=(const query_server&) = delete;
+
+        // Listens on the socket, replacing whatever is there, and accepts
+        // connections on a thread of its own; each connection gets a thread.
+        // Queries themselves run on the executor, like any other.
+        Status start();
+        // Blocks until stop() is called.
+        void wait();
+        // Closes the socket and every connection, and waits for their threads.
+        void stop();
+
+    private: // NOLINT
+        void accept_connections();
+        void serve_connection(int fd);
+        // Runs the request, cancelling it if the peer closes the connection in
+        // the meantime: a query with no results for a while would otherwise
+        // only notice when it next writes one.
+        void serve_request(int fd, const query_request &request,
+                           const std::function<bool(const std::string &line)> &write_line);
+
+        const std::string socket_path_;
+        storage_backend* client_;
+        int listen_fd_ = -1;
+        std::thread accept_thread_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        bool stopping_ = false;
+        std::set<int> connections_;   // sockets of the connections being served
+};
+
+#endif  // QUERY_SERVER_H_ // NOLINT
@@ -0,0 +1,35 @@
+#include <cstdlib>
+#include <iostream>
+
+#include "metrics.h"
+#include "query_server.h"
+
+int main(int argc, char* argv[]) {
+    std::string socket_path = DEFAULT_QUERY_SOCKET;
+    if (const char* from_env = std::getenv(QUERY_SOCKET_ENV)) {
+        socket_path = from_env;
+    }
+    if (argc > 1) {
+        socket_path = argv[1];
+    }
+    int statistics_ttl_seconds = DEFAULT_SERVER_INDEX_STATISTICS_TTL_SECONDS;
+    if (const char* ttl = std::getenv(INDEX_STATISTICS_TTL_ENV)) {
+        statistics_ttl_seconds = std::atoi(ttl);
+    }
+
+    start_metrics_export();
+    set_index_statistics_ttl(statistics_ttl_seconds);
+    auto client = make_storage_backend();
+    // start the pools now rather than on the first query
+    executor::get();
+
+    query_server server(socket_path, client.get());
+    Status status = server.start();
+    if (!status.ok()) {
+        std::cerr << status.message() << std::endl;
+        return 1;
+    }
+    std::cout << "Serving queries on " << socket_path << std::endl;
+    server.wait();
+    return 0;
+}
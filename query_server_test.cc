@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "query_server.h"
+#include "test_util.h"
+
+namespace {
+
+const char TRACE_A[] = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+const char TRACE_B[] = "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb";
+
+class QueryServer : public local_backend_test {
+ protected:
+  void SetUp() override {
+    local_backend_test::SetUp();
+    const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    const std::string structs = std::string(TRACE_STRUCT_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    ASSERT_TRUE(backend_->create_bucket(hashes).ok());
+    ASSERT_TRUE(backend_->create_bucket(structs).ok());
+    ASSERT_TRUE(backend_->write(structs, "00-150-250", std::string("Trace ID: ") + TRACE_A + ":\n"
+      ":1111111111111111:frontend:1\n"
+      "1111111111111111:2222222222222222:cart:2\n"
+      "Trace ID: " + TRACE_B + ":\n"
+      ":3333333333333333:frontend:1\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "12/00-150-250", std::string(TRACE_A) + "\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "34/00-150-250", std::string(TRACE_B) + "\n").ok());
+  }
+
+  // Up to 90 more batches (as many as there are two-digit hashes left) over
+  // 1000-2000, each with one trace, whose frontend calls cart only if with_cart.
+  void write_batches(int num_batches, bool with_cart) {
+    const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    const std::string structs = std::string(TRACE_STRUCT_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    for (int i = 0; i < num_batches; i++) {
+      const std::string batch_name = std::to_string(10 + i) + "-" + std::to_string(1001 + 10 * i) + "-" +
+        std::to_string(1006 + 10 * i);
+      std::string structure = std::string("Trace ID: ") + TRACE_A + ":\n:1111111111111111:frontend:1\n";
+      if (with_cart) {
+        structure += "1111111111111111:2222222222222222:cart:2\n";
+      }
+      ASSERT_TRUE(backend_->write(structs, batch_name, structure).ok());
+      ASSERT_TRUE(backend_->write(hashes, (with_cart ? "12/" : "34/") + batch_name,
+        std::string(TRACE_A) + "\n").ok());
+    }
+  }
+};
+
+int connect_to(const std::string &socket_path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+  return fd;
+}
+
+// Sends the request and reads the response, up to its "done" or "error" line.
+std::vector<std::string> send_request(int fd, const std::string &request) {
+  const std::string data = request + "\n";
+  EXPECT_EQ(send(fd, data.data(), data.size(), 0), static_cast<ssize_t>(data.size()));
+  std::vector<std::string> lines;
+  std::string line;
+  char c;
+  while (recv(fd, &c, 1, 0) == 1) {
+    if (c != '\n') {
+      line.push_back(c);
+      continue;
+    }
+    lines.push_back(line);
+    if (line.rfind("done", 0) == 0 || line.rfind("error", 0) == 0) {
+      break;
+    }
+    line.clear();
+  }
+  return lines;
+}
+
+}  // namespace
+
+TEST(QueryRequest, ParsesConditionsAndTheirExpression) {
+  auto request = parse_query_request(
+      "range 100 450\n"
+      "node 0 frontend\n"
+      "node 1 cart\n"
+      "edge 0 1\n"
+      "condition 1 duration > 300000000\n"
+      "condition 1 http.url == /cart?id=1 2\n"
+      "where NOT 0 OR 1\n"
+      "return 0 trace_id\n"
+      "limit 10\n");
+  ASSERT_TRUE(request.ok()) << request.status().message();
+  EXPECT_EQ(request->query_trace.num_nodes, 2);
+  ASSERT_EQ(request->conditions.size(), 2);
+  EXPECT_TRUE(request->conditions[0].is_latency_condition);
+  EXPECT_EQ(request->conditions[0].comp, Greater_than);
+  EXPECT_TRUE(request->conditions[1].is_attribute_condition);
+  EXPECT_EQ(request->conditions[1].node_property_value, "/cart?id=1 2");
+  EXPECT_EQ(expression_to_string(request->where.value()), "(NOT 0 OR 1)");
+  EXPECT_EQ(request->limit, 10);
+
+  EXPECT_FALSE(parse_query_request("range 100 450\nnode 0 frontend\n").ok());
+  EXPECT_FALSE(parse_query_request("range 100 450\nnode 0 frontend\nreturn 1 trace_id\n").ok());
+  EXPECT_FALSE(parse_query_request("range 100 450\nnode 1 frontend\nreturn 1 trace_id\n").ok());
+  EXPECT_FALSE(parse_query_request("range 100 450\nnode 0 frontend\nreturn 0 name\n").ok());
+}
+
+TEST_F(QueryServer, AnswersQueriesOnOneConnectionAfterAnother) {
+  const std::string socket_path = root_ + "/query.sock";
+  query_server server(socket_path, backend_.get());
+  ASSERT_TRUE(server.start().ok());
+
+  int fd = connect_to(socket_path);
+  std::vector<std::string> response = send_request(fd,
+      "range 100 450\nnode 0 frontend\nnode 1 cart\nedge 0 1\nreturn 0 trace_id\n");
+  EXPECT_EQ(response, std::vector<std::string>({std::string("result ") + TRACE_A, "done 1"}));
+
+  response = send_request(fd, "range 100 450\nnode 0 frontend\nreturn 0 trace_id\nlimit 1\n");
+  EXPECT_EQ(response.size(), 2);
+  EXPECT_EQ(response.back(), "done 1");
+
+  response = send_request(fd, "range 100 450\nnode 0 frontend\nreturn 0 trace_id\nwhere 0\n");
+  ASSERT_EQ(response.size(), 1);
+  EXPECT_EQ(response[0].rfind("error", 0), 0);
+  close(fd);
+
+  // stopping closes connections that are still open
+  fd = connect_to(socket_path);
+  server.stop();
+  char c;
+  EXPECT_LE(recv(fd, &c, 1, 0), 0);
+  close(fd);
+}
+
+TEST_F(QueryServer, StopsAQueryWhenItsClientHangsUp) {
+  // frontend on its own, so asking for frontend -> cart reads every batch
+  // and never has a result to write
+  write_batches(90, false);
+  const std::string request = "range 1000 2000\nnode 0 frontend\nnode 1 cart\nedge 0 1\nreturn 0 trace_id\n\n";
+
+  counting_backend backend(root_);
+  backend.slow_down(std::chrono::milliseconds(10));
+  const std::string socket_path = root_ + "/query.sock";
+  query_server server(socket_path, &backend);
+  ASSERT_TRUE(server.start().ok());
+  int fd = connect_to(socket_path);
+  EXPECT_EQ(send_request(fd, request), std::vector<std::string>({"done 0"}));
+  close(fd);
+  const int full = backend.reads();
+
+  fd = connect_to(socket_path);
+  ASSERT_EQ(send(fd, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+  // hangs up once the query is under way
+  for (int waited = 0; backend.reads() == full && waited < 5000; waited++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_GT(backend.reads(), full);
+  close(fd);
+  // waits for the connection, and so its query, to finish
+  server.stop();
+  EXPECT_LT(backend.reads() - full, full / 2);
+}
+
+TEST_F(QueryServer, AnswersAClientThatOnlyShutsDownItsWriteSide) {
+  write_batches(90, true);
+  counting_backend backend(root_);
+  backend.slow_down(std::chrono::milliseconds(10));
+  const std::string socket_path = root_ + "/query.sock";
+  query_server server(socket_path, &backend);
+  ASSERT_TRUE(server.start().ok());
+
+  // sends the request and no more, as nc -N does, then waits for every result
+  int fd = connect_to(socket_path);
+  const std::string request = "range 1000 2000\nnode 0 frontend\nnode 1 cart\nedge 0 1\nreturn 0 trace_id\n";
+  ASSERT_EQ(send(fd, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+  ASSERT_EQ(shutdown(fd, SHUT_WR), 0);
+  std::string response;
+  char chunk[4096];
+  ssize_t n;
+  while ((n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+    response.append(chunk, n);
+  }
+  close(fd);
+  server.stop();
+
+  std::vector<std::string> lines;
+  std::istringstream stream(response);
+  for (std::string line; std::getline(stream, line);) {
+    lines.push_back(line);
+  }
+  ASSERT_EQ(lines.size(), 91);
+  EXPECT_EQ(lines.back(), "done 90");
+}
@@ -0,0 +1,209 @@
+#include "span_batch.h"
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "little_endian.h"
+
+namespace ot = opentelemetry::proto::trace::v1;
+
+namespace {
+
+const size_t MAGIC_LENGTH = sizeof(SPAN_ID_INDEX_MAGIC) - 1;
+const size_t HEADER_LENGTH = MAGIC_LENGTH + 4 + 8 + 4 + 4;
+const size_t SLOT_LENGTH = 16;
+
+// Only the first scope of the first resource, like the scans this replaces.
+const google::protobuf::RepeatedPtrField<ot::Span>* indexed_spans(const ot::TracesData &data) {
+    if (data.resource_spans_size() < 1 || data.resource_spans(0).scope_spans_size() < 1) {
+        return nullptr;
+    }
+    return &data.resource_spans(0).scope_spans(0).spans();
+}
+
+size_t slot_for(uint64_t span_id, uint32_t slots_log2) {
+    // span IDs are random, but mix them anyway in case a tracer isn't
+    return (span_id * 0x9E3779B97F4A7C15ull) >> (64 - slots_log2);
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+}  // namespace
+
+bool span_id_from_hex(const std::string &hex, uint64_t &span_id) {
+    if (hex.size() < 16) {
+        return false;
+    }
+    span_id = 0;
+    for (int i = 0; i < 16; i++) {
+        int val = hex_value(hex[i]);
+        if (val < 0) {
+            return false;
+        }
+        span_id = (span_id << 4) | val;
+    }
+    return true;
+}
+
+bool span_id_from_bytes(const std::string &bytes, uint64_t &span_id) {
+    if (bytes.size() < 8) {
+        return false;
+    }
+    span_id = 0;
+    for (int i = 0; i < 8; i++) {
+        span_id = (span_id << 8) | static_cast<unsigned char>(bytes[i]);
+    }
+    return true;
+}
+
+span_batch::span_batch(std::unique_ptr<const ot::TracesData> data, int64_t generation,
+                       std::shared_ptr<const stored_object> persisted_index)
+: data_(std::move(data)), generation_(generation) {
+    if (persisted_index != nullptr && load_persisted_index(std::move(persisted_index))) {
+        return;
+    }
+
+    auto spans = indexed_spans(*data_);
+    if (spans == nullptr) {
+        return;
+    }
+    index_.reserve(spans->size());
+    for (int i = 0; i < spans->size(); i++) {
+        uint64_t span_id;
+        if (span_id_from_bytes(spans->Get(i).span_id(), span_id)) {
+            index_.emplace(span_id, i);  // keeps the first of any duplicates
+        }
+    }
+}
+
+bool span_batch::load_persisted_index(std::shared_ptr<const stored_object> persisted_index) {
+    const char* p = persisted_index->data();
+    const size_t size = persisted_index->size();
+    if (size < HEADER_LENGTH || persisted_index->view().substr(0, MAGIC_LENGTH) != SPAN_ID_INDEX_MAGIC) {
+        return false;
+    }
+    auto spans = indexed_spans(*data_);
+    const uint32_t num_spans = spans == nullptr ? 0 : spans->size();
+    uint32_t slots_log2 = get_u32(p + MAGIC_LENGTH + 12);
+    if (get_u32(p + MAGIC_LENGTH) != SPAN_ID_INDEX_VERSION ||
+        static_cast<int64_t>(get_u64(p + MAGIC_LENGTH + 4)) != generation_ ||
+        slots_log2 < 1 || slots_log2 > 32 ||
+        get_u32(p + MAGIC_LENGTH + 16) != num_spans ||
+        size != HEADER_LENGTH + (static_cast<size_t>(1) << slots_log2) * SLOT_LENGTH) {
+        return false;
+    }
+    persisted_index_ = std::move(persisted_index);
+    persisted_slots_log2_ = slots_log2;
+    return true;
+}
+
+int span_batch::find_persisted(uint64_t span_id) const {
+    const char* slots = persisted_index_->data() + HEADER_LENGTH;
+    const size_t mask = (static_cast<size_t>(1) << persisted_slots_log2_) - 1;
+    size_t slot = slot_for(span_id, persisted_slots_log2_);
+    for (size_t probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask) {
+        const char* entry = slots + slot * SLOT_LENGTH;
+        uint32_t position = get_u32(entry + 8);
+        if (position == 0) {
+            return -1;
+        }
+        if (get_u64(entry) == span_id) {
+            return position - 1;
+        }
+    }
+    return -1;
+}
+
+const ot::Span* span_batch::find_span(const std::string &span_id) const {
+    uint64_t id;
+    if (!span_id_from_hex(span_id, id)) {
+        return nullptr;
+    }
+
+    int position = -1;
+    if (persisted_index_ != nullptr) {
+        position = find_persisted(id);
+    } else {
+        auto it = index_.find(id);
+        if (it != index_.end()) {
+            position = it->second;
+        }
+    }
+    if (position < 0) {
+        return nullptr;
+    }
+
+    // a sidecar is only trusted as far as its span count, so check the span is really there
+    const ot::Span &span = indexed_spans(*data_)->Get(position);
+    uint64_t found;
+    if (!span_id_from_bytes(span.span_id(), found) || found != id) {
+        return nullptr;
+    }
+    return &span;
+}
+
+size_t span_batch::space_used() const {
+    // unordered_map nodes are roughly a key, a value and a next pointer
+    return data_->SpaceUsedLong() + index_.size() * (sizeof(uint64_t) + sizeof(int) + sizeof(void*)) +
+        index_.bucket_count() * sizeof(void*);
+}
+
+std::string serialize_span_id_index(const ot::TracesData &data, int64_t generation) {
+    auto spans = indexed_spans(data);
+    const uint32_t num_spans = spans == nullptr ? 0 : spans->size();
+
+    // at most half full, so probes stay short
+    uint32_t slots_log2 = 1;
+    while ((static_cast<uint64_t>(1) << slots_log2) < 2 * static_cast<uint64_t>(num_spans)) {
+        slots_log2++;
+    }
+    const size_t num_slots = static_cast<size_t>(1) << slots_log2;
+    const size_t mask = num_slots - 1;
+
+    std::vector<uint64_t> slot_ids(num_slots, 0);
+    std::vector<uint32_t> slot_positions(num_slots, 0);
+    for (uint32_t i = 0; i < num_spans; i++) {
+        uint64_t span_id;
+        if (!span_id_from_bytes(spans->Get(i).span_id(), span_id)) {
+            continue;
+        }
+        size_t slot = slot_for(span_id, slots_log2);
+        while (slot_positions[slot] != 0 && slot_ids[slot] != span_id) {
+            slot = (slot + 1) & mask;
+        }
+        if (slot_positions[slot] == 0) {
+            slot_ids[slot] = span_id;
+            slot_positions[slot] = i + 1;
+        }
+    }
+
+    std::string out = SPAN_ID_INDEX_MAGIC;
+    put_u32(out, SPAN_ID_INDEX_VERSION);
+    put_u64(out, static_cast<uint64_t>(generation));
+    put_u32(out, slots_log2);
+    put_u32(out, num_spans);
+    out.reserve(HEADER_LENGTH + num_slots * SLOT_LENGTH);
+    for (size_t slot = 0; slot < num_slots; slot++) {
+        put_u64(out, slot_ids[slot]);
+        put_u32(out, slot_positions[slot]);
+        put_u32(out, 0);
+    }
+    return out;
+}
+
+bool span_id_index_sidecars_enabled() {
+    static const bool enabled = std::getenv(SPAN_ID_INDEX_SIDECARS_ENV) != nullptr;
+    return enabled;
+}
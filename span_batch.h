@@ -0,0 +1,71 @@
+/*
+ * A parsed span object (one service's spans for one batch) together with a
+ * hash table from span ID to the span's position in it.
+ *
+ * Evaluating a condition or a return value means finding one span by ID;
+ * scanning the batch for it costs O(spans in batch) per trace and condition.
+ * The table is built once when the object is parsed and cached with it.
+ *
+ * The table can also be persisted as a sidecar object, so that it is read
+ * rather than rebuilt:
+ *
+ *     "QSPI" u32 version i64 generation u32 log2(slots) u32 n_spans
+ *     slots x (u64 span id, u32 position + 1, u32 unused)
+ *
+ * little endian, open addressing with linear probing, position 0 marking an
+ * empty slot.  The generation is that of the span object the table was built
+ * from; a sidecar for any other generation is ignored.
+*/
+
+#ifndef SPAN_BATCH_H_ // NOLINT
+#define SPAN_BATCH_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "storage.h"
+#include "opentelemetry/proto/trace/v1/trace.pb.h"
+
+const char SPAN_ID_INDEX_MAGIC[] = "QSPI";
+const uint32_t SPAN_ID_INDEX_VERSION = 1;
+// If set, span objects are indexed from their sidecar when it is current.
+const char SPAN_ID_INDEX_SIDECARS_ENV[] = "QUEST_SPAN_ID_INDEX_SIDECARS";
+
+class span_batch {
+    public: // NOLINT
+        // Uses the persisted table if it matches this generation of the
+        // object, and builds one in memory otherwise.
+        span_batch(std::unique_ptr<const opentelemetry::proto::trace::v1::TracesData> data, int64_t generation,
+                   std::shared_ptr<const stored_object> persisted_index = nullptr);
+
+        const opentelemetry::proto::trace::v1::TracesData& data() const { return *data_; }
+        int64_t generation() const { return generation_; }
+        bool uses_persisted_index() const { return persisted_index_ != nullptr; }
+
+        // The span with this ID (hex, as in structural objects), or nullptr.
+        const opentelemetry::proto::trace::v1::Span* find_span(const std::string &span_id) const;
+
+        size_t space_used() const;
+
+    private: // NOLINT
+        bool load_persisted_index(std::shared_ptr<const stored_object> persisted_index);
+        int find_persisted(uint64_t span_id) const;
+
+        std::unique_ptr<const opentelemetry::proto::trace::v1::TracesData> data_;
+        int64_t generation_;
+        std::unordered_map<uint64_t, int> index_;
+        std::shared_ptr<const stored_object> persisted_index_;
+        uint32_t persisted_slots_log2_ = 0;
+};
+
+// Span IDs as integers: the first 16 hex characters, or the 8 bytes of a span's span_id().
+bool span_id_from_hex(const std::string &hex, uint64_t &span_id);
+bool span_id_from_bytes(const std::string &bytes, uint64_t &span_id);
+
+// The sidecar described above, for the spans in data.
+std::string serialize_span_id_index(const opentelemetry::proto::trace::v1::TracesData &data, int64_t generation);
+bool span_id_index_sidecars_enabled();
+
+#endif  // SPAN_BATCH_H_ // NOLINT
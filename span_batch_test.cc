@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "span_batch.h"
+
+namespace ot = opentelemetry::proto::trace::v1;
+
+namespace {
+
+std::unique_ptr<ot::TracesData> make_spans(int count) {
+  auto data = std::make_unique<ot::TracesData>();
+  auto scope = data->add_resource_spans()->add_scope_spans();
+  for (int i = 0; i < count; i++) {
+    auto span = scope->add_spans();
+    std::string id(8, '\0');
+    id[0] = static_cast<char>(0xab);
+    id[7] = static_cast<char>(i);
+    span->set_span_id(id);
+    span->set_name("span" + std::to_string(i));
+  }
+  return data;
+}
+
+std::string hex_id(int i) {
+  const char hex[] = "0123456789abcdef";
+  return std::string("ab000000000000") + hex[i / 16] + hex[i % 16];
+}
+
+}  // namespace
+
+TEST(SpanBatch, FindsSpansInMemory) {
+  span_batch batch(make_spans(100), 1);
+  EXPECT_FALSE(batch.uses_persisted_index());
+  for (int i = 0; i < 100; i++) {
+    auto span = batch.find_span(hex_id(i));
+    ASSERT_NE(span, nullptr);
+    EXPECT_EQ(span->name(), "span" + std::to_string(i));
+  }
+  EXPECT_EQ(batch.find_span(hex_id(200)), nullptr);
+  EXPECT_EQ(batch.find_span("not hex"), nullptr);
+}
+
+TEST(SpanBatch, FindsSpansThroughSidecar) {
+  auto sidecar = std::make_shared<string_object>(serialize_span_id_index(*make_spans(100), 7));
+  span_batch batch(make_spans(100), 7, sidecar);
+  EXPECT_TRUE(batch.uses_persisted_index());
+  for (int i = 0; i < 100; i++) {
+    auto span = batch.find_span(hex_id(i));
+    ASSERT_NE(span, nullptr);
+    EXPECT_EQ(span->name(), "span" + std::to_string(i));
+  }
+  EXPECT_EQ(batch.find_span(hex_id(200)), nullptr);
+}
+
+TEST(SpanBatch, IgnoresSidecarForOtherGeneration) {
+  auto sidecar = std::make_shared<string_object>(serialize_span_id_index(*make_spans(10), 7));
+  span_batch batch(make_spans(10), 8, sidecar);
+  EXPECT_FALSE(batch.uses_persisted_index());
+  ASSERT_NE(batch.find_span(hex_id(3)), nullptr);
+}
@@ -0,0 +1,233 @@
+#include "span_columns.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <utility>
+
+#include "little_endian.h"
+#include "span_batch.h"
+
+namespace ot = opentelemetry::proto::trace::v1;
+
+namespace {
+
+const size_t MAGIC_LENGTH = sizeof(SPAN_COLUMNS_MAGIC) - 1;
+static_assert(sizeof(SPAN_LATENCY_SUMMARY_MAGIC) == sizeof(SPAN_COLUMNS_MAGIC), "magics of one length");
+const size_t TRACE_ID_BYTES = 16;
+
+Status invalid(const std::string &why) {
+    return Status(google::cloud::StatusCode::kInvalidArgument, "span columns: " + why);
+}
+
+}  // namespace
+
+bool attribute_value_as_string(const opentelemetry::proto::common::v1::AnyValue &value, std::string &out) {
+    switch (value.value_case()) {
+        case opentelemetry::proto::common::v1::AnyValue::kStringValue:
+            out = value.string_value();
+            return true;
+        case opentelemetry::proto::common::v1::AnyValue::kBoolValue:
+            out = value.bool_value() ? "true" : "false";
+            return true;
+        case opentelemetry::proto::common::v1::AnyValue::kIntValue:
+            out = std::to_string(value.int_value());
+            return true;
+        case opentelemetry::proto::common::v1::AnyValue::kDoubleValue:
+            out = std::to_string(value.double_value());
+            return true;
+        default:
+            return false;
+    }
+}
+
+StatusOr<std::shared_ptr<const span_columns>> span_columns::parse(const stored_object &contents) {
+    std::string_view view = contents.view();
+    if (view.size() < 2 * MAGIC_LENGTH || view.substr(0, MAGIC_LENGTH) != SPAN_COLUMNS_MAGIC ||
+        view.substr(view.size() - MAGIC_LENGTH) != SPAN_COLUMNS_MAGIC) {
+        return invalid("bad magic");
+    }
+
+    std::shared_ptr<span_columns> columns(new span_columns());
+    byte_reader reader(view.data(), view.size() - MAGIC_LENGTH);
+    reader.take(MAGIC_LENGTH);
+    if (reader.u32() != SPAN_COLUMNS_VERSION) {
+        return invalid("unsupported version");
+    }
+    columns->generation_ = static_cast<int64_t>(reader.u64());
+    const uint32_t num_spans = reader.u32();
+
+    reader.column(columns->span_ids_, num_spans);
+    const char* trace_ids = reader.take(static_cast<size_t>(num_spans) * TRACE_ID_BYTES);
+    if (trace_ids != nullptr) {
+        columns->trace_ids_.assign(trace_ids, static_cast<size_t>(num_spans) * TRACE_ID_BYTES);
+    }
+    reader.column(columns->start_times_, num_spans);
+    reader.column(columns->end_times_, num_spans);
+    reader.column(columns->status_codes_, num_spans);
+
+    const uint32_t num_attributes = reader.u32();
+    for (uint32_t i = 0; i < num_attributes && reader.ok(); i++) {
+        std::string key = reader.string();
+        attribute_column &column = columns->attributes_[key];
+        const uint32_t num_values = reader.u32();
+        for (uint32_t j = 0; j < num_values && reader.ok(); j++) {
+            column.dictionary.push_back(reader.string());
+        }
+        reader.column(column.codes, num_spans);
+        for (uint32_t code : column.codes) {
+            if (code > num_values) {
+                return invalid("attribute code out of range");
+            }
+        }
+    }
+    if (!reader.ok() || reader.position() != view.size() - MAGIC_LENGTH) {
+        return invalid("truncated or trailing data");
+    }
+
+    columns->positions_.reserve(num_spans);
+    for (uint32_t i = 0; i < num_spans; i++) {
+        columns->positions_.emplace(columns->span_ids_[i], i);
+    }
+    return std::shared_ptr<const span_columns>(std::move(columns));
+}
+
+int span_columns::find_span(const std::string &span_id) const {
+    uint64_t id;
+    if (!span_id_from_hex(span_id, id)) {
+        return -1;
+    }
+    auto it = positions_.find(id);
+    return it == positions_.end() ? -1 : it->second;
+}
+
+std::string span_columns::trace_id(size_t position) const {
+    return trace_ids_.substr(position * TRACE_ID_BYTES, TRACE_ID_BYTES);
+}
+
+const attribute_column* span_columns::attribute(const std::string &key) const {
+    auto it = attributes_.find(key);
+    return it == attributes_.end() ? nullptr : &it->second;
+}
+
+std::string serialize_span_columns(const ot::TracesData &data, int64_t generation) {
+    const google::protobuf::RepeatedPtrField<ot::Span>* spans = nullptr;
+    if (data.resource_spans_size() > 0 && data.resource_spans(0).scope_spans_size() > 0) {
+        spans = &data.resource_spans(0).scope_spans(0).spans();
+    }
+    const uint32_t num_spans = spans == nullptr ? 0 : spans->size();
+
+    std::string span_ids, trace_ids, starts, ends, statuses;
+    // ordered, so the same spans always serialize the same way
+    std::map<std::string, std::pair<std::map<std::string, uint32_t>, std::vector<uint32_t>>> attributes;
+    for (uint32_t i = 0; i < num_spans; i++) {
+        const ot::Span &span = spans->Get(i);
+        uint64_t span_id = 0;
+        span_id_from_bytes(span.span_id(), span_id);
+        put_u64(span_ids, span_id);
+        std::string trace_id = span.trace_id();
+        trace_id.resize(TRACE_ID_BYTES, '\0');
+        trace_ids += trace_id;
+        put_u64(starts, span.start_time_unix_nano());
+        put_u64(ends, span.end_time_unix_nano());
+        put_u32(statuses, span.status().code());
+
+        for (const auto &attribute : span.attributes()) {
+            std::string value;
+            if (!attribute_value_as_string(attribute.value(), value)) {
+                continue;
+            }
+            auto &[dictionary, codes] = attributes[attribute.key()];
+            codes.resize(num_spans, 0);
+            if (codes[i] != 0) {
+                continue;  // conditions look at the first value for a key
+            }
+            auto inserted = dictionary.emplace(value, dictionary.size() + 1);
+            codes[i] = inserted.first->second;
+        }
+    }
+
+    std::string out = SPAN_COLUMNS_MAGIC;
+    put_u32(out, SPAN_COLUMNS_VERSION);
+    put_u64(out, static_cast<uint64_t>(generation));
+    put_u32(out, num_spans);
+    out += span_ids;
+    out += trace_ids;
+    out += starts;
+    out += ends;
+    out += statuses;
+    put_u32(out, attributes.size());
+    for (auto &[key, attribute] : attributes) {
+        auto &[dictionary, codes] = attribute;
+        put_string(out, key);
+        std::vector<const std::string*> values(dictionary.size());
+        for (auto &[value, code] : dictionary) {
+            values[code - 1] = &value;
+        }
+        put_u32(out, values.size());
+        for (auto value : values) {
+            put_string(out, *value);
+        }
+        for (uint32_t code : codes) {
+            put_u32(out, code);
+        }
+    }
+    out += SPAN_COLUMNS_MAGIC;
+    return out;
+}
+
+bool span_columns_enabled() {
+    static const bool enabled = std::getenv(SPAN_COLUMNS_ENV) != nullptr;
+    return enabled;
+}
+
+StatusOr<span_latency_summary> parse_span_latency_summary(const stored_object &contents) {
+    std::string_view view = contents.view();
+    if (view.size() < 2 * MAGIC_LENGTH || view.substr(0, MAGIC_LENGTH) != SPAN_LATENCY_SUMMARY_MAGIC ||
+        view.substr(view.size() - MAGIC_LENGTH) != SPAN_LATENCY_SUMMARY_MAGIC) {
+        return Status(google::cloud::StatusCode::kInvalidArgument, "span latency summary: bad magic");
+    }
+    byte_reader reader(view.data(), view.size() - MAGIC_LENGTH);
+    reader.take(MAGIC_LENGTH);
+    if (reader.u32() != SPAN_LATENCY_SUMMARY_VERSION) {
+        return Status(google::cloud::StatusCode::kInvalidArgument, "span latency summary: unsupported version");
+    }
+    span_latency_summary summary;
+    summary.generation = static_cast<int64_t>(reader.u64());
+    summary.num_spans = reader.u32();
+    summary.min_latency = reader.u64();
+    summary.max_latency = reader.u64();
+    if (!reader.ok() || reader.position() != view.size() - MAGIC_LENGTH) {
+        return Status(google::cloud::StatusCode::kInvalidArgument,
+            "span latency summary: truncated or trailing data");
+    }
+    return summary;
+}
+
+std::string serialize_span_latency_summary(const ot::TracesData &data, int64_t generation) {
+    span_latency_summary summary;
+    if (data.resource_spans_size() > 0 && data.resource_spans(0).scope_spans_size() > 0) {
+        for (const ot::Span &span : data.resource_spans(0).scope_spans(0).spans()) {
+            const uint64_t latency = span.end_time_unix_nano() > span.start_time_unix_nano() ?
+                span.end_time_unix_nano() - span.start_time_unix_nano() : 0;
+            summary.min_latency = summary.num_spans == 0 ? latency : std::min(summary.min_latency, latency);
+            summary.max_latency = std::max(summary.max_latency, latency);
+            summary.num_spans++;
+        }
+    }
+
+    std::string out = SPAN_LATENCY_SUMMARY_MAGIC;
+    put_u32(out, SPAN_LATENCY_SUMMARY_VERSION);
+    put_u64(out, static_cast<uint64_t>(generation));
+    put_u32(out, summary.num_spans);
+    put_u64(out, summary.min_latency);
+    put_u64(out, summary.max_latency);
+    out += SPAN_LATENCY_SUMMARY_MAGIC;
+    return out;
+}
+
+bool span_latency_summaries_enabled() {
+    static const bool enabled = std::getenv(SPAN_LATENCY_SUMMARIES_ENV) != nullptr;
+    return enabled;
+}
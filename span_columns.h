@@ -0,0 +1,108 @@
+/*
+ * A columnar copy of one span object (one service's spans for one batch),
+ * stored as a sidecar next to it.
+ *
+ * Latency and attribute conditions only look at a few fields of each span,
+ * but evaluating them on the span object means fetching and parsing every
+ * field of every span.  The columns hold just those fields, one array each,
+ * so a condition can be evaluated over the whole batch in one pass (see
+ * evaluate_condition_on_columns() in graph_query.h):
+ *
+ *     "QSPC" u32 version i64 generation u32 n_spans
+ *     u64 span_id[n]  u8 trace_id[n][16]  u64 start[n]  u64 end[n]  u32 status[n]
+ *     u32 n_attributes, then for each attribute key:
+ *         string key, u32 n_values, n_values x string, u32 code[n]
+ *     "QSPC"
+ *
+ * Strings are a u32 length and bytes; integers are little endian.  Attribute
+ * values are dictionary encoded: code 0 means the span doesn't have the
+ * attribute, code k the k-th value in the dictionary.  Values are kept as
+ * the strings does_attribute_condition_hold() compares.  As with span_batch,
+ * only the first scope of the first resource is covered, and the generation
+ * is that of the span object the columns were built from.
+*/
+
+#ifndef SPAN_COLUMNS_H_ // NOLINT
+#define SPAN_COLUMNS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "storage.h"
+#include "opentelemetry/proto/trace/v1/trace.pb.h"
+
+const char SPAN_COLUMNS_MAGIC[] = "QSPC";
+const uint32_t SPAN_COLUMNS_VERSION = 1;
+// If set, conditions that the columns can answer are evaluated on them.
+const char SPAN_COLUMNS_ENV[] = "QUEST_SPAN_COLUMNS";
+
+struct attribute_column {
+    std::vector<std::string> dictionary;
+    std::vector<uint32_t> codes;
+};
+
+class span_columns {
+    public: // NOLINT
+        static StatusOr<std::shared_ptr<const span_columns>> parse(const stored_object &contents);
+
+        size_t num_spans() const { return span_ids_.size(); }
+        int64_t generation() const { return generation_; }
+
+        // Position of the span with this ID (hex, as in structural objects), or -1.
+        int find_span(const std::string &span_id) const;
+
+        const std::vector<uint64_t>& start_times() const { return start_times_; }
+        const std::vector<uint64_t>& end_times() const { return end_times_; }
+        const std::vector<uint32_t>& status_codes() const { return status_codes_; }
+        // Raw bytes, like Span::trace_id().
+        std::string trace_id(size_t position) const;
+        // nullptr if no span in the batch has the attribute.
+        const attribute_column* attribute(const std::string &key) const;
+
+    private: // NOLINT
+        span_columns() = default;
+
+        int64_t generation_ = 0;
+        std::vector<uint64_t> span_ids_;
+        std::string trace_ids_;
+        std::vector<uint64_t> start_times_;
+        std::vector<uint64_t> end_times_;
+        std::vector<uint32_t> status_codes_;
+        std::unordered_map<std::string, attribute_column> attributes_;
+        std::unordered_map<uint64_t, int> positions_;
+};
+
+// The shortest and longest span latency in one span object, stored as a
+// sidecar of its own so a query for the slowest traces can rule a batch out
+// before reading anything else of it:
+//
+//     "QSLS" u32 version i64 generation u32 n_spans u64 min_latency u64 max_latency "QSLS"
+//
+// Latencies are end minus start time in nanoseconds; both are 0 for no spans.
+const char SPAN_LATENCY_SUMMARY_MAGIC[] = "QSLS";
+const uint32_t SPAN_LATENCY_SUMMARY_VERSION = 1;
+// If set, top-K queries skip batches whose summaries show they can't make the cut.
+const char SPAN_LATENCY_SUMMARIES_ENV[] = "QUEST_SPAN_LATENCY_SUMMARIES";
+
+struct span_latency_summary {
+    int64_t generation = 0;
+    uint32_t num_spans = 0;
+    uint64_t min_latency = 0;
+    uint64_t max_latency = 0;
+};
+
+StatusOr<span_latency_summary> parse_span_latency_summary(const stored_object &contents);
+std::string serialize_span_latency_summary(const opentelemetry::proto::trace::v1::TracesData &data,
+    int64_t generation);
+bool span_latency_summaries_enabled();
+
+// The string form attribute conditions compare against; false for value types they don't support.
+bool attribute_value_as_string(const opentelemetry::proto::common::v1::AnyValue &value, std::string &out);
+
+std::string serialize_span_columns(const opentelemetry::proto::trace::v1::TracesData &data, int64_t generation);
+bool span_columns_enabled();
+
+#endif  // SPAN_COLUMNS_H_ // NOLINT
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "span_columns.h"
+
+namespace ot = opentelemetry::proto::trace::v1;
+
+namespace {
+
+ot::TracesData make_spans() {
+  ot::TracesData data;
+  auto scope = data.add_resource_spans()->add_scope_spans();
+  for (int i = 0; i < 3; i++) {
+    auto span = scope->add_spans();
+    span->set_span_id(std::string(7, '\0') + static_cast<char>(i + 1));
+    span->set_trace_id(std::string(15, '\0') + static_cast<char>(i + 10));
+    span->set_start_time_unix_nano(1000 * i);
+    span->set_end_time_unix_nano(1000 * i + 100 * (i + 1));
+    if (i != 1) {
+      auto attribute = span->add_attributes();
+      attribute->set_key("http.method");
+      attribute->mutable_value()->set_string_value(i == 0 ? "GET" : "POST");
+    }
+    auto attribute = span->add_attributes();
+    attribute->set_key("retries");
+    attribute->mutable_value()->set_int_value(2);
+  }
+  return data;
+}
+
+}  // namespace
+
+TEST(SpanColumns, RoundTrip) {
+  auto parsed = span_columns::parse(string_object(serialize_span_columns(make_spans(), 42)));
+  ASSERT_TRUE(parsed.ok());
+  auto columns = parsed.value();
+
+  EXPECT_EQ(columns->generation(), 42);
+  ASSERT_EQ(columns->num_spans(), 3);
+  EXPECT_EQ(columns->find_span("0000000000000002"), 1);
+  EXPECT_EQ(columns->find_span("0000000000000009"), -1);
+  EXPECT_EQ(columns->start_times()[2], 2000);
+  EXPECT_EQ(columns->end_times()[2], 2300);
+  EXPECT_EQ(columns->trace_id(1), std::string(15, '\0') + static_cast<char>(11));
+
+  auto method = columns->attribute("http.method");
+  ASSERT_NE(method, nullptr);
+  EXPECT_EQ(method->dictionary.size(), 2);
+  EXPECT_EQ(method->dictionary[method->codes[0] - 1], "GET");
+  EXPECT_EQ(method->codes[1], 0);
+  EXPECT_EQ(method->dictionary[method->codes[2] - 1], "POST");
+
+  auto retries = columns->attribute("retries");
+  ASSERT_NE(retries, nullptr);
+  ASSERT_EQ(retries->dictionary.size(), 1);
+  EXPECT_EQ(retries->dictionary[0], "2");
+  EXPECT_EQ(columns->attribute("missing"), nullptr);
+}
+
+TEST(SpanColumns, RejectsTruncated) {
+  std::string contents = serialize_span_columns(make_spans(), 42);
+  contents.erase(30, 8);
+  EXPECT_FALSE(span_columns::parse(string_object(contents)).ok());
+}
+
+TEST(SpanLatencySummary, RoundTrip) {
+  auto summary = parse_span_latency_summary(string_object(serialize_span_latency_summary(make_spans(), 42)));
+  ASSERT_TRUE(summary.ok());
+  EXPECT_EQ(summary->generation, 42);
+  EXPECT_EQ(summary->num_spans, 3);
+  EXPECT_EQ(summary->min_latency, 100);
+  EXPECT_EQ(summary->max_latency, 300);
+
+  summary = parse_span_latency_summary(string_object(serialize_span_latency_summary(ot::TracesData(), 1)));
+  ASSERT_TRUE(summary.ok());
+  EXPECT_EQ(summary->num_spans, 0);
+  EXPECT_EQ(summary->max_latency, 0);
+  EXPECT_FALSE(parse_span_latency_summary(string_object(serialize_span_columns(make_spans(), 42))).ok());
+}
@@ -0,0 +1,464 @@
+#include "storage.h"
+#include "common.h"
+#include "disk_cache.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class mapped_object : public stored_object {
+    public: // NOLINT
+        mapped_object(void* addr, size_t size, int64_t generation)
+        : addr_(addr), size_(size), generation_(generation) {}
+        ~mapped_object() override {
+            if (addr_ != nullptr) {
+                munmap(addr_, size_);
+            }
+        }
+        mapped_object(const mapped_object&) = delete;
+        mapped_object& operator=(const mapped_object&) = delete;
+
+        const char* data() const override { return static_cast<const char*>(addr_); }
+        size_t size() const override { return size_; }
+        int64_t generation() const override { return generation_; }
+
+    private: // NOLINT
+        void* addr_;
+        size_t size_;
+        int64_t generation_;
+};
+
+int64_t generation_from_stat(const struct stat &st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+Status object_not_found(const std::string &bucket, const std::string &object) {
+    return Status(google::cloud::StatusCode::kNotFound, "no such object: " + bucket + "/" + object);
+}
+
+Status io_error(const std::string &what, const std::string &path) {
+    return Status(google::cloud::StatusCode::kInternal, what + " failed for " + path + ": " + strerror(errno));
+}
+
+}  // namespace
+
+/// **************** local files ********************************
+
+StatusOr<std::shared_ptr<const stored_object>> map_local_file(const std::string &path, int64_t generation) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return Status(google::cloud::StatusCode::kNotFound, "no such file: " + path);
+        }
+        return io_error("open", path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return io_error("fstat", path);
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        return Status(google::cloud::StatusCode::kNotFound, "no such file: " + path);
+    }
+
+    size_t size = st.st_size;
+    void* addr = nullptr;
+    if (size > 0) {
+        addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return io_error("mmap", path);
+        }
+        // Most readers parse the whole object front to back.
+        madvise(addr, size, MADV_SEQUENTIAL);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+
+    if (generation < 0) {
+        generation = generation_from_stat(st);
+    }
+    return std::shared_ptr<const stored_object>(std::make_shared<mapped_object>(addr, size, generation));
+}
+
+StatusOr<std::string> read_local_file_range(const std::string &path, int64_t begin, int64_t end) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return Status(google::cloud::StatusCode::kNotFound, "no such file: " + path);
+    }
+    in.seekg(0, std::ios::end);
+    int64_t size = in.tellg();
+    begin = std::min(std::max<int64_t>(begin, 0), size);
+    end = std::min(std::max(end, begin), size);
+
+    std::string contents(end - begin, '\0');
+    in.seekg(begin);
+    in.read(&contents[0], end - begin);
+    return contents;
+}
+
+Status write_local_file(const std::string &path_name, std::string_view contents) {
+    fs::path path = path_name;
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (ec) {
+        return Status(google::cloud::StatusCode::kInternal, "could not create " + path.parent_path().string());
+    }
+
+    // write to a hidden temporary and rename, so readers never see partial objects
+    std::ostringstream tmp_name;
+    tmp_name << "." << path.filename().string() << ".tmp" << getpid() << "-" << std::this_thread::get_id();
+    fs::path tmp = path.parent_path() / tmp_name.str();
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size());
+        if (!out) {
+            return io_error("write", tmp.string());
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        return Status(google::cloud::StatusCode::kInternal, "could not rename to " + path.string());
+    }
+    return Status();
+}
+
+/// **************** gcs_backend ********************************
+
+StatusOr<std::shared_ptr<const stored_object>> gcs_backend::read(
+    const std::string &bucket, const std::string &object) {
+    auto reader = client_.ReadObject(bucket, object);
+    if (!reader) {
+        return reader.status();
+    }
+
+    std::string object_content{std::istreambuf_iterator<char>{reader}, {}};
+    int64_t generation = reader.generation().value_or(0);
+    return std::shared_ptr<const stored_object>(
+        std::make_shared<string_object>(std::move(object_content), generation));
+}
+
+StatusOr<std::string> gcs_backend::read_range(
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end) {
+    auto reader = client_.ReadObject(bucket, object, gcs::ReadRange(begin, end));
+    if (!reader) {
+        return reader.status();
+    }
+
+    std::string object_content{std::istreambuf_iterator<char>{reader}, {}};
+    return object_content;
+}
+
+StatusOr<object_info> gcs_backend::stat(const std::string &bucket, const std::string &object) {
+    auto metadata = client_.GetObjectMetadata(bucket, object);
+    if (!metadata) {
+        return metadata.status();
+    }
+    return object_info {
+        .name = metadata->name(),
+        .size = metadata->size(),
+        .generation = metadata->generation(),
+    };
+}
+
+StatusOr<std::vector<object_info>> gcs_backend::list_objects(
+    const std::string &bucket, const std::string &prefix, int64_t max_results) {
+    std::vector<object_info> response;
+    if (max_results == 0) {
+        return response;
+    }
+
+    // MaxResults only limits the page size, so we still stop iterating ourselves.
+    auto listing = max_results > 0 ?
+        client_.ListObjects(bucket, gcs::Prefix(prefix), gcs::MaxResults(max_results)) :
+        client_.ListObjects(bucket, gcs::Prefix(prefix));
+    for (auto&& object_metadata : listing) {
+        if (!object_metadata) {
+            return object_metadata.status();
+        }
+        response.push_back(object_info {
+            .name = object_metadata->name(),
+            .size = object_metadata->size(),
+            .generation = object_metadata->generation(),
+        });
+        if (max_results > 0 && static_cast<int64_t>(response.size()) >= max_results) {
+            break;
+        }
+    }
+    return response;
+}
+
+StatusOr<std::vector<std::string>> gcs_backend::list_prefixes(
+    const std::string &bucket, const std::string &delimiter) {
+    std::vector<std::string> response;
+    for (auto&& prefix : client_.ListObjectsAndPrefixes(bucket, gcs::Delimiter(delimiter))) {
+        if (!prefix) {
+            return prefix.status();
+        }
+
+        auto result = *std::move(prefix);
+        if (absl::holds_alternative<std::string>(result)) {
+            response.push_back(absl::get<std::string>(result));
+        }
+    }
+    return response;
+}
+
+Status gcs_backend::write(const std::string &bucket, const std::string &object, const std::string &contents) {
+    gcs::ObjectWriteStream stream = client_.WriteObject(bucket, object);
+    stream << contents;
+    stream.Close();
+
+    StatusOr<gcs::ObjectMetadata> metadata = std::move(stream).metadata();
+    if (!metadata) {
+        return metadata.status();
+    }
+    return Status();
+}
+
+StatusOr<std::map<std::string, std::string>> gcs_backend::get_bucket_labels(const std::string &bucket) {
+    StatusOr<gcs::BucketMetadata> bucket_metadata = client_.GetBucketMetadata(bucket);
+    if (!bucket_metadata) {
+        return bucket_metadata.status();
+    }
+
+    std::map<std::string, std::string> labels;
+    for (auto const& kv : bucket_metadata->labels()) {
+        labels[kv.first] = kv.second;
+    }
+    return labels;
+}
+
+Status gcs_backend::set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) {
+    auto updated_metadata = client_.PatchBucket(bucket, gcs::BucketMetadataPatchBuilder().SetLabel(key, value));
+    if (!updated_metadata) {
+        return updated_metadata.status();
+    }
+    return Status();
+}
+
+Status gcs_backend::create_bucket(const std::string &bucket) {
+    auto bucket_metadata = client_.CreateBucketForProject(bucket, PROJECT_ID,
+        gcs::BucketMetadata().set_location(BUCKETS_LOCATION).set_storage_class(gcs::storage_class::Regional()));
+    if (!bucket_metadata) {
+        return bucket_metadata.status();
+    }
+    return Status();
+}
+
+/// **************** local_backend ********************************
+
+std::string local_backend::object_path(const std::string &bucket, const std::string &object) const {
+    return root_ + "/" + bucket + "/" + object;
+}
+
+std::string local_backend::labels_path(const std::string &bucket) const {
+    return root_ + "/" + bucket + ".labels";
+}
+
+StatusOr<std::shared_ptr<const stored_object>> local_backend::read(
+    const std::string &bucket, const std::string &object) {
+    auto mapped = map_local_file(object_path(bucket, object));
+    if (mapped.status().code() == google::cloud::StatusCode::kNotFound) {
+        return object_not_found(bucket, object);
+    }
+    return mapped;
+}
+
+StatusOr<std::string> local_backend::read_range(
+    const std::string &bucket, const std::string &object, int64_t begin, int64_t end) {
+    auto contents = read_local_file_range(object_path(bucket, object), begin, end);
+    if (contents.status().code() == google::cloud::StatusCode::kNotFound) {
+        return object_not_found(bucket, object);
+    }
+    return contents;
+}
+
+StatusOr<object_info> local_backend::stat(const std::string &bucket, const std::string &object) {
+    std::string path = object_path(bucket, object);
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || S_ISDIR(st.st_mode)) {
+        return object_not_found(bucket, object);
+    }
+    return object_info {
+        .name = object,
+        .size = static_cast<uint64_t>(st.st_size),
+        .generation = generation_from_stat(st),
+    };
+}
+
+StatusOr<std::vector<object_info>> local_backend::list_objects(
+    const std::string &bucket, const std::string &prefix, int64_t max_results) {
+    std::vector<object_info> response;
+    fs::path bucket_dir = fs::path(root_) / bucket;
+    std::error_code ec;
+    if (!fs::is_directory(bucket_dir, ec)) {
+        return Status(google::cloud::StatusCode::kNotFound, "no such bucket: " + bucket);
+    }
+
+    // Only walk the directory the prefix points into.
+    fs::path start_dir = bucket_dir;
+    std::size_t last_slash = prefix.rfind('/');
+    if (last_slash != std::string::npos) {
+        start_dir = bucket_dir / prefix.substr(0, last_slash);
+        if (!fs::is_directory(start_dir, ec)) {
+            return response;
+        }
+    }
+
+    for (auto it = fs::recursive_directory_iterator(start_dir, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        std::string name = it->path().lexically_relative(bucket_dir).generic_string();
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        // skip half-written objects from write()
+        if (it->path().filename().string()[0] == '.') {
+            continue;
+        }
+        struct stat st;
+        if (::stat(it->path().c_str(), &st) != 0) {
+            continue;
+        }
+        response.push_back(object_info {
+            .name = name,
+            .size = static_cast<uint64_t>(st.st_size),
+            .generation = generation_from_stat(st),
+        });
+    }
+    if (ec) {
+        return Status(google::cloud::StatusCode::kInternal, "listing " + bucket + " failed: " + ec.message());
+    }
+
+    std::sort(response.begin(), response.end(),
+        [](const object_info &a, const object_info &b) { return a.name < b.name; });
+    if (max_results >= 0 && static_cast<int64_t>(response.size()) > max_results) {
+        response.resize(max_results);
+    }
+    return response;
+}
+
+StatusOr<std::vector<std::string>> local_backend::list_prefixes(
+    const std::string &bucket, const std::string &delimiter) {
+    auto objects = list_objects(bucket, "", -1);
+    if (!objects.ok()) {
+        return objects.status();
+    }
+
+    std::vector<std::string> response;
+    for (auto &object : objects.value()) {
+        std::size_t pos = object.name.find(delimiter);
+        if (pos == std::string::npos) {
+            continue;
+        }
+        std::string prefix = object.name.substr(0, pos + delimiter.size());
+        if (response.empty() || response.back() != prefix) {
+            response.push_back(prefix);
+        }
+    }
+    return response;
+}
+
+Status local_backend::write(const std::string &bucket, const std::string &object, const std::string &contents) {
+    return write_local_file(object_path(bucket, object), contents);
+}
+
+StatusOr<std::map<std::string, std::string>> local_backend::get_bucket_labels(const std::string &bucket) {
+    std::error_code ec;
+    if (!fs::is_directory(fs::path(root_) / bucket, ec)) {
+        return Status(google::cloud::StatusCode::kNotFound, "no such bucket: " + bucket);
+    }
+
+    std::map<std::string, std::string> labels;
+    std::ifstream in(labels_path(bucket));
+    std::string line;
+    while (std::getline(in, line)) {
+        std::size_t eq = line.find('=');
+        if (eq != std::string::npos) {
+            labels[line.substr(0, eq)] = line.substr(eq + 1);
+        }
+    }
+    return labels;
+}
+
+Status local_backend::set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) {
+    auto labels = get_bucket_labels(bucket);
+    if (!labels.ok()) {
+        return labels.status();
+    }
+    labels.value()[key] = value;
+
+    std::ofstream out(labels_path(bucket), std::ios::trunc);
+    for (auto const& kv : labels.value()) {
+        out << kv.first << "=" << kv.second << "\n";
+    }
+    if (!out) {
+        return io_error("write", labels_path(bucket));
+    }
+    return Status();
+}
+
+Status local_backend::create_bucket(const std::string &bucket) {
+    std::error_code ec;
+    fs::path bucket_dir = fs::path(root_) / bucket;
+    if (fs::is_directory(bucket_dir, ec)) {
+        return Status(google::cloud::StatusCode::kAborted, "bucket already exists: " + bucket);
+    }
+    fs::create_directories(bucket_dir, ec);
+    if (ec) {
+        return Status(google::cloud::StatusCode::kInternal, "could not create bucket " + bucket);
+    }
+    return Status();
+}
+
+/// **************** Other ********************************
+
+stored_object_stream::view_buffer::view_buffer(const char* begin, size_t size) {
+    // the get area is never written through, std::streambuf just isn't const-aware
+    char* start = const_cast<char*>(begin);
+    setg(start, start, start + size);
+}
+
+stored_object_stream::stored_object_stream(std::shared_ptr<const stored_object> object)
+: std::istream(nullptr), object_(std::move(object)), buffer_(object_->data(), object_->size()) {
+    rdbuf(&buffer_);
+}
+
+std::unique_ptr<storage_backend> make_storage_backend() {
+    const char* root = std::getenv(LOCAL_STORAGE_ROOT_ENV);
+    if (root != nullptr && root[0] != '\0') {
+        return std::make_unique<metered_backend>(std::make_unique<local_backend>(root));
+    }
+
+    // metered below the disk cache, so only requests that reach GCS count
+    // as storage requests; the cache counts its own hits
+    std::unique_ptr<storage_backend> backend = std::make_unique<metered_backend>(std::make_unique<gcs_backend>());
+    const char* cache_dir = std::getenv(DISK_CACHE_DIR_ENV);
+    if (cache_dir != nullptr && cache_dir[0] != '\0') {
+        const char* capacity = std::getenv(DISK_CACHE_BYTES_ENV);
+        uint64_t capacity_bytes = capacity != nullptr ?
+            std::strtoull(capacity, nullptr, 10) : DEFAULT_DISK_CACHE_BYTES;
+        backend = std::make_unique<disk_cache_backend>(std::move(backend), cache_dir, capacity_bytes);
+    }
+    return backend;
+}
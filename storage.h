@@ -0,0 +1,179 @@
+/*
+ * Storage backends that every Quest read and write goes through.
+ *
+ * gcs_backend talks to Google Cloud Storage, local_backend serves the same
+ * bucket/object layout from a directory on local disk and memory-maps objects
+ * so that reads are zero-copy.  Buckets are top level directories of the
+ * root, object names (which may contain '/') are paths within them, and
+ * bucket labels live next to the bucket in "<bucket>.labels".  A
+ * disk_cache_backend (disk_cache.h) can sit in front of either.
+*/
+
+#ifndef STORAGE_H_ // NOLINT
+#define STORAGE_H_
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "google/cloud/storage/client.h"
+
+namespace gcs = ::google::cloud::storage;
+using ::google::cloud::StatusOr;
+using ::google::cloud::Status;
+
+// If set, make_storage_backend() serves data from this directory instead of GCS.
+const char LOCAL_STORAGE_ROOT_ENV[] = "QUEST_LOCAL_STORAGE_ROOT";
+
+/**
+ * Read-only bytes of a single stored object.  Holders keep the underlying
+ * buffer (or mapping) alive, so views into it are valid for the lifetime of
+ * the shared_ptr.
+ */
+class stored_object {
+    public: // NOLINT
+        virtual ~stored_object() = default;
+        virtual const char* data() const = 0;
+        virtual size_t size() const = 0;
+        // Changes whenever the object is rewritten; 0 if the backend can't tell.
+        virtual int64_t generation() const { return 0; }
+
+        std::string_view view() const { return std::string_view(data(), size()); }
+        std::string str() const { return std::string(data(), size()); }
+};
+
+// An object whose bytes are held in memory, as read from GCS or built by a caller.
+class string_object : public stored_object {
+    public: // NOLINT
+        explicit string_object(std::string contents, int64_t generation = 0)
+        : contents_(std::move(contents)), generation_(generation) {}
+
+        const char* data() const override { return contents_.data(); }
+        size_t size() const override { return contents_.size(); }
+        int64_t generation() const override { return generation_; }
+
+    private: // NOLINT
+        std::string contents_;
+        int64_t generation_;
+};
+
+struct object_info {
+    std::string name;
+    uint64_t size;
+    int64_t generation;
+};
+
+class storage_backend {
+    public: // NOLINT
+        virtual ~storage_backend() = default;
+
+        virtual StatusOr<std::shared_ptr<const stored_object>> read(
+            const std::string &bucket, const std::string &object) = 0;
+        // Bytes [begin, end) of the object, clamped to its size.
+        virtual StatusOr<std::string> read_range(
+            const std::string &bucket, const std::string &object, int64_t begin, int64_t end) = 0;
+        virtual StatusOr<object_info> stat(const std::string &bucket, const std::string &object) = 0;
+        // Objects whose names start with prefix, in lexicographic order.
+        // A negative max_results lists everything.
+        virtual StatusOr<std::vector<object_info>> list_objects(
+            const std::string &bucket, const std::string &prefix = "", int64_t max_results = -1) = 0;
+        // Distinct name prefixes up to and including the first delimiter.
+        virtual StatusOr<std::vector<std::string>> list_prefixes(
+            const std::string &bucket, const std::string &delimiter) = 0;
+        virtual Status write(const std::string &bucket, const std::string &object, const std::string &contents) = 0;
+
+        virtual StatusOr<std::map<std::string, std::string>> get_bucket_labels(const std::string &bucket) = 0;
+        virtual Status set_bucket_label(
+            const std::string &bucket, const std::string &key, const std::string &value) = 0;
+        // Returns kAborted if the bucket already exists, like GCS does.
+        virtual Status create_bucket(const std::string &bucket) = 0;
+
+        // Hint that the object will be read soon.  Only backends with a local
+        // tier act on it, and they report so through accepts_prefetch().
+        virtual void prefetch(const std::string & /*bucket*/, const std::string & /*object*/) {}
+        virtual bool accepts_prefetch() const { return false; }
+};
+
+class gcs_backend : public storage_backend {
+    public: // NOLINT
+        gcs_backend() = default;
+        explicit gcs_backend(gcs::Client client) : client_(std::move(client)) {}
+
+        StatusOr<std::shared_ptr<const stored_object>> read(
+            const std::string &bucket, const std::string &object) override;
+        StatusOr<std::string> read_range(
+            const std::string &bucket, const std::string &object, int64_t begin, int64_t end) override;
+        StatusOr<object_info> stat(const std::string &bucket, const std::string &object) override;
+        StatusOr<std::vector<object_info>> list_objects(
+            const std::string &bucket, const std::string &prefix, int64_t max_results) override;
+        StatusOr<std::vector<std::string>> list_prefixes(
+            const std::string &bucket, const std::string &delimiter) override;
+        Status write(const std::string &bucket, const std::string &object, const std::string &contents) override;
+        StatusOr<std::map<std::string, std::string>> get_bucket_labels(const std::string &bucket) override;
+        Status set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) override;
+        Status create_bucket(const std::string &bucket) override;
+
+    private: // NOLINT
+        gcs::Client client_;
+};
+
+class local_backend : public storage_backend {
+    public: // NOLINT
+        explicit local_backend(std::string root) : root_(std::move(root)) {}
+
+        StatusOr<std::shared_ptr<const stored_object>> read(
+            const std::string &bucket, const std::string &object) override;
+        StatusOr<std::string> read_range(
+            const std::string &bucket, const std::string &object, int64_t begin, int64_t end) override;
+        StatusOr<object_info> stat(const std::string &bucket, const std::string &object) override;
+        StatusOr<std::vector<object_info>> list_objects(
+            const std::string &bucket, const std::string &prefix, int64_t max_results) override;
+        StatusOr<std::vector<std::string>> list_prefixes(
+            const std::string &bucket, const std::string &delimiter) override;
+        Status write(const std::string &bucket, const std::string &object, const std::string &contents) override;
+        StatusOr<std::map<std::string, std::string>> get_bucket_labels(const std::string &bucket) override;
+        Status set_bucket_label(const std::string &bucket, const std::string &key, const std::string &value) override;
+        Status create_bucket(const std::string &bucket) override;
+
+    private: // NOLINT
+        std::string object_path(const std::string &bucket, const std::string &object) const;
+        std::string labels_path(const std::string &bucket) const;
+
+        std::string root_;
+};
+
+/**
+ * std::istream over a stored_object, for the Deserialize() functions of the
+ * index structures.  Does not copy the object's bytes.
+ */
+class stored_object_stream : public std::istream {
+    public: // NOLINT
+        explicit stored_object_stream(std::shared_ptr<const stored_object> object);
+
+    private: // NOLINT
+        struct view_buffer : public std::streambuf {
+            view_buffer(const char* begin, size_t size);
+        };
+
+        std::shared_ptr<const stored_object> object_;
+        view_buffer buffer_;
+};
+
+// Helpers for backends that keep objects in local files.
+// Maps the file read-only; a negative generation means "use the file's mtime".
+StatusOr<std::shared_ptr<const stored_object>> map_local_file(const std::string &path, int64_t generation = -1);
+StatusOr<std::string> read_local_file_range(const std::string &path, int64_t begin, int64_t end);
+// Writes a hidden temporary next to path and renames it into place.
+Status write_local_file(const std::string &path, std::string_view contents);
+
+// local_backend if QUEST_LOCAL_STORAGE_ROOT is set, otherwise GCS, fronted by
+// a disk_cache_backend if QUEST_DISK_CACHE_DIR is set; either way metered.
+std::unique_ptr<storage_backend> make_storage_backend();
+
+#endif  // STORAGE_H_ // NOLINT
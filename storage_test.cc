@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "storage.h"
+#include "disk_cache.h"
+#include "metrics.h"
+#include "test_util.h"
+
+using LocalBackend = local_backend_test;
+
+TEST_F(LocalBackend, WriteThenRead) {
+  ASSERT_TRUE(backend_->create_bucket("b").ok());
+  ASSERT_TRUE(backend_->write("b", "svc/1-2-3", "hello world").ok());
+
+  auto obj = backend_->read("b", "svc/1-2-3");
+  ASSERT_TRUE(obj.ok());
+  EXPECT_EQ(obj.value()->str(), "hello world");
+
+  auto range = backend_->read_range("b", "svc/1-2-3", 6, 100);
+  ASSERT_TRUE(range.ok());
+  EXPECT_EQ(range.value(), "world");
+
+  EXPECT_EQ(backend_->read("b", "missing").status().code(),
+            ::google::cloud::StatusCode::kNotFound);
+}
+
+TEST_F(LocalBackend, ListObjectsAndPrefixes) {
+  ASSERT_TRUE(backend_->create_bucket("b").ok());
+  ASSERT_TRUE(backend_->write("b", "a/2", "x").ok());
+  ASSERT_TRUE(backend_->write("b", "a/1", "xy").ok());
+  ASSERT_TRUE(backend_->write("b", "c/1", "xyz").ok());
+
+  auto all = backend_->list_objects("b");
+  ASSERT_TRUE(all.ok());
+  ASSERT_EQ(all->size(), 3);
+  EXPECT_EQ(all->at(0).name, "a/1");
+  EXPECT_EQ(all->at(0).size, 2);
+  EXPECT_EQ(all->at(2).name, "c/1");
+
+  auto first = backend_->list_objects("b", "a/", 1);
+  ASSERT_TRUE(first.ok());
+  ASSERT_EQ(first->size(), 1);
+  EXPECT_EQ(first->at(0).name, "a/1");
+
+  auto prefixes = backend_->list_prefixes("b", "/");
+  ASSERT_TRUE(prefixes.ok());
+  ASSERT_EQ(prefixes->size(), 2);
+  EXPECT_EQ(prefixes->at(0), "a/");
+  EXPECT_EQ(prefixes->at(1), "c/");
+}
+
+TEST_F(LocalBackend, BucketLabels) {
+  ASSERT_TRUE(backend_->create_bucket("idx").ok());
+  EXPECT_EQ(backend_->create_bucket("idx").code(),
+            ::google::cloud::StatusCode::kAborted);
+
+  ASSERT_TRUE(backend_->set_bucket_label("idx", "root", "0-100").ok());
+  ASSERT_TRUE(backend_->set_bucket_label("idx", "granularity", "10").ok());
+  ASSERT_TRUE(backend_->set_bucket_label("idx", "root", "0-1000").ok());
+
+  auto labels = backend_->get_bucket_labels("idx");
+  ASSERT_TRUE(labels.ok());
+  EXPECT_EQ(labels->size(), 2);
+  EXPECT_EQ(labels->at("root"), "0-1000");
+  EXPECT_EQ(labels->at("granularity"), "10");
+}
+
+TEST_F(LocalBackend, DiskCacheTier) {
+  std::string cache_dir = root_ + "_cache";
+  ASSERT_TRUE(backend_->create_bucket("b").ok());
+  ASSERT_TRUE(backend_->write("b", "svc/1", "0123456789").ok());
+  ASSERT_TRUE(backend_->write("b", "svc/2", "abcdefghij").ok());
+
+  {
+    disk_cache_backend cache(std::make_unique<local_backend>(root_), cache_dir, 15);
+    EXPECT_EQ(cache.read("b", "svc/1").value()->str(), "0123456789");
+    EXPECT_EQ(cache.read("b", "svc/1").value()->str(), "0123456789");
+    EXPECT_EQ(cache.get_stats().hits, 1);
+    EXPECT_EQ(cache.get_stats().misses, 1);
+
+    // only one object fits, so prefetching svc/2 evicts svc/1
+    cache.prefetch("b", "svc/2");
+    cache.wait_for_prefetches();
+    EXPECT_EQ(cache.get_stats().evictions, 1);
+    EXPECT_EQ(cache.get_stats().entries, 1);
+    EXPECT_EQ(cache.read_range("b", "svc/2", 2, 4).value(), "cd");
+  }
+
+  // a new process picks up what is already on disk
+  disk_cache_backend cache(std::make_unique<local_backend>(root_), cache_dir, 15);
+  EXPECT_EQ(cache.get_stats().entries, 1);
+  EXPECT_EQ(cache.read("b", "svc/2").value()->str(), "abcdefghij");
+  EXPECT_EQ(cache.get_stats().hits, 1);
+
+  // writing through the cache drops the stale copy
+  ASSERT_TRUE(cache.write("b", "svc/2", "klmnopqrst").ok());
+  EXPECT_EQ(cache.get_stats().entries, 0);
+  EXPECT_EQ(cache.read("b", "svc/2").value()->str(), "klmnopqrst");
+
+  std::string cmd = "rm -rf " + cache_dir;
+  system(cmd.c_str());
+}
+
+TEST_F(LocalBackend, DiskCacheHitsAreNotStorageRequests) {
+  std::string cache_dir = root_ + "_cache";
+  ASSERT_TRUE(backend_->create_bucket("b").ok());
+  ASSERT_TRUE(backend_->write("b", "svc/1", "0123456789").ok());
+  histogram &remote_reads = metrics().get_histogram(
+      "quest_storage_request_seconds", "Storage request latency, by operation and bucket class.",
+      {{"op", "read"}, {"bucket_class", storage_bucket_class("b")}});
+  counter &hits = metrics().get_counter("quest_disk_cache_hits_total", "Disk cache lookups that hit.");
+  const int64_t reads_before = remote_reads.get_snapshot().count;
+  const int64_t hits_before = hits.value();
+
+  {
+    // as make_storage_backend() puts them together
+    disk_cache_backend cache(std::make_unique<metered_backend>(std::make_unique<local_backend>(root_)),
+                             cache_dir, 1000);
+    EXPECT_EQ(cache.read("b", "svc/1").value()->str(), "0123456789");
+    EXPECT_EQ(cache.read("b", "svc/1").value()->str(), "0123456789");
+  }
+  EXPECT_EQ(remote_reads.get_snapshot().count, reads_before + 1);
+  EXPECT_EQ(hits.value(), hits_before + 1);
+  std::string cmd = "rm -rf " + cache_dir;
+  system(cmd.c_str());
+}
+
+TEST_F(LocalBackend, DiskCacheReadsJoinPrefetchesAndDropsThemWhenFull) {
+  std::string cache_dir = root_ + "_cache";
+  ASSERT_TRUE(backend_->create_bucket("b").ok());
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(backend_->write("b", "svc/" + std::to_string(i), "0123456789").ok());
+  }
+  auto remote = std::make_unique<counting_backend>(root_);
+  counting_backend *counted = remote.get();
+  {
+    disk_cache_backend cache(std::move(remote), cache_dir, 1000, 2);
+    cache.prefetch("b", "svc/0");
+    // waits for the prefetch, or finds what it stored, instead of reading it again
+    EXPECT_EQ(cache.read("b", "svc/0").value()->str(), "0123456789");
+    EXPECT_EQ(counted->reads(), 1);
+
+    // held, so the first two are pending when the third is asked for
+    counted->hold_reads();
+    cache.prefetch("b", "svc/1");
+    cache.prefetch("b", "svc/2");
+    cache.prefetch("b", "svc/3");
+    counted->release_reads();
+    cache.wait_for_prefetches();
+    EXPECT_EQ(counted->reads(), 3);
+    EXPECT_EQ(cache.get_stats().entries, 3);
+  }
+  std::string cmd = "rm -rf " + cache_dir;
+  system(cmd.c_str());
+}
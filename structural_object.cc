@@ -0,0 +1,493 @@
+#include "structural_object.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#include "common.h"
+#include "little_endian.h"
+
+namespace {
+
+const char TRACE_HEADER[] = "Trace ID: ";
+const size_t TRACE_HEADER_LENGTH = sizeof(TRACE_HEADER) - 1;
+const size_t MAGIC_LENGTH = sizeof(STRUCTURAL_OBJECT_MAGIC) - 1;
+const size_t TRAILER_LENGTH = 8 + MAGIC_LENGTH;
+const int SPAN_ID_BYTES = SPAN_ID_LENGTH / 2;
+const int TRACE_ID_BYTES = TRACE_ID_LENGTH / 2;
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;  // upper case wouldn't survive the round trip
+}
+
+bool hex_to_bytes(std::string_view hex, char* out, size_t num_bytes) {
+    if (hex.size() != 2 * num_bytes) {
+        return false;
+    }
+    for (size_t i = 0; i < num_bytes; i++) {
+        int high = hex_value(hex[2 * i]);
+        int low = hex_value(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out[i] = static_cast<char>((high << 4) | low);
+    }
+    return true;
+}
+
+void append_hex(std::string &out, const char* bytes, size_t num_bytes) {
+    for (size_t i = 0; i < num_bytes; i++) {
+        out.push_back(hexmap[(bytes[i] & 0xF0) >> 4]);
+        out.push_back(hexmap[bytes[i] & 0x0F]);
+    }
+}
+
+bool is_zero(const char* bytes, size_t num_bytes) {
+    for (size_t i = 0; i < num_bytes; i++) {
+        if (bytes[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct text_block {
+    std::string_view trace_id;
+    size_t offset;
+    size_t length;
+};
+
+// Trace blocks in object order, delimited the way extract_trace_from_traces_object() does it.
+std::vector<text_block> index_text(std::string_view view) {
+    std::vector<text_block> blocks;
+    size_t pos = view.find(TRACE_HEADER);
+    while (pos != std::string_view::npos) {
+        size_t next = view.find("Trace ID", pos + 1);
+        size_t end = next == std::string_view::npos ? view.size() : next;
+        size_t id_start = pos + TRACE_HEADER_LENGTH;
+        size_t id_end = view.find(':', id_start);
+        if (id_end != std::string_view::npos && id_end < end) {
+            size_t length = end - pos;
+            if (view[pos + length - 1] == '\n') {
+                length--;
+            }
+            blocks.push_back(text_block {
+                .trace_id = view.substr(id_start, id_end - id_start),
+                .offset = pos,
+                .length = length,
+            });
+        }
+        pos = next == std::string_view::npos ? next : view.find(TRACE_HEADER, next);
+    }
+    return blocks;
+}
+
+struct span_line {
+    std::string_view parent;
+    std::string_view span;
+    std::string_view service;
+    std::string_view hash;
+};
+
+// parent:span:service:hash, where only the service may itself contain ':'
+bool split_span_line(std::string_view line, span_line &out) {
+    size_t first = line.find(':');
+    size_t second = first == std::string_view::npos ? first : line.find(':', first + 1);
+    size_t last = line.rfind(':');
+    if (second == std::string_view::npos || last <= second) {
+        return false;
+    }
+    out.parent = line.substr(0, first);
+    out.span = line.substr(first + 1, second - first - 1);
+    out.service = line.substr(second + 1, last - second - 1);
+    out.hash = line.substr(last + 1);
+    return true;
+}
+
+Status invalid(const std::string &why) {
+    return Status(google::cloud::StatusCode::kInvalidArgument, "structural object: " + why);
+}
+
+}  // namespace
+
+bool is_binary_structural_object(std::string_view contents) {
+    return contents.size() >= MAGIC_LENGTH + 4 + TRAILER_LENGTH &&
+        contents.substr(0, MAGIC_LENGTH) == STRUCTURAL_OBJECT_MAGIC &&
+        contents.substr(contents.size() - MAGIC_LENGTH) == STRUCTURAL_OBJECT_MAGIC;
+}
+
+StatusOr<std::shared_ptr<const structural_object>> structural_object::parse(
+    std::shared_ptr<const stored_object> contents) {
+    std::shared_ptr<structural_object> parsed(new structural_object(std::move(contents)));
+    if (is_binary_structural_object(parsed->contents_->view())) {
+        Status status = parsed->load_binary();
+        if (!status.ok()) {
+            return status;
+        }
+    } else {
+        parsed->load_text();
+    }
+    return std::shared_ptr<const structural_object>(std::move(parsed));
+}
+
+void structural_object::load_text() {
+    std::string_view view = contents_->view();
+    for (auto &block : index_text(view)) {
+        text_index_.push_back(text_entry {
+            .trace_id = block.trace_id,
+            .offset = block.offset,
+            .length = block.length,
+        });
+    }
+    // stable, so that a duplicated trace ID resolves to its first block like a linear search would
+    std::stable_sort(text_index_.begin(), text_index_.end(),
+        [](const text_entry &a, const text_entry &b) { return a.trace_id < b.trace_id; });
+}
+
+Status structural_object::load_binary() {
+    binary_ = true;
+    const char* data = contents_->data();
+    const size_t size = contents_->size();
+    const size_t body_end = size - TRAILER_LENGTH;
+
+    size_t pos = MAGIC_LENGTH;
+    if (get_u32(data + pos) != STRUCTURAL_OBJECT_VERSION) {
+        return invalid("unsupported version");
+    }
+    pos += 4;
+
+    if (pos + 4 > body_end) {
+        return invalid("truncated string table");
+    }
+    uint32_t num_strings = get_u32(data + pos);
+    pos += 4;
+    strings_.reserve(num_strings);
+    for (uint32_t i = 0; i < num_strings; i++) {
+        if (pos + 4 > body_end) {
+            return invalid("truncated string table");
+        }
+        uint32_t length = get_u32(data + pos);
+        pos += 4;
+        if (pos + length > body_end) {
+            return invalid("truncated string table");
+        }
+        strings_.emplace_back(data + pos, length);
+        pos += length;
+    }
+
+    if (pos + 4 > body_end) {
+        return invalid("truncated spans");
+    }
+    num_spans_ = get_u32(data + pos);
+    pos += 4;
+    spans_ = data + pos;
+    if (pos + static_cast<uint64_t>(num_spans_) * SPAN_RECORD_SIZE > body_end) {
+        return invalid("truncated spans");
+    }
+    pos += static_cast<uint64_t>(num_spans_) * SPAN_RECORD_SIZE;
+    for (uint32_t i = 0; i < num_spans_; i++) {
+        const char* record = spans_ + i * SPAN_RECORD_SIZE;
+        if (get_u32(record + 2 * SPAN_ID_BYTES) >= num_strings ||
+            get_u32(record + 2 * SPAN_ID_BYTES + 4) >= num_strings) {
+            return invalid("span refers to a missing string");
+        }
+    }
+
+    if (get_u64(data + body_end) != pos || pos + 4 > body_end) {
+        return invalid("bad trace index offset");
+    }
+    num_traces_ = get_u32(data + pos);
+    pos += 4;
+    traces_ = data + pos;
+    if (pos + static_cast<uint64_t>(num_traces_) * TRACE_RECORD_SIZE != body_end) {
+        return invalid("bad trace index length");
+    }
+    for (uint32_t i = 0; i < num_traces_; i++) {
+        const char* record = traces_ + i * TRACE_RECORD_SIZE;
+        uint64_t first = get_u32(record + TRACE_ID_BYTES);
+        uint64_t count = get_u32(record + TRACE_ID_BYTES + 4);
+        if (first + count > num_spans_) {
+            return invalid("trace refers to missing spans");
+        }
+        if (i > 0 && memcmp(record - TRACE_RECORD_SIZE, record, TRACE_ID_BYTES) > 0) {
+            return invalid("trace index is not sorted");
+        }
+    }
+    return Status();
+}
+
+size_t structural_object::num_traces() const {
+    return binary_ ? num_traces_ : text_index_.size();
+}
+
+std::vector<std::string> structural_object::trace_ids() const {
+    std::vector<std::string> ids;
+    ids.reserve(num_traces());
+    if (binary_) {
+        for (uint32_t i = 0; i < num_traces_; i++) {
+            std::string id;
+            append_hex(id, traces_ + i * TRACE_RECORD_SIZE, TRACE_ID_BYTES);
+            ids.push_back(id);
+        }
+    } else {
+        for (auto &entry : text_index_) {
+            ids.emplace_back(entry.trace_id);
+        }
+    }
+    return ids;
+}
+
+std::string structural_object::binary_trace(size_t trace_index) const {
+    const char* record = traces_ + trace_index * TRACE_RECORD_SIZE;
+    uint32_t first = get_u32(record + TRACE_ID_BYTES);
+    uint32_t count = get_u32(record + TRACE_ID_BYTES + 4);
+
+    std::string out = TRACE_HEADER;
+    append_hex(out, record, TRACE_ID_BYTES);
+    out.push_back(':');
+    for (uint32_t i = first; i < first + count; i++) {
+        const char* span = spans_ + static_cast<size_t>(i) * SPAN_RECORD_SIZE;
+        out.push_back('\n');
+        if (!is_zero(span, SPAN_ID_BYTES)) {
+            append_hex(out, span, SPAN_ID_BYTES);
+        }
+        out.push_back(':');
+        append_hex(out, span + SPAN_ID_BYTES, SPAN_ID_BYTES);
+        out.push_back(':');
+        out.append(strings_[get_u32(span + 2 * SPAN_ID_BYTES)]);
+        out.push_back(':');
+        out.append(strings_[get_u32(span + 2 * SPAN_ID_BYTES + 4)]);
+    }
+    return out;
+}
+
+std::string structural_object::find_binary_trace(const char* trace_id) const {
+    size_t low = 0;
+    size_t high = num_traces_;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = memcmp(traces_ + mid * TRACE_RECORD_SIZE, trace_id, TRACE_ID_BYTES);
+        if (cmp == 0) {
+            return binary_trace(mid);
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return "";
+}
+
+std::string structural_object::trace(const trace_id_t &trace_id) const {
+    if (!binary_) {
+        return trace(trace_id.hex());
+    }
+    char id[TRACE_ID_BYTES];
+    for (int i = 0; i < 8; i++) {
+        id[i] = static_cast<char>(trace_id.high >> (56 - 8 * i));
+        id[8 + i] = static_cast<char>(trace_id.low >> (56 - 8 * i));
+    }
+    return find_binary_trace(id);
+}
+
+std::string structural_object::trace(const std::string &trace_id) const {
+    if (binary_) {
+        char id[TRACE_ID_BYTES];
+        if (!hex_to_bytes(trace_id, id, TRACE_ID_BYTES)) {
+            return "";
+        }
+        return find_binary_trace(id);
+    }
+
+    auto it = std::lower_bound(text_index_.begin(), text_index_.end(), trace_id,
+        [](const text_entry &entry, const std::string &id) { return entry.trace_id < id; });
+    if (it == text_index_.end() || it->trace_id != trace_id) {
+        return "";
+    }
+    return std::string(contents_->view().substr(it->offset, it->length));
+}
+
+std::string structural_object::text() const {
+    if (!binary_) {
+        return contents_->str();
+    }
+
+    // the trace index is sorted by ID, the spans are still in the original order
+    std::vector<std::pair<uint32_t, uint32_t>> first_span_and_trace;
+    for (uint32_t i = 0; i < num_traces_; i++) {
+        first_span_and_trace.push_back(std::make_pair(get_u32(traces_ + i * TRACE_RECORD_SIZE + TRACE_ID_BYTES), i));
+    }
+    std::sort(first_span_and_trace.begin(), first_span_and_trace.end());
+
+    std::string out;
+    for (auto &[first_span, trace_index] : first_span_and_trace) {
+        out += binary_trace(trace_index);
+        out.push_back('\n');
+    }
+    return out;
+}
+
+size_t structural_object::space_used() const {
+    return sizeof(*this) + contents_->size() + text_index_.capacity() * sizeof(text_entry) +
+        strings_.capacity() * sizeof(std::string_view);
+}
+
+StatusOr<std::string> convert_structural_object_to_binary(std::string_view text) {
+    std::vector<text_block> blocks = index_text(text);
+    if (!blocks.empty() && text.substr(0, blocks[0].offset).find_first_not_of("\n") != std::string_view::npos) {
+        return invalid("text before the first trace");
+    }
+
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> string_ids;
+    auto string_id = [&](std::string_view s) {
+        auto it = string_ids.find(std::string(s));
+        if (it != string_ids.end()) {
+            return it->second;
+        }
+        uint32_t id = strings.size();
+        strings.emplace_back(s);
+        string_ids[strings.back()] = id;
+        return id;
+    };
+
+    std::string spans;
+    struct trace_record {
+        char id[TRACE_ID_BYTES];
+        uint32_t first_span;
+        uint32_t num_spans;
+    };
+    std::vector<trace_record> traces;
+    uint32_t num_spans = 0;
+
+    for (auto &block : blocks) {
+        trace_record tr;
+        if (!hex_to_bytes(block.trace_id, tr.id, TRACE_ID_BYTES)) {
+            return invalid("bad trace ID " + std::string(block.trace_id));
+        }
+        tr.first_span = num_spans;
+
+        std::string_view body = text.substr(block.offset, block.length);
+        size_t line_start = body.find('\n');
+        if (body.substr(0, line_start) != TRACE_HEADER + std::string(block.trace_id) + ":") {
+            return invalid("bad header for trace " + std::string(block.trace_id));
+        }
+        while (line_start != std::string_view::npos) {
+            size_t line_end = body.find('\n', line_start + 1);
+            std::string_view line = body.substr(line_start + 1,
+                line_end == std::string_view::npos ? std::string_view::npos : line_end - line_start - 1);
+            line_start = line_end;
+
+            span_line sl;
+            char parent[SPAN_ID_BYTES] = {0};
+            char span[SPAN_ID_BYTES];
+            if (!split_span_line(line, sl) ||
+                (!sl.parent.empty() && !hex_to_bytes(sl.parent, parent, SPAN_ID_BYTES)) ||
+                (!sl.parent.empty() && is_zero(parent, SPAN_ID_BYTES)) ||
+                !hex_to_bytes(sl.span, span, SPAN_ID_BYTES)) {
+                return invalid("bad span line \"" + std::string(line) + "\"");
+            }
+            spans.append(parent, SPAN_ID_BYTES);
+            spans.append(span, SPAN_ID_BYTES);
+            put_u32(spans, string_id(sl.service));
+            put_u32(spans, string_id(sl.hash));
+            num_spans++;
+        }
+        tr.num_spans = num_spans - tr.first_span;
+        traces.push_back(tr);
+    }
+
+    std::sort(traces.begin(), traces.end(),
+        [](const trace_record &a, const trace_record &b) { return memcmp(a.id, b.id, TRACE_ID_BYTES) < 0; });
+    for (size_t i = 1; i < traces.size(); i++) {
+        if (memcmp(traces[i - 1].id, traces[i].id, TRACE_ID_BYTES) == 0) {
+            return invalid("duplicate trace ID");
+        }
+    }
+
+    std::string out = STRUCTURAL_OBJECT_MAGIC;
+    put_u32(out, STRUCTURAL_OBJECT_VERSION);
+    put_u32(out, strings.size());
+    for (auto &s : strings) {
+        put_u32(out, s.size());
+        out += s;
+    }
+    put_u32(out, num_spans);
+    out += spans;
+    uint64_t index_offset = out.size();
+    put_u32(out, traces.size());
+    for (auto &tr : traces) {
+        out.append(tr.id, TRACE_ID_BYTES);
+        put_u32(out, tr.first_span);
+        put_u32(out, tr.num_spans);
+    }
+    put_u64(out, index_offset);
+    out += STRUCTURAL_OBJECT_MAGIC;
+
+    // make sure every trace reads back exactly as it was
+    auto converted = structural_object::parse(std::make_shared<string_object>(out));
+    if (!converted.ok()) {
+        return converted.status();
+    }
+    for (auto &block : blocks) {
+        if (converted.value()->trace(std::string(block.trace_id)) != text.substr(block.offset, block.length)) {
+            return invalid("trace " + std::string(block.trace_id) + " does not round trip");
+        }
+    }
+    return out;
+}
+
+StatusOr<std::shared_ptr<const structural_object>> read_structural_object(
+    const std::string &batch_name, storage_backend* client) {
+    const std::string bucket = std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+    const std::string key = object_cache_key(bucket, batch_name);
+
+    auto cached = structural_object_cache().get(key);
+    if (cached.has_value()) {
+        if (false == cache_revalidation_enabled() ||
+            is_current_generation(bucket, batch_name, cached->generation, client)) {
+            profile_cache_hit();
+            return cached->value;
+        }
+        structural_object_cache().invalidate(key);
+    }
+
+    return structural_object_parses_in_flight().run(key,
+        [&]() -> StatusOr<std::shared_ptr<const structural_object>> {
+            // straight from the backend: the parsed object keeps the bytes, and
+            // is what's cached
+            auto contents = client->read(bucket, batch_name);
+            if (!contents.ok()) {
+                return contents.status();
+            }
+            auto parsed = structural_object::parse(contents.value());
+            if (parsed.ok()) {
+                structural_object_cache().put(
+                    key, parsed.value(), parsed.value()->space_used(), contents.value()->generation());
+            }
+            return parsed;
+        });
+}
+
+StatusOr<std::string> read_structural_object_text(const std::string &batch_name, storage_backend* client) {
+    auto contents = read_stored_object(
+        std::string(TRACE_STRUCT_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX), batch_name, client);
+    if (!contents.ok()) {
+        return contents.status();
+    }
+    if (!is_binary_structural_object(contents.value()->view())) {
+        return contents.value()->str();
+    }
+    auto parsed = structural_object::parse(contents.value());
+    if (!parsed.ok()) {
+        return parsed.status();
+    }
+    return parsed.value()->text();
+}
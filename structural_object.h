@@ -0,0 +1,108 @@
+/*
+ * Readers for the structural (dyntraces) objects, in either of two formats.
+ *
+ * The text format is the one the collector has always written:
+ *
+ *     Trace ID: <32 hex chars>:
+ *     <parent span id>:<span id>:<service>:<hash>
+ *     ...
+ *
+ * with an empty parent for the root span.  Finding one trace in it means
+ * searching the whole object.
+ *
+ * The binary format keeps the same information as packed records and ends
+ * with a footer that is sorted by trace ID, so a lookup is a binary search:
+ *
+ *     "QSTB" u32 version
+ *     u32 n_strings, then n_strings x (u32 length, bytes)  service names and hashes
+ *     u32 n_spans, then n_spans x span_record                 grouped by trace, in text order
+ *     u32 n_traces, then n_traces x trace_record              sorted by trace ID
+ *     u64 offset of n_traces, "QSTB"
+ *
+ * All integers are little endian.  Span IDs and trace IDs are stored as raw
+ * bytes.  An all-zero parent means the span is a root, because OpenTelemetry
+ * treats an all-zero span ID as invalid.
+*/
+
+#ifndef STRUCTURAL_OBJECT_H_ // NOLINT
+#define STRUCTURAL_OBJECT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "storage.h"
+#include "trace_id.h"
+
+const char STRUCTURAL_OBJECT_MAGIC[] = "QSTB";
+const uint32_t STRUCTURAL_OBJECT_VERSION = 1;
+const int SPAN_RECORD_SIZE = 24;   // parent[8], span[8], u32 service, u32 hash
+const int TRACE_RECORD_SIZE = 24;  // trace_id[16], u32 first span, u32 span count
+
+class structural_object {
+    public: // NOLINT
+        // Accepts either format; fails only on a truncated or corrupt binary object.
+        static StatusOr<std::shared_ptr<const structural_object>> parse(
+            std::shared_ptr<const stored_object> contents);
+
+        bool is_binary() const { return binary_; }
+        size_t num_traces() const;
+        std::vector<std::string> trace_ids() const;
+
+        /**
+         * The trace's block in text format, as delimited by
+         * extract_trace_from_traces_object(): the "Trace ID: <id>:" header
+         * and one line per span, without a trailing newline.
+         * Empty if the trace is not in this object.
+         */
+        std::string trace(const std::string &trace_id) const;
+        std::string trace(const trace_id_t &trace_id) const;
+
+        // The whole object in text format.
+        std::string text() const;
+        // The object's bytes and its index, for cache budgets.
+        size_t space_used() const;
+
+    private: // NOLINT
+        struct text_entry {
+            std::string_view trace_id;
+            size_t offset;
+            size_t length;
+        };
+
+        explicit structural_object(std::shared_ptr<const stored_object> contents)
+        : contents_(std::move(contents)) {}
+        Status load_binary();
+        void load_text();
+        std::string binary_trace(size_t trace_index) const;
+        std::string find_binary_trace(const char* trace_id) const;
+
+        std::shared_ptr<const stored_object> contents_;
+        bool binary_ = false;
+
+        // text format
+        std::vector<text_entry> text_index_;
+
+        // binary format, pointing into contents_
+        std::vector<std::string_view> strings_;
+        const char* spans_ = nullptr;
+        uint32_t num_spans_ = 0;
+        const char* traces_ = nullptr;
+        uint32_t num_traces_ = 0;
+};
+
+bool is_binary_structural_object(std::string_view contents);
+
+// Fails if the text doesn't follow the format above closely enough to be
+// reproduced byte for byte by structural_object::trace().
+StatusOr<std::string> convert_structural_object_to_binary(std::string_view text);
+
+// Parsed objects are cached by name and generation (see object_cache.h).
+StatusOr<std::shared_ptr<const structural_object>> read_structural_object(
+    const std::string &batch_name, storage_backend* client);
+// For callers that work on the whole text, whatever format the object is stored in.
+StatusOr<std::string> read_structural_object_text(const std::string &batch_name, storage_backend* client);
+
+#endif  // STRUCTURAL_OBJECT_H_ // NOLINT
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "common.h"
+#include "structural_object.h"
+#include "test_util.h"
+
+namespace {
+
+const char TRACE_A[] = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+const char TRACE_B[] = "0123456789abcdef0123456789abcdef";
+
+// Two traces, in the order the collector writes them: B before A.
+std::string text_object() {
+  return std::string("Trace ID: ") + TRACE_B + ":\n"
+    ":1111111111111111:frontend:1234\n"
+    "1111111111111111:2222222222222222:cart:5678\n"
+    "Trace ID: " + TRACE_A + ":\n"
+    ":3333333333333333:frontend:1234\n";
+}
+
+std::shared_ptr<const structural_object> parse(const std::string &contents) {
+  auto parsed = structural_object::parse(std::make_shared<string_object>(contents));
+  EXPECT_TRUE(parsed.ok());
+  return parsed.value();
+}
+
+using StructuralObjectReads = local_backend_test;
+
+}  // namespace
+
+TEST(StructuralObject, TextLookup) {
+  auto object = parse(text_object());
+  EXPECT_FALSE(object->is_binary());
+  EXPECT_EQ(object->num_traces(), 2);
+  EXPECT_EQ(object->trace(TRACE_B), std::string("Trace ID: ") + TRACE_B + ":\n"
+    ":1111111111111111:frontend:1234\n"
+    "1111111111111111:2222222222222222:cart:5678");
+  EXPECT_EQ(object->trace(TRACE_A), std::string("Trace ID: ") + TRACE_A + ":\n"
+    ":3333333333333333:frontend:1234");
+  EXPECT_EQ(object->trace("ffffffffffffffffffffffffffffffff"), "");
+}
+
+TEST(StructuralObject, BinaryMatchesText) {
+  auto text = parse(text_object());
+  auto binary_contents = convert_structural_object_to_binary(text_object());
+  ASSERT_TRUE(binary_contents.ok());
+  EXPECT_TRUE(is_binary_structural_object(binary_contents.value()));
+
+  auto binary = parse(binary_contents.value());
+  EXPECT_TRUE(binary->is_binary());
+  EXPECT_EQ(binary->num_traces(), 2);
+  EXPECT_EQ(binary->trace_ids(), text->trace_ids());
+  EXPECT_EQ(binary->trace(TRACE_A), text->trace(TRACE_A));
+  EXPECT_EQ(binary->trace(TRACE_B), text->trace(TRACE_B));
+  EXPECT_EQ(binary->trace("not a trace id"), "");
+  EXPECT_EQ(binary->text(), text_object());
+}
+
+TEST(StructuralObject, LookupByParsedTraceId) {
+  trace_id_t id;
+  ASSERT_TRUE(trace_id_t::from_hex(TRACE_B, id));
+  EXPECT_EQ(id.hex(), TRACE_B);
+  EXPECT_EQ(id, trace_id_t::from_bytes(std::string("\x01\x23\x45\x67\x89\xab\xcd\xef", 8) +
+                                       std::string("\x01\x23\x45\x67\x89\xab\xcd\xef", 8)));
+  EXPECT_FALSE(trace_id_t::from_hex("0123", id));
+  EXPECT_FALSE(trace_id_t::from_hex("g123456789abcdef0123456789abcdef", id));
+
+  auto text = parse(text_object());
+  auto binary = parse(convert_structural_object_to_binary(text_object()).value());
+  trace_id_t a, missing;
+  ASSERT_TRUE(trace_id_t::from_hex(TRACE_A, a));
+  EXPECT_EQ(text->trace(a), text->trace(TRACE_A));
+  EXPECT_EQ(binary->trace(a), text->trace(TRACE_A));
+  EXPECT_EQ(binary->trace(missing), "");
+}
+
+TEST(StructuralObject, RejectsWhatItCannotReproduce) {
+  // upper case hex would come back lower case
+  EXPECT_FALSE(convert_structural_object_to_binary(
+    "Trace ID: AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA:\n:3333333333333333:frontend:1234\n").ok());
+  EXPECT_FALSE(convert_structural_object_to_binary(
+    std::string("Trace ID: ") + TRACE_A + ":\nnot a span line\n").ok());
+
+  // a truncated binary object is an error, not an empty text object
+  std::string binary = convert_structural_object_to_binary(text_object()).value();
+  binary.erase(20, 10);
+  EXPECT_FALSE(structural_object::parse(std::make_shared<string_object>(binary)).ok());
+}
+
+TEST_F(StructuralObjectReads, AreParsedOnce) {
+  counting_backend backend(root_);
+  const std::string bucket = std::string(TRACE_STRUCT_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+  ASSERT_TRUE(backend.create_bucket(bucket).ok());
+  ASSERT_TRUE(backend.write(bucket, "1-2-3", text_object()).ok());
+
+  auto first = read_structural_object("1-2-3", &backend);
+  auto second = read_structural_object("1-2-3", &backend);
+  ASSERT_TRUE(first.ok());
+  ASSERT_TRUE(second.ok());
+  EXPECT_EQ(first.value(), second.value());
+  EXPECT_EQ(backend.reads(), 1);
+  EXPECT_EQ(second.value()->trace(TRACE_A), parse(text_object())->trace(TRACE_A));
+
+  EXPECT_FALSE(read_structural_object("4-5-6", &backend).ok());
+}
@@ -0,0 +1,384 @@
+#include "structure_catalog.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+
+#include "little_endian.h"
+#include "structure_manifest.h"
+
+namespace {
+
+const size_t MAGIC_LENGTH = sizeof(STRUCTURE_CATALOG_MAGIC) - 1;
+
+Status invalid(const std::string &why) {
+    return Status(google::cloud::StatusCode::kInvalidArgument, "structure catalog: " + why);
+}
+
+std::string catalog_bucket() {
+    return std::string(STRUCTURE_CATALOG_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+}
+
+bool is_batch_name(const std::string &name) {
+    return split_by_string(name, hyphen).size() == 3;
+}
+
+// Fills in structure's batch list from tracehashes, and its exemplar and shape if it has none.
+Status refresh_structure(catalog_structure &structure, storage_backend* client) {
+    const std::string hashes_bucket = std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+    auto objects = client->list_objects(hashes_bucket, structure.prefix);
+    if (!objects.ok()) {
+        return objects.status();
+    }
+    structure.batch_names.clear();
+    for (auto &object : objects.value()) {
+        std::string batch_name = object.name.substr(structure.prefix.size());
+        if (is_batch_name(batch_name)) {
+            structure.batch_names.push_back(batch_name);
+        }
+    }
+    std::sort(structure.batch_names.begin(), structure.batch_names.end());
+
+    if (structure.exemplar.empty()) {
+        auto exemplar = get_examplar_from_prefix(structure.prefix, client);
+        if (!exemplar.ok()) {
+            return exemplar.status();
+        }
+        structure.exemplar = exemplar.value();
+        if (structure.exemplar != "") {
+            structure.shape = morph_trace_object_to_trace_structure(structure.exemplar);
+        }
+    }
+    return Status();
+}
+
+Status write_structure_manifest(
+    const std::string &batch_name, const std::vector<std::string> &prefixes, storage_backend* client) {
+    std::map<std::string, std::vector<trace_id_t>> trace_ids;
+    for (auto &prefix : prefixes) {
+        auto ids = get_trace_ids_from_trace_hashes_object(prefix + batch_name, client);
+        if (!ids.ok()) {
+            return ids.status();
+        }
+        if (false == ids->empty()) {
+            trace_ids[prefix] = std::move(ids.value());
+        }
+    }
+    const std::string manifests_bucket = std::string(STRUCTURE_MANIFESTS_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+    Status written = client->write(manifests_bucket, batch_name, serialize_structure_manifest(trace_ids));
+    // this process may have read the manifest it replaces
+    object_cache().invalidate(object_cache_key(manifests_bucket, batch_name));
+    return written;
+}
+
+// The structures in each batch, by prefix.
+std::map<std::string, std::set<std::string>> prefixes_by_batch(const std::vector<catalog_structure> &structures) {
+    std::map<std::string, std::set<std::string>> prefixes;
+    for (auto &structure : structures) {
+        for (auto &batch_name : structure.batch_names) {
+            prefixes[batch_name].insert(structure.prefix);
+        }
+    }
+    return prefixes;
+}
+
+// Rewrites the manifests of the batches whose structures changed, since a
+// structure missing from a manifest reads as not being in the batch.
+// Batches without a manifest are left to write_structure_manifests().
+Status rewrite_changed_manifests(const std::map<std::string, std::set<std::string>> &previous,
+                                 const std::map<std::string, std::set<std::string>> &current,
+                                 storage_backend* client) {
+    std::vector<std::string> changed;
+    for (auto &[batch_name, prefixes] : current) {
+        auto found = previous.find(batch_name);
+        if (found == previous.end() || found->second != prefixes) {
+            changed.push_back(batch_name);
+        }
+    }
+    if (changed.empty()) {
+        return Status();
+    }
+    auto existing = client->list_objects(
+        std::string(STRUCTURE_MANIFESTS_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX));
+    if (!existing.ok()) {
+        return existing.status().code() == google::cloud::StatusCode::kNotFound ? Status() : existing.status();
+    }
+    std::set<std::string> written;
+    for (auto &object : existing.value()) {
+        written.insert(object.name);
+    }
+
+    std::vector<std::vector<std::string>> batch_prefixes;
+    std::vector<std::future<Status>> writes;
+    batch_prefixes.reserve(changed.size());
+    for (auto &batch_name : changed) {
+        if (written.find(batch_name) == written.end()) {
+            continue;
+        }
+        const std::set<std::string> &prefixes = current.at(batch_name);
+        batch_prefixes.emplace_back(prefixes.begin(), prefixes.end());
+        writes.push_back(executor::get().submit(
+            io_pool, write_structure_manifest, std::cref(batch_name), std::cref(batch_prefixes.back()), client));
+    }
+    for (auto &write : writes) {
+        Status status = executor::get().wait(write);
+        if (!status.ok()) {
+            executor::get().wait_all(writes);
+            return status;
+        }
+    }
+    return Status();
+}
+
+}  // namespace
+
+StatusOr<structure_catalog> parse_structure_catalog(std::string_view contents) {
+    if (contents.size() < 2 * MAGIC_LENGTH || contents.substr(0, MAGIC_LENGTH) != STRUCTURE_CATALOG_MAGIC ||
+        contents.substr(contents.size() - MAGIC_LENGTH) != STRUCTURE_CATALOG_MAGIC) {
+        return invalid("bad magic");
+    }
+
+    byte_reader reader(contents.data(), contents.size() - MAGIC_LENGTH);
+    reader.take(MAGIC_LENGTH);
+    if (reader.u32() != STRUCTURE_CATALOG_VERSION) {
+        return invalid("unsupported version");
+    }
+
+    structure_catalog catalog;
+    catalog.covered_until = static_cast<time_t>(reader.u64());
+    const uint32_t num_structures = reader.u32();
+    for (uint32_t i = 0; i < num_structures && reader.ok(); i++) {
+        catalog_structure structure;
+        structure.prefix = reader.string();
+        structure.exemplar = reader.string();
+
+        const uint32_t num_nodes = reader.u32();
+        structure.shape.num_nodes = num_nodes;
+        for (uint32_t j = 0; j < num_nodes && reader.ok(); j++) {
+            structure.shape.node_names[j] = reader.string();
+        }
+        const uint32_t num_edges = reader.u32();
+        for (uint32_t j = 0; j < num_edges && reader.ok(); j++) {
+            const int parent = reader.u32();
+            const int child = reader.u32();
+            structure.shape.edges.insert(std::make_pair(parent, child));
+        }
+
+        const uint32_t num_batches = reader.u32();
+        for (uint32_t j = 0; j < num_batches && reader.ok(); j++) {
+            structure.batch_names.push_back(reader.string());
+        }
+        catalog.structures.push_back(std::move(structure));
+    }
+
+    if (!reader.ok() || reader.position() != contents.size() - MAGIC_LENGTH) {
+        return invalid("truncated or corrupt");
+    }
+    return catalog;
+}
+
+std::string serialize_structure_catalog(const structure_catalog &catalog) {
+    std::string out(STRUCTURE_CATALOG_MAGIC);
+    put_u32(out, STRUCTURE_CATALOG_VERSION);
+    put_u64(out, catalog.covered_until);
+    put_u32(out, catalog.structures.size());
+    for (const auto &structure : catalog.structures) {
+        put_string(out, structure.prefix);
+        put_string(out, structure.exemplar);
+
+        put_u32(out, structure.shape.num_nodes);
+        for (uint64_t i = 0; i < structure.shape.num_nodes; i++) {
+            auto name = structure.shape.node_names.find(i);
+            put_string(out, name == structure.shape.node_names.end() ? "" : name->second);
+        }
+        put_u32(out, structure.shape.edges.size());
+        for (const auto &edge : structure.shape.edges) {
+            put_u32(out, edge.first);
+            put_u32(out, edge.second);
+        }
+
+        put_u32(out, structure.batch_names.size());
+        for (const auto &batch_name : structure.batch_names) {
+            put_string(out, batch_name);
+        }
+    }
+    out += STRUCTURE_CATALOG_MAGIC;
+    return out;
+}
+
+StatusOr<std::shared_ptr<const structure_catalog>> read_structure_catalog(storage_backend* client) {
+    static std::mutex mutex;
+    static std::shared_ptr<const structure_catalog> cached;
+    static int64_t cached_generation = 0;
+
+    auto contents = read_stored_object(catalog_bucket(), STRUCTURE_CATALOG_OBJECT, client);
+    if (!contents.ok()) {
+        return contents.status();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cached != nullptr && cached_generation == contents.value()->generation()) {
+        return cached;
+    }
+    auto parsed = parse_structure_catalog(contents.value()->view());
+    if (!parsed.ok()) {
+        return parsed.status();
+    }
+    cached = std::make_shared<const structure_catalog>(std::move(parsed.value()));
+    cached_generation = contents.value()->generation();
+    return cached;
+}
+
+StatusOr<structure_catalog> update_structure_catalog(storage_backend* client, bool verbose) {
+    structure_catalog catalog;
+    auto existing = read_object(catalog_bucket(), STRUCTURE_CATALOG_OBJECT, client);
+    if (existing.ok()) {
+        auto parsed = parse_structure_catalog(existing.value());
+        if (!parsed.ok()) {
+            return parsed.status();
+        }
+        catalog = std::move(parsed.value());
+    } else if (existing.status().code() != google::cloud::StatusCode::kNotFound) {
+        return existing.status();
+    }
+
+    const std::string hashes_bucket = std::string(TRACE_HASHES_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+    auto prefixes = client->list_prefixes(hashes_bucket, "/");
+    if (!prefixes.ok()) {
+        return prefixes.status();
+    }
+
+    const std::map<std::string, std::set<std::string>> previous_prefixes = prefixes_by_batch(catalog.structures);
+
+    // structures that are no longer in tracehashes are dropped
+    std::map<std::string, catalog_structure> known;
+    for (auto &structure : catalog.structures) {
+        known[structure.prefix] = std::move(structure);
+    }
+    std::vector<catalog_structure> structures(prefixes->size());
+    for (uint64_t i = 0; i < prefixes->size(); i++) {
+        auto found = known.find(prefixes.value()[i]);
+        if (found != known.end()) {
+            structures[i] = std::move(found->second);
+        } else {
+            structures[i].prefix = prefixes.value()[i];
+        }
+    }
+
+    std::vector<std::future<Status>> refreshed;
+    for (auto &structure : structures) {
+        refreshed.push_back(executor::get().submit(io_pool, refresh_structure, std::ref(structure), client));
+    }
+    for (uint64_t i = 0; i < refreshed.size(); i++) {
+        Status status = executor::get().wait(refreshed[i]);
+        if (!status.ok()) {
+            executor::get().wait_all(refreshed);
+            return status;
+        }
+        print_progress(static_cast<float>(i + 1) / refreshed.size(), "Updating structure catalog", verbose);
+    }
+
+    catalog.structures.clear();
+    catalog.covered_until = 0;
+    for (auto &structure : structures) {
+        // an exemplar that couldn't be found can't be matched; try again next time
+        if (structure.exemplar.empty()) {
+            continue;
+        }
+        for (auto &batch_name : structure.batch_names) {
+            catalog.covered_until = std::max<time_t>(catalog.covered_until, extract_batch_timestamps(batch_name).second);
+        }
+        catalog.structures.push_back(std::move(structure));
+    }
+    std::sort(catalog.structures.begin(), catalog.structures.end(),
+        [](const catalog_structure &a, const catalog_structure &b) { return a.prefix < b.prefix; });
+
+    // before the catalog, so a query that sees a batch's new structure in it
+    // doesn't then miss it in the batch's manifest
+    Status rewritten = rewrite_changed_manifests(previous_prefixes, prefixes_by_batch(catalog.structures), client);
+    if (!rewritten.ok()) {
+        return rewritten;
+    }
+
+    Status created = client->create_bucket(catalog_bucket());
+    if (!created.ok() && created.code() != google::cloud::StatusCode::kAborted) {
+        return created;
+    }
+    Status written = client->write(catalog_bucket(), STRUCTURE_CATALOG_OBJECT, serialize_structure_catalog(catalog));
+    if (!written.ok()) {
+        return written;
+    }
+    return catalog;
+}
+
+StatusOr<int> write_structure_manifests(const structure_catalog &catalog, storage_backend* client, bool verbose) {
+    const std::string manifests_bucket = std::string(STRUCTURE_MANIFESTS_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX);
+    Status created = client->create_bucket(manifests_bucket);
+    if (!created.ok() && created.code() != google::cloud::StatusCode::kAborted) {
+        return created;
+    }
+    auto existing = client->list_objects(manifests_bucket);
+    if (!existing.ok()) {
+        return existing.status();
+    }
+    std::set<std::string> written;
+    for (auto &object : existing.value()) {
+        written.insert(object.name);
+    }
+
+    std::map<std::string, std::vector<std::string>> batch_to_prefixes;
+    for (auto &structure : catalog.structures) {
+        for (auto &batch_name : structure.batch_names) {
+            if (written.find(batch_name) == written.end()) {
+                batch_to_prefixes[batch_name].push_back(structure.prefix);
+            }
+        }
+    }
+
+    std::vector<std::future<Status>> writes;
+    for (auto &[batch_name, prefixes] : batch_to_prefixes) {
+        writes.push_back(executor::get().submit(
+            io_pool, write_structure_manifest, std::cref(batch_name), std::cref(prefixes), client));
+    }
+    for (uint64_t i = 0; i < writes.size(); i++) {
+        Status status = executor::get().wait(writes[i]);
+        if (!status.ok()) {
+            executor::get().wait_all(writes);
+            return status;
+        }
+        print_progress(static_cast<float>(i + 1) / writes.size(), "Writing structure manifests", verbose);
+    }
+    return static_cast<int>(writes.size());
+}
+
+std::vector<matched_structure> get_structures_matching_query_from_catalog(
+    const structure_catalog &catalog, trace_structure &query_trace) {
+    std::vector<matched_structure> candidates(catalog.structures.size());
+    std::vector<std::future<bool>> matched;
+    for (uint64_t i = 0; i < catalog.structures.size(); i++) {
+        matched.push_back(executor::get().submit(cpu_pool, check_shape_validity,
+            catalog.structures[i].shape, query_trace, std::ref(candidates[i].shape)));
+    }
+    std::vector<matched_structure> matching;
+    for (uint64_t i = 0; i < matched.size(); i++) {
+        if (false == executor::get().wait(matched[i])) {
+            continue;
+        }
+        const catalog_structure &structure = catalog.structures[i];
+        candidates[i].prefix = structure.prefix;
+        candidates[i].root_service_name = get_root_service_name(structure.exemplar);
+        candidates[i].batch_names = structure.batch_names;
+        std::sort(candidates[i].batch_names.begin(), candidates[i].batch_names.end());
+        candidates[i].batches_known = true;
+        matching.push_back(std::move(candidates[i]));
+    }
+    return matching;
+}
+
+bool structure_catalog_enabled() {
+    static const bool enabled = std::getenv(STRUCTURE_CATALOG_ENV) != nullptr;
+    return enabled;
+}
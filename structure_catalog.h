@@ -0,0 +1,86 @@
+/*
+ * A catalog of the distinct trace structures in tracehashes, kept as a
+ * single object.
+ *
+ * Without it, get_structures_matching_query() lists every prefix (one per
+ * structure hash) in tracehashes and then lists and reads under each prefix
+ * just to find an exemplar trace, all before any matching starts.  The
+ * catalog has, for each structure hash, an exemplar trace, its shape and
+ * the batches the structure occurs in, so a query reads one object instead:
+ *
+ *     "QSCT" u32 version u64 covered_until u32 n_structures
+ *     n_structures x {
+ *         string prefix, string exemplar
+ *         u32 n_nodes, n_nodes x string service
+ *         u32 n_edges, n_edges x (u32 parent, u32 child)
+ *         u32 n_batches, n_batches x string batch name      sorted
+ *     }
+ *     "QSCT"
+ *
+ * Strings are a u32 length and bytes; integers are little endian.  The
+ * shape is the exemplar as morph_trace_object_to_trace_structure() reads
+ * it.  covered_until is the latest batch end time the catalog has seen;
+ * queries that reach past it don't use the catalog, since batches written
+ * after it was updated would be missed.
+ *
+ * `make_structure_catalog` (make_structure_catalog_main.cc) creates the
+ * catalog and brings it up to date, along with the per-batch manifests.
+*/
+
+#ifndef STRUCTURE_CATALOG_H_ // NOLINT
+#define STRUCTURE_CATALOG_H_
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "get_traces_by_structure.h"
+
+const char STRUCTURE_CATALOG_BUCKET_PREFIX[] = "index-structure-catalog";
+const char STRUCTURE_CATALOG_OBJECT[] = "catalog";
+const char STRUCTURE_CATALOG_MAGIC[] = "QSCT";
+const uint32_t STRUCTURE_CATALOG_VERSION = 1;
+const char STRUCTURE_CATALOG_ENV[] = "QUEST_STRUCTURE_CATALOG";
+
+struct catalog_structure {
+    std::string prefix;         // the structure's folder in tracehashes, "<hash>/"
+    std::string exemplar;       // one trace with this structure, in the structural object text format
+    trace_structure shape;
+    std::vector<std::string> batch_names;
+};
+
+struct structure_catalog {
+    time_t covered_until = 0;
+    std::vector<catalog_structure> structures;  // sorted by prefix
+};
+
+StatusOr<structure_catalog> parse_structure_catalog(std::string_view contents);
+std::string serialize_structure_catalog(const structure_catalog &catalog);
+
+// The stored catalog, parsed once per generation of the object and shared between queries.
+StatusOr<std::shared_ptr<const structure_catalog>> read_structure_catalog(storage_backend* client);
+
+/**
+ * Brings the stored catalog up to date with tracehashes, creating it if
+ * there is none: new structures get an exemplar, and every structure's
+ * batch list is refreshed.  Batches whose structures changed have their
+ * manifests, if any, rewritten.  Returns the catalog that was written.
+ */
+StatusOr<structure_catalog> update_structure_catalog(storage_backend* client, bool verbose);
+
+/**
+ * Writes the manifest (structure_manifest.h) of every batch in the catalog
+ * that doesn't have one yet.  Returns how many were written.
+ */
+StatusOr<int> write_structure_manifests(const structure_catalog &catalog, storage_backend* client, bool verbose);
+
+// The catalog's structures the query matches, with the batches each occurs in.
+std::vector<matched_structure> get_structures_matching_query_from_catalog(
+    const structure_catalog &catalog, trace_structure &query_trace);
+
+// Whether get_structures_matching_query() reads the catalog; set by QUEST_STRUCTURE_CATALOG.
+bool structure_catalog_enabled();
+
+#endif  // STRUCTURE_CATALOG_H_ // NOLINT
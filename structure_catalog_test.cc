@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+
+#include "structure_catalog.h"
+#include "structure_manifest.h"
+#include "test_util.h"
+
+namespace {
+
+const char TRACE_A[] = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+const char TRACE_B[] = "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb";
+
+class StructureCatalog : public local_backend_test {
+ protected:
+  void SetUp() override {
+    local_backend_test::SetUp();
+    // read once, by the first query
+    setenv(STRUCTURE_CATALOG_ENV, "1", 1);
+    setenv(STRUCTURE_MANIFESTS_ENV, "1", 1);
+
+    const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    const std::string structs = std::string(TRACE_STRUCT_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+    ASSERT_TRUE(backend_->create_bucket(hashes).ok());
+    ASSERT_TRUE(backend_->create_bucket(structs).ok());
+
+    // frontend -> cart in the first batch, frontend on its own in both
+    ASSERT_TRUE(backend_->write(structs, "00-100-200", std::string("Trace ID: ") + TRACE_A + ":\n"
+      ":1111111111111111:frontend:1\n"
+      "1111111111111111:2222222222222222:cart:2\n"
+      "Trace ID: " + TRACE_B + ":\n"
+      ":3333333333333333:frontend:1\n").ok());
+    ASSERT_TRUE(backend_->write(structs, "01-300-400", std::string("Trace ID: ") + TRACE_B + ":\n"
+      ":3333333333333333:frontend:1\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "12/00-100-200", std::string(TRACE_A) + "\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "34/00-100-200", std::string(TRACE_B) + "\n").ok());
+    ASSERT_TRUE(backend_->write(hashes, "34/01-300-400", std::string(TRACE_B) + "\n").ok());
+  }
+};
+
+}  // namespace
+
+TEST_F(StructureCatalog, UpdateThenRead) {
+  auto updated = update_structure_catalog(backend_.get(), false);
+  ASSERT_TRUE(updated.ok()) << updated.status().message();
+  EXPECT_EQ(updated->covered_until, 400);
+  ASSERT_EQ(updated->structures.size(), 2);
+  EXPECT_EQ(updated->structures[0].prefix, "12/");
+  EXPECT_EQ(updated->structures[0].shape.num_nodes, 2);
+  EXPECT_EQ(updated->structures[0].batch_names, std::vector<std::string>({"00-100-200"}));
+  EXPECT_EQ(updated->structures[1].batch_names, std::vector<std::string>({"00-100-200", "01-300-400"}));
+
+  auto read = read_structure_catalog(backend_.get());
+  ASSERT_TRUE(read.ok());
+  EXPECT_EQ(serialize_structure_catalog(*read.value()), serialize_structure_catalog(updated.value()));
+
+  std::string truncated = serialize_structure_catalog(updated.value());
+  truncated.erase(10, 5);
+  EXPECT_FALSE(parse_structure_catalog(truncated).ok());
+}
+
+TEST_F(StructureCatalog, MatchesOnlyBatchesWithTheStructure) {
+  ASSERT_TRUE(update_structure_catalog(backend_.get(), false).ok());
+
+  trace_structure query;
+  query.num_nodes = 2;
+  query.node_names = {{0, "frontend"}, {1, "cart"}};
+  query.edges.insert(std::make_pair(0, 1));
+  auto matching = get_structures_matching_query(query, 400, false, backend_.get());
+  ASSERT_TRUE(matching.ok());
+  ASSERT_EQ(matching->size(), 1);
+  EXPECT_EQ(matching->at(0).prefix, "12/");
+  EXPECT_TRUE(matching->at(0).batches_known);
+  EXPECT_EQ(matching->at(0).batch_names, std::vector<std::string>({"00-100-200"}));
+  auto traces = read_traces_of_structures(matching.value(), {"00-100-200", "01-300-400"}, 0, 400,
+    backend_.get());
+  ASSERT_TRUE(traces.ok());
+  ASSERT_EQ(traces->size(), 1);
+  ASSERT_EQ(traces->at(0).trace_ids.size(), 1);
+  EXPECT_EQ(traces->at(0).trace_ids[0].hex(), TRACE_A);
+  EXPECT_EQ(traces->at(0).object_names, std::vector<std::string>({"00-100-200"}));
+
+  // frontend on its own is in both structures, but only the second is in the later batch
+  query.num_nodes = 1;
+  query.node_names = {{0, "frontend"}};
+  query.edges.clear();
+  matching = get_structures_matching_query(query, 400, false, backend_.get());
+  ASSERT_TRUE(matching.ok());
+  ASSERT_EQ(matching->size(), 2);
+  traces = read_traces_of_structures(matching.value(), {"01-300-400"}, 300, 400, backend_.get());
+  ASSERT_TRUE(traces.ok());
+  EXPECT_TRUE(traces->at(0).object_names.empty());
+  EXPECT_EQ(traces->at(1).object_names, std::vector<std::string>({"01-300-400"}));
+}
+
+TEST_F(StructureCatalog, ManifestsListEachBatchsStructures) {
+  auto catalog = update_structure_catalog(backend_.get(), false);
+  ASSERT_TRUE(catalog.ok());
+  auto written = write_structure_manifests(catalog.value(), backend_.get(), false);
+  ASSERT_TRUE(written.ok());
+  EXPECT_EQ(written.value(), 2);
+  // already there
+  EXPECT_EQ(write_structure_manifests(catalog.value(), backend_.get(), false).value(), 0);
+
+  auto first = read_structure_manifest("00-100-200", backend_.get());
+  ASSERT_TRUE(first.ok());
+  EXPECT_EQ(first.value()->num_structures(), 2);
+  ASSERT_EQ(first.value()->trace_ids("12/").size(), 1);
+  EXPECT_EQ(first.value()->trace_ids("12/")[0].hex(), TRACE_A);
+  EXPECT_EQ(first.value()->trace_ids("34/")[0].hex(), TRACE_B);
+  EXPECT_TRUE(first.value()->trace_ids("56/").empty());
+
+  auto second = read_structure_manifest("01-300-400", backend_.get());
+  ASSERT_TRUE(second.ok());
+  EXPECT_TRUE(second.value()->trace_ids("12/").empty());
+  EXPECT_EQ(second.value()->trace_ids("34/").size(), 1);
+}
+
+TEST_F(StructureCatalog, RewritesTheManifestsOfBatchesThatGainAStructure) {
+  auto catalog = update_structure_catalog(backend_.get(), false);
+  ASSERT_TRUE(catalog.ok());
+  ASSERT_TRUE(write_structure_manifests(catalog.value(), backend_.get(), false).ok());
+  EXPECT_TRUE(read_structure_manifest("01-300-400", backend_.get()).value()->trace_ids("12/").empty());
+
+  // frontend -> cart turns up in the second batch too
+  const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+  ASSERT_TRUE(backend_->write(hashes, "12/01-300-400", std::string(TRACE_A) + "\n").ok());
+  catalog = update_structure_catalog(backend_.get(), false);
+  ASSERT_TRUE(catalog.ok());
+
+  auto second = read_structure_manifest("01-300-400", backend_.get());
+  ASSERT_TRUE(second.ok());
+  ASSERT_EQ(second.value()->trace_ids("12/").size(), 1);
+  EXPECT_EQ(second.value()->trace_ids("12/")[0].hex(), TRACE_A);
+  EXPECT_EQ(second.value()->trace_ids("34/").size(), 1);
+  // nothing left for write_structure_manifests() to do
+  EXPECT_EQ(write_structure_manifests(catalog.value(), backend_.get(), false).value(), 0);
+}
+
+TEST_F(StructureCatalog, ReadsStructuresAManifestDoesNotListFromTracehashes) {
+  auto catalog = update_structure_catalog(backend_.get(), false);
+  ASSERT_TRUE(catalog.ok());
+  ASSERT_TRUE(write_structure_manifests(catalog.value(), backend_.get(), false).ok());
+  // reaches the batch after its manifest was written
+  const std::string hashes = std::string(TRACE_HASHES_BUCKET_PREFIX) + BUCKETS_SUFFIX;
+  ASSERT_TRUE(backend_->write(hashes, "56/01-300-400", std::string(TRACE_A) + "\n").ok());
+
+  auto listed = get_trace_ids_of_structure_in_batch("34/", "01-300-400", backend_.get());
+  ASSERT_TRUE(listed.ok());
+  ASSERT_EQ(listed->size(), 1);
+  EXPECT_EQ(listed.value()[0].hex(), TRACE_B);
+  auto unlisted = get_trace_ids_of_structure_in_batch("56/", "01-300-400", backend_.get());
+  ASSERT_TRUE(unlisted.ok());
+  ASSERT_EQ(unlisted->size(), 1);
+  EXPECT_EQ(unlisted.value()[0].hex(), TRACE_A);
+}
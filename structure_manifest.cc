@@ -0,0 +1,127 @@
+#include "structure_manifest.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#include "common.h"
+#include "little_endian.h"
+
+namespace {
+
+const size_t MAGIC_LENGTH = sizeof(STRUCTURE_MANIFEST_MAGIC) - 1;
+const size_t TRACE_ID_BYTES = 16;
+
+Status invalid(const std::string &why) {
+    return Status(google::cloud::StatusCode::kInvalidArgument, "structure manifest: " + why);
+}
+
+}  // namespace
+
+StatusOr<std::shared_ptr<const structure_manifest>> structure_manifest::parse(
+    std::shared_ptr<const stored_object> contents) {
+    std::string_view view = contents->view();
+    if (view.size() < 2 * MAGIC_LENGTH || view.substr(0, MAGIC_LENGTH) != STRUCTURE_MANIFEST_MAGIC ||
+        view.substr(view.size() - MAGIC_LENGTH) != STRUCTURE_MANIFEST_MAGIC) {
+        return invalid("bad magic");
+    }
+
+    std::shared_ptr<structure_manifest> manifest(new structure_manifest(contents));
+    byte_reader reader(view.data(), view.size() - MAGIC_LENGTH);
+    reader.take(MAGIC_LENGTH);
+    if (reader.u32() != STRUCTURE_MANIFEST_VERSION) {
+        return invalid("unsupported version");
+    }
+    manifest->num_structures_ = reader.u32();
+    manifest->records_ = reader.take(static_cast<size_t>(manifest->num_structures_) * STRUCTURE_RECORD_SIZE);
+    manifest->num_trace_ids_ = reader.u32();
+    manifest->trace_ids_ = reader.take(static_cast<size_t>(manifest->num_trace_ids_) * TRACE_ID_BYTES);
+    const uint32_t num_bytes = reader.u32();
+    const char* prefixes = reader.take(num_bytes);
+    if (!reader.ok() || reader.position() != view.size() - MAGIC_LENGTH) {
+        return invalid("truncated or corrupt");
+    }
+    manifest->prefixes_ = std::string_view(prefixes, num_bytes);
+    return std::shared_ptr<const structure_manifest>(manifest);
+}
+
+std::string_view structure_manifest::record_prefix(uint32_t index) const {
+    const char* record = records_ + static_cast<size_t>(index) * STRUCTURE_RECORD_SIZE;
+    const uint64_t offset = get_u32(record);
+    const uint64_t length = get_u32(record + 4);
+    if (offset + length > prefixes_.size()) {
+        return std::string_view();
+    }
+    return prefixes_.substr(offset, length);
+}
+
+std::vector<trace_id_t> structure_manifest::trace_ids(std::string_view prefix) const {
+    std::vector<trace_id_t> ret;
+    uint32_t lo = 0, hi = num_structures_;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (record_prefix(mid) < prefix) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == num_structures_ || record_prefix(lo) != prefix) {
+        return ret;
+    }
+
+    const char* record = records_ + static_cast<size_t>(lo) * STRUCTURE_RECORD_SIZE;
+    const uint64_t first = get_u32(record + 8);
+    const uint64_t count = get_u32(record + 12);
+    if (first + count > num_trace_ids_) {
+        return ret;
+    }
+    ret.reserve(count);
+    for (uint64_t i = first; i < first + count; i++) {
+        ret.push_back(trace_id_t::from_bytes(std::string_view(trace_ids_ + i * TRACE_ID_BYTES, TRACE_ID_BYTES)));
+    }
+    return ret;
+}
+
+std::string serialize_structure_manifest(const std::map<std::string, std::vector<trace_id_t>> &trace_ids) {
+    std::string out(STRUCTURE_MANIFEST_MAGIC);
+    put_u32(out, STRUCTURE_MANIFEST_VERSION);
+    put_u32(out, trace_ids.size());
+    uint32_t prefix_offset = 0;
+    uint32_t first = 0;
+    for (const auto &structure : trace_ids) {
+        put_u32(out, prefix_offset);
+        put_u32(out, structure.first.size());
+        put_u32(out, first);
+        put_u32(out, structure.second.size());
+        prefix_offset += structure.first.size();
+        first += structure.second.size();
+    }
+    put_u32(out, first);
+    for (const auto &structure : trace_ids) {
+        for (const auto &trace_id : structure.second) {
+            out += trace_id.bytes();
+        }
+    }
+    put_u32(out, prefix_offset);
+    for (const auto &structure : trace_ids) {
+        out += structure.first;
+    }
+    out += STRUCTURE_MANIFEST_MAGIC;
+    return out;
+}
+
+StatusOr<std::shared_ptr<const structure_manifest>> read_structure_manifest(
+    const std::string &batch_name, storage_backend* client) {
+    auto contents = read_stored_object(
+        std::string(STRUCTURE_MANIFESTS_BUCKET_PREFIX) + std::string(BUCKETS_SUFFIX), batch_name, client);
+    if (!contents.ok()) {
+        return contents.status();
+    }
+    return structure_manifest::parse(contents.value());
+}
+
+bool structure_manifests_enabled() {
+    static const bool enabled = std::getenv(STRUCTURE_MANIFESTS_ENV) != nullptr;
+    return enabled;
+}
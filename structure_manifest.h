@@ -0,0 +1,78 @@
+/*
+ * Per-batch manifests of which structures occur in the batch.
+ *
+ * tracehashes has one object per structure and batch, "<hash>/<batch>",
+ * holding the IDs of the batch's traces with that structure.  Structural
+ * filtering used to probe "<hash>/<batch>" for every matching structure and
+ * every batch in the query's range, and most of those reads are NotFound.
+ * A batch's manifest lists the structures in it together with their trace
+ * IDs, so one read per batch answers the probes of all of them.  Structures
+ * it doesn't list are still probed, since their tracehashes objects may have
+ * reached the batch after its manifest was written:
+ *
+ *     "QSMF" u32 version
+ *     u32 n_structures, n_structures x structure_record     sorted by prefix
+ *     u32 n_trace_ids, n_trace_ids x u8[16]
+ *     u32 n_bytes, the prefixes' bytes
+ *     "QSMF"
+ *
+ * Integers are little endian.  A structure's trace IDs are [first,
+ * first + count) of the trace ID array, in the order its tracehashes object
+ * lists them.  Records have a fixed size so that looking a structure up is
+ * a binary search on the object as read, with nothing to parse first; the
+ * same manifest is consulted once for every structure a query matches.
+*/
+
+#ifndef STRUCTURE_MANIFEST_H_ // NOLINT
+#define STRUCTURE_MANIFEST_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "storage.h"
+#include "trace_id.h"
+
+const char STRUCTURE_MANIFESTS_BUCKET_PREFIX[] = "index-structure-manifests";
+const char STRUCTURE_MANIFEST_MAGIC[] = "QSMF";
+const uint32_t STRUCTURE_MANIFEST_VERSION = 1;
+const int STRUCTURE_RECORD_SIZE = 16;  // u32 prefix offset, u32 prefix length, u32 first, u32 count
+const char STRUCTURE_MANIFESTS_ENV[] = "QUEST_STRUCTURE_MANIFESTS";
+
+class structure_manifest {
+    public: // NOLINT
+        static StatusOr<std::shared_ptr<const structure_manifest>> parse(
+            std::shared_ptr<const stored_object> contents);
+
+        size_t num_structures() const { return num_structures_; }
+        // Empty if the structure is not in this batch.
+        std::vector<trace_id_t> trace_ids(std::string_view prefix) const;
+
+    private: // NOLINT
+        explicit structure_manifest(std::shared_ptr<const stored_object> contents)
+        : contents_(std::move(contents)) {}
+        // Empty if the record points outside the object.
+        std::string_view record_prefix(uint32_t index) const;
+
+        std::shared_ptr<const stored_object> contents_;
+        // pointing into contents_
+        const char* records_ = nullptr;
+        uint32_t num_structures_ = 0;
+        const char* trace_ids_ = nullptr;
+        uint32_t num_trace_ids_ = 0;
+        std::string_view prefixes_;
+};
+
+// Trace IDs by structure prefix ("<hash>/") to a manifest.
+std::string serialize_structure_manifest(const std::map<std::string, std::vector<trace_id_t>> &trace_ids);
+
+StatusOr<std::shared_ptr<const structure_manifest>> read_structure_manifest(
+    const std::string &batch_name, storage_backend* client);
+
+// Whether structural filtering reads manifests; set by QUEST_STRUCTURE_MANIFESTS.
+bool structure_manifests_enabled();
+
+#endif  // STRUCTURE_MANIFEST_H_ // NOLINT
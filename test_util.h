@@ -0,0 +1,109 @@
+/*
+ * Helpers shared by the tests: a fixture with a local_backend over a fresh
+ * directory, and a local_backend that counts, and can slow down, its reads.
+*/
+
+#ifndef TEST_UTIL_H_ // NOLINT
+#define TEST_UTIL_H_
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "storage.h"
+
+// backend_ serves root_, a new directory that is removed after the test.
+class local_backend_test : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char root_template[] = "/tmp/quest_testXXXXXX";
+    root_ = mkdtemp(root_template);
+    backend_ = std::make_unique<local_backend>(root_);
+  }
+
+  void TearDown() override {
+    std::string cmd = "rm -rf " + root_;
+    system(cmd.c_str());
+  }
+
+  std::string root_;
+  std::unique_ptr<storage_backend> backend_;
+};
+
+// Counts reads, in all and by object, to tell whether an object came from
+// the backend or a cache, and can hold reads back until the test lets them go.
+class counting_backend : public local_backend {
+ public:
+  explicit counting_backend(const std::string &root) : local_backend(root) {}
+
+  StatusOr<std::shared_ptr<const stored_object>> read(
+      const std::string &bucket, const std::string &object) override {
+    reads_++;
+    std::chrono::milliseconds delay(0);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      reads_by_object_[object]++;
+      if (slow_object_.empty() || slow_object_ == object) {
+        delay = delay_;
+      }
+      released_.wait_for(lock, HOLD_LIMIT, [&]() {
+        return false == held_ || (!held_object_.empty() && held_object_ != object);
+      });
+    }
+    std::this_thread::sleep_for(delay);
+    return local_backend::read(bucket, object);
+  }
+
+  int reads() const { return reads_; }
+  int reads(const std::string &object) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reads_by_object_[object];
+  }
+
+  // Makes every read, or only those of object if given, take delay.
+  void slow_down(std::chrono::milliseconds delay, const std::string &object = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    delay_ = delay;
+    slow_object_ = object;
+  }
+
+  // Makes every read, or only those of object if given, wait for
+  // release_reads().  A query's threads run queued reads while they wait on
+  // their own, so one may end up holding the read that would release the
+  // rest; reads give up waiting after HOLD_LIMIT rather than hang the test.
+  void hold_reads(const std::string &object = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_ = true;
+    held_object_ = object;
+  }
+
+  void release_reads() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      held_ = false;
+    }
+    released_.notify_all();
+  }
+
+ private:
+  static constexpr std::chrono::seconds HOLD_LIMIT{1};
+
+  std::atomic<int> reads_{0};
+  std::mutex mutex_;
+  std::map<std::string, int> reads_by_object_;
+  std::chrono::milliseconds delay_{0};
+  std::string slow_object_;
+  std::condition_variable released_;
+  bool held_ = false;
+  std::string held_object_;
+};
+
+#endif  // TEST_UTIL_H_ // NOLINT
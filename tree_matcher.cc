@@ -0,0 +1,246 @@
+#include "tree_matcher.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace {
+
+const int WILDCARD_LABEL = -1;
+
+struct rooted_forest {
+    std::vector<int> labels;
+    std::vector<int> parents;  // -1 for roots
+    std::vector<int> roots;
+    // (label, child), sorted so that children with the same label are adjacent
+    std::vector<std::vector<std::pair<int, int>>> children;
+};
+
+typedef std::vector<std::pair<int, int>>::const_iterator child_iterator;
+
+int label_id(const std::string &name, std::unordered_map<std::string, int> &label_ids) {
+    if (name == ASTERISK_SERVICE) {
+        return WILDCARD_LABEL;
+    }
+    auto inserted = label_ids.emplace(name.substr(0, name.find(colon)), label_ids.size());
+    return inserted.first->second;
+}
+
+bool build_forest(const trace_structure &graph, std::unordered_map<std::string, int> &label_ids,
+    rooted_forest &forest) {
+    const int n = graph.num_nodes;
+    forest.labels.assign(n, WILDCARD_LABEL);
+    forest.parents.assign(n, -1);
+    forest.children.assign(n, {});
+    for (int i = 0; i < n; i++) {
+        auto name = graph.node_names.find(i);
+        if (name == graph.node_names.end()) {
+            return false;
+        }
+        forest.labels[i] = label_id(name->second, label_ids);
+    }
+    for (const auto &edge : graph.edges) {
+        const int parent = edge.first;
+        const int child = edge.second;
+        if (parent < 0 || parent >= n || child < 0 || child >= n || forest.parents[child] != -1) {
+            return false;
+        }
+        forest.parents[child] = parent;
+        forest.children[parent].push_back(std::make_pair(forest.labels[child], child));
+    }
+
+    // every node must hang off a root, or there is a cycle
+    std::vector<int> stack;
+    for (int i = 0; i < n; i++) {
+        if (forest.parents[i] == -1) {
+            forest.roots.push_back(i);
+            stack.push_back(i);
+        }
+    }
+    int reached = 0;
+    while (!stack.empty()) {
+        int node = stack.back();
+        stack.pop_back();
+        reached++;
+        for (const auto &child : forest.children[node]) {
+            stack.push_back(child.second);
+        }
+    }
+    if (reached != n) {
+        return false;
+    }
+
+    for (auto &children : forest.children) {
+        std::sort(children.begin(), children.end());
+    }
+    return true;
+}
+
+std::pair<child_iterator, child_iterator> children_with_label(
+    const std::vector<std::pair<int, int>> &children, int label) {
+    return std::equal_range(children.begin(), children.end(), std::make_pair(label, 0),
+        [](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first < b.first; });
+}
+
+class tree_matcher {
+    public: // NOLINT
+        tree_matcher(const rooted_forest &candidate, const rooted_forest &query)
+        : candidate_(candidate), query_(query) {}
+
+        void match(std::vector<std::unordered_map<int, int>> &iso_maps) {
+            // pre order of the query, so a node's parent is always placed before it
+            std::vector<int> stack = {query_.roots[0]};
+            while (!stack.empty()) {
+                int node = stack.back();
+                stack.pop_back();
+                pre_order_.push_back(node);
+                for (const auto &child : query_.children[node]) {
+                    stack.push_back(child.second);
+                }
+            }
+
+            fits_.assign(query_.labels.size(), std::vector<char>(candidate_.labels.size(), 0));
+            for (auto q = pre_order_.rbegin(); q != pre_order_.rend(); ++q) {
+                for (size_t t = 0; t < candidate_.labels.size(); t++) {
+                    fits_[*q][t] = labels_match(query_.labels[*q], candidate_.labels[t]) && children_fit(*q, t);
+                }
+            }
+
+            assignment_.assign(query_.labels.size(), -1);
+            used_.assign(candidate_.labels.size(), 0);
+            iso_maps_ = &iso_maps;
+            const int root = pre_order_[0];
+            for (size_t t = 0; t < candidate_.labels.size(); t++) {
+                if (fits_[root][t]) {
+                    place(0, t);
+                }
+            }
+        }
+
+    private: // NOLINT
+        static bool labels_match(int query_label, int candidate_label) {
+            return query_label == WILDCARD_LABEL || candidate_label == WILDCARD_LABEL ||
+                query_label == candidate_label;
+        }
+
+        // Calls f on the children of t that query node q could go to.
+        template <typename F>
+        void for_each_candidate_child(int t, int q, F f) const {
+            const auto &children = candidate_.children[t];
+            const int label = query_.labels[q];
+            if (label == WILDCARD_LABEL) {
+                for (auto it = children.begin(); it != children.end(); ++it) {
+                    f(it - children.begin(), it->second);
+                }
+                return;
+            }
+            for (int bucket : {WILDCARD_LABEL, label}) {
+                auto range = children_with_label(children, bucket);
+                for (auto it = range.first; it != range.second; ++it) {
+                    f(it - children.begin(), it->second);
+                }
+            }
+        }
+
+        // Whether q's children can go to distinct children of t, by augmenting paths.
+        bool children_fit(int q, int t) const {
+            const auto &query_children = query_.children[q];
+            if (query_children.empty()) {
+                return true;
+            }
+            if (query_children.size() > candidate_.children[t].size()) {
+                return false;
+            }
+            std::vector<std::vector<int>> options(query_children.size());
+            for (size_t i = 0; i < query_children.size(); i++) {
+                const int child = query_children[i].second;
+                for_each_candidate_child(t, child, [&](int position, int candidate_child) {
+                    if (fits_[child][candidate_child]) {
+                        options[i].push_back(position);
+                    }
+                });
+                if (options[i].empty()) {
+                    return false;
+                }
+            }
+
+            std::vector<int> matched_to(candidate_.children[t].size(), -1);
+            std::vector<char> visited;
+            std::function<bool(int)> augment = [&](int i) {
+                for (int position : options[i]) {
+                    if (visited[position]) {
+                        continue;
+                    }
+                    visited[position] = 1;
+                    if (matched_to[position] == -1 || augment(matched_to[position])) {
+                        matched_to[position] = i;
+                        return true;
+                    }
+                }
+                return false;
+            };
+            for (size_t i = 0; i < options.size(); i++) {
+                visited.assign(matched_to.size(), 0);
+                if (false == augment(i)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void place(size_t position, int t) {
+            const int q = pre_order_[position];
+            assignment_[q] = t;
+            used_[t] = 1;
+            extend(position + 1);
+            used_[t] = 0;
+        }
+
+        void extend(size_t position) {
+            if (position == pre_order_.size()) {
+                std::unordered_map<int, int> iso_map;
+                for (size_t q = 0; q < assignment_.size(); q++) {
+                    iso_map[q] = assignment_[q];
+                }
+                iso_maps_->push_back(std::move(iso_map));
+                return;
+            }
+            const int q = pre_order_[position];
+            for_each_candidate_child(assignment_[query_.parents[q]], q, [&](int, int t) {
+                if (fits_[q][t] && false == used_[t]) {
+                    place(position, t);
+                }
+            });
+        }
+
+        const rooted_forest &candidate_;
+        const rooted_forest &query_;
+        std::vector<int> pre_order_;
+        std::vector<std::vector<char>> fits_;
+        std::vector<int> assignment_;
+        std::vector<char> used_;
+        std::vector<std::unordered_map<int, int>>* iso_maps_ = nullptr;
+};
+
+}  // namespace
+
+bool get_tree_embeddings(const trace_structure &candidate_trace, const trace_structure &query_trace,
+    std::vector<std::unordered_map<int, int>> &iso_maps) {
+    std::unordered_map<std::string, int> label_ids;
+    rooted_forest candidate;
+    rooted_forest query;
+    if (false == build_forest(candidate_trace, label_ids, candidate) ||
+        false == build_forest(query_trace, label_ids, query) ||
+        query.roots.size() != 1) {
+        return false;
+    }
+    tree_matcher(candidate, query).match(iso_maps);
+    return true;
+}
+
+bool tree_matcher_enabled() {
+    static const bool enabled = std::getenv(TREE_MATCHER_ENV) != nullptr;
+    return enabled;
+}
@@ -0,0 +1,48 @@
+/*
+ * Subgraph matching specialized to trees, as an alternative to
+ * boost::vf2_subgraph_iso() in get_isomorphism_mappings().
+ *
+ * Traces are rooted trees and so are the queries we ask about them.  When
+ * the query is connected, an induced subgraph isomorphism between two trees
+ * is just an embedding: every query edge goes to a parent/child edge of the
+ * trace, and children of the same query node go to distinct children.  That
+ * lets us match bottom up instead of searching over all vertex pairs:
+ *
+ *   1. fits[q][t]: the subtree of query node q embeds with q at trace node t.
+ *      Computed in post order; q's children have to be matched to distinct
+ *      children of t that they fit at (a small bipartite matching).
+ *   2. Every embedding is enumerated in pre order from the trace nodes the
+ *      query root fits at, only ever trying children that fit.
+ *
+ * Children of each trace node are bucketed by service name, so a query node
+ * with a concrete service only looks at children with the same service (or
+ * ASTERISK_SERVICE); an ASTERISK_SERVICE query node looks at all of them.
+ * Service names are compared the way vertex_comp_t compares them.
+ *
+ * The embeddings found are the same set as VF2 finds, possibly in a
+ * different order.
+*/
+
+#ifndef TREE_MATCHER_H_ // NOLINT
+#define TREE_MATCHER_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "get_traces_by_structure.h"
+
+const char TREE_MATCHER_ENV[] = "QUEST_TREE_MATCHER";
+
+/**
+ * Query node index to trace node index for every embedding of query_trace
+ * in candidate_trace.  Returns false, leaving iso_maps alone, if the query
+ * is not a single rooted tree or the candidate is not a forest; callers
+ * should fall back to VF2 then.
+ */
+bool get_tree_embeddings(const trace_structure &candidate_trace, const trace_structure &query_trace,
+    std::vector<std::unordered_map<int, int>> &iso_maps);
+
+// Whether get_isomorphism_mappings() tries get_tree_embeddings() before VF2; set by QUEST_TREE_MATCHER.
+bool tree_matcher_enabled();
+
+#endif  // TREE_MATCHER_H_ // NOLINT
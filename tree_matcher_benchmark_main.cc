@@ -0,0 +1,117 @@
+/*
+ * Times get_tree_embeddings() against boost::vf2_subgraph_iso() on synthetic
+ * traces that are deep (long call chains) or wide (a root calling hundreds of
+ * services), and checks that both find the same embeddings.
+ *
+ * usage: tree_matcher_benchmark [repetitions]
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tree_matcher.h"
+
+namespace {
+
+std::string service(int i) {
+    return "service" + std::to_string(i);
+}
+
+// A chain of `depth` spans, cycling through `num_services` services.
+trace_structure deep_trace(int depth, int num_services) {
+    trace_structure trace;
+    trace.num_nodes = depth;
+    for (int i = 0; i < depth; i++) {
+        trace.node_names[i] = service(i % num_services);
+        if (i > 0) {
+            trace.edges.insert(std::make_pair(i - 1, i));
+        }
+    }
+    return trace;
+}
+
+// A root calling `fanout` spans across `num_services` services, each of which calls two more.
+trace_structure wide_trace(int fanout, int num_services) {
+    trace_structure trace;
+    trace.node_names[0] = "frontend";
+    int next = 1;
+    for (int i = 0; i < fanout; i++) {
+        const int child = next++;
+        trace.node_names[child] = service(i % num_services);
+        trace.edges.insert(std::make_pair(0, child));
+        for (int j = 0; j < 2; j++) {
+            const int grandchild = next++;
+            trace.node_names[grandchild] = service((i + j + 1) % num_services);
+            trace.edges.insert(std::make_pair(child, grandchild));
+        }
+    }
+    trace.num_nodes = next;
+    return trace;
+}
+
+trace_structure query(const std::vector<std::string> &names, const std::vector<std::pair<int, int>> &edges) {
+    trace_structure trace;
+    trace.num_nodes = names.size();
+    for (uint64_t i = 0; i < names.size(); i++) {
+        trace.node_names[i] = names[i];
+    }
+    for (const auto &edge : edges) {
+        trace.edges.insert(edge);
+    }
+    return trace;
+}
+
+std::vector<std::vector<std::pair<int, int>>> sorted(const std::vector<std::unordered_map<int, int>> &iso_maps) {
+    std::vector<std::vector<std::pair<int, int>>> ret;
+    for (const auto &iso_map : iso_maps) {
+        ret.emplace_back(iso_map.begin(), iso_map.end());
+        std::sort(ret.back().begin(), ret.back().end());
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+bool run(const std::string &name, trace_structure candidate, trace_structure query_trace, int repetitions) {
+    std::vector<std::unordered_map<int, int>> tree_maps, vf2_maps;
+
+    auto start = boost::posix_time::microsec_clock::local_time();
+    for (int i = 0; i < repetitions; i++) {
+        tree_maps.clear();
+        get_tree_embeddings(candidate, query_trace, tree_maps);
+    }
+    auto tree_time = boost::posix_time::microsec_clock::local_time() - start;
+
+    start = boost::posix_time::microsec_clock::local_time();
+    for (int i = 0; i < repetitions; i++) {
+        vf2_maps = get_isomorphism_mappings_vf2(candidate, query_trace);
+    }
+    auto vf2_time = boost::posix_time::microsec_clock::local_time() - start;
+
+    const bool same = sorted(tree_maps) == sorted(vf2_maps);
+    std::cout << name << ": " << candidate.num_nodes << " spans, " << tree_maps.size() << " embeddings"
+        << "  tree " << tree_time.total_microseconds() / repetitions << "us"
+        << "  vf2 " << vf2_time.total_microseconds() / repetitions << "us"
+        << (same ? "" : "  MISMATCH") << std::endl;
+    return same;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const int repetitions = argc > 1 ? std::atoi(argv[1]) : 10;
+
+    bool ok = true;
+    ok &= run("deep, chain query", deep_trace(500, 5),
+        query({service(1), service(2), service(3)}, {{0, 1}, {1, 2}}), repetitions);
+    ok &= run("deep, wildcard chain query", deep_trace(500, 5),
+        query({service(1), ASTERISK_SERVICE, service(3), service(4)}, {{0, 1}, {1, 2}, {2, 3}}), repetitions);
+    ok &= run("wide, fanout query", wide_trace(300, 50),
+        query({"frontend", service(1), service(2), service(3)}, {{0, 1}, {0, 2}, {0, 3}}), repetitions);
+    ok &= run("wide, two level query", wide_trace(300, 50),
+        query({"frontend", service(7), service(8), ASTERISK_SERVICE}, {{0, 1}, {1, 2}, {0, 3}}), repetitions);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tree_matcher.h"
+
+namespace {
+
+// Each node's parent is a random earlier node, so node 0 is the root.
+trace_structure random_tree(std::mt19937 &rng, int num_nodes, int num_services) {
+  trace_structure tree;
+  tree.num_nodes = num_nodes;
+  for (int i = 0; i < num_nodes; i++) {
+    tree.node_names[i] = "service" + std::to_string(rng() % num_services);
+    if (i > 0) {
+      tree.edges.insert(std::make_pair(static_cast<int>(rng() % i), i));
+    }
+  }
+  return tree;
+}
+
+std::vector<std::vector<std::pair<int, int>>> sorted(const std::vector<std::unordered_map<int, int>> &iso_maps) {
+  std::vector<std::vector<std::pair<int, int>>> ret;
+  for (const auto &iso_map : iso_maps) {
+    ret.emplace_back(iso_map.begin(), iso_map.end());
+    std::sort(ret.back().begin(), ret.back().end());
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+
+}  // namespace
+
+TEST(TreeMatcher, SameEmbeddingsAsVf2) {
+  std::mt19937 rng(7);
+  for (int round = 0; round < 200; round++) {
+    trace_structure candidate = random_tree(rng, 2 + rng() % 30, 3);
+    trace_structure query = random_tree(rng, 1 + rng() % 4, 3);
+    if (round % 3 == 0) {
+      query.node_names[rng() % query.num_nodes] = ASTERISK_SERVICE;
+    }
+
+    std::vector<std::unordered_map<int, int>> tree_maps;
+    ASSERT_TRUE(get_tree_embeddings(candidate, query, tree_maps));
+    EXPECT_EQ(sorted(tree_maps), sorted(get_isomorphism_mappings_vf2(candidate, query))) << "round " << round;
+  }
+}
+
+TEST(TreeMatcher, ChildrenGoToDistinctSpans) {
+  // a frontend calling cart once can't match a query where it calls cart twice
+  trace_structure candidate;
+  candidate.num_nodes = 2;
+  candidate.node_names = {{0, "frontend"}, {1, "cart"}};
+  candidate.edges.insert(std::make_pair(0, 1));
+
+  trace_structure query;
+  query.num_nodes = 3;
+  query.node_names = {{0, "frontend"}, {1, "cart"}, {2, ASTERISK_SERVICE}};
+  query.edges.insert(std::make_pair(0, 1));
+  query.edges.insert(std::make_pair(0, 2));
+
+  std::vector<std::unordered_map<int, int>> iso_maps;
+  ASSERT_TRUE(get_tree_embeddings(candidate, query, iso_maps));
+  EXPECT_TRUE(iso_maps.empty());
+}
+
+TEST(TreeMatcher, DeclinesWhatIsNotATree) {
+  trace_structure tree;
+  tree.num_nodes = 2;
+  tree.node_names = {{0, "frontend"}, {1, "cart"}};
+  tree.edges.insert(std::make_pair(0, 1));
+
+  // two roots
+  trace_structure forest = tree;
+  forest.edges.clear();
+  // a span with two parents
+  trace_structure diamond = tree;
+  diamond.num_nodes = 3;
+  diamond.node_names[2] = "payment";
+  diamond.edges.insert(std::make_pair(0, 2));
+  diamond.edges.insert(std::make_pair(1, 2));
+
+  std::vector<std::unordered_map<int, int>> iso_maps;
+  EXPECT_FALSE(get_tree_embeddings(tree, forest, iso_maps));
+  EXPECT_FALSE(get_tree_embeddings(diamond, tree, iso_maps));
+  EXPECT_FALSE(get_tree_embeddings(tree, diamond, iso_maps));
+  EXPECT_TRUE(iso_maps.empty());
+}